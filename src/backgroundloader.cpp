@@ -1,47 +1,215 @@
 #include "backgroundloader.h"
+#include "perftrace.h"
+#include "podofoutil.h"
+#include "referenceindex.h"
+
+#include <QMutexLocker>
+#include <QTime>
 
 #include <podofo/podofo.h>
 using namespace PoDoFo;
 
 #include <iostream>
 
-BackgroundLoader::BackgroundLoader(PdfMemDocument* doc)
-    : m_timer(),
-      m_lastObjectIdx(-1),
-      m_pDoc(doc)
+namespace {
+
+// Upper bound on the objects loaded per acquisition of the document lock
+static const int maxBatchSize = 512;
+
+// ... and on how long we may hold the lock, in milliseconds. This is the
+// longest the GUI can be kept waiting by the loader.
+static const int maxBatchTime = 20;
+
+// Number of progress() emissions we spread a whole load over.
+static const int progressSteps = 200;
+
+// Hints beyond this many are forgotten, oldest first. Anything that old has
+// probably scrolled off screen already.
+static const size_t maxHints = 4096;
+
+};
+
+BackgroundLoader::BackgroundLoader(PdfMemDocument* doc, QMutex* documentLock, QObject* parent,
+                                   ReferenceIndex* referenceIndex)
+    : QThread(parent),
+      m_pDoc(doc),
+      m_pDocumentLock(documentLock),
+      m_pReferenceIndex(referenceIndex),
+      m_stopMutex(),
+      m_bStop(false),
+      m_hintMutex(),
+      m_hints(),
+      m_bAllLoaded(false)
 {
-    connect(&m_timer, SIGNAL(timeout()), SLOT(loadNextObject()));
     qDebug("Beginning background load of %i objects", doc->GetObjects().GetSize());
 }
 
 BackgroundLoader::~BackgroundLoader()
 {
+    Stop();
+    wait();
 }
 
-void BackgroundLoader::start()
+void BackgroundLoader::Stop()
 {
-    m_timer.start();
+    QMutexLocker lock(&m_stopMutex);
+    m_bStop = true;
 }
 
-void BackgroundLoader::loadNextObject()
+bool BackgroundLoader::IsStopping() const
 {
-    // FIXME: We should not have to cast away constness in pdfvecobjects
-    // just to index its members.
-    PdfVecObjects & objs = const_cast<PdfVecObjects&>(m_pDoc->GetObjects());
-    const int objCount = objs.GetSize();
+    QMutexLocker lock(&m_stopMutex);
+    return m_bStop;
+}
+
+void BackgroundLoader::Prioritise(const std::vector<PdfReference> & refs)
+{
+    QMutexLocker lock(&m_hintMutex);
+    if (m_bAllLoaded)
+        return;
+
+    std::vector<PdfReference>::const_iterator itEnd = refs.end();
+    for (std::vector<PdfReference>::const_iterator it = refs.begin(); it != itEnd; ++it)
+        m_hints.push_front(*it);
+    while (m_hints.size() > maxHints)
+        m_hints.pop_back();
+}
+
+void BackgroundLoader::TakeHints(std::vector<PdfReference> & out, int max)
+{
+    QMutexLocker lock(&m_hintMutex);
+    out.clear();
+    while (!m_hints.empty() && out.size() < static_cast<size_t>(max))
+    {
+        out.push_back(m_hints.front());
+        m_hints.pop_front();
+    }
+}
+
+void BackgroundLoader::run()
+{
+    PdfVecObjects & objs = indexableObjects(m_pDoc);
+
+    // We use an integer index into the vector because it doesn't actually
+    // matter if we miss a few items due to insertions/deletions; anything we
+    // skip is loaded on demand anyway. The vector is only ever modified with
+    // the document lock held, and we re-read its size every batch, so the
+    // index is always valid while we use it.
+    int nextObjectIdx = 0;
+    int objCount = 0;
+    int lastProgress = 0;
+    QTime batchTimer;
+    std::vector<PdfReference> hints;
 
-    if (m_lastObjectIdx + 1 >= objCount)
+    while (!IsStopping())
+    {
+        {
+            QMutexLocker lock(m_pDocumentLock);
+            objCount = objs.GetSize();
+            if (nextObjectIdx >= objCount)
+                break;
+
+            PerfTrace::Scope batchScope("load-batch");
+            batchTimer.start();
+
+            // Whatever the user is about to look at goes first. Note that
+            // looking objects up by reference may sort the object vector,
+            // which can make the in-order pass below skip or repeat some
+            // objects; that's harmless.
+            TakeHints(hints, maxBatchSize);
+            std::vector<PdfReference>::const_iterator itEnd = hints.end();
+            for (std::vector<PdfReference>::const_iterator it = hints.begin(); it != itEnd; ++it)
+            {
+                PdfObject* const obj = objs.GetObject(*it);
+                if (obj)
+                {
+                    PerfTrace::Scope scope("delayed-load");
+                    obj->GetDataType();
+                }
+            }
+
+            const int batchEnd = qMin(nextObjectIdx + maxBatchSize, objCount);
+            while (nextObjectIdx < batchEnd && batchTimer.elapsed() < maxBatchTime)
+            {
+                // XXX no podofo support for directly forcing delayed load
+                PdfObject* const obj = objs[nextObjectIdx++];
+                {
+                    PerfTrace::Scope scope("delayed-load");
+                    obj->GetDataType();
+                }
+                if (m_pReferenceIndex)
+                    m_pReferenceIndex->Update(obj);
+            }
+        }
+
+        if (nextObjectIdx - lastProgress >= qMax(1, objCount / progressSteps))
+        {
+            lastProgress = nextObjectIdx;
+            emit progress(nextObjectIdx);
+        }
+
+        // QMutex isn't fair; give a waiting GUI thread a chance at the lock
+        // before we grab it again.
+        yieldCurrentThread();
+    }
+
+    {
+        // We're done, so hints have nothing left to speed up
+        QMutexLocker lock(&m_hintMutex);
+        m_bAllLoaded = true;
+        m_hints.clear();
+    }
+
+    if (m_pReferenceIndex)
+        FinishReferenceIndex();
+
+    if (!IsStopping())
     {
-        m_timer.stop();
         emit progress(objCount);
         emit done();
-        return;
     }
-    else
+}
+
+void BackgroundLoader::FinishReferenceIndex()
+{
+    PdfVecObjects & objs = indexableObjects(m_pDoc);
+
+    // Sorting the object vector may have made the in-order pass skip some
+    // objects. Sweep it again for any that aren't indexed yet, which is just
+    // a hash lookup for the ones that are. Sorting can also happen during a
+    // sweep, so keep going until one finds nothing left to do.
+    int nextObjectIdx = 0;
+    bool indexedAny = false;
+    QTime batchTimer;
+
+    while (!IsStopping())
     {
-        // XXX no podofo support for directly forcing delayed load
-	// FIXME unsafe if objects are removed while loading happening.
-        objs[++m_lastObjectIdx]->GetDataType();
-        emit progress(m_lastObjectIdx);
+        {
+            QMutexLocker lock(m_pDocumentLock);
+            const int objCount = objs.GetSize();
+            if (nextObjectIdx >= objCount)
+            {
+                if (!indexedAny)
+                {
+                    m_pReferenceIndex->SetComplete();
+                    break;
+                }
+                nextObjectIdx = 0;
+                indexedAny = false;
+            }
+
+            batchTimer.start();
+            while (nextObjectIdx < objCount && batchTimer.elapsed() < maxBatchTime)
+            {
+                const PdfObject* const obj = objs[nextObjectIdx++];
+                if (!m_pReferenceIndex->IsIndexed(obj->Reference()))
+                {
+                    m_pReferenceIndex->Update(obj);
+                    indexedAny = true;
+                }
+            }
+        }
+
+        yieldCurrentThread();
     }
 }
@@ -1,41 +1,93 @@
 #ifndef PODOFOBROWSER_BACKGROUNDLOADER_H
 #define PODOFOBROWSER_BACKGROUNDLOADER_H
 
-#include <QObject>
-#include <QTimer>
+#include <QMutex>
+#include <QThread>
 
-namespace PoDoFo {
-    class PdfMemDocument;
-    class PdfObject;
-}
+#include <deque>
+#include <vector>
 
-class BackgroundLoader : public QObject
+#include <podofo/podofo.h>
+
+class ReferenceIndex;
+
+/**
+ * Forces the delayed loading of every object in a document on a worker
+ * thread, so that browsing is snappy once the loader has caught up.
+ *
+ * Locking: PoDoFo's delayed loading reads every object through the one input
+ * device shared by the whole document, so even "read only" calls such as
+ * GetDataType() may not run concurrently. Everybody touching the document
+ * while a loader exists must hold `documentLock' (a recursive mutex owned by
+ * whoever owns the document). The loader takes the lock for one short batch
+ * of objects at a time, so other threads never wait on it for long.
+ *
+ * Scheduling: objects are loaded in document order, except that objects
+ * passed to Prioritise() jump the queue. The most recent hints are served
+ * first, since they best reflect what the user is looking at right now.
+ *
+ * Indexing: if given a ReferenceIndex, the loader records the references held
+ * by every object as it loads it, and marks the index complete once it has
+ * seen them all. The index is only touched with the document lock held.
+ *
+ * Ownership: the loader never owns the document or the index. Deleting the loader stops it
+ * and waits for the worker, after which the document may be deleted. Don't
+ * delete the loader while holding the document lock.
+ */
+class BackgroundLoader : public QThread
 {
     Q_OBJECT
 
 public:
-    BackgroundLoader(PoDoFo::PdfMemDocument* doc);
+    BackgroundLoader(PoDoFo::PdfMemDocument* doc, QMutex* documentLock, QObject* parent = 0,
+                     ReferenceIndex* referenceIndex = 0);
 
     virtual ~BackgroundLoader();
 
+    // Ask the worker to stop after its current batch. Returns immediately.
+    void Stop();
 
-public slots:
-    void loadNextObject();
-    void start();
+    // Hint that the objects `refs' will be wanted soon, so they should be
+    // loaded before the rest of the document. Cheap, and safe to call from
+    // any thread with or without the document lock held. Hints for objects
+    // that don't exist are ignored.
+    void Prioritise(const std::vector<PoDoFo::PdfReference> & refs);
+    void Prioritise(const PoDoFo::PdfReference & ref)
+    {
+        Prioritise(std::vector<PoDoFo::PdfReference>(1, ref));
+    }
 
 signals:
-    // Progress loading from 0 to number of objects
+    // Progress loading from 0 to number of objects. Emitted in coarse steps.
     void progress(int);
+    // Emitted once every object has been loaded (but not if stopped early).
     void done();
 
+protected:
+    virtual void run();
+
 private:
-    QTimer m_timer;
-    // We use an integer index into the vector because it doesn't actually matter
-    // if we miss a few items due to insertions/deletions. On the other hand, using
-    // an invalid iterator could be _BAD_.
-    int m_lastObjectIdx;
+    bool IsStopping() const;
+
+    // Move up to `max' of the most recent hints into `out'
+    void TakeHints(std::vector<PoDoFo::PdfReference> & out, int max);
+
+    // Index whatever objects the in-order pass missed, then mark the index
+    // complete. Returns early if asked to stop.
+    void FinishReferenceIndex();
+
     // Document
     PoDoFo::PdfMemDocument* m_pDoc;
+    QMutex* m_pDocumentLock;
+    ReferenceIndex* m_pReferenceIndex;
+
+    mutable QMutex m_stopMutex;
+    bool m_bStop;
+
+    // Pending hints, most recent first. Guarded by m_hintMutex.
+    QMutex m_hintMutex;
+    std::deque<PoDoFo::PdfReference> m_hints;
+    bool m_bAllLoaded;
 };
 
 #endif
@@ -0,0 +1,224 @@
+#include "batchprocessor.h"
+#include "documentinfo.h"
+#include "documentsearch.h"
+#include "pdfobjectmodel.h"
+#include "podofoutil.h"
+#include "workerpool.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QIODevice>
+#include <QMutexLocker>
+
+#include <stdexcept>
+#include <vector>
+
+using namespace PoDoFo;
+
+namespace {
+
+// "name": value
+QString member( const char * name, const QString & value )
+{
+    return jsonString( QString::fromUtf8(name) ) + QString::fromUtf8(": ") + value;
+}
+
+QString pdfErrorString( const PdfError & e )
+{
+    const char * const msg = PdfError::ErrorMessage( e.GetError() );
+    return QString::fromLocal8Bit( msg ? msg : "" );
+}
+
+QString referenceString( const PdfReference & ref )
+{
+    return QString::fromUtf8("%1 %2 R").arg( ref.ObjectNumber() ).arg( ref.GenerationNumber() );
+}
+
+};
+
+BatchProcessor::Options::Options()
+    : searchQuery(),
+      exportDir(),
+      treeDepth(0),
+      threadCount(0)
+{
+}
+
+BatchProcessor::BatchProcessor(const Options & options, QIODevice & output)
+    : m_options(options),
+      m_outputMutex(),
+      m_output(output),
+      m_claimMutex(),
+      m_files(),
+      m_nextFileIdx(0),
+      m_failedCount(0)
+{
+}
+
+int BatchProcessor::Run(const QStringList & files)
+{
+    {
+        QMutexLocker lock(&m_claimMutex);
+        m_files = files;
+        m_nextFileIdx = 0;
+        m_failedCount = 0;
+    }
+
+    int threadCount = m_options.threadCount;
+    if (threadCount <= 0)
+        threadCount = WorkerPool::IdealThreadCount();
+    threadCount = qMin(threadCount, files.size());
+
+    WorkerPool workers;
+    workers.Start(this, &BatchProcessor::Work, threadCount);
+    workers.Wait();
+
+    QMutexLocker lock(&m_claimMutex);
+    return m_failedCount;
+}
+
+bool BatchProcessor::Claim(QString & filename)
+{
+    QMutexLocker lock(&m_claimMutex);
+    if (m_nextFileIdx >= m_files.size())
+        return false;
+    filename = m_files[m_nextFileIdx++];
+    return true;
+}
+
+void BatchProcessor::Work()
+{
+    QString filename;
+    while (Claim(filename))
+    {
+        bool ok = false;
+        const QString line = ProcessFile(filename, ok);
+        WriteLine(line);
+        if (!ok)
+        {
+            QMutexLocker lock(&m_claimMutex);
+            ++m_failedCount;
+        }
+    }
+}
+
+void BatchProcessor::WriteLine(const QString & line)
+{
+    const QByteArray bytes = line.toUtf8() + '\n';
+    QMutexLocker lock(&m_outputMutex);
+    m_output.write(bytes);
+    // Let whatever's downstream in the pipeline get on with it
+    if (QFile * const file = qobject_cast<QFile*>(&m_output))
+        file->flush();
+}
+
+QString BatchProcessor::ProcessFile(const QString & filename, bool & ok) const
+{
+    QStringList members;
+    members << member("file", jsonString(filename));
+
+    PdfMemDocument doc;
+    try {
+        doc.Load( filename.toLocal8Bit().data() );
+
+        QStringList fields;
+        fields << member("ok", QString::fromUtf8("true"))
+               << member("version", jsonString( QString::fromUtf8("1.%1")
+                        .arg( static_cast<int>(doc.GetPdfVersion()) - static_cast<int>(ePdfVersion_1_0) ) ))
+               << member("objects", QString::number( doc.GetObjects().GetSize() ))
+               << member("pages", QString::number( doc.GetPageCount() ));
+
+        QStringList info;
+        const DocumentInfoEntries entries = documentInfoEntries( &doc );
+        for (DocumentInfoEntries::const_iterator it = entries.begin(); it != entries.end(); ++it)
+            info << jsonString( it->first ) + QString::fromUtf8(": ") + jsonString( it->second );
+        fields << member("info", QString::fromUtf8("{") + info.join(QString::fromUtf8(", ")) + QString::fromUtf8("}"));
+
+        if (!m_options.searchQuery.isEmpty())
+        {
+            QStringList matches;
+            const std::vector<PdfReference> results = DocumentSearch::Search( &doc, m_options.searchQuery );
+            for (std::vector<PdfReference>::const_iterator it = results.begin(); it != results.end(); ++it)
+                matches << jsonString( referenceString( *it ) );
+            fields << member("matches", QString::fromUtf8("[") + matches.join(QString::fromUtf8(", ")) + QString::fromUtf8("]"));
+        }
+
+        if (!m_options.exportDir.isEmpty())
+        {
+            int exported = 0;
+            int failed = 0;
+            ExportStreams( doc, filename, exported, failed );
+            fields << member("exported", QString::number( exported ))
+                   << member("exportErrors", QString::number( failed ));
+        }
+
+        if (m_options.treeDepth > 0)
+        {
+            const PdfObjectModel model( &doc );
+            fields << member("tree", TreeJson( model, QModelIndex(), m_options.treeDepth ));
+        }
+
+        members << fields;
+        ok = true;
+    } catch( PdfError & e ) {
+        members << member("ok", QString::fromUtf8("false")) << member("error", jsonString( pdfErrorString( e ) ));
+        ok = false;
+    } catch( std::exception & e ) {
+        // The model complains about broken documents like this
+        members << member("ok", QString::fromUtf8("false")) << member("error", jsonString( QString::fromLocal8Bit( e.what() ) ));
+        ok = false;
+    }
+
+    return QString::fromUtf8("{") + members.join(QString::fromUtf8(", ")) + QString::fromUtf8("}");
+}
+
+void BatchProcessor::ExportStreams(const PdfMemDocument & doc, const QString & filename,
+                                   int & exported, int & failed) const
+{
+    const QFileInfo fileInfo( filename );
+    const QDir dir( m_options.exportDir );
+    // Files of the same name from different directories mustn't collide
+    const QString prefix = QString::number( qHash( fileInfo.absoluteFilePath() ), 16 )
+                         + QLatin1Char('-') + fileInfo.completeBaseName();
+
+    const PdfVecObjects & objs = doc.GetObjects();
+    for (TCIVecObjects it = objs.begin(); it != objs.end(); ++it)
+    {
+        if (!(*it)->HasStream())
+            continue;
+        const PdfReference & ref = (*it)->Reference();
+        const QString name = dir.filePath( QString::fromUtf8("%1-%2-%3.bin")
+                .arg( prefix ).arg( ref.ObjectNumber() ).arg( ref.GenerationNumber() ) );
+        QString error;
+        bool written = false;
+        try {
+            written = exportStream( *it, name, error );
+        } catch( PdfError & ) {
+            // Counted below, like an I/O error
+        }
+        if (written)
+            ++exported;
+        else
+            ++failed;
+    }
+}
+
+QString BatchProcessor::TreeJson(const PdfObjectModel & model, const QModelIndex & parent, int depth) const
+{
+    QStringList rows;
+    const int rowCount = model.rowCount( parent );
+    for (int row = 0; row < rowCount; ++row)
+    {
+        const QModelIndex key = model.index( row, PdfObjectModel::Column_ParentIdentifier, parent );
+        QStringList fields;
+        fields << member("key", jsonString( model.data( key, Qt::DisplayRole ).toString() ))
+               << member("value", jsonString( model.data( model.index( row, PdfObjectModel::Column_RawValue, parent ), Qt::DisplayRole ).toString() ))
+               << member("type", jsonString( model.data( model.index( row, PdfObjectModel::Column_Type, parent ), Qt::DisplayRole ).toString() ));
+        if (depth > 1 && model.rowCount( key ) > 0)
+            fields << member("children", TreeJson( model, key, depth - 1 ));
+        rows << QString::fromUtf8("{") + fields.join(QString::fromUtf8(", ")) + QString::fromUtf8("}");
+    }
+    return QString::fromUtf8("[") + rows.join(QString::fromUtf8(", ")) + QString::fromUtf8("]");
+}
@@ -0,0 +1,97 @@
+#ifndef PODOFOBROWSER_BATCHPROCESSOR_H
+#define PODOFOBROWSER_BATCHPROCESSOR_H
+
+#include <QCoreApplication>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+
+#include <podofo/podofo.h>
+
+class QIODevice;
+class QModelIndex;
+class PdfObjectModel;
+
+/**
+ * Inspects many files without a GUI, for `podofobrowser --batch'. Uses the
+ * same code the browser does: PdfObjectModel for the object tree, the info
+ * dialog's entries, DocumentSearch and stream export.
+ *
+ * The files are shared out between worker threads, one per core unless
+ * told otherwise, each of which opens, inspects and closes one file at a
+ * time. Every document belongs to a single worker, so no document lock is
+ * needed.
+ *
+ * One line of JSON is written to the output for each file as soon as it's
+ * done, so the lines come in no particular order:
+ *
+ *   {"file": "a.pdf", "ok": true, "version": "1.4", "objects": 120,
+ *    "pages": 4, "info": {"Title": "...", ...}, "matches": ["12 0 R"],
+ *    "exported": 30, "exportErrors": 0,
+ *    "tree": [{"key": "...", "value": "...", "type": "...", "children": [...]}]}
+ *
+ * "matches", "exported", "exportErrors" and "tree" appear only when asked
+ * for. A file that can't be read gives {"file": ..., "ok": false, "error":
+ * "..."}.
+ */
+class BatchProcessor
+{
+    Q_DECLARE_TR_FUNCTIONS(BatchProcessor)
+
+public:
+    struct Options
+    {
+        Options();
+
+        // Search every file for this, as the search dock would; empty for
+        // no search
+        QString searchQuery;
+        // Write every stream, decoded, to a file in this directory; empty
+        // for no export. The files are named after the PDF, with a hash of
+        // its path in front, and the object and generation numbers.
+        QString exportDir;
+        // Levels of the catalog-rooted tree to output; 0 for none
+        int treeDepth;
+        // Files to work on at once; 0 for one per core
+        int threadCount;
+    };
+
+    BatchProcessor(const Options & options, QIODevice & output);
+
+    // Process all of `files' and return how many couldn't be read
+    int Run(const QStringList & files);
+
+private:
+    // Run by each worker thread
+    void Work();
+
+    // Claim the next file for a worker. Returns false once there are none
+    // left.
+    bool Claim(QString & filename);
+
+    // Inspect `filename', returning its line of output (without the
+    // newline) and whether it could be read
+    QString ProcessFile(const QString & filename, bool & ok) const;
+
+    // Export all the streams of `doc', read from `filename', and count how
+    // many could and couldn't be
+    void ExportStreams(const PoDoFo::PdfMemDocument & doc, const QString & filename,
+                       int & exported, int & failed) const;
+
+    // The rows under `parent' and `depth' levels below them, as a JSON array
+    QString TreeJson(const PdfObjectModel & model, const QModelIndex & parent, int depth) const;
+
+    void WriteLine(const QString & line);
+
+    const Options m_options;
+
+    QMutex m_outputMutex;
+    QIODevice & m_output;
+
+    QMutex m_claimMutex;
+    QStringList m_files;
+    int m_nextFileIdx;
+    int m_failedCount;
+};
+
+#endif
@@ -0,0 +1,546 @@
+// podofobrowser-benchmark: times the hot paths of the browser against
+// synthetic documents and any PDF files named on the command line, writing
+// one line of JSON per result so that runs can be compared by script.
+//
+// Built only when PODOFOBROWSER_BUILD_BENCHMARK is set; see the README.
+
+#include "backgroundloader.h"
+#include "documentsaver.h"
+#include "filteredstreamdevice.h"
+#include "pdfobjectmodel.h"
+#include "podofoutil.h"
+#include "rawstreamdevice.h"
+#include "referenceindex.h"
+#include "hexwidget/DeviceCache.h"
+
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <QTime>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+using namespace PoDoFo;
+
+namespace {
+
+static const int defaultPages = 2000;
+static const int defaultIterations = 5;
+
+// Size of each of the two big streams in a synthetic document, one stored
+// raw and one compressed, for the hex view patterns
+static const int bigStreamSize = 4 * 1024 * 1024;
+
+// How deep below the top-level rows the model walk goes
+static const int modelWalkDepth = 3;
+
+// The hex view's geometry: bytes per row, and rows on screen. Like the
+// view's paintEvent(), each screen fetches twice what it shows.
+static const unsigned int hexRowBytes = 16;
+static const unsigned int hexScreenRows = 48;
+static const unsigned int hexScreenBytes = hexRowBytes * hexScreenRows;
+
+// Most fetches made by one scroll pattern
+static const int maxHexFetches = 20000;
+
+int usage()
+{
+    QTextStream err( stderr );
+    err << "Usage: podofobrowser-benchmark [--pages N] [--iterations N] [--no-synthetic] [FILE ...]\n"
+        << "Times opening, loading, browsing, hex viewing and saving each FILE, and\n"
+        << "synthetic documents of N/20 and N pages, writing a line of JSON per result.\n";
+    return 2;
+}
+
+// "name": value
+QString member( const char * name, const QString & value )
+{
+    return jsonString( QString::fromUtf8(name) ) + QString::fromUtf8(": ") + value;
+}
+
+/**
+ * Writes the results, a line of JSON each, to standard output
+ */
+class Reporter
+{
+public:
+    Reporter() : m_out( stdout ) { }
+
+    // `times' are the milliseconds each iteration took, each doing
+    // `operations' of whatever is being timed
+    void Report( const QString & benchmark, const QString & file, int objects,
+                 int operations, std::vector<int> times )
+    {
+        if (times.empty())
+            return;
+        std::sort( times.begin(), times.end() );
+        QStringList members;
+        members << member("benchmark", jsonString( benchmark ))
+                << member("file", jsonString( file ))
+                << member("objects", QString::number( objects ))
+                << member("operations", QString::number( operations ))
+                << member("iterations", QString::number( times.size() ))
+                << member("min_ms", QString::number( times.front() ))
+                << member("median_ms", QString::number( times[times.size() / 2] ))
+                << member("max_ms", QString::number( times.back() ));
+        m_out << QLatin1Char('{') << members.join( QString::fromUtf8(", ") ) << QString::fromUtf8("}\n");
+        m_out.flush();
+    }
+
+private:
+    QTextStream m_out;
+};
+
+// Fill `data' with `size' bytes that compress somewhat, as image data does
+QByteArray syntheticData( int size )
+{
+    QByteArray data( size, '\0' );
+    for (int i = 0; i < size; ++i)
+        data[i] = static_cast<char>( (i / 64) * 7 + std::rand() % 16 );
+    return data;
+}
+
+// Write a document with `pages' pages to `filename'. Each page has a
+// content stream, a shared font, an image on every tenth page, and a
+// dictionary of nested arrays to make the object tree bushy. Two big
+// streams are added for the hex view patterns.
+void writeSyntheticPdf( const QString & filename, int pages )
+{
+    PdfMemDocument doc;
+    PdfVecObjects & objs = doc.GetObjects();
+
+    PdfObject* font = objs.CreateObject( "Font" );
+    font->GetDictionary().AddKey( PdfName("Subtype"), PdfName("Type1") );
+    font->GetDictionary().AddKey( PdfName("BaseFont"), PdfName("Helvetica") );
+
+    PdfObject* image = 0;
+    for (int i = 0; i < pages; ++i)
+    {
+        PdfPage* page = doc.CreatePage( PdfPage::CreateStandardPageSize( ePdfPageSize_A4 ) );
+
+        QByteArray content;
+        for (int line = 0; line < 40; ++line)
+            content += "BT /F1 10 Tf 72 " + QByteArray::number( 800 - line * 18 )
+                + " Td (Page " + QByteArray::number( i + 1 ) + ", line "
+                + QByteArray::number( line + 1 ) + ") Tj ET\n";
+
+        PdfDictionary resources;
+        PdfDictionary fonts;
+        fonts.AddKey( PdfName("F1"), font->Reference() );
+        resources.AddKey( PdfName("Font"), fonts );
+
+        if (i % 10 == 0)
+        {
+            const int size = 64;
+            image = objs.CreateObject( "XObject" );
+            PdfDictionary & dict = image->GetDictionary();
+            dict.AddKey( PdfName("Subtype"), PdfName("Image") );
+            dict.AddKey( PdfName("Width"), PdfVariant( static_cast<pdf_int64>(size) ) );
+            dict.AddKey( PdfName("Height"), PdfVariant( static_cast<pdf_int64>(size) ) );
+            dict.AddKey( PdfName("BitsPerComponent"), PdfVariant( static_cast<pdf_int64>(8) ) );
+            dict.AddKey( PdfName("ColorSpace"), PdfName("DeviceRGB") );
+            const QByteArray pixels = syntheticData( size * size * 3 );
+            image->GetStream()->Set( pixels.constData(), pixels.size() );
+        }
+        PdfDictionary xobjects;
+        xobjects.AddKey( PdfName("Im1"), image->Reference() );
+        resources.AddKey( PdfName("XObject"), xobjects );
+        content += "q 64 0 0 64 72 72 cm /Im1 Do Q\n";
+
+        page->GetContents()->GetStream()->Set( content.constData(), content.size() );
+        page->GetObject()->GetDictionary().AddKey( PdfName("Resources"), resources );
+
+        PdfArray items;
+        for (int a = 0; a < 5; ++a)
+        {
+            PdfArray inner;
+            for (int n = 0; n < 20; ++n)
+                inner.push_back( PdfVariant( static_cast<pdf_int64>(i * 100 + a * 20 + n) ) );
+            items.push_back( inner );
+        }
+        PdfDictionary info;
+        info.AddKey( PdfName("Items"), items );
+        info.AddKey( PdfName("Label"), PdfString( QByteArray( "Page " + QByteArray::number( i + 1 ) ).constData() ) );
+        page->GetObject()->GetDictionary().AddKey( PdfName("PieceInfo"), info );
+    }
+
+    const QByteArray big = syntheticData( bigStreamSize );
+    PdfObject* raw = objs.CreateObject( PdfVariant( PdfDictionary() ) );
+    raw->GetStream()->Set( big.constData(), big.size(), TVecFilters() );
+    PdfObject* compressed = objs.CreateObject( PdfVariant( PdfDictionary() ) );
+    compressed->GetStream()->Set( big.constData(), big.size() );
+
+    doc.Write( filename.toLocal8Bit().data() );
+}
+
+// The biggest stream in `doc' with a filter, or without one
+const PdfObject* biggestStream( const PdfMemDocument & doc, bool filtered )
+{
+    const PdfObject* biggest = 0;
+    pdf_long biggestLength = -1;
+    const PdfVecObjects & objs = doc.GetObjects();
+    for (TCIVecObjects it = objs.begin(); it != objs.end(); ++it)
+    {
+        const PdfObject* obj = *it;
+        if (!obj->HasStream())
+            continue;
+        if (obj->GetDictionary().HasKey( PdfName("Filter") ) != filtered)
+            continue;
+        const char* data = 0;
+        pdf_long len = 0;
+        try {
+            getEncodedStreamData( obj->GetStream(), data, len );
+        } catch( PdfError & ) {
+            continue;
+        }
+        if (len > biggestLength)
+        {
+            biggest = obj;
+            biggestLength = len;
+        }
+    }
+    return biggest;
+}
+
+// Visit the rows under `parent' to `depth' levels, asking for everything a
+// view asks for to show them. Returns the number of rows visited.
+int walkModel( const PdfObjectModel & model, const QModelIndex & parent, int depth )
+{
+    int visited = 0;
+    const int rows = model.rowCount( parent );
+    const int columns = model.columnCount( parent );
+    for (int row = 0; row < rows; ++row)
+    {
+        for (int column = 0; column < columns; ++column)
+            model.data( model.index( row, column, parent ), Qt::DisplayRole );
+        const QModelIndex child = model.index( row, 0, parent );
+        model.parent( child );
+        ++visited;
+        if (depth > 0)
+            visited += walkModel( model, child, depth - 1 );
+    }
+    return visited;
+}
+
+/**
+ * Runs the benchmarks on one file
+ */
+class FileBenchmark
+{
+public:
+    FileBenchmark( const QString & filename, const QString & label, int iterations, Reporter & reporter )
+        : m_filename( filename ), m_label( label ), m_iterations( iterations ),
+          m_objects( 0 ), m_reporter( reporter )
+    {
+    }
+
+    void Run()
+    {
+        BenchmarkOpen();
+        BenchmarkLoad();
+        BenchmarkModel();
+        BenchmarkHexView();
+        BenchmarkSave();
+    }
+
+private:
+    PdfMemDocument* Open() const
+    {
+        return new PdfMemDocument( m_filename.toLocal8Bit().data() );
+    }
+
+    PdfMemDocument* OpenAndLoad( QMutex & lock ) const
+    {
+        PdfMemDocument* doc = Open();
+        BackgroundLoader loader( doc, &lock );
+        loader.start();
+        loader.wait();
+        return doc;
+    }
+
+    void Report( const char* benchmark, int operations, const std::vector<int> & times )
+    {
+        m_reporter.Report( QString::fromUtf8(benchmark), m_label, m_objects, operations, times );
+    }
+
+    void BenchmarkOpen()
+    {
+        std::vector<int> times;
+        QTime timer;
+        for (int i = 0; i < m_iterations; ++i)
+        {
+            timer.start();
+            std::auto_ptr<PdfMemDocument> doc( Open() );
+            times.push_back( timer.elapsed() );
+            m_objects = doc->GetObjects().GetSize();
+        }
+        Report( "open", 1, times );
+    }
+
+    void BenchmarkLoad()
+    {
+        std::vector<int> times;
+        QTime timer;
+        for (int i = 0; i < m_iterations; ++i)
+        {
+            std::auto_ptr<PdfMemDocument> doc( Open() );
+            QMutex lock( QMutex::Recursive );
+            ReferenceIndex index;
+            BackgroundLoader loader( doc.get(), &lock, 0, &index );
+            timer.start();
+            loader.start();
+            loader.wait();
+            times.push_back( timer.elapsed() );
+        }
+        Report( "background-load", m_objects, times );
+    }
+
+    void BenchmarkModel()
+    {
+        QMutex lock( QMutex::Recursive );
+        std::auto_ptr<PdfMemDocument> doc( OpenAndLoad( lock ) );
+
+        std::vector<int> build, cold, warm;
+        int rows = 0;
+        QTime timer;
+        for (int i = 0; i < m_iterations; ++i)
+        {
+            timer.start();
+            PdfObjectModel model( doc.get(), 0, false, &lock );
+            build.push_back( timer.elapsed() );
+
+            // The first walk makes the nodes, the second finds them made
+            timer.start();
+            rows = walkModel( model, QModelIndex(), modelWalkDepth );
+            cold.push_back( timer.elapsed() );
+            timer.start();
+            walkModel( model, QModelIndex(), modelWalkDepth );
+            warm.push_back( timer.elapsed() );
+        }
+        Report( "model-build", m_objects, build );
+        Report( "model-walk-cold", rows, cold );
+        Report( "model-walk-warm", rows, warm );
+
+        // Every object, in no particular order
+        std::vector<PdfReference> refs;
+        const PdfVecObjects & objs = doc->GetObjects();
+        for (TCIVecObjects it = objs.begin(); it != objs.end(); ++it)
+            refs.push_back( (*it)->Reference() );
+        std::random_shuffle( refs.begin(), refs.end() );
+
+        PdfObjectModel model( doc.get(), 0, false, &lock );
+        std::vector<int> find;
+        for (int i = 0; i < m_iterations; ++i)
+        {
+            timer.start();
+            for (std::vector<PdfReference>::const_iterator it = refs.begin(); it != refs.end(); ++it)
+                model.FindObject( *it );
+            find.push_back( timer.elapsed() );
+        }
+        Report( "find-object", static_cast<int>(refs.size()), find );
+    }
+
+    // Scroll through the data of `device' the ways people do, fetching
+    // what the hex view would for each screen
+    void ScrollPatterns( const char* kind, QIODevice* (*makeDevice)( const PdfObject*, QMutex* ),
+                         const PdfObject* obj, QMutex & lock )
+    {
+        // Work out how much data there is first, so every pattern covers
+        // the same ground
+        quint64 size = 0;
+        {
+            std::auto_ptr<QIODevice> device( makeDevice( obj, &lock ) );
+            DeviceCache cache;
+            cache.setDevice( device.get() );
+            cache.readTo( ~static_cast<quint64>(0) );
+            size = cache.available();
+        }
+        if (size <= hexScreenBytes)
+            return;
+        const quint64 last = size - hexScreenBytes;
+
+        static const char* const patterns[] = { "line-down", "page-down", "page-up", "random" };
+        for (int p = 0; p < 4; ++p)
+        {
+            std::vector<int> times;
+            int fetches = 0;
+            QTime timer;
+            for (int i = 0; i < m_iterations; ++i)
+            {
+                std::auto_ptr<QIODevice> device( makeDevice( obj, &lock ) );
+                DeviceCache cache;
+                cache.setDevice( device.get() );
+                std::srand( 1 );
+                fetches = 0;
+                timer.start();
+                quint64 offset = p == 2 ? last : 0;
+                while (fetches < maxHexFetches)
+                {
+                    cache.fetch( offset, 2 * hexScreenBytes );
+                    ++fetches;
+                    if (p == 0)
+                        offset += hexRowBytes;
+                    else if (p == 1)
+                        offset += hexScreenBytes;
+                    else if (p == 2)
+                    {
+                        if (offset < hexScreenBytes)
+                            break;
+                        offset -= hexScreenBytes;
+                    }
+                    else
+                        offset = (static_cast<quint64>(std::rand()) * RAND_MAX + std::rand()) % last;
+                    if (offset > last)
+                        break;
+                }
+                times.push_back( timer.elapsed() );
+            }
+            Report( QByteArray( QByteArray("hexview-") + kind + '-' + patterns[p] ).constData(), fetches, times );
+        }
+    }
+
+    static QIODevice* makeRawDevice( const PdfObject* obj, QMutex* lock )
+    {
+        return new RawStreamDevice( obj, lock );
+    }
+
+    static QIODevice* makeDecodedDevice( const PdfObject* obj, QMutex* lock )
+    {
+        return new FilteredStreamDevice( obj, lock );
+    }
+
+    void BenchmarkHexView()
+    {
+        QMutex lock( QMutex::Recursive );
+        std::auto_ptr<PdfMemDocument> doc( OpenAndLoad( lock ) );
+
+        // Stored data can be read anywhere; decoded data only in order
+        if (const PdfObject* raw = biggestStream( *doc, false ))
+            ScrollPatterns( "raw", makeRawDevice, raw, lock );
+        if (const PdfObject* filtered = biggestStream( *doc, true ))
+            ScrollPatterns( "decoded", makeDecodedDevice, filtered, lock );
+    }
+
+    void BenchmarkSave()
+    {
+        QTemporaryFile out( QDir::tempPath() + QString::fromUtf8("/podofobrowser-benchmark-XXXXXX.pdf") );
+        if (!out.open())
+            return;
+        out.close();
+
+        std::vector<int> saver, write;
+        QTime timer;
+        for (int i = 0; i < m_iterations; ++i)
+        {
+            QMutex lock( QMutex::Recursive );
+            std::auto_ptr<PdfMemDocument> doc( OpenAndLoad( lock ) );
+
+            // What fileSave() does for every unencrypted document
+            DocumentSaver documentSaver( doc.get(), &lock, out.fileName() );
+            timer.start();
+            documentSaver.start();
+            documentSaver.wait();
+            saver.push_back( timer.elapsed() );
+            if (!documentSaver.GetErrorString().isEmpty())
+            {
+                QTextStream( stderr ) << m_label << ": " << documentSaver.GetErrorString() << "\n";
+                return;
+            }
+
+            // And what PoDoFo does, for comparison
+            timer.start();
+            doc->Write( out.fileName().toLocal8Bit().data() );
+            write.push_back( timer.elapsed() );
+        }
+        Report( "save", m_objects, saver );
+        Report( "podofo-write", m_objects, write );
+    }
+
+    const QString m_filename;
+    const QString m_label;
+    const int m_iterations;
+    int m_objects;
+    Reporter & m_reporter;
+};
+
+};
+
+int main( int argc, char ** argv )
+{
+    QCoreApplication a( argc, argv );
+
+    int pages = defaultPages;
+    int iterations = defaultIterations;
+    bool synthetic = true;
+    QStringList files;
+    const QStringList args = a.arguments();
+    for (int i = 1; i < args.size(); ++i)
+    {
+        const QString & arg = args[i];
+        const bool hasValue = i + 1 < args.size();
+        bool ok = true;
+        if (arg == QString::fromUtf8("--pages") && hasValue)
+            pages = args[++i].toInt( &ok );
+        else if (arg == QString::fromUtf8("--iterations") && hasValue)
+            iterations = args[++i].toInt( &ok );
+        else if (arg == QString::fromUtf8("--no-synthetic"))
+            synthetic = false;
+        else if (arg.startsWith( QString::fromUtf8("--") ))
+            ok = false;
+        else
+            files << arg;
+        if (!ok || pages < 1 || iterations < 1)
+            return usage();
+    }
+
+    // Same data every run
+    std::srand( 1 );
+
+    Reporter reporter;
+    int status = 0;
+
+    if (synthetic)
+    {
+        const int sizes[] = { qMax( 1, pages / 20 ), pages };
+        for (int s = 0; s < 2; ++s)
+        {
+            QTemporaryFile file( QDir::tempPath() + QString::fromUtf8("/podofobrowser-benchmark-XXXXXX.pdf") );
+            if (!file.open())
+            {
+                QTextStream( stderr ) << "Cannot create a temporary file\n";
+                return 1;
+            }
+            file.close();
+            try {
+                writeSyntheticPdf( file.fileName(), sizes[s] );
+                FileBenchmark( file.fileName(), QString::fromUtf8("synthetic-%1-pages").arg( sizes[s] ),
+                               iterations, reporter ).Run();
+            } catch( PdfError & e ) {
+                QTextStream( stderr ) << "Synthetic document: " << PdfError::ErrorName( e.GetError() ) << "\n";
+                status = 1;
+            }
+        }
+    }
+
+    for (QStringList::const_iterator it = files.begin(); it != files.end(); ++it)
+    {
+        try {
+            FileBenchmark( *it, QFileInfo( *it ).fileName(), iterations, reporter ).Run();
+        } catch( PdfError & e ) {
+            QTextStream( stderr ) << *it << ": " << PdfError::ErrorName( e.GetError() ) << "\n";
+            status = 1;
+        }
+    }
+
+    return status;
+}
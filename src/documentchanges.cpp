@@ -0,0 +1,25 @@
+#include "documentchanges.h"
+
+using namespace PoDoFo;
+
+DocumentChanges::DocumentChanges()
+    : m_objects(),
+      m_bChanged( false ),
+      m_bComplete( true ),
+      m_changeCount( 0 )
+{
+}
+
+bool DocumentChanges::Add( const PdfReference & ref )
+{
+    m_bChanged = true;
+    ++m_changeCount;
+    return m_objects.insert( ref ).second;
+}
+
+void DocumentChanges::Clear()
+{
+    m_objects.clear();
+    m_bChanged = false;
+    m_bComplete = true;
+}
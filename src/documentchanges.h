@@ -0,0 +1,57 @@
+#ifndef PODOFOBROWSER_DOCUMENTCHANGES_H
+#define PODOFOBROWSER_DOCUMENTCHANGES_H
+
+#include <set>
+
+#include <podofo/podofo.h>
+
+/**
+ * Whether a document has changed since it was opened or last saved, and
+ * which indirect objects have, which are what an incremental save appends
+ * to the file.
+ *
+ * It belongs with the document rather than with the object model, which is
+ * rebuilt whenever the tree switches between the catalog and object views,
+ * so the changes made in one view are still there to save from the other.
+ *
+ * A change that can't be pinned on an indirect object, such as one to the
+ * trailer, leaves the list incomplete. Only a full save is sure to keep it.
+ *
+ * Locking: guarded by the document lock. Hold it for every call.
+ */
+class DocumentChanges
+{
+public:
+    DocumentChanges();
+
+    // Record a change to the indirect object `ref'. Returns true if it
+    // hadn't been changed already.
+    bool Add(const PoDoFo::PdfReference & ref);
+
+    // Record a change to something other than an indirect object
+    void AddUntracked() { m_bChanged = true; m_bComplete = false; ++m_changeCount; }
+
+    // Anything changed since the last Clear()?
+    bool IsChanged() const { return m_bChanged; }
+
+    // How many changes have been recorded since the document was opened,
+    // saved or not. Two counts differ if anything changed in between.
+    int GetChangeCount() const { return m_changeCount; }
+
+    bool Contains(const PoDoFo::PdfReference & ref) const { return m_objects.count(ref) != 0; }
+    const std::set<PoDoFo::PdfReference> & GetObjects() const { return m_objects; }
+
+    // Whether every change is to one of GetObjects()
+    bool IsComplete() const { return m_bComplete; }
+
+    // Forget every change, once they've been saved or the document closed
+    void Clear();
+
+private:
+    std::set<PoDoFo::PdfReference> m_objects;
+    bool m_bChanged;
+    bool m_bComplete;
+    int m_changeCount;
+};
+
+#endif
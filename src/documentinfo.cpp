@@ -0,0 +1,57 @@
+#include "documentinfo.h"
+
+using namespace PoDoFo;
+
+namespace {
+
+QString fromPdfString( const PdfString & str )
+{
+    return QString::fromUtf8( str.GetStringUtf8().c_str() );
+}
+
+QString fromPdfName( const PdfName & name )
+{
+    return QString::fromUtf8( name.GetEscapedName().c_str() );
+}
+
+};
+
+DocumentInfoEntries documentInfoEntries( PdfDocument * document )
+{
+    PdfInfo * const info = document->GetInfo();
+
+    DocumentInfoEntries entries;
+    entries << qMakePair( QString::fromUtf8("Title"), fromPdfString( info->GetTitle() ) )
+            << qMakePair( QString::fromUtf8("Author"), fromPdfString( info->GetAuthor() ) )
+            << qMakePair( QString::fromUtf8("Subject"), fromPdfString( info->GetSubject() ) )
+            << qMakePair( QString::fromUtf8("Keywords"), fromPdfString( info->GetKeywords() ) )
+            << qMakePair( QString::fromUtf8("Creator"), fromPdfString( info->GetCreator() ) )
+            << qMakePair( QString::fromUtf8("Producer"), fromPdfString( info->GetProducer() ) )
+            << qMakePair( QString::fromUtf8("Trapped"), fromPdfName( info->GetTrapped() ) );
+
+    const PdfObject * const infoObject = info->GetObject();
+    if (!infoObject || !infoObject->IsDictionary())
+        return entries;
+
+    const TKeyMap & keys = infoObject->GetDictionary().GetKeys();
+    for (TKeyMap::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+        const QString name = fromPdfName( it->first );
+        bool known = false;
+        for (int i = 0; i < standardInfoEntryCount && !known; ++i)
+            known = entries[i].first == name;
+        const PdfObject * const object = it->second;
+        if (known || !object)
+            continue;
+
+        if (object->IsString())
+            entries << qMakePair( name, fromPdfString( object->GetString() ) );
+        else if (object->IsName())
+            entries << qMakePair( name, fromPdfName( object->GetName() ) );
+        else if (object->IsNumber())
+            entries << qMakePair( name, QString::number( static_cast<qlonglong>(object->GetNumber()) ) );
+        else if (object->IsReal())
+            entries << qMakePair( name, QString::number( object->GetReal() ) );
+    }
+    return entries;
+}
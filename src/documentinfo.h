@@ -0,0 +1,23 @@
+#ifndef PODOFOBROWSER_DOCUMENTINFO_H
+#define PODOFOBROWSER_DOCUMENTINFO_H
+
+#include <QList>
+#include <QPair>
+#include <QString>
+
+#include <podofo/podofo.h>
+
+// A document's Info dictionary as (key, value) pairs, for the info dialog
+// and --batch output
+typedef QList< QPair<QString, QString> > DocumentInfoEntries;
+
+// The standard keys (Title, Author, Subject, Keywords, Creator, Producer and
+// Trapped) always come first, in that order, then any others whose values
+// are strings, names or numbers. Note that PoDoFo sets the Producer when it
+// reads the Info dictionary.
+DocumentInfoEntries documentInfoEntries( PoDoFo::PdfDocument * document );
+
+// Number of standard entries at the start of every DocumentInfoEntries
+enum { standardInfoEntryCount = 7 };
+
+#endif
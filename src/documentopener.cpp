@@ -0,0 +1,105 @@
+#include "documentopener.h"
+#include "perftrace.h"
+#include "sessioncache.h"
+
+#include <QMutexLocker>
+
+using namespace PoDoFo;
+
+DocumentOpener::DocumentOpener(const QString & filename, QObject* parent)
+    : QThread(parent),
+      m_filename(filename),
+      m_pDocument(0),
+      m_bReadSessionCache(false),
+      m_pSessionCache(0),
+      m_error(),
+      m_bFailed(false),
+      m_cancelMutex(),
+      m_bCancelled(false)
+{
+    // finished() is emitted from the worker thread, so this is a queued
+    // connection and workerFinished() runs in our own (GUI) thread.
+    connect(this, SIGNAL(finished()), SLOT(workerFinished()));
+}
+
+DocumentOpener::~DocumentOpener()
+{
+    // Callers only delete us once the worker is done, but be paranoid.
+    wait();
+    delete m_pDocument;
+    delete m_pSessionCache;
+}
+
+void DocumentOpener::Cancel()
+{
+    QMutexLocker lock(&m_cancelMutex);
+    m_bCancelled = true;
+}
+
+bool DocumentOpener::IsCancelled() const
+{
+    QMutexLocker lock(&m_cancelMutex);
+    return m_bCancelled;
+}
+
+PdfMemDocument* DocumentOpener::TakeDocument()
+{
+    PdfMemDocument* doc = m_pDocument;
+    m_pDocument = 0;
+    return doc;
+}
+
+SessionCache* DocumentOpener::TakeSessionCache()
+{
+    SessionCache* cache = m_pSessionCache;
+    m_pSessionCache = 0;
+    return cache;
+}
+
+void DocumentOpener::run()
+{
+    // Before parsing, so the cache notices if the file changes meanwhile
+    SessionCache* cache = m_bReadSessionCache ? new SessionCache( m_filename ) : 0;
+
+    PdfMemDocument* doc = 0;
+    try {
+        PerfTrace::Scope scope( "open" );
+        doc = new PdfMemDocument( m_filename.toLocal8Bit().data() );
+    } catch( PdfError & e ) {
+        m_error = e;
+        m_bFailed = true;
+        delete cache;
+        return;
+    }
+
+    if (IsCancelled())
+    {
+        // Nobody wants it; don't keep a possibly huge document around until
+        // the event loop gets around to deleting us.
+        delete doc;
+        delete cache;
+        return;
+    }
+
+    if (cache)
+    {
+        PerfTrace::Scope scope( "read-session-cache" );
+        cache->Read( doc->GetObjects().GetSize() );
+    }
+    m_pDocument = doc;
+    m_pSessionCache = cache;
+}
+
+void DocumentOpener::workerFinished()
+{
+    if (IsCancelled())
+    {
+        deleteLater();
+        return;
+    }
+
+    if (m_bFailed)
+        emit failed();
+    else
+        emit opened();
+}
@@ -0,0 +1,83 @@
+#ifndef PODOFOBROWSER_DOCUMENTOPENER_H
+#define PODOFOBROWSER_DOCUMENTOPENER_H
+
+#include <QMutex>
+#include <QString>
+#include <QThread>
+
+#include <podofo/podofo.h>
+
+class SessionCache;
+
+/**
+ * Parses a PDF file into a new PdfMemDocument on a worker thread, so that
+ * the GUI (and the document currently on screen) stays usable while a large
+ * file is being opened.
+ *
+ * The opener owns the document it creates until TakeDocument() is called.
+ * When the worker is done, opened() or failed() is emitted in the thread the
+ * opener lives in (normally the GUI thread).
+ *
+ * PoDoFo offers no way to interrupt the parser, so Cancel() can't stop the
+ * worker. Instead a cancelled opener emits nothing, throws away whatever it
+ * parsed and deletes itself once the worker finishes. Callers must forget
+ * their pointer to the opener after calling Cancel().
+ */
+class DocumentOpener : public QThread
+{
+    Q_OBJECT
+
+public:
+    DocumentOpener(const QString & filename, QObject* parent = 0);
+
+    virtual ~DocumentOpener();
+
+    const QString & GetFileName() const { return m_filename; }
+
+    // Discard the result and delete this object when the worker finishes.
+    void Cancel();
+
+    // Return the newly parsed document, passing ownership to the caller.
+    // Only meaningful from a slot connected to opened().
+    PoDoFo::PdfMemDocument* TakeDocument();
+
+    // Also look for a SessionCache for the file once it's parsed, so it's
+    // read on the worker too. Call before start().
+    void ReadSessionCache() { m_bReadSessionCache = true; }
+
+    // Return the file's session cache, whether or not anything was found
+    // in it, passing ownership to the caller. Null unless
+    // ReadSessionCache() was called. Only meaningful from a slot connected
+    // to opened().
+    SessionCache* TakeSessionCache();
+
+    // The error that caused failed() to be emitted.
+    const PoDoFo::PdfError & GetError() const { return m_error; }
+
+signals:
+    void opened();
+    void failed();
+
+protected:
+    virtual void run();
+
+private slots:
+    void workerFinished();
+
+private:
+    bool IsCancelled() const;
+
+    const QString m_filename;
+
+    // Written only by the worker thread, and only read once it's finished.
+    PoDoFo::PdfMemDocument* m_pDocument;
+    bool m_bReadSessionCache;
+    SessionCache* m_pSessionCache;
+    PoDoFo::PdfError m_error;
+    bool m_bFailed;
+
+    mutable QMutex m_cancelMutex;
+    bool m_bCancelled;
+};
+
+#endif
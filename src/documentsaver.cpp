@@ -0,0 +1,213 @@
+#include "documentsaver.h"
+#include "perftrace.h"
+#include "podofoutil.h"
+
+#include <QFile>
+#include <QMutexLocker>
+#include <QTime>
+
+#include <algorithm>
+#include <utility>
+
+using namespace PoDoFo;
+
+namespace {
+
+// Longest we may hold the document lock for at a time, in milliseconds.
+// This is the longest the GUI can be kept waiting by the saver.
+static const int maxBatchTime = 20;
+
+// Number of progress() emissions we spread a whole save over.
+static const int progressSteps = 200;
+
+};
+
+DocumentSaver::DocumentSaver(PdfMemDocument* doc, QMutex* documentLock, const QString & filename,
+                             QObject* parent)
+    : QThread(parent),
+      m_pDoc(doc),
+      m_pDocumentLock(documentLock),
+      m_filename(filename),
+      m_objects(),
+      m_objectCount(0),
+      m_streamsToCompress(),
+      m_compressor(doc, documentLock),
+      m_errorString(),
+      m_bFailed(false),
+      m_cancelMutex(),
+      m_bCancelled(false)
+{
+    {
+        QMutexLocker lock(m_pDocumentLock);
+        const PdfVecObjects & objs = m_pDoc->GetObjects();
+        m_objects.reserve(objs.GetSize());
+        for (TCIVecObjects it = objs.begin(); it != objs.end(); ++it)
+            m_objects.push_back((*it)->Reference());
+    }
+    std::sort(m_objects.begin(), m_objects.end());
+    m_objectCount = static_cast<int>(m_objects.size());
+
+    // finished() is emitted from the worker thread, so this is a queued
+    // connection and workerFinished() runs in our own (GUI) thread.
+    connect(this, SIGNAL(finished()), SLOT(workerFinished()));
+}
+
+DocumentSaver::~DocumentSaver()
+{
+    Cancel();
+    wait();
+}
+
+bool DocumentSaver::CanSave(const PdfMemDocument* doc)
+{
+    return !doc->GetEncrypted();
+}
+
+void DocumentSaver::CompressStreamsFirst(const std::vector<PdfReference> & streams, StreamCompressor::Level level)
+{
+    m_streamsToCompress = streams;
+    m_compressor.SetLevel(level);
+}
+
+void DocumentSaver::Cancel()
+{
+    m_compressor.Cancel();
+    QMutexLocker lock(&m_cancelMutex);
+    m_bCancelled = true;
+}
+
+bool DocumentSaver::IsCancelled() const
+{
+    QMutexLocker lock(&m_cancelMutex);
+    return m_bCancelled;
+}
+
+void DocumentSaver::run()
+{
+    m_compressor.Compress(m_streamsToCompress);
+    if (IsCancelled())
+        return;
+
+    QFile file(m_filename);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        m_errorString = file.errorString();
+        m_bFailed = true;
+        return;
+    }
+
+    bool ok = false;
+    try {
+        PerfTrace::Scope scope("save");
+        ok = WriteDocument(file) && file.flush();
+        if (!ok)
+            m_errorString = file.errorString();
+    } catch( PdfError & e ) {
+        const char * const msg = PdfError::ErrorMessage( e.GetError() );
+        m_errorString = QString::fromLocal8Bit( msg ? msg : "" );
+    }
+    file.close();
+
+    // Don't leave half a file lying around
+    if (!ok)
+    {
+        file.remove();
+        m_bFailed = true;
+    }
+}
+
+bool DocumentSaver::WriteDocument(QIODevice & file)
+{
+    EPdfWriteMode mode;
+    EPdfVersion version;
+    {
+        QMutexLocker lock(m_pDocumentLock);
+        mode = m_pDoc->GetWriteMode();
+        version = m_pDoc->GetPdfVersion();
+    }
+
+    // The comment of high-bit bytes tells tools the file isn't plain text
+    const QByteArray header = "%PDF-1." + QByteArray::number( static_cast<int>(version) - static_cast<int>(ePdfVersion_1_0) )
+                            + "\n%\xe2\xe3\xcf\xd3\n";
+    if (file.write(header) != header.size())
+        return false;
+
+    XRefEntries written;
+    written.reserve(m_objects.size());
+    size_t nextObjectIdx = 0;
+    size_t lastProgress = 0;
+    QTime batchTimer;
+
+    while (nextObjectIdx < m_objects.size())
+    {
+        if (IsCancelled())
+            return false;
+
+        {
+            QMutexLocker lock(m_pDocumentLock);
+            const PdfVecObjects & objs = m_pDoc->GetObjects();
+            batchTimer.start();
+            // Always make some progress, however long one object takes
+            do
+            {
+                const PdfReference & ref = m_objects[nextObjectIdx++];
+                const PdfObject * const obj = objs.GetObject(ref);
+                if (!obj)
+                    continue;
+                written.push_back(std::make_pair(ref, file.pos()));
+                if (!writePdfObject(file, *obj, mode))
+                    return false;
+            }
+            while (nextObjectIdx < m_objects.size() && batchTimer.elapsed() < maxBatchTime);
+        }
+
+        if (nextObjectIdx - lastProgress >= static_cast<size_t>(qMax(1, m_objectCount / progressSteps)))
+        {
+            lastProgress = nextObjectIdx;
+            emit progress(static_cast<int>(nextObjectIdx));
+        }
+
+        // QMutex isn't fair; give a waiting GUI thread a chance at the lock
+        // before we grab it again.
+        yieldCurrentThread();
+    }
+
+    if (IsCancelled())
+        return false;
+
+    QMutexLocker lock(m_pDocumentLock);
+    return writeXRefAndTrailer(file, written, MakeTrailer(), mode, true);
+}
+
+PdfObject DocumentSaver::MakeTrailer() const
+{
+    // Start afresh rather than copy the old trailer, which may be the
+    // dictionary of a cross-reference stream, and only keep what still
+    // applies to the new file
+    PdfObject trailer( (PdfDictionary()) );
+    PdfDictionary & dict = trailer.GetDictionary();
+
+    const PdfReference last = m_objects.empty() ? PdfReference() : m_objects.back();
+    dict.AddKey( PdfName("Size"), PdfVariant( static_cast<pdf_int64>(last.ObjectNumber()) + 1 ) );
+
+    const PdfDictionary & old = m_pDoc->GetTrailer()->GetDictionary();
+    static const char* const keptKeys[] = { "Root", "Info", "ID" };
+    for (size_t i = 0; i < sizeof(keptKeys) / sizeof(keptKeys[0]); ++i)
+    {
+        const PdfObject * const value = old.GetKey( PdfName(keptKeys[i]) );
+        if (value)
+            dict.AddKey( PdfName(keptKeys[i]), *value );
+    }
+    return trailer;
+}
+
+void DocumentSaver::workerFinished()
+{
+    if (IsCancelled())
+        return;
+
+    if (m_bFailed)
+        emit failed();
+    else
+        emit saved();
+}
@@ -0,0 +1,108 @@
+#ifndef PODOFOBROWSER_DOCUMENTSAVER_H
+#define PODOFOBROWSER_DOCUMENTSAVER_H
+
+#include <QMutex>
+#include <QString>
+#include <QThread>
+
+#include <vector>
+
+#include <podofo/podofo.h>
+
+#include "streamcompressor.h"
+
+/**
+ * Writes a whole document to a new file on a worker thread, so that the GUI
+ * stays usable while a large document is saved.
+ *
+ * Rather than handing the document to PdfMemDocument::Write(), which would
+ * need the document lock for as long as the whole write takes, the saver
+ * writes the objects itself, a short batch at a time under the lock (see
+ * BackgroundLoader), then a cross-reference table and trailer. Streams left
+ * uncompressed by editing can be compressed in parallel first; see
+ * CompressStreamsFirst(). Everyone else
+ * can read the document in between, but it must not be changed until the
+ * saver is done.
+ *
+ * Encrypted documents can't be saved this way, since we'd have to encrypt
+ * what we write; see CanSave().
+ *
+ * When the worker is done, saved() or failed() is emitted in the thread the
+ * saver lives in (normally the GUI thread). A cancelled saver emits neither
+ * and removes what it wrote.
+ *
+ * Ownership: the saver never owns the document. Deleting the saver cancels
+ * it and waits for the worker, which is never long. Don't delete the saver
+ * while holding the document lock.
+ */
+class DocumentSaver : public QThread
+{
+    Q_OBJECT
+
+public:
+    DocumentSaver(PoDoFo::PdfMemDocument* doc, QMutex* documentLock, const QString & filename,
+                  QObject* parent = 0);
+
+    virtual ~DocumentSaver();
+
+    // Whether `doc' can be saved by a DocumentSaver. The caller must hold
+    // the document lock.
+    static bool CanSave(const PoDoFo::PdfMemDocument* doc);
+
+    const QString & GetFileName() const { return m_filename; }
+
+    // Number of objects there are to write, for progress()
+    int GetObjectCount() const { return m_objectCount; }
+
+    // Before writing anything, compress the unfiltered streams among
+    // `streams' with a StreamCompressor. Call before start().
+    void CompressStreamsFirst(const std::vector<PoDoFo::PdfReference> & streams, StreamCompressor::Level level);
+
+    // Ask the worker to stop after its current batch. Returns immediately.
+    void Cancel();
+
+    // Why failed() was emitted
+    const QString & GetErrorString() const { return m_errorString; }
+
+signals:
+    // Number of objects written so far. Emitted in coarse steps.
+    void progress(int);
+    void saved();
+    void failed();
+
+protected:
+    virtual void run();
+
+private slots:
+    void workerFinished();
+
+private:
+    bool IsCancelled() const;
+
+    // Write everything to `file'. Returns false on I/O errors or when
+    // cancelled; throws PdfError.
+    bool WriteDocument(QIODevice & file);
+
+    // The trailer for the new file
+    PoDoFo::PdfObject MakeTrailer() const;
+
+    PoDoFo::PdfMemDocument* m_pDoc;
+    QMutex* m_pDocumentLock;
+    const QString m_filename;
+
+    // The objects to write, in order, as they were when the saver was made
+    std::vector<PoDoFo::PdfReference> m_objects;
+    int m_objectCount;
+
+    std::vector<PoDoFo::PdfReference> m_streamsToCompress;
+    StreamCompressor m_compressor;
+
+    // Written only by the worker thread, and only read once it's finished.
+    QString m_errorString;
+    bool m_bFailed;
+
+    mutable QMutex m_cancelMutex;
+    bool m_bCancelled;
+};
+
+#endif
@@ -0,0 +1,276 @@
+#include "documentsearch.h"
+#include "podofoutil.h"
+#include "streamsnapshot.h"
+#include "wordsplitter.h"
+
+#include <QMutexLocker>
+
+using namespace PoDoFo;
+
+namespace {
+
+// Objects handed to a worker at a time. Small enough to keep the workers
+// evenly loaded however the big streams are spread over the document.
+static const int rangeSize = 64;
+
+// How often results are passed on, in milliseconds
+static const int pollInterval = 100;
+
+/**
+ * Keeps track of which query words an object has matched so far
+ */
+class QueryMatcher : public WordSplitter
+{
+public:
+    QueryMatcher( const std::vector<QByteArray> & words )
+        : m_words(words), m_found(words.size(), false), m_remaining(words.size())
+    {
+    }
+
+    void Reset()
+    {
+        EndWord();
+        m_found.assign( m_words.size(), false );
+        m_remaining = m_words.size();
+    }
+
+    bool AllFound() const { return m_remaining == 0; }
+
+protected:
+    virtual void Word( const QByteArray & word )
+    {
+        for (std::vector<QByteArray>::size_type i = 0; i < m_words.size(); ++i)
+        {
+            if (!m_found[i] && word.startsWith( m_words[i] ))
+            {
+                m_found[i] = true;
+                --m_remaining;
+            }
+        }
+    }
+
+private:
+    const std::vector<QByteArray> & m_words;
+    std::vector<bool> m_found;
+    std::vector<bool>::size_type m_remaining;
+};
+
+/**
+ * Feeds decoded stream data to a QueryMatcher until it has matched every
+ * word or the search is cancelled.
+ */
+class MatchSink : public StreamDataSink
+{
+public:
+    // `search' may be null if nothing can cancel the search
+    MatchSink( QueryMatcher & matcher, const DocumentSearch * search )
+        : m_matcher(matcher), m_search(search)
+    {
+    }
+
+    virtual pdf_long Write( const char* pBuffer, pdf_long lLen )
+    {
+        m_matcher.Feed( pBuffer, lLen );
+        return lLen;
+    }
+
+    virtual void Close() { m_matcher.EndWord(); }
+
+    virtual bool WantsMore() const { return !m_matcher.AllFound() && !(m_search && m_search->IsCancelled()); }
+
+private:
+    QueryMatcher & m_matcher;
+    const DocumentSearch * m_search;
+};
+
+};
+
+DocumentSearch::DocumentSearch(PdfMemDocument* doc, QMutex* documentLock, const QString & query,
+                               QObject* parent)
+    : QObject(parent),
+      m_pDoc(doc),
+      m_pDocumentLock(documentLock),
+      m_words(WordSplitter::Split(query)),
+      m_cancelMutex(),
+      m_bCancelled(false),
+      m_claimMutex(),
+      m_nextObjectIdx(0),
+      m_resultMutex(),
+      m_results(),
+      m_workers(),
+      m_pollTimer(),
+      m_bRunning(true)
+{
+    connect(&m_pollTimer, SIGNAL(timeout()), this, SLOT(poll()));
+    m_pollTimer.start(pollInterval);
+
+    m_workers.Start(this, &DocumentSearch::Work, WorkerPool::IdealThreadCount(), QThread::LowPriority);
+}
+
+DocumentSearch::~DocumentSearch()
+{
+    Cancel();
+    m_workers.Wait();
+}
+
+std::vector<PdfReference> DocumentSearch::Search(const PdfMemDocument* doc, const QString & query)
+{
+    std::vector<PdfReference> results;
+    const std::vector<QByteArray> words(WordSplitter::Split(query));
+    if (words.empty())
+        return results;
+
+    QueryMatcher matcher(words);
+    StreamSnapshot snapshot;
+    const PdfVecObjects & objs = doc->GetObjects();
+    for (TCIVecObjects it = objs.begin(); it != objs.end(); ++it)
+    {
+        matcher.Reset();
+        bool haveSnapshot = false;
+        try {
+            matcher.FeedValue(**it);
+            if (!matcher.AllFound() && (*it)->HasStream())
+                haveSnapshot = snapshot.Take(*it, true);
+        } catch (PdfError &) {
+            // Search what we can of it
+        }
+
+        if (haveSnapshot)
+        {
+            MatchSink sink(matcher, 0);
+            try {
+                snapshot.Decode(sink);
+            } catch (PdfError &) {
+                // Keep whatever matched before the filters gave up
+            }
+            snapshot.Clear();
+        }
+
+        if (matcher.AllFound())
+            results.push_back((*it)->Reference());
+    }
+    return results;
+}
+
+void DocumentSearch::Cancel()
+{
+    QMutexLocker lock(&m_cancelMutex);
+    m_bCancelled = true;
+}
+
+bool DocumentSearch::IsCancelled() const
+{
+    QMutexLocker lock(&m_cancelMutex);
+    return m_bCancelled;
+}
+
+bool DocumentSearch::IsRunning() const
+{
+    return m_bRunning;
+}
+
+void DocumentSearch::TakeResults(std::vector<PdfReference> & out)
+{
+    QMutexLocker lock(&m_resultMutex);
+    out.clear();
+    out.swap(m_results);
+}
+
+void DocumentSearch::poll()
+{
+    const bool allDone = m_workers.IsFinished();
+    if (allDone)
+    {
+        m_pollTimer.stop();
+        m_bRunning = false;
+    }
+
+    if (IsCancelled())
+        return;
+
+    bool haveResults;
+    {
+        QMutexLocker lock(&m_resultMutex);
+        haveResults = !m_results.empty();
+    }
+    if (haveResults)
+        emit resultsReady();
+    if (allDone)
+        emit finished();
+}
+
+bool DocumentSearch::ClaimRange(int & begin, int & end)
+{
+    int objCount;
+    {
+        QMutexLocker lock(m_pDocumentLock);
+        objCount = m_pDoc->GetObjects().GetSize();
+    }
+
+    QMutexLocker lock(&m_claimMutex);
+    if (m_nextObjectIdx >= objCount)
+        return false;
+    begin = m_nextObjectIdx;
+    end = qMin(begin + rangeSize, objCount);
+    m_nextObjectIdx = end;
+    return true;
+}
+
+void DocumentSearch::AddResult(const PdfReference & ref)
+{
+    QMutexLocker lock(&m_resultMutex);
+    m_results.push_back(ref);
+}
+
+void DocumentSearch::Work()
+{
+    PdfVecObjects & objs = indexableObjects(m_pDoc);
+
+    if (m_words.empty())
+        return;
+
+    QueryMatcher matcher(m_words);
+    StreamSnapshot snapshot;
+    int begin = 0;
+    int end = 0;
+    while (!IsCancelled() && ClaimRange(begin, end))
+    {
+        for (int idx = begin; idx < end && !IsCancelled(); ++idx)
+        {
+            matcher.Reset();
+            PdfReference ref;
+            bool haveSnapshot = false;
+            {
+                // As in BackgroundLoader, an index into the vector is good
+                // enough; re-check it against the size, which may have shrunk
+                // since the range was claimed.
+                QMutexLocker lock(m_pDocumentLock);
+                if (idx >= static_cast<int>(objs.GetSize()))
+                    break;
+                const PdfObject* obj = objs[idx];
+                ref = obj->Reference();
+                try {
+                    matcher.FeedValue(*obj);
+                    if (!matcher.AllFound() && obj->HasStream())
+                        haveSnapshot = snapshot.Take(obj, true);
+                } catch (PdfError &) {
+                    // Search what we can of it
+                }
+            }
+
+            if (haveSnapshot)
+            {
+                MatchSink sink(matcher, this);
+                try {
+                    snapshot.Decode(sink);
+                } catch (PdfError &) {
+                    // Keep whatever matched before the filters gave up
+                }
+                snapshot.Clear();
+            }
+
+            if (matcher.AllFound())
+                AddResult(ref);
+        }
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef PODOFOBROWSER_DOCUMENTSEARCH_H
+#define PODOFOBROWSER_DOCUMENTSEARCH_H
+
+#include <QByteArray>
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+#include <vector>
+
+#include <podofo/podofo.h>
+
+#include "workerpool.h"
+
+/**
+ * Searches a whole document by brute force, for when there's no SearchIndex
+ * to ask yet. Matches exactly what a SearchIndex query would. The search
+ * starts as soon as it's created.
+ *
+ * The object vector is shared out between several worker threads a range at
+ * a time. A worker looks at an object with the document lock held, copying
+ * out its stream if it has one, and decodes and searches the stream without
+ * the lock. Decoding is nearly all the work, so the workers mostly run in
+ * parallel even though the document itself can only be read by one at a
+ * time. Streams are decoded only until every query word has been seen.
+ *
+ * Results come in no particular order. They're collected from the workers
+ * and handed out in batches in the thread the search lives in (normally the
+ * GUI thread): resultsReady() says there are some to TakeResults().
+ *
+ * Ownership: the search never owns the document. Deleting the search cancels
+ * it and waits for the workers, after which the document may be deleted.
+ * Don't delete the search while holding the document lock.
+ */
+class DocumentSearch : public QObject
+{
+    Q_OBJECT
+
+public:
+    DocumentSearch(PoDoFo::PdfMemDocument* doc, QMutex* documentLock, const QString & query,
+                   QObject* parent = 0);
+
+    virtual ~DocumentSearch();
+
+    // Search the whole of `doc' on the calling thread, for a document
+    // nobody else is using (as in --batch). Returns the matching objects in
+    // document order.
+    static std::vector<PoDoFo::PdfReference> Search(const PoDoFo::PdfMemDocument* doc, const QString & query);
+
+    // Ask the workers to stop after the object they're on. No more signals
+    // are emitted afterwards. Returns immediately.
+    void Cancel();
+    bool IsCancelled() const;
+
+    // True until every worker is done, having finished or been cancelled
+    bool IsRunning() const;
+
+    // Move the results found since the last call into `out'
+    void TakeResults(std::vector<PoDoFo::PdfReference> & out);
+
+signals:
+    // There are new results to TakeResults()
+    void resultsReady();
+    // Every object has been searched (but not emitted if cancelled)
+    void finished();
+
+private slots:
+    // Pass on what the workers have been up to
+    void poll();
+
+private:
+    // Run by each worker thread
+    void Work();
+
+    // Claim the next range of objects for a worker to search. Returns false
+    // once there are none left.
+    bool ClaimRange(int & begin, int & end);
+
+    // Hand over an object a worker found
+    void AddResult(const PoDoFo::PdfReference & ref);
+
+    PoDoFo::PdfMemDocument* m_pDoc;
+    QMutex* m_pDocumentLock;
+    const std::vector<QByteArray> m_words;
+
+    mutable QMutex m_cancelMutex;
+    bool m_bCancelled;
+
+    // Next object to hand out to a worker
+    QMutex m_claimMutex;
+    int m_nextObjectIdx;
+
+    // Found by the workers but not yet taken
+    QMutex m_resultMutex;
+    std::vector<PoDoFo::PdfReference> m_results;
+
+    WorkerPool m_workers;
+    QTimer m_pollTimer;
+    bool m_bRunning;
+};
+
+#endif
@@ -0,0 +1,159 @@
+#include "filteredstreamdevice.h"
+#include "perftrace.h"
+#include "podofoutil.h"
+
+#include <QMutexLocker>
+
+#include <cstring>
+
+using namespace PoDoFo;
+
+namespace {
+
+// Amount of encoded data fed to the filters per step. Small enough that the
+// document lock is never held for long, large enough that the per-call
+// overhead in the filters doesn't matter.
+static const pdf_long encodedChunkSize = 64 * 1024;
+
+};
+
+class FilteredStreamDevice::DecodedSink : public PdfOutputStream
+{
+public:
+    DecodedSink(QByteArray* buffer) : m_pBuffer(buffer) { }
+
+    virtual pdf_long Write(const char* pBuffer, pdf_long lLen)
+    {
+        m_pBuffer->append(pBuffer, lLen);
+        return lLen;
+    }
+
+    virtual void Close() { }
+
+private:
+    QByteArray* m_pBuffer;
+};
+
+FilteredStreamDevice::FilteredStreamDevice(const PdfObject* object, QMutex* documentLock, QObject* parent)
+    : QIODevice(parent),
+      m_pObject(object),
+      m_pDocumentLock(documentLock),
+      m_decoded(),
+      m_decodedPos(0),
+      m_pSink(0),
+      m_pDecodeStream(0),
+      m_encodedPos(0),
+      m_bInputDone(false),
+      m_bFailed(false),
+      m_error()
+{
+    m_pSink = new DecodedSink(&m_decoded);
+
+    QMutexLocker lock(m_pDocumentLock);
+    try {
+        // Forces the delayed load of the stream, if that hasn't happened yet
+        m_pObject->GetStream();
+
+        const TVecFilters filters = PdfFilterFactory::CreateFilterList(m_pObject);
+        if (!filters.empty())
+            m_pDecodeStream = PdfFilterFactory::CreateDecodeStream(filters, m_pSink, &m_pObject->GetDictionary());
+    } catch (PdfError & e) {
+        Fail(e);
+    }
+
+    open(QIODevice::ReadOnly);
+}
+
+FilteredStreamDevice::~FilteredStreamDevice()
+{
+    delete m_pDecodeStream;
+    delete m_pSink;
+}
+
+void FilteredStreamDevice::Fail(const PdfError & e)
+{
+    m_error = e;
+    m_bFailed = true;
+    m_bInputDone = true;
+    const char * const msg = PdfError::ErrorMessage(e.GetError());
+    setErrorString( QString::fromLocal8Bit(msg ? msg : "") );
+}
+
+bool FilteredStreamDevice::DecodeMore()
+{
+    if (m_bInputDone)
+        return false;
+
+    PerfTrace::Scope scope("decode-stream");
+    try {
+        // Look the buffer up afresh each time, in case the stream was
+        // reallocated under us. We'd return garbage then, but never crash.
+        const char * encoded = 0;
+        pdf_long encodedLen = 0;
+        getEncodedStreamData(m_pObject->GetStream(), encoded, encodedLen);
+
+        if (m_encodedPos < encodedLen)
+        {
+            const pdf_long chunk = qMin(encodedChunkSize, encodedLen - m_encodedPos);
+            if (m_pDecodeStream)
+                m_pDecodeStream->Write(encoded + m_encodedPos, chunk);
+            else
+                m_decoded.append(encoded + m_encodedPos, chunk);
+            m_encodedPos += chunk;
+        }
+        else
+        {
+            // Let the filters flush anything they're still holding
+            if (m_pDecodeStream)
+                m_pDecodeStream->Close();
+            m_bInputDone = true;
+        }
+    } catch (PdfError & e) {
+        Fail(e);
+        return false;
+    }
+    return true;
+}
+
+qint64 FilteredStreamDevice::readData(char* data, qint64 maxSize)
+{
+    QMutexLocker lock(m_pDocumentLock);
+
+    while (m_decoded.size() - m_decodedPos < maxSize && DecodeMore())
+        ;
+
+    const qint64 n = qMin<qint64>(maxSize, m_decoded.size() - m_decodedPos);
+    if (n == 0)
+        return m_bFailed ? -1 : 0;
+
+    memcpy(data, m_decoded.constData() + m_decodedPos, n);
+    m_decodedPos += n;
+
+    // Don't let consumed data pile up at the front of the buffer
+    if (m_decodedPos == m_decoded.size())
+    {
+        m_decoded.clear();
+        m_decodedPos = 0;
+    }
+    else if (m_decodedPos > encodedChunkSize && m_decodedPos > m_decoded.size() / 2)
+    {
+        m_decoded.remove(0, m_decodedPos);
+        m_decodedPos = 0;
+    }
+    return n;
+}
+
+qint64 FilteredStreamDevice::writeData(const char*, qint64)
+{
+    return -1;
+}
+
+qint64 FilteredStreamDevice::bytesAvailable() const
+{
+    return (m_decoded.size() - m_decodedPos) + QIODevice::bytesAvailable();
+}
+
+bool FilteredStreamDevice::atEnd() const
+{
+    return m_bInputDone && bytesAvailable() == 0;
+}
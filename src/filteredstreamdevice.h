@@ -0,0 +1,76 @@
+#ifndef PODOFOBROWSER_FILTEREDSTREAMDEVICE_H
+#define PODOFOBROWSER_FILTEREDSTREAMDEVICE_H
+
+#include <QByteArray>
+#include <QIODevice>
+
+#include <podofo/podofo.h>
+
+class QMutex;
+
+/**
+ * A read-only, sequential QIODevice that yields the decoded contents of a
+ * PDF object's stream. The encoded data is pushed through PoDoFo's filter
+ * chain a chunk at a time as the reader asks for more, so the first bytes are
+ * available immediately however large the stream is, and the decoded stream
+ * is never held in memory as a whole.
+ *
+ * The decoded size isn't known until the whole stream has been read.
+ *
+ * The device is opened by the constructor. Every read takes `documentLock',
+ * which may be null if the document isn't shared with other threads. The
+ * object must outlive the device; if its stream is replaced, throw the device
+ * away and make a new one.
+ *
+ * Decoding errors end the stream early; HasError() and GetError() tell you
+ * what went wrong.
+ */
+class FilteredStreamDevice : public QIODevice
+{
+public:
+    FilteredStreamDevice(const PoDoFo::PdfObject* object, QMutex* documentLock, QObject* parent = 0);
+
+    virtual ~FilteredStreamDevice();
+
+    virtual bool isSequential() const { return true; }
+    virtual bool atEnd() const;
+    virtual qint64 bytesAvailable() const;
+
+    bool HasError() const { return m_bFailed; }
+    const PoDoFo::PdfError & GetError() const { return m_error; }
+
+protected:
+    virtual qint64 readData(char* data, qint64 maxSize);
+    virtual qint64 writeData(const char* data, qint64 maxSize);
+
+private:
+    class DecodedSink;
+
+    // Push the next chunk of encoded data through the filters. Returns false
+    // once there's nothing more to decode.
+    bool DecodeMore();
+
+    // Remember `e' and stop decoding
+    void Fail(const PoDoFo::PdfError & e);
+
+    const PoDoFo::PdfObject* m_pObject;
+    QMutex* m_pDocumentLock;
+
+    // Decoded data not yet returned by readData() starts at m_decodedPos
+    QByteArray m_decoded;
+    int m_decodedPos;
+
+    // Receives the filters' output and appends it to m_decoded
+    DecodedSink* m_pSink;
+    // Head of the filter chain, or null if the stream isn't filtered
+    PoDoFo::PdfOutputStream* m_pDecodeStream;
+
+    // How much of the encoded data has been pushed through so far
+    PoDoFo::pdf_long m_encodedPos;
+    bool m_bInputDone;
+
+    bool m_bFailed;
+    PoDoFo::PdfError m_error;
+};
+
+#endif
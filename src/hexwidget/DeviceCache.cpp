@@ -0,0 +1,254 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#include "DeviceCache.h"
+
+#include <QIODevice>
+#include <QTemporaryFile>
+
+namespace {
+	// Random I/O devices are read and cached in blocks of this many bytes
+	const unsigned int cacheBlockSize = 4096;
+	const unsigned int defaultCacheSize = 4 * 1024 * 1024;
+	// Readahead never goes beyond this many blocks
+	const unsigned int maxReadahead = 64;
+	// Sequential devices are read this much at a time
+	const int sequentialChunkSize = 64 * 1024;
+	// Data read from a sequential device moves from memory to a temporary
+	// file once there's more than this much of it
+	const unsigned int spillThreshold = 8 * 1024 * 1024;
+}
+
+DeviceCache::DeviceCache()
+	: m_io(0), m_buf(), m_bufOffset(0),
+	  m_blockCache(), m_recency(), m_cacheClock(0), m_cacheBlocks(defaultCacheSize / cacheBlockSize),
+	  m_readahead(1), m_lastFetchOffset(0), m_lastFetchDirection(0),
+	  m_seqRead(0), m_seqAtEnd(false), m_spill(0) {
+}
+
+DeviceCache::~DeviceCache() {
+	delete m_spill;
+}
+
+void DeviceCache::setDevice(QIODevice * d) {
+	m_io = d;
+	m_buf.clear();
+	m_bufOffset = 0;
+	m_blockCache.clear();
+	m_recency.clear();
+	m_readahead = 1;
+	m_lastFetchOffset = 0;
+	m_lastFetchDirection = 0;
+	m_seqRead = 0;
+	m_seqAtEnd = false;
+	delete m_spill;
+	m_spill = 0;
+}
+
+void DeviceCache::setCacheSize(unsigned int bytes) {
+	m_cacheBlocks = qMax(1u, bytes / cacheBlockSize);
+	trimCache();
+}
+
+unsigned int DeviceCache::cacheSize() const {
+	return m_cacheBlocks * cacheBlockSize;
+}
+
+quint64 DeviceCache::available() const {
+	if (!m_io)
+		return 0;
+	return m_io->isSequential() ? m_seqRead : m_io->size();
+}
+
+bool DeviceCache::atEnd() const {
+	return !m_io || !m_io->isSequential() || m_seqAtEnd;
+}
+
+void DeviceCache::fetch(quint64 offset, unsigned int size) {
+	if (!m_io || windowContains(offset, size))
+		return;
+
+	if (m_io->isSequential()) {
+		readTo(offset + size);
+		if (m_spill)
+			fetchBlocks(m_spill, offset, size);
+		// otherwise m_buf holds everything read so far, from offset zero
+	} else {
+		fetchBlocks(m_io, offset, size);
+	}
+}
+
+void DeviceCache::readTo(quint64 end) {
+	if (!m_io || !m_io->isSequential())
+		return;
+
+	while (m_seqRead < end && !m_seqAtEnd) {
+		qint64 bytesRead;
+		if (!m_spill) {
+			// Append straight to the in-memory backlog
+			const int oldSize = m_buf.size();
+			m_buf.resize(oldSize + sequentialChunkSize);
+			bytesRead = m_io->read(m_buf.data() + oldSize, sequentialChunkSize);
+			m_buf.resize(oldSize + qMax<qint64>(bytesRead, 0));
+		} else {
+			QByteArray chunk(sequentialChunkSize, '\0');
+			bytesRead = m_io->read(chunk.data(), sequentialChunkSize);
+			if (bytesRead > 0) {
+				// A block cached at the old end of the data was short,
+				// and now it isn't.
+				if (m_seqRead % cacheBlockSize)
+					removeBlock(m_seqRead / cacheBlockSize);
+				m_spill->seek(m_seqRead);
+				if (m_spill->write(chunk.constData(), bytesRead) != bytesRead) {
+					// Out of disk space or similar. Pretend the data
+					// ends here rather than show nonsense.
+					qWarning("DeviceCache: unable to write to %s, truncating data",
+						 qPrintable(m_spill->fileName()));
+					m_seqAtEnd = true;
+					break;
+				}
+			}
+		}
+
+		if (bytesRead <= 0) {
+			// That's all there is
+			m_seqAtEnd = true;
+			break;
+		}
+		m_seqRead += bytesRead;
+
+		if (!m_spill && static_cast<unsigned int>(m_buf.size()) > spillThreshold)
+			startSpilling();
+	}
+}
+
+void DeviceCache::startSpilling() {
+	m_spill = new QTemporaryFile();
+	if (!m_spill->open() || m_spill->write(m_buf) != m_buf.size()) {
+		// Keep going in memory; that's no worse than we used to be.
+		qWarning("DeviceCache: unable to create temporary file, keeping data in memory");
+		delete m_spill;
+		m_spill = 0;
+		return;
+	}
+	// From now on m_buf is just a window onto the file
+	m_buf.clear();
+	m_bufOffset = 0;
+}
+
+void DeviceCache::fetchBlocks(QIODevice * dev, quint64 offset, unsigned int size) {
+	// We rebuild the buffer from cached blocks, reading whatever isn't
+	// cached. No attempt to check for reading past the end of the available
+	// data, etc is made here.
+	++m_cacheClock;
+
+	// Adapt the readahead to the way the reader is moving. Small
+	// steps in the same direction as last time count as sustained
+	// scrolling; anything else is a jump.
+	const quint64 nearby = 4 * (static_cast<quint64>(size) + cacheBlockSize * m_readahead);
+	int direction = 0;
+	if (offset > m_lastFetchOffset && offset - m_lastFetchOffset <= nearby)
+		direction = 1;
+	else if (offset < m_lastFetchOffset && m_lastFetchOffset - offset <= nearby)
+		direction = -1;
+
+	if (direction != 0 && direction == m_lastFetchDirection)
+		m_readahead = qMin(m_readahead * 2, maxReadahead);
+	else
+		m_readahead = 1;
+	m_lastFetchOffset = offset;
+	m_lastFetchDirection = direction;
+
+	quint64 first = offset / cacheBlockSize;
+	quint64 last = (offset + qMax(size, 1u) - 1) / cacheBlockSize;
+	if (direction < 0)
+		first = first > m_readahead ? first - m_readahead : 0;
+	else
+		last += m_readahead;
+	cacheBlocks(dev, first, last);
+
+	// Assemble the buffer, stopping at the end of the data
+	m_buf.clear();
+	m_bufOffset = first * cacheBlockSize;
+	for (quint64 block = first; block <= last; ++block) {
+		BlockCache::iterator it = m_blockCache.find(block);
+		if (it == m_blockCache.end())
+			break;
+		touchBlock(block);
+		m_buf.append(it.value().data);
+		if (it.value().data.size() < static_cast<int>(cacheBlockSize))
+			break;
+	}
+
+	trimCache();
+}
+
+void DeviceCache::cacheBlocks(QIODevice * dev, quint64 first, quint64 last) {
+	quint64 block = first;
+	while (block <= last) {
+		if (m_blockCache.contains(block)) {
+			touchBlock(block);
+			++block;
+			continue;
+		}
+
+		// Read the whole run of missing blocks at once
+		quint64 runEnd = block;
+		while (runEnd < last && !m_blockCache.contains(runEnd + 1))
+			++runEnd;
+
+		if (!dev->seek(block * cacheBlockSize))
+			return;
+		const QByteArray run = dev->read((runEnd - block + 1) * cacheBlockSize);
+		for (int pos = 0; block <= runEnd; ++block, pos += cacheBlockSize) {
+			if (pos >= run.size())
+				// Past the end of the device, so there's nothing more to get
+				return;
+			CachedBlock & entry = m_blockCache[block];
+			entry.data = run.mid(pos, cacheBlockSize);
+			entry.lastUsed = m_cacheClock;
+			entry.recency = m_recency.insert(m_recency.end(), block);
+			if (entry.data.size() < static_cast<int>(cacheBlockSize))
+				return;
+		}
+	}
+}
+
+void DeviceCache::touchBlock(quint64 block) {
+	CachedBlock & entry = m_blockCache[block];
+	entry.lastUsed = m_cacheClock;
+	m_recency.erase(entry.recency);
+	entry.recency = m_recency.insert(m_recency.end(), block);
+}
+
+void DeviceCache::removeBlock(quint64 block) {
+	BlockCache::iterator it = m_blockCache.find(block);
+	if (it == m_blockCache.end())
+		return;
+	m_recency.erase(it.value().recency);
+	m_blockCache.erase(it);
+}
+
+void DeviceCache::trimCache() {
+	// Blocks used by the current buffer have the current clock value and are
+	// never thrown away here, so the cache may briefly exceed its limit.
+	while (static_cast<unsigned int>(m_blockCache.size()) > m_cacheBlocks) {
+		const quint64 oldest = m_recency.first();
+		if (m_blockCache.constFind(oldest).value().lastUsed == m_cacheClock)
+			break;
+		removeBlock(oldest);
+	}
+}
@@ -0,0 +1,141 @@
+/*
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+*/
+
+#ifndef DEVICECACHE_H_
+#define DEVICECACHE_H_
+
+#include <QByteArray>
+#include <QHash>
+#include <QLinkedList>
+#include <QtGlobal>
+
+class QIODevice;
+class QTemporaryFile;
+
+/**
+ * Random access to the data of any QIODevice, for viewers that only look at
+ * a small part of it at a time.
+ *
+ * Random I/O devices are read in fixed size blocks, which are kept in an LRU
+ * cache of limited size. Readahead adapts to the way the reader moves.
+ *
+ * Sequential devices can't go back, so whatever is read from them is kept:
+ * in memory at first, then in a temporary file once there's too much of it.
+ * The file is read back through the block cache like any random I/O device,
+ * so memory use stays bounded however much is read.
+ *
+ * The cache never owns the device, which must already be open and must stay
+ * valid until setDevice() is called with another one or the cache is
+ * destroyed.
+ */
+class DeviceCache {
+public:
+	DeviceCache();
+	~DeviceCache();
+
+public:
+	// Operate on `d', which may be null, forgetting anything cached
+	void setDevice(QIODevice * d);
+	QIODevice * device() const { return m_io; }
+
+	// Memory, in bytes, that may be used to cache blocks. The default is
+	// 4MB.
+	void setCacheSize(unsigned int bytes);
+	unsigned int cacheSize() const;
+
+	// For a sequential device, read until at least `end' bytes have been
+	// read in total or the device runs out. Does nothing for random I/O.
+	void readTo(quint64 end);
+
+	// How much data there is to look at: for a sequential device, how
+	// much has been read so far.
+	quint64 available() const;
+
+	// True if available() is all there will ever be
+	bool atEnd() const;
+
+	// Make window() hold at least the `size' bytes at `offset', or as many
+	// of them as exist. For a sequential device, data not yet read is read
+	// first.
+	void fetch(quint64 offset, unsigned int size);
+
+	// True if window() already holds the `size' bytes at `offset'
+	bool windowContains(quint64 offset, unsigned int size) const {
+		return m_bufOffset <= offset && m_bufOffset + m_buf.size() >= offset + size;
+	}
+
+	// The data fetched, which starts at windowOffset() in the device
+	const QByteArray & window() const { return m_buf; }
+	quint64 windowOffset() const { return m_bufOffset; }
+
+private:
+	// Not copyable
+	DeviceCache(const DeviceCache &);
+	DeviceCache & operator=(const DeviceCache &);
+
+	// Move the sequential backlog in m_buf out to m_spill
+	void startSpilling();
+
+	// Fill m_buf from device `dev' through the block cache
+	void fetchBlocks(QIODevice * dev, quint64 offset, unsigned int size);
+
+	// Make sure blocks `first' to `last' inclusive of `dev' are in the
+	// block cache, reading any runs of missing blocks in one go.
+	void cacheBlocks(QIODevice * dev, quint64 first, quint64 last);
+
+	// Mark cached block `block' as used by the current fetch
+	void touchBlock(quint64 block);
+
+	// Forget cached block `block', if it's cached
+	void removeBlock(quint64 block);
+
+	// Throw out the least recently used blocks until the cache fits
+	void trimCache();
+
+private:
+	QIODevice * m_io;
+
+	// The current data segment. For a random I/O device it's assembled
+	// from cached blocks; for a sequential device it's everything read so
+	// far, until that gets too big and moves to m_spill.
+	QByteArray m_buf;
+	quint64 m_bufOffset;
+
+	typedef QLinkedList<quint64> BlockList;
+	struct CachedBlock {
+		QByteArray data;
+		quint64 lastUsed;	// value of m_cacheClock when last used
+		BlockList::iterator recency;	// where it is in m_recency
+	};
+	typedef QHash<quint64, CachedBlock> BlockCache;
+	BlockCache m_blockCache;	// keyed by block number
+	BlockList m_recency;		// cached block numbers, least recently used first
+	quint64 m_cacheClock;		// ticks once per fetch
+	unsigned int m_cacheBlocks;	// most blocks we may cache
+
+	// Readahead, in blocks, and the state used to adapt it. It doubles for
+	// as long as the reader keeps going the same way, and drops back to one
+	// block as soon as it jumps somewhere else.
+	unsigned int m_readahead;
+	quint64 m_lastFetchOffset;
+	int m_lastFetchDirection;	// -1, 0 or 1
+
+	quint64 m_seqRead;		// bytes read from a sequential device
+	bool m_seqAtEnd;		// true once it ran dry
+	QTemporaryFile * m_spill;	// null until we start spilling
+};
+
+#endif
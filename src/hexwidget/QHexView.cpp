@@ -18,6 +18,7 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 */
 
 #include "QHexView.h"
+#include "perftrace.h"
 
 #include <QApplication>
 #include <QPixmap>
@@ -42,6 +43,7 @@ QHexView::QHexView(QWidget * parent) : QAbstractScrollArea(parent),
 		m_ShowHex(true), m_ShowAscii(true), 
 		m_ShowAddress(true), m_ShowComments(true), m_Origin(0), m_AddressOffset(0), 
 		m_SelectionStart(-1), m_SelectionEnd(-1), m_io(0),
+		m_dataSize(0), m_sizeKnown(true),
 		m_Highlighting(Highlighting_None),
 		m_EvenWord(Qt::blue), m_NonPrintableText(Qt::red), 
 		m_UnprintableChar('.'), m_ShowLine1(true), m_ShowLine2(true), 
@@ -262,6 +264,14 @@ void QHexView::keyPressEvent(QKeyEvent *event) {
 			scrollTo(0);
 			break;
 		case Qt::Key_End:			
+			if(!m_sizeKnown) {
+				// The user asked for it, so read the lot. Anything
+				// big ends up in the temporary file, not in memory.
+				m_cache.readTo(~static_cast<quint64>(0));
+				m_dataSize = m_cache.available();
+				m_sizeKnown = true;
+				updateScrollbars();
+			}
 			scrollTo(dataSize() - bytesPerRow());
 			break;
 		case Qt::Key_Down:
@@ -681,19 +691,20 @@ void QHexView::mouseReleaseEvent(QMouseEvent *event) {
 //------------------------------------------------------------------------------
 void QHexView::setData(QIODevice *d, size_t s)
 {
-	m_buf.clear();
-	m_bufOffset = 0;
+	m_cache.setDevice(d);
 
 	if (d)
 	{
 		m_io = d;
-		m_dataSize = s;
+		m_sizeKnown = (s != unknownSize);
+		m_dataSize = m_sizeKnown ? s : 0;
 	}
 	else
 	{
 		// Clear the viewer
 		m_io = 0;
 		m_dataSize = 0;
+		m_sizeKnown = true;
 	}
 	
 	deselect();
@@ -764,48 +775,39 @@ void QHexView::fetchData(unsigned int offset, unsigned int size) const
 	if (!m_io)
 		return;
 
-	if (m_bufOffset <= offset && m_bufOffset + m_buf.size() >= offset + size)
-		// Request already satisfied; buffer contains required data.
-		return;
+	PerfTrace::Scope scope("hexview-fetch");
 
-	// We need to do some real work, since the buffer needs more data. If we're
-	// doing sequential I/O that means reading more data. For random I/O we throw
-	// the old data away and replace it.
-	if (m_io->isSequential())
-	{
-		// Read from the stream and append to our internal bufffer until
-		// we have enough data to satisfy the caller's request or we know
-		// we can read nothing more.
-		// m_bufOffset will always be zero for sequential streams.
-		while (offset + size < m_bufOffset + m_buf.size())
-		{
-			static const int fd_max_read = 8192;
-			char readBuffer[fd_max_read];
-			qint64 bytesRead = m_io->read(&readBuffer[0], fd_max_read);
-			if (bytesRead <= 0)
-				break;
-			m_buf.append( QByteArray(&readBuffer[0], bytesRead) );
-		}
-	}
-	else
-	{
-		// Device is random I/O capable, so we can just grab a new
-		// buffer to work on and throw out the old one. No attempt
-		// to check for reading past the end of the available data, etc
-		// is made here.
-		static const int readahead = 4096;
-		m_io->seek(offset);
-		m_buf = m_io->read(size + readahead);
-		m_bufOffset = offset;
+	// The cache does the real work: it reads ahead, keeps recently used data
+	// from random I/O devices, and keeps everything read from sequential
+	// ones, in a temporary file if there's a lot of it.
+	m_cache.fetch(offset, size);
+
+	if (!m_sizeKnown) {
+		m_dataSize = m_cache.available();
+		m_sizeKnown = m_cache.atEnd();
 	}
 }
 
+//------------------------------------------------------------------------------
+// Name: setCacheSize(unsigned int bytes)
+//------------------------------------------------------------------------------
+void QHexView::setCacheSize(unsigned int bytes) {
+	m_cache.setCacheSize(bytes);
+}
+
+//------------------------------------------------------------------------------
+// Name: cacheSize() const
+//------------------------------------------------------------------------------
+unsigned int QHexView::cacheSize() const {
+	return m_cache.cacheSize();
+}
+
 //------------------------------------------------------------------------------
 // Name: 
 //------------------------------------------------------------------------------
 void QHexView::drawHexDump(QPainter &painter, unsigned int offset, unsigned int row, int &wordCount) const {
 
-	const QByteArray &dataRef(m_buf);
+	const QByteArray &dataRef(m_cache.window());
 	const int size = dataSize();
 
 	// Try to fill the buffer to satisfy the request
@@ -834,7 +836,7 @@ void QHexView::drawHexDump(QPainter &painter, unsigned int offset, unsigned int
 			// Location of the start of the current word within the
 			// current working buffer (rather than absolute
 			// stream position).
-			const int bufIdx = index - m_bufOffset;
+			const int bufIdx = index - bufOffset();
 	
 			switch(m_WordWidth) {
 			case 1:
@@ -920,7 +922,7 @@ void QHexView::drawHexDump(QPainter &painter, unsigned int offset, unsigned int
 //------------------------------------------------------------------------------
 void QHexView::drawAsciiDump(QPainter &painter, unsigned int offset, unsigned int row) const {
 	
-	const QByteArray &dataRef(m_buf);
+	const QByteArray &dataRef(m_cache.window());
 	const int size = dataSize();
 	
 	// i is the byte index
@@ -936,7 +938,7 @@ void QHexView::drawAsciiDump(QPainter &painter, unsigned int offset, unsigned in
 		if(index < size) {
 			
 			// Read the char out of the current window into the data
-			const char ch = dataRef[index - m_bufOffset];
+			const char ch = dataRef[index - bufOffset()];
 
 			const int drawLeft = asciiDumpLeft() + i * m_FontWidth;
 			const bool printable = isPrintable(ch);
@@ -1000,6 +1002,18 @@ void QHexView::paintEvent(QPaintEvent *) {
 			updateScrollbars();
 		}
 	}
+
+	if(!m_sizeKnown) {
+		// We only find out how much data there is by reading it. Keep a
+		// screenful beyond what's visible, so there's always somewhere to
+		// scroll to until we hit the end.
+		const size_t oldSize = m_dataSize;
+		const unsigned int screenBytes = (viewport()->height() / m_FontHeight + 1) * bytesPerRow();
+		fetchData(offset, 2 * screenBytes);
+		if(m_dataSize != oldSize) {
+			updateScrollbars();
+		}
+	}
 	
 	while(row + m_FontHeight < static_cast<unsigned int>(height()) && offset < static_cast<unsigned int>(dataSize())) {
 	
@@ -1062,22 +1076,30 @@ void QHexView::deselect() {
 //------------------------------------------------------------------------------
 QByteArray QHexView::selectedBytes() const {
 	QByteArray ret;
-	const QByteArray &dataRef(m_buf);
-	const int size = dataSize();
-	// TODO: For sequential streams, stop reading when we hit the end
-	// of the currently read data, since we know that no bytes that're
-	// as yet unseen may be selected.
-	for(int i = 0; i < size; ++i) {
-		if(isSelected(i)) {
-			// Fetch the required byte. The fetch code will optimise
-			// this to operate efficiently.
-			fetchData(i, 1);
-			// The fetch must not fail, or we'll try to access a negative
-			// index, overflow, and read unallocated memory.
-			Q_ASSERT(i >= m_bufOffset);
-			ret.push_back(dataRef[i - m_bufOffset]);
-			//qDebug("i: %i, o: %i, data: %c (bufstate: %i + %i)", i, i - m_bufOffset, dataRef[i - m_bufOffset], m_bufOffset, m_buf.size());
-		}
+	if (!hasSelectedText())
+		return ret;
+
+	// Only data that's been read can have been selected, so for sequential
+	// streams this never reads anything new.
+	const unsigned int start = qMin(m_SelectionStart, m_SelectionEnd);
+	const unsigned int end = qMin(static_cast<unsigned int>(qMax(m_SelectionStart, m_SelectionEnd)),
+				      static_cast<unsigned int>(dataSize()));
+
+	// Copy in chunks, so a big selection from a random I/O device goes
+	// through the block cache a screenful at a time, not byte by byte.
+	static const unsigned int chunkSize = 64 * 1024;
+	for (unsigned int i = start; i < end; ) {
+		const unsigned int n = qMin(chunkSize, end - i);
+		fetchData(i, n);
+		// The fetch must not fail, or we'll try to access a negative
+		// index, overflow, and read unallocated memory.
+		Q_ASSERT(i >= bufOffset());
+		const unsigned int bufEnd = bufOffset() + m_cache.window().size();
+		if (i < bufOffset() || i >= bufEnd)
+			break;
+		const unsigned int avail = qMin(n, bufEnd - i);
+		ret.append(m_cache.window().constData() + (i - bufOffset()), avail);
+		i += avail;
 	}
 	
 	return ret;
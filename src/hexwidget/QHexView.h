@@ -25,6 +25,8 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
 #ifndef QHEXVIEW_20060506_H_
 #define QHEXVIEW_20060506_H_
 
+#include "DeviceCache.h"
+
 #include <QAbstractScrollArea>
 #include <QByteArray>
 #include <QMap>
@@ -103,14 +105,19 @@ private:
 	QIODevice * m_io;		// The data stream. We do not own this object
 					// and must never destroy it.
 					
-	size_t m_dataSize;		// Size of data source being operated on.
+	mutable size_t m_dataSize;	// Size of data source being operated on. If
+					// m_sizeKnown is false, this is just how much
+					// we've read so far.
 
-	mutable QByteArray m_buf;	// The current data segment being operated on.
-					// For a random I/O device it's just the visible
-					// page; for a sequential I/O device it's everything
-					// up to the current point.
-	
-	mutable unsigned int m_bufOffset;	// Offset in bytes of the buffer into the data.
+	mutable bool m_sizeKnown;	// False until we've read to the end of a
+					// sequential device of unknown size.
+
+	// Reads and keeps the data from m_io. Its window is the current data
+	// segment being operated on.
+	mutable DeviceCache m_cache;
+
+	// Offset in bytes of the cache's window into the data
+	unsigned int bufOffset() const { return static_cast<unsigned int>(m_cache.windowOffset()); }
 
 public:
 	/**
@@ -127,15 +134,29 @@ public:
 	 * If the target device is not seekable, the hex editor widget may
 	 * use quite a bit of memory or attempt to use a temp file to store
 	 * the data.
+	 *
+	 * A sequential device whose size can't be known in advance may be
+	 * passed with a size of unknownSize. The data is then read as the user
+	 * scrolls towards it, and the scroll range grows to match until the
+	 * end of the device is reached.
 	 */
 	void setData(QIODevice* d, size_t s);
 
+	static const size_t unknownSize = ~static_cast<size_t>(0);
+
 	/**
 	 * Release all references to the current data being accessed and reset the
 	 * viewer to empty.
 	 */
 	inline void clear() { setData(0,0); }
 
+	/**
+	 * Set the amount of memory, in bytes, that may be used to cache data
+	 * read from a random I/O device. The default is 4MB.
+	 */
+	void setCacheSize(unsigned int bytes);
+	unsigned int cacheSize() const;
+
 	void setAddressOffset(address_t offset);
 	void scrollTo(unsigned int offset);
 	
@@ -0,0 +1,170 @@
+#include "incrementalwriter.h"
+#include "perftrace.h"
+#include "podofoutil.h"
+
+#include <QFile>
+
+#include <algorithm>
+#include <utility>
+
+using namespace PoDoFo;
+
+namespace {
+
+// How much of the end of the file to look through for "startxref"
+static const int tailSize = 1024;
+
+bool writeBytes( QFile & file, const QByteArray & bytes )
+{
+    return file.write( bytes ) == bytes.size();
+}
+
+};
+
+IncrementalWriter::IncrementalWriter( const PdfMemDocument* doc, const QString & filename )
+    : m_pDoc( doc ),
+      m_filename( filename ),
+      m_lastXRefOffset( -1 ),
+      m_errorString()
+{
+}
+
+bool IncrementalWriter::CanUpdate()
+{
+    if (m_pDoc->GetEncrypted())
+    {
+        m_errorString = tr("The document is encrypted");
+        return false;
+    }
+    // A hybrid file keeps some objects in object streams that only its
+    // cross-reference stream knows about
+    if (m_pDoc->GetTrailer()->GetDictionary().HasKey( PdfName("XRefStm") ))
+    {
+        m_errorString = tr("The file uses a cross-reference stream");
+        return false;
+    }
+    return m_lastXRefOffset >= 0 || ReadLastXRef();
+}
+
+bool IncrementalWriter::ReadLastXRef()
+{
+    QFile file( m_filename );
+    if (!file.open( QIODevice::ReadOnly ))
+    {
+        m_errorString = file.errorString();
+        return false;
+    }
+
+    // "startxref", the offset and "%%EOF" end the file, but allow for some
+    // junk after them
+    const qint64 size = file.size();
+    if (!file.seek( qMax<qint64>( 0, size - tailSize ) ))
+    {
+        m_errorString = file.errorString();
+        return false;
+    }
+    const QByteArray tail = file.read( tailSize );
+    const int keyword = tail.lastIndexOf( "startxref" );
+    if (keyword < 0)
+    {
+        m_errorString = tr("There's no \"startxref\" at the end of the file");
+        return false;
+    }
+    const QByteArray rest = tail.mid( keyword + static_cast<int>(sizeof("startxref")) - 1 ).simplified();
+    const int space = rest.indexOf( ' ' );
+    bool ok = false;
+    const qint64 offset = (space < 0 ? rest : rest.left( space )).toLongLong( &ok );
+    if (!ok || offset < 0 || offset >= size)
+    {
+        m_errorString = tr("The file's \"startxref\" offset is broken");
+        return false;
+    }
+
+    // Anything other than a table is taken for a cross-reference stream,
+    // or a damaged file we'd better write out afresh
+    if (!file.seek( offset ) || !file.read( 16 ).trimmed().startsWith( "xref" ))
+    {
+        m_errorString = tr("The file uses a cross-reference stream");
+        return false;
+    }
+
+    m_lastXRefOffset = offset;
+    return true;
+}
+
+bool IncrementalWriter::Write( const std::vector<PdfReference> & changed )
+{
+    if (!CanUpdate())
+        return false;
+    if (changed.empty())
+        return true;
+
+    QFile file( m_filename );
+    if (!file.open( QIODevice::ReadWrite ))
+    {
+        m_errorString = file.errorString();
+        return false;
+    }
+
+    PerfTrace::Scope scope( "save-incremental" );
+    const qint64 originalSize = file.size();
+    bool ok = false;
+    try {
+        ok = file.seek( originalSize ) && WriteUpdate( file, changed ) && file.flush();
+    } catch( PdfError & ) {
+        file.resize( originalSize );
+        throw;
+    }
+    if (!ok)
+    {
+        m_errorString = file.errorString();
+        file.resize( originalSize );
+        return false;
+    }
+    return true;
+}
+
+bool IncrementalWriter::WriteUpdate( QFile & file, const std::vector<PdfReference> & changed )
+{
+    std::vector<PdfReference> refs( changed );
+    std::sort( refs.begin(), refs.end() );
+    refs.erase( std::unique( refs.begin(), refs.end() ), refs.end() );
+
+    // The file may not end with a newline
+    if (!writeBytes( file, "\n" ))
+        return false;
+
+    // The objects, noting where each one went
+    const EPdfWriteMode mode = m_pDoc->GetWriteMode();
+    XRefEntries written;
+    written.reserve( refs.size() );
+    for (std::vector<PdfReference>::const_iterator it = refs.begin(); it != refs.end(); ++it)
+    {
+        const PdfObject * const obj = m_pDoc->GetObjects().GetObject( *it );
+        if (!obj)
+            continue;
+        written.push_back( std::make_pair( *it, file.pos() ) );
+        if (!writePdfObject( file, *obj, mode ))
+            return false;
+    }
+    if (written.empty())
+        return true;
+
+    // The trailer, which is the document's own pointed back at the last one
+    PdfObject trailer( *m_pDoc->GetTrailer() );
+    PdfDictionary & dict = trailer.GetDictionary();
+    pdf_int64 size = static_cast<pdf_int64>(written.back().first.ObjectNumber()) + 1;
+    const PdfObject * const oldSize = dict.GetKey( PdfName("Size") );
+    if (oldSize && oldSize->IsNumber())
+        size = std::max( size, oldSize->GetNumber() );
+    dict.AddKey( PdfName("Size"), PdfVariant( size ) );
+    dict.AddKey( PdfName("Prev"), PdfVariant( static_cast<pdf_int64>(m_lastXRefOffset) ) );
+
+    const qint64 xrefOffset = file.pos();
+    if (!writeXRefAndTrailer( file, written, trailer, mode, false ))
+        return false;
+
+    // The next update goes on the end of this one
+    m_lastXRefOffset = xrefOffset;
+    return true;
+}
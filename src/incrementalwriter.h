@@ -0,0 +1,64 @@
+#ifndef PODOFOBROWSER_INCREMENTALWRITER_H
+#define PODOFOBROWSER_INCREMENTALWRITER_H
+
+#include <QCoreApplication>
+#include <QString>
+
+#include <vector>
+
+#include <podofo/podofo.h>
+
+class QFile;
+
+/**
+ * Saves changes to a document by appending them to the file it was read
+ * from as a PDF incremental update: the changed objects, a cross-reference
+ * section for just those objects, and a trailer pointing back at the
+ * previous one. Nothing already in the file is rewritten, so saving a small
+ * change to a huge file is quick, and the original content is never at risk.
+ *
+ * Not every file can be updated this way; see CanUpdate(). Those have to be
+ * written out in full instead.
+ *
+ * The file must not have been changed since the document was read from it
+ * (or last updated by an IncrementalWriter).
+ */
+class IncrementalWriter
+{
+    Q_DECLARE_TR_FUNCTIONS(IncrementalWriter)
+
+public:
+    IncrementalWriter(const PoDoFo::PdfMemDocument* doc, const QString & filename);
+
+    // Check that the file can take an incremental update. It mustn't be
+    // encrypted, since the update would have to be encrypted too, and it
+    // must end in a classic cross-reference table: an update to a file with
+    // cross-reference streams would have to use one as well. If not,
+    // ErrorString() says why. The caller must hold the document lock.
+    bool CanUpdate();
+
+    // Append the current state of the objects `changed'. Objects that no
+    // longer exist are skipped. On failure, returns false with ErrorString()
+    // set, having cut the file back to what it was. Throws PdfError, likewise
+    // after cutting the file back, if an object can't be written. The
+    // caller must hold the document lock.
+    bool Write(const std::vector<PoDoFo::PdfReference> & changed);
+
+    const QString & ErrorString() const { return m_errorString; }
+
+private:
+    // Find where the last cross-reference section in the file starts, and
+    // check it's a table
+    bool ReadLastXRef();
+
+    // Write the update at the end of `file'. Returns false on I/O errors.
+    bool WriteUpdate(QFile & file, const std::vector<PoDoFo::PdfReference> & changed);
+
+    const PoDoFo::PdfMemDocument* m_pDoc;
+    const QString m_filename;
+    // Offset of the last cross-reference section, or -1 if not known yet
+    qint64 m_lastXRefOffset;
+    QString m_errorString;
+};
+
+#endif
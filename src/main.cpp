@@ -19,19 +19,106 @@
  ***************************************************************************/
 
 #include <QApplication>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QStringList>
+#include <QTextStream>
 
+#include "batchprocessor.h"
+#include "perftrace.h"
 #include "podofobrowser.h"
 #include <qapplication.h>
 
+#include <cstdio>
+#include <cstring>
+
+namespace {
+
+int batchUsage()
+{
+    QTextStream err( stderr );
+    err << "Usage: podofobrowser --batch [--search QUERY] [--export DIR] [--tree DEPTH] [--jobs N] [FILE ...]\n"
+        << "Writes a line of JSON describing each FILE to standard output. With no\n"
+        << "FILEs, their names are read from standard input, one per line.\n";
+    return 2;
+}
+
+// podofobrowser --batch: inspect files with no GUI at all
+int batchMain( int argc, char ** argv )
+{
+    QCoreApplication a( argc, argv );
+
+    BatchProcessor::Options options;
+    QStringList files;
+    const QStringList args = a.arguments();
+    for (int i = 2; i < args.size(); ++i)
+    {
+        const QString & arg = args[i];
+        const bool hasValue = i + 1 < args.size();
+        bool ok = true;
+        if (arg == QString::fromUtf8("--search") && hasValue)
+            options.searchQuery = args[++i];
+        else if (arg == QString::fromUtf8("--export") && hasValue)
+            options.exportDir = args[++i];
+        else if (arg == QString::fromUtf8("--tree") && hasValue)
+            options.treeDepth = args[++i].toInt( &ok );
+        else if (arg == QString::fromUtf8("--jobs") && hasValue)
+            options.threadCount = args[++i].toInt( &ok );
+        else if (arg.startsWith( QString::fromUtf8("--") ))
+            ok = false;
+        else
+            files << arg;
+        if (!ok)
+            return batchUsage();
+    }
+
+    if (!options.exportDir.isEmpty() && !QDir().mkpath( options.exportDir ))
+    {
+        QTextStream( stderr ) << "Cannot create the export directory\n";
+        return 2;
+    }
+
+    if (files.isEmpty())
+    {
+        QTextStream in( stdin );
+        for (QString line = in.readLine(); !line.isNull(); line = in.readLine())
+            if (!line.isEmpty())
+                files << line;
+    }
+
+    QFile out;
+    if (!out.open( stdout, QIODevice::WriteOnly ))
+        return 2;
+    BatchProcessor processor( options, out );
+    return processor.Run( files ) ? 1 : 0;
+}
+
+};
+
 int main( int argc, char ** argv ) {
+    if( argc >= 2 && !strcmp( argv[1], "--batch" ) )
+        return batchMain( argc, argv );
+
     QApplication a( argc, argv );
     Q_INIT_RESOURCE(podofobrowserrsrc);
 
     a.connect( &a, SIGNAL(lastWindowClosed()), &a, SLOT(quit()) );
 
-    if( qApp->argc() >= 2 )
+    // podofobrowser --trace TRACEFILE [FILE ...]: time what's slow from the
+    // start, and write a trace of it to TRACEFILE on the way out
+    int firstFile = 1;
+    QString traceFile;
+    if( qApp->argc() >= 3 && !strcmp( qApp->argv()[1], "--trace" ) )
     {
-        for( int i=1; i<qApp->argc(); i++ )
+        traceFile = QString::fromLocal8Bit( qApp->argv()[2] );
+        firstFile = 3;
+        PerfTrace::SetEnabled( true );
+    }
+
+    if( qApp->argc() > firstFile )
+    {
+        for( int i=firstFile; i<qApp->argc(); i++ )
             new PoDoFoBrowser( QString::fromLocal8Bit( qApp->argv()[i] ) );
     }
     else
@@ -40,5 +127,10 @@ int main( int argc, char ** argv ) {
         new PoDoFoBrowser();
     }
 
-    return a.exec();
+    const int status = a.exec();
+
+    if( !traceFile.isEmpty() && !PerfTrace::WriteChromeTrace( traceFile ) )
+        QTextStream( stderr ) << "Cannot write the trace file\n";
+
+    return status;
 }
@@ -0,0 +1,83 @@
+#include "memorybudget.h"
+#include "pdfobjectmodel.h"
+
+#include <QTreeView>
+
+namespace {
+
+// Collapsed rows remembered at most; the oldest are forgotten first
+static const size_t maxCollapsed = 4096;
+
+};
+
+MemoryBudget::MemoryBudget(QTreeView* view, QObject* parent)
+    : QObject(parent),
+      m_pView(view),
+      m_budget(0),
+      m_collapsed()
+{
+    connect( m_pView, SIGNAL(collapsed(const QModelIndex &)), this, SLOT(rowCollapsed(const QModelIndex &)) );
+    connect( m_pView, SIGNAL(expanded(const QModelIndex &)), this, SLOT(rowExpanded()) );
+}
+
+void MemoryBudget::SetBudget(qint64 bytes)
+{
+    m_budget = bytes;
+    Enforce();
+}
+
+qint64 MemoryBudget::GetUsage() const
+{
+    const PdfObjectModel* model = static_cast<const PdfObjectModel*>(m_pView->model());
+    return model ? model->EstimateMemoryUse() : 0;
+}
+
+void MemoryBudget::Reset()
+{
+    m_collapsed.clear();
+}
+
+void MemoryBudget::rowCollapsed(const QModelIndex & index)
+{
+    m_collapsed.push_back( QPersistentModelIndex( index ) );
+    if (m_collapsed.size() > maxCollapsed)
+        m_collapsed.pop_front();
+    Enforce();
+}
+
+void MemoryBudget::rowExpanded()
+{
+    // Expanding is what makes rows, so it's what can take us over budget
+    Enforce();
+}
+
+bool MemoryBudget::HoldsCurrent(const QModelIndex & index) const
+{
+    for (QModelIndex current = m_pView->currentIndex(); current.isValid(); current = current.parent())
+        if (current.internalPointer() == index.internalPointer())
+            return true;
+    return false;
+}
+
+int MemoryBudget::Enforce()
+{
+    PdfObjectModel* model = static_cast<PdfObjectModel*>(m_pView->model());
+    if (!model || m_budget <= 0 || GetUsage() <= m_budget)
+        return 0;
+
+    // Drop well below the budget, so we don't have to do it all again as
+    // soon as another row is expanded
+    const qint64 target = m_budget / 4 * 3;
+    int dropped = 0;
+    while (!m_collapsed.empty() && model->EstimateMemoryUse() > target)
+    {
+        const QModelIndex index = m_collapsed.front();
+        m_collapsed.pop_front();
+        // Gone with a subtree dropped before it, or in use again
+        if (!index.isValid() || m_pView->isExpanded( index ) || HoldsCurrent( index ))
+            continue;
+        model->DropChildren( index );
+        ++dropped;
+    }
+    return dropped;
+}
@@ -0,0 +1,64 @@
+#ifndef PODOFOBROWSER_MEMORYBUDGET_H
+#define PODOFOBROWSER_MEMORYBUDGET_H
+
+#include <QObject>
+#include <QPersistentModelIndex>
+
+#include <deque>
+
+class QModelIndex;
+class QTreeView;
+
+/**
+ * Keeps the rows a PdfObjectModel has made for a tree view within a memory
+ * budget. Every row ever expanded would otherwise stay in memory, so
+ * browsing a huge document for long enough would use more and more.
+ *
+ * The budget watches rows being collapsed. When the model takes more than
+ * the budget, the rows under the subtrees collapsed longest ago are dropped
+ * (see PdfObjectModel::DropChildren()) until it takes no more than three
+ * quarters of it. Subtrees that have been expanded again, or hold the current
+ * row, are left alone. Dropped rows come back as they were when next
+ * expanded.
+ *
+ * The view may be given a new model at any time; call Reset() when it is.
+ */
+class MemoryBudget : public QObject
+{
+    Q_OBJECT
+
+public:
+    MemoryBudget(QTreeView* view, QObject* parent = 0);
+
+    // The most memory, in bytes, the model's rows should take
+    void SetBudget(qint64 bytes);
+    qint64 GetBudget() const { return m_budget; }
+
+    // About how much memory, in bytes, the model's rows take now
+    qint64 GetUsage() const;
+
+    // Forget the collapsed rows, which belong to a model the view no longer
+    // shows
+    void Reset();
+
+    // Drop rows if the model is over budget. Returns the number of subtrees
+    // dropped.
+    int Enforce();
+
+private slots:
+    void rowCollapsed(const QModelIndex & index);
+    void rowExpanded();
+
+private:
+    // Whether the current row is `index' or somewhere under it
+    bool HoldsCurrent(const QModelIndex & index) const;
+
+    QTreeView* m_pView;
+    qint64 m_budget;
+
+    // Rows collapsed, longest ago first. A row collapsed more than once is
+    // in here more than once.
+    std::deque<QPersistentModelIndex> m_collapsed;
+};
+
+#endif
@@ -1,6 +1,11 @@
 #include "pdfobjectmodel.h"
 #include "podofoutil.h"
+#include "backgroundloader.h"
+#include "perftrace.h"
+#include "referenceindex.h"
 
+#include <QFont>
+#include <QHash>
 #include <QString>
 #include <QPixmap>
 #include <QVariant>
@@ -10,6 +15,7 @@
 using std::pair;
 #include <algorithm>
 #include <vector>
+#include <new>
 #include <cassert>
 #include <exception>
 #include <stdexcept>
@@ -20,8 +26,144 @@ namespace {
 
 static PdfEncrypt* pEncrypt = 0; //XXX
 
+// How many top-level rows past the one being asked for we hint to the
+// background loader. A few screenfuls is plenty.
+static const int rootHintLookahead = 128;
+
+// Rough heap use of a node's display strings and icon, on top of the node
+// itself, for EstimateMemoryUse()
+static const int nodeDisplayCacheSize = 96;
+
 class PdfObjectModelNode;
 
+// A trivial slab allocator for objects of type T. Objects are carved out of
+// large blocks, and freed slots are kept on their block's free list for
+// reuse, so building and tearing down big trees doesn't hammer the heap. A
+// block is given back once every object in it has been freed, except that
+// one empty block is kept in reserve so that a tree shrinking and growing
+// across a block boundary doesn't allocate and free it over and over. Every
+// object allocated from the pool must be destroyed before the pool is.
+//
+// Allocate() and Free() only deal in raw storage; the caller constructs and
+// destroys the object in place.
+template<class T>
+class SlabPool
+{
+public:
+    SlabPool()
+        : m_slabs(), m_available(), m_pSpare(0)
+    {
+    }
+
+    ~SlabPool()
+    {
+        typename SlabMap::const_iterator itEnd = m_slabs.end();
+        for (typename SlabMap::const_iterator it = m_slabs.begin(); it != itEnd; ++it)
+            DeleteSlab(it->second);
+    }
+
+    void* Allocate()
+    {
+        if (m_available.empty())
+            NewSlab();
+        Slab * const slab = *m_available.begin();
+        FreeSlot * const slot = slab->pFree;
+        slab->pFree = slot->next;
+        ++slab->live;
+        if (!slab->pFree)
+            m_available.erase(slab);
+        if (slab == m_pSpare)
+            m_pSpare = 0;
+        return slot;
+    }
+
+    void Free(void* p)
+    {
+        // The slab holding `p' is the last one starting at or before it
+        typename SlabMap::iterator it = m_slabs.upper_bound(static_cast<char*>(p));
+        assert(it != m_slabs.begin());
+        --it;
+        Slab * const slab = it->second;
+
+        FreeSlot * const slot = static_cast<FreeSlot*>(p);
+        if (!slab->pFree)
+            m_available.insert(slab);
+        slot->next = slab->pFree;
+        slab->pFree = slot;
+        if (--slab->live)
+            return;
+
+        if (!m_pSpare)
+        {
+            m_pSpare = slab;
+            return;
+        }
+        m_available.erase(slab);
+        m_slabs.erase(it);
+        DeleteSlab(slab);
+    }
+
+private:
+    // Not copyable
+    SlabPool(const SlabPool&);
+    SlabPool& operator=(const SlabPool&);
+
+    struct FreeSlot { FreeSlot * next; };
+
+    struct Slab
+    {
+        char * storage;
+        // Slots not in use, and how many are
+        FreeSlot * pFree;
+        size_t live;
+    };
+
+    // Every slab by the start of its storage, and those with free slots
+    typedef std::map<char*, Slab*> SlabMap;
+    typedef std::set<Slab*> SlabSet;
+
+    enum { slotsPerSlab = 1024 };
+
+    // Bytes per slot. A function rather than a constant so the pool can be
+    // declared while T is still an incomplete type.
+    static size_t SlotSize()
+    {
+        const size_t align = qMax(sizeof(double), sizeof(void*));
+        const size_t size = qMax(sizeof(T), sizeof(FreeSlot));
+        return (size + align - 1) / align * align;
+    }
+
+    void NewSlab()
+    {
+        // ::operator new returns storage suitably aligned for anything,
+        // and SlotSize() keeps every later slot aligned too.
+        Slab * const slab = new Slab;
+        slab->storage = static_cast<char*>(::operator new(SlotSize() * slotsPerSlab));
+        slab->pFree = 0;
+        slab->live = 0;
+        // Threaded last to first, so slots are handed out in order
+        for (size_t i = slotsPerSlab; i-- > 0; )
+        {
+            FreeSlot * const slot = reinterpret_cast<FreeSlot*>(slab->storage + SlotSize() * i);
+            slot->next = slab->pFree;
+            slab->pFree = slot;
+        }
+        m_slabs.insert(std::make_pair(slab->storage, slab));
+        m_available.insert(slab);
+    }
+
+    static void DeleteSlab(Slab * slab)
+    {
+        ::operator delete(slab->storage);
+        delete slab;
+    }
+
+    SlabMap m_slabs;
+    SlabSet m_available;
+    // An empty slab kept rather than given back, or null
+    Slab * m_pSpare;
+};
+
 // PdfObjectModelTree keeps track of the nodes associated with a particular
 // document and contains some tree-wide shared data. It also knows the root 
 // of the tree of nodes for the model.
@@ -43,15 +185,42 @@ public:
     PdfObjectModelNode* GetRoot(int n) const { return m_roots[n]; }
     const std::vector<PdfObjectModelNode*> & GetRoots() const { return m_roots; }
 
+    // Return the row of the root node tracking the indirect object `ref', or
+    // -1 if there's no such root.
+    int FindRoot(const PdfReference & ref) const;
+
+    // Add a root node for the indirect object `object' after the existing
+    // roots, returning its row. The caller must tell the model's users.
+    int AppendRoot(PdfObject* object);
+
     PdfMemDocument* GetDocument() const { return m_pDoc; }
 
     bool FollowReferences() const { return m_bFollowReferences; }
 
+    // Number of nodes in the tree
+    int GetNodeCount() const { return m_nodeCount; }
+
+    // Remember that `node' was drawn as a dangling reference to `target', so
+    // it can be redrawn if the target turns up
+    void NoteDangling(PdfObjectModelNode* node, const PdfReference & target);
+    // The live nodes noted as dangling references to `target', which are
+    // then forgotten
+    std::vector<PdfObjectModelNode*> TakeDangling(const PdfReference & target);
+
 private:
     friend class PdfObjectModelNode;
     // XXX TODO Force full model creation for these calls to produce correct results
-    int CountAliases(const PdfObject * object) const { return m_nodeAliases.count(object); }
-    std::vector<PdfObjectModelNode*> GetAliases(const PdfObject * object) const;
+    int CountAliases(const PdfObject * object) const { return m_nodeAliases.value(object).count; }
+    PdfObjectModelNode* GetFirstAlias(const PdfObject * object) const { return m_nodeAliases.value(object).first; }
+
+    // All nodes are created and destroyed through these, never with new and
+    // delete, so that they come from the tree's pool.
+    PdfObjectModelNode* CreateNode(PdfObject* object,
+                                   PdfObjectModelNode* parent,
+                                   const PdfName & parentKey,
+                                   int parentType,
+                                   int row);
+    void DestroyNode(PdfObjectModelNode* node);
 
     // Called from each node's ctor
     void NodeCreated(PdfObjectModelNode* node);
@@ -60,10 +229,44 @@ private:
 
     PdfMemDocument* m_pDoc;
     const bool m_bFollowReferences;
-    typedef std::multimap<const PdfObject*,PdfObjectModelNode*> NodeAliasMap;
+
+    SlabPool<PdfObjectModelNode> m_nodePool;
+    int m_nodeCount;
+
+    // Maps each object to the chain of nodes tracking it, most recently
+    // created first. The chain is a doubly linked list threaded through the
+    // nodes themselves (m_pNextAlias / m_pPrevAlias), so walking it never
+    // allocates and a node can unlink itself in constant time however many
+    // aliases a shared font or resource dictionary has. Nearly every object
+    // has exactly one node, so this is one small hash entry per object.
+    struct AliasChain
+    {
+        AliasChain() : first(0), count(0) { }
+        PdfObjectModelNode* first;
+        int count;
+    };
+    typedef QHash<const PdfObject*,AliasChain> NodeAliasMap;
     NodeAliasMap m_nodeAliases;
+
+    // Set while the whole tree is being torn down, so nodes don't bother
+    // unlinking themselves from the alias map one by one.
+    bool m_bDestroying;
+
+    // See NoteDangling(): the nodes by referenceKey() of their target, and
+    // the target of each node so it can be forgotten when it's deleted
+    QMultiHash<quint64,PdfObjectModelNode*> m_danglingByTarget;
+    QHash<PdfObjectModelNode*,quint64> m_danglingTargets;
+
     std::vector<PdfObjectModelNode*> m_roots;
 
+    // Maps referenceKey() of each root's object to its row in m_roots. Roots
+    // never move and are only added by AppendRoot(), so the index can't go
+    // stale; FindRoot() still double checks what it finds.
+    typedef QHash<quint64,int> RootIndex;
+    mutable RootIndex m_rootIndex;
+
+    // (Re)build m_rootIndex from scratch
+    void IndexRoots() const;
 };
 
 // PdfObjectModelNode wraps a PdfObject item. It keeps track of the
@@ -93,7 +296,8 @@ public:
                        PdfObject* object,
                        PdfObjectModelNode* parent,
                        const PdfName & parentKey,
-                       ParentageType parentType);
+                       ParentageType parentType,
+                       int row);
 
     ~PdfObjectModelNode();
 
@@ -104,8 +308,12 @@ public:
     // Return the appropriate data for the node given a particular role
     QVariant GetData(int role) const;
 
-    // Return the number of children of this node
-    int CountChildren() const { if (IsPretendEmpty()) return 0; EnsureChildrenLoaded(); return m_children.size(); }
+    // Return the number of children of this node. Counting them doesn't
+    // create their nodes, so collapsed rows cost nothing until expanded.
+    int CountChildren() const { if (IsPretendEmpty()) return 0; return m_bChildrenLoaded ? m_children.size() : CountObjectChildren(); }
+
+    // Whether the child nodes exist, rather than just being counted
+    bool HasChildNodes() const { return m_bChildrenLoaded && !m_children.empty(); }
 
     // Get the n'th child node of this object, or 0 if no such child
     // exists.
@@ -117,21 +325,37 @@ public:
     PdfObjectModelNode * GetParent() const { return m_pParent; }
 
     // Return the index of this object inside its parent's
-    // child list.
-    int GetIndexInParent() const;
+    // child list (or in the tree's root list for root nodes).
+    int GetIndexInParent() const { return m_row; }
 
     // Return the key in the parent object that has this object
     // or a reference to it as its value. A null value is returned
     // if the parent is an array.
     const PdfName & GetParentKey() const { return m_parentKey; }
 
+    // Return true iff the node's object is an indirect object, rather than
+    // something contained in one
+    bool IsIndirectObject() const { return m_parentType != PT_Contained; }
+
+    // Return the indirect object that is, or contains, this node's object
+    const PdfObject * GetOwningObject() const
+    {
+        const PdfObjectModelNode * node = this;
+        while (!node->IsIndirectObject())
+            node = node->GetParent();
+        return node->GetObject();
+    }
+
     // Return the number of aliases this node has, ie the number of other
     // nodes that track the same PdfObject
     int CountAliases() { return m_pTree->CountAliases(m_pObject); }
 
-    // Return a list of nodes that track the same object as this node. The alias
-    // list includes this node.
-    std::vector<PdfObjectModelNode*> GetAliases() const { return m_pTree->GetAliases(m_pObject); }
+    // Iterate over the nodes that track the same object as this node, in no
+    // particular order. The alias list includes this node. Deleting a node
+    // removes it from the list, so it's safe to invalidate the children of
+    // the current alias and then move on to the next one.
+    PdfObjectModelNode* GetFirstAlias() const { return m_pTree->GetFirstAlias(m_pObject); }
+    PdfObjectModelNode* GetNextAlias() const { return m_pNextAlias; }
 
     // Forget about any children and re-scan for children next time anyone
     // wants to know about them. Call this method before doing something
@@ -159,6 +383,14 @@ public:
     // Are we pretending to have no children?
     bool IsPretendEmpty() const { return m_bPretendEmpty; }
 
+    // Display strings and icon for the view, worked out on first use and then
+    // remembered until InvalidateDisplay() is called. The model must call
+    // that whenever the object, or anything shown in its summary, changes.
+    const QString & GetLabel() const;
+    const QString & GetValueSummary() const;
+    const QPixmap & GetIcon() const;
+    void InvalidateDisplay() { m_bLabelCached = m_bValueCached = m_bIconCached = false; }
+
     // Return true iff the object is a reference to an existing indirect object
     bool IsValidReference() const { return m_pObject->IsReference() && m_pTree->GetDocument()->GetObjects().GetObject(m_pObject->GetReference()); }
 
@@ -179,6 +411,7 @@ public:
     bool CanDeleteChild(int row) const;
 
 private:
+    friend class PdfObjectModelTree;
 
     // Make sure the child list is populated.
     inline void EnsureChildrenLoaded() const { if (!m_bChildrenLoaded) { const_cast<PdfObjectModelNode*>(this)->PopulateChildren(); } }
@@ -186,10 +419,13 @@ private:
     // Create nodes to fill the child list. Must NEVER be called except via EnsureChildrenLoaded().
     void PopulateChildren();
 
+    // The number of children PopulateChildren() would create
+    int CountObjectChildren() const;
+
     // Add a child node for the passed object
     void AddNode(PdfObject* object, ParentageType pt, const PdfName & parentKey = PdfName::KeyNull )
     {
-        m_children.push_back( new PdfObjectModelNode(m_pTree, object, this, parentKey, pt ) );
+        m_children.push_back( m_pTree->CreateNode(object, this, parentKey, pt, m_children.size()) );
     }
 
     // Are we pretending to be empty?
@@ -199,6 +435,11 @@ private:
     // True iff this object has a populated list of children.
     bool m_bChildrenLoaded;
 
+    // Which of the display caches below are valid
+    mutable bool m_bLabelCached;
+    mutable bool m_bValueCached;
+    mutable bool m_bIconCached;
+
     // Tree object for this node
     PdfObjectModelTree * m_pTree;
 
@@ -207,6 +448,11 @@ private:
 
     ParentageType m_parentType;
 
+    // Neighbours in the chain of nodes tracking the same object, see
+    // PdfObjectModelTree::m_nodeAliases
+    PdfObjectModelNode * m_pNextAlias;
+    PdfObjectModelNode * m_pPrevAlias;
+
     // Parent node. The meaning of this pointer varies depending on the parentage
     // relationship:
     //
@@ -220,95 +466,211 @@ private:
     // and referenced objects.
     PdfName m_parentKey;
 
+    // Our position in the parent's child list, or in the root list. Child
+    // lists are only ever appended to; anything that adds or removes a
+    // child in the middle deletes the whole child list first (see
+    // InvalidateChildren()), so the rows are renumbered when it's rebuilt.
+    int m_row;
+
     // A list of pointers to all children of this node
     std::vector<PdfObjectModelNode*> m_children;
 
-};
-
-class PdfObjectsComperator { 
-public:
-    PdfObjectsComperator( const PdfReference & ref )
-        : m_ref( ref )
-        {
-        }
-    
-    bool operator()(const PdfObjectModelNode* p1) const { 
-        return p1 ? (p1->GetObject()->Reference() == m_ref ) : false;
-    }
-
-private:
-    const PdfReference m_ref;
+    // Display caches, see GetLabel() etc.
+    mutable QString m_label;
+    mutable QString m_valueSummary;
+    mutable QPixmap m_icon;
 };
 
 PdfObjectModelTree::PdfObjectModelTree(PdfMemDocument * doc, const std::vector<PdfObject*>& roots, bool followReferences)
     : m_pDoc(doc),
       m_bFollowReferences(followReferences),
+      m_nodePool(),
+      m_nodeCount(0),
       m_nodeAliases(),
-      m_roots()
+      m_bDestroying(false),
+      m_danglingByTarget(),
+      m_danglingTargets(),
+      m_roots(),
+      m_rootIndex()
 {
+    m_roots.reserve(roots.size());
+    m_nodeAliases.reserve(roots.size());
     std::vector<PdfObject*>::const_iterator itEnd = roots.end();
     for (std::vector<PdfObject*>::const_iterator it = roots.begin();
          it != itEnd;
          ++it)
     {
         assert(*it);
-        m_roots.push_back( new PdfObjectModelNode(this, *it, NULL, PdfName::KeyNull, PdfObjectModelNode::PT_Root) );
+        m_roots.push_back( CreateNode(*it, NULL, PdfName::KeyNull, PdfObjectModelNode::PT_Root, m_roots.size()) );
     }
+    IndexRoots();
+}
+
+void PdfObjectModelTree::IndexRoots() const
+{
+    m_rootIndex.clear();
+    m_rootIndex.reserve(m_roots.size());
+    for (int i = 0; i < static_cast<int>(m_roots.size()); ++i)
+    {
+        // If an object somehow appears twice, the first root wins, as it
+        // did when we used to search the root list.
+        const quint64 key = referenceKey(m_roots[i]->GetObject()->Reference());
+        if (!m_rootIndex.contains(key))
+            m_rootIndex.insert(key, i);
+    }
+}
+
+int PdfObjectModelTree::FindRoot(const PdfReference & ref) const
+{
+    RootIndex::const_iterator it = m_rootIndex.find(referenceKey(ref));
+    if (it == m_rootIndex.end())
+        return -1;
+
+    const int row = it.value();
+    if (row < static_cast<int>(m_roots.size()) && m_roots[row]->GetObject()->Reference() == ref)
+        return row;
+
+    // Shouldn't happen, but a wrong answer is worse than a slow one.
+    qDebug("Root index out of date, rebuilding");
+    IndexRoots();
+    it = m_rootIndex.find(referenceKey(ref));
+    return it == m_rootIndex.end() ? -1 : it.value();
+}
+
+int PdfObjectModelTree::AppendRoot(PdfObject* object)
+{
+    assert(object && object->Reference().IsIndirect());
+    const int row = m_roots.size();
+    m_roots.push_back( CreateNode(object, NULL, PdfName::KeyNull, PdfObjectModelNode::PT_Root, row) );
+    const quint64 key = referenceKey(object->Reference());
+    if (!m_rootIndex.contains(key))
+        m_rootIndex.insert(key, row);
+    return row;
 }
 
 PdfObjectModelTree::~PdfObjectModelTree()
 {
+    // The node destructors still have to run, but the pool's memory and the
+    // alias map are thrown away wholesale afterwards.
+    m_bDestroying = true;
     std::vector<PdfObjectModelNode*>::const_iterator itEnd = m_roots.end();
     for (std::vector<PdfObjectModelNode*>::const_iterator it = m_roots.begin();
          it != itEnd;
          ++it)
     {
-        delete (*it);
+        DestroyNode(*it);
     }
-    assert(m_nodeAliases.size() == 0);
 }
 
-std::vector<PdfObjectModelNode*> PdfObjectModelTree::GetAliases(const PdfObject* item) const
+PdfObjectModelNode* PdfObjectModelTree::CreateNode(PdfObject* object,
+                                                   PdfObjectModelNode* parent,
+                                                   const PdfName & parentKey,
+                                                   int parentType,
+                                                   int row)
 {
-    std::pair<NodeAliasMap::const_iterator,NodeAliasMap::const_iterator> r = m_nodeAliases.equal_range(item);
-    std::vector<PdfObjectModelNode*> aliases;
-    for ( NodeAliasMap::const_iterator it = r.first;
-          it != r.second;
-          ++it)
-        aliases.push_back( (*it).second );
-    return aliases;
+    void * const mem = m_nodePool.Allocate();
+    try {
+        return new (mem) PdfObjectModelNode(this, object, parent, parentKey,
+                                            static_cast<PdfObjectModelNode::ParentageType>(parentType), row);
+    } catch (...) {
+        m_nodePool.Free(mem);
+        throw;
+    }
+}
+
+void PdfObjectModelTree::DestroyNode(PdfObjectModelNode* node)
+{
+    node->~PdfObjectModelNode();
+    m_nodePool.Free(node);
 }
 
 void PdfObjectModelTree::NodeCreated(PdfObjectModelNode* node)
 {
-    const PdfObject * const obj = node->GetObject();
-    m_nodeAliases.insert( pair<const PdfObject*,PdfObjectModelNode*>(obj, node) );
+    ++m_nodeCount;
+    AliasChain & chain = m_nodeAliases[node->GetObject()];
+    node->m_pNextAlias = chain.first;
+    if (chain.first)
+        chain.first->m_pPrevAlias = node;
+    chain.first = node;
+    ++chain.count;
 }
 
 void PdfObjectModelTree::NodeDeleted(PdfObjectModelNode* node)
 {
-    const PdfObject * const obj = node->GetObject();
-    std::multimap<const PdfObject*, PdfObjectModelNode*>::iterator it = m_nodeAliases.lower_bound(obj);
-    while ( (*it).first == obj && (*it).second != node )
-        ++it;
-    if ( (*it).first != obj || (*it).second != node )
+    --m_nodeCount;
+    if (m_bDestroying)
+        return;
+
+    if (!m_danglingTargets.isEmpty())
+    {
+        QHash<PdfObjectModelNode*,quint64>::iterator dangling = m_danglingTargets.find(node);
+        if (dangling != m_danglingTargets.end())
+        {
+            m_danglingByTarget.remove(dangling.value(), node);
+            m_danglingTargets.erase(dangling);
+        }
+    }
+
+    NodeAliasMap::iterator it = m_nodeAliases.find(node->GetObject());
+    if (it == m_nodeAliases.end())
         throw std::logic_error("Could not find object,node pair for node being deleted in alias map");
-    m_nodeAliases.erase(it);
+
+    AliasChain & chain = it.value();
+    if (node->m_pPrevAlias)
+        node->m_pPrevAlias->m_pNextAlias = node->m_pNextAlias;
+    else if (chain.first == node)
+        chain.first = node->m_pNextAlias;
+    else
+        throw std::logic_error("Could not find object,node pair for node being deleted in alias map");
+    if (node->m_pNextAlias)
+        node->m_pNextAlias->m_pPrevAlias = node->m_pPrevAlias;
+    node->m_pNextAlias = node->m_pPrevAlias = 0;
+
+    if (--chain.count == 0)
+        m_nodeAliases.erase(it);
+}
+
+void PdfObjectModelTree::NoteDangling(PdfObjectModelNode* node, const PdfReference & target)
+{
+    if (m_danglingTargets.contains(node))
+        return;
+    const quint64 key = referenceKey(target);
+    m_danglingTargets.insert(node, key);
+    m_danglingByTarget.insert(key, node);
+}
+
+std::vector<PdfObjectModelNode*> PdfObjectModelTree::TakeDangling(const PdfReference & target)
+{
+    const QList<PdfObjectModelNode*> nodes = m_danglingByTarget.values(referenceKey(target));
+    for (QList<PdfObjectModelNode*>::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+        m_danglingTargets.remove(*it);
+    m_danglingByTarget.remove(referenceKey(target));
+    return std::vector<PdfObjectModelNode*>(nodes.begin(), nodes.end());
 }
 
 PdfObjectModelNode::PdfObjectModelNode(PdfObjectModelTree * tree,
                                        PdfObject* object,
                                        PdfObjectModelNode* parent,
                                        const PdfName & parentKey,
-                                       ParentageType parentType)
+                                       ParentageType parentType,
+                                       int row)
     : m_bPretendEmpty(false),
       m_bChildrenLoaded(false),
+      m_bLabelCached(false),
+      m_bValueCached(false),
+      m_bIconCached(false),
       m_pTree(tree),
       m_pObject(object),
+      m_pNextAlias(0),
+      m_pPrevAlias(0),
       m_pParent(parent),
       m_parentKey(parentKey),
       m_parentType(parentType),
-      m_children()
+      m_row(row),
+      m_children(),
+      m_label(),
+      m_valueSummary(),
+      m_icon()
 {
     if (parentType != PT_Root && !parent)
         throw std::invalid_argument("Non-root node with null parent");
@@ -329,6 +691,10 @@ void PdfObjectModelNode::InsertElement(int row)
     // our child list will have been invalidated by the caller and we don't want
     // to rescan it until after the row is inserted. Trust the caller to check
     // CanInsertElement() .
+    //
+    // Since the child list is rebuilt afterwards, the children after `row'
+    // get their new row numbers then.
+    assert(m_children.size() == 0);
     PdfArray & a = m_pObject->GetArray();
     std::vector<PdfObject>::iterator it = a.begin();
     std::advance(it, row);
@@ -379,14 +745,16 @@ void PdfObjectModelNode::DeleteChild(int row)
 void PdfObjectModelNode::InvalidateChildren()
 {
     // Delete all the children of this object and flag it as needing to
-    // rescan for children next time the child list is accessed.
+    // rescan for children next time the child list is accessed. Their slots
+    // go back to the tree's pool for the next subtree to be expanded.
     const std::vector<PdfObjectModelNode*>::iterator itEnd = m_children.end();
     for (std::vector<PdfObjectModelNode*>::iterator it = m_children.begin();
          it != itEnd;
          ++it)
-        delete *it;
+        m_pTree->DestroyNode(*it);
 
-    m_children.clear();
+    // Swap rather than clear() so a wide child list's storage is released now
+    std::vector<PdfObjectModelNode*>().swap(m_children);
     m_bChildrenLoaded = false;
 }
 
@@ -401,6 +769,7 @@ void PdfObjectModelNode::PopulateChildren()
     // This method must never be called except via EnsureChildrenLoaded()
     // and only by that if the child list is not populated.
     assert(!m_bChildrenLoaded);
+    PerfTrace::Scope scope("populate-children");
 
     if (m_pTree->FollowReferences() && m_pObject->IsReference())
     {
@@ -444,32 +813,21 @@ void PdfObjectModelNode::PopulateChildren()
     m_bChildrenLoaded = true;
 }
 
-int PdfObjectModelNode::GetIndexInParent() const
+int PdfObjectModelNode::CountObjectChildren() const
 {
-    if (!m_pParent)
-    {
-        // We don't have a parent, ie we're in the top level table. This is a vector
-        // of node pointers, so we can just find ourselves in that vector.
-        const std::vector<PdfObjectModelNode*> & roots = static_cast<PdfObjectModelTree*>(m_pTree)->GetRoots();
-        for (int i = 0; i < roots.size(); ++i)
-        {
-            if (roots[i] == this)
-                return i;
-        }
-        throw std::logic_error("Root node not found in root node list");
-    }
-
-    // find our index in the parent's child vector
-    int counter = 0;
-    std::vector<PdfObjectModelNode*>::iterator itEnd ( m_pParent->m_children.end() );
-    for ( std::vector<PdfObjectModelNode*>::iterator it =m_pParent->m_children.begin();
-          it != itEnd;
-          ++it, ++counter )
+    // This must agree with PopulateChildren()
+    if (m_pTree->FollowReferences() && m_pObject->IsReference())
+        return IsValidReference() ? 1 : 0;
+    else if (m_pObject->IsDictionary())
     {
-        if (*it == this)
-            return counter;
+        const int count = m_pObject->GetDictionary().GetKeys().size();
+        if (m_pObject->GetDictionary().HasKey( PdfName::KeyLength ) && m_pObject->HasStream())
+            return count - 1;
+        return count;
     }
-    throw std::logic_error("Node not present in parent's list of children!");
+    else if (m_pObject->IsArray())
+        return m_pObject->GetArray().size();
+    return 0;
 }
 
 bool PdfObjectModelNode::SetRawData(const QByteArray & data)
@@ -486,15 +844,154 @@ bool PdfObjectModelNode::SetRawData(const QByteArray & data)
 void PdfObjectModelNode::SetData(const PdfVariant& variant)
 {
     InvalidateChildren();
+    InvalidateDisplay();
     *(m_pObject) = variant;
 }
 
+// Append "/Key value " to `out' if `dict' has the key `key'
+static void AppendKeySummary(QString & out, const PdfDictionary & dict, const PdfName & key)
+{
+    const PdfObject * const value = dict.GetKey(key);
+    if (value)
+    {
+        std::string s;
+        value->ToString(s);
+        out += QString::fromUtf8("/%1 %2 ")
+            .arg(QString::fromUtf8(key.GetName().c_str()))
+            .arg(QString::fromUtf8(s.c_str()));
+    }
+}
+
+// The pixmaps are shared by every node, and loaded from the resources only
+// once each.
+static const QPixmap & IconForFile(const char * fileName)
+{
+    static QHash<const char*,QPixmap> icons;
+    QHash<const char*,QPixmap>::iterator it = icons.find(fileName);
+    if (it == icons.end())
+        it = icons.insert(fileName, QPixmap(QString::fromUtf8(fileName)));
+    return it.value();
+}
+
+const QString & PdfObjectModelNode::GetLabel() const
+{
+    if (m_bLabelCached)
+        return m_label;
+
+    if (!m_pParent)
+    {
+        const PdfReference & ref ( m_pObject->Reference() );
+        m_label = QString::fromUtf8("%1 %2 obj")
+            .arg(ref.ObjectNumber())
+            .arg(ref.GenerationNumber());
+    }
+    else
+    {
+        const PdfObject * const item = m_pParent->GetObject();
+
+        if (item->IsDictionary())
+        {
+            // Item is a directly contained object in a dictionary, so show dictionary key
+            // We'll interpret the key as utf-8, which it usually should be if it's got any
+            // high-bit stuff in it.
+            m_label = QString::fromUtf8( m_parentKey.GetName().c_str() );
+        }
+        else if (item->IsArray())
+        {
+            // directly contained array element
+            m_label = QString::fromUtf8("<element %1>")
+                .arg(m_row);
+        }
+        else if (item->IsReference())
+        {
+            // item is an indirect object from a followed reference
+            const PdfReference& ref ( item->GetReference() );
+            m_label = QString::fromUtf8("%1 %2 obj").
+                arg(ref.ObjectNumber()).
+                arg(ref.GenerationNumber());
+        }
+        else
+            m_label = QString::fromUtf8("<UNKNOWN>");
+    }
+    m_bLabelCached = true;
+    return m_label;
+}
+
+const QString & PdfObjectModelNode::GetValueSummary() const
+{
+    if (m_bValueCached)
+        return m_valueSummary;
+
+    if (m_pObject->IsDictionary())
+    {
+        static const PdfName KeySubType("SubType");
+        static const PdfName KeyName("Name");
+
+        const PdfDictionary & dict ( m_pObject->GetDictionary() );
+        m_valueSummary = QString::fromUtf8("<< ");
+        AppendKeySummary(m_valueSummary, dict, PdfName::KeyType);
+        AppendKeySummary(m_valueSummary, dict, KeySubType);
+        AppendKeySummary(m_valueSummary, dict, KeyName);
+        m_valueSummary += QString::fromUtf8("... >>");
+    }
+    else if (m_pObject->IsArray())
+    {
+        m_valueSummary = QString::fromUtf8("[%1]").arg(m_pObject->GetArray().size());
+    }
+    else
+    {
+        std::string s;
+        m_pObject->ToString(s);
+        m_valueSummary = QString::fromUtf8( s.c_str() );
+    }
+    m_bValueCached = true;
+    return m_valueSummary;
+}
+
+const QPixmap & PdfObjectModelNode::GetIcon() const
+{
+    if (m_bIconCached)
+        return m_icon;
+
+    const char * iconFileName = "";
+    switch (m_pObject->GetDataType())
+    {
+        case ePdfDataType_Bool: iconFileName = ":/icons/bool.png"; break;
+        case ePdfDataType_Number: iconFileName = ":/icons/number.png"; break;
+        case ePdfDataType_Real: iconFileName = ":/icons/real.png"; break;
+        case ePdfDataType_String: iconFileName = ":/icons/litstring.png"; break;
+        case ePdfDataType_HexString: iconFileName = ":/icons/hexstring.png"; break;
+        case ePdfDataType_Name: iconFileName = ":/icons/name.png"; break;
+        case ePdfDataType_Array: iconFileName = ":/icons/array.png"; break;
+        case ePdfDataType_Dictionary: iconFileName = ":/icons/dictionary.png"; break;
+        case ePdfDataType_Null: iconFileName = ":/icons/empty.png"; break;
+        case ePdfDataType_Reference:
+                         if (IsValidReference())
+                             iconFileName = ":/icons/reference.png";
+                         else
+                         {
+                             iconFileName = ":/icons/dangling_reference.png";
+                             // Only the tree's bookkeeping changes, not the node
+                             m_pTree->NoteDangling(const_cast<PdfObjectModelNode*>(this), m_pObject->GetReference());
+                         }
+                         break;
+        case ePdfDataType_RawData: iconFileName = ""; break;
+        default: break;
+    }
+    m_icon = IconForFile(iconFileName);
+    m_bIconCached = true;
+    return m_icon;
+}
+
 }; // end anonymous namespace
 
 
-PdfObjectModel::PdfObjectModel(PdfMemDocument* doc, QObject* parent, bool catalogRooted)
-    : QAbstractTableModel(parent), m_bDocChanged(false), m_pTree(0)
+PdfObjectModel::PdfObjectModel(PdfMemDocument* doc, QObject* parent, bool catalogRooted, QMutex* documentLock)
+    : QAbstractTableModel(parent), m_bReadOnly(false), m_ownChanges(), m_pChanges(&m_ownChanges),
+      m_pDocumentLock(documentLock),
+      m_pLoader(0), m_pReferenceIndex(0), m_hintedRootsBegin(0), m_hintedRootsEnd(0), m_pTree(0)
 {
+    QMutexLocker lock(m_pDocumentLock);
     if (catalogRooted)
         setupModelData_CatalogRooted(doc);
     else
@@ -544,6 +1041,7 @@ void PdfObjectModel::setupModelData_IndirectRooted(PdfMemDocument * doc)
 
 void PdfObjectModel::PrepareForSubtreeChange(const QModelIndex& index)
 {
+    QMutexLocker lock(m_pDocumentLock);
     assert(index.isValid());
     // Loop over all aliases of this node and prepare their subtrees
     // for the change to the underlying data model. Note that the alias list
@@ -551,64 +1049,96 @@ void PdfObjectModel::PrepareForSubtreeChange(const QModelIndex& index)
     PdfObjectModelNode* node = static_cast<PdfObjectModelNode*>(index.internalPointer());
     const int childCount = node->CountChildren();
     const PdfObject * const obj = node->GetObject();
-    std::vector<PdfObjectModelNode*> aliases = node->GetAliases();
-    std::vector<PdfObjectModelNode*>::iterator itEnd = aliases.end();
-    for (std::vector<PdfObjectModelNode*>::iterator it = aliases.begin();
-         it != itEnd;
-         ++it)
+    // If the object contains (a reference to) itself somewhere below, some
+    // aliases are descendants of others and get deleted as we go. They drop
+    // out of the alias list when they do, so we never visit them.
+    for (PdfObjectModelNode* alias = node->GetFirstAlias(); alias; alias = alias->GetNextAlias())
     {
         // Inform the model about the change to this particular subtree
         // alias nodes MUST have the same number of children and same associated object.
-        assert(obj == (*it)->GetObject());
-        assert(childCount == (*it)->CountChildren());
+        assert(obj == alias->GetObject());
+        assert(childCount == alias->CountChildren());
         // Find out what this particular node's position within its parent node
         // is.
         beginRemoveRows(
-                        createIndex( (*it)->GetIndexInParent(), 0, (*it) ),
+                        createIndex( alias->GetIndexInParent(), 0, alias ),
                         0,
-                        (*it)->CountChildren()
+                        alias->CountChildren()
                         );
-        (*it)->InvalidateChildren();
-        (*it)->SetPretendEmpty(true);
+        alias->InvalidateChildren();
+        alias->SetPretendEmpty(true);
         endRemoveRows();
     }
 }
 
 void PdfObjectModel::SubtreeChanged(const QModelIndex& index)
 {
+    QMutexLocker lock(m_pDocumentLock);
     assert(index.isValid());
     PdfObjectModelNode* node = static_cast<PdfObjectModelNode*>(index.internalPointer());
     const PdfObject * const obj = node->GetObject();
+
+    // The object owning the node needs saving, and the references it holds
+    // may have changed
+    const PdfObject * const owner = node->GetOwningObject();
+    RecordChange(owner);
+    if (m_pReferenceIndex)
+        m_pReferenceIndex->Update(owner);
+
+    RefreshSubtreeRows(index);
+}
+
+void PdfObjectModel::RefreshSubtreeRows(const QModelIndex& index)
+{
+    QMutexLocker lock(m_pDocumentLock);
+    assert(index.isValid());
+    PdfObjectModelNode* node = static_cast<PdfObjectModelNode*>(index.internalPointer());
+    const PdfObject * const obj = node->GetObject();
+
     // Loop over all aliases of this node and inform the model the tree
-    // below that node has changed.
-    std::vector<PdfObjectModelNode*> aliases = node->GetAliases();
-    std::vector<PdfObjectModelNode*>::iterator itEnd = aliases.end();
-    for (std::vector<PdfObjectModelNode*>::iterator it = aliases.begin();
-         it != itEnd;
-         ++it)
+    // below that node has changed. Aliases created as we repopulate child
+    // lists go to the front of the alias list, so we won't visit them; they're
+    // brand new and up to date anyway.
+    for (PdfObjectModelNode* alias = node->GetFirstAlias(); alias; alias = alias->GetNextAlias())
     {
         // alias nodes MUST have the same associated object.
-        assert(obj == (*it)->GetObject());
+        assert(obj == alias->GetObject());
         // Inform the model about changes to this particular alias node
-        (*it)->SetPretendEmpty(false);
-        QModelIndex nodeIndex = createIndex((*it)->GetIndexInParent(), 0, (*it) );
-        if ((*it)->CountChildren())
+        alias->SetPretendEmpty(false);
+        alias->InvalidateDisplay();
+        QModelIndex nodeIndex = createIndex(alias->GetIndexInParent(), 0, alias );
+        if (alias->CountChildren())
         {
-            beginInsertRows(nodeIndex, 0, (*it)->CountChildren() - 1 );
+            beginInsertRows(nodeIndex, 0, alias->CountChildren() - 1 );
             endInsertRows();
         }
-        emit dataChanged( nodeIndex, nodeIndex );
+        emit dataChanged( nodeIndex, createIndex(nodeIndex.row(), Column_Type, alias) );
+
+        // A container's summary shows some of its members' values, so it's
+        // out of date too.
+        PdfObjectModelNode * const container = alias->GetParent();
+        if (container && container->GetObject() != obj && !container->GetObject()->IsReference())
+        {
+            container->InvalidateDisplay();
+            const QModelIndex containerIndex = createIndex(container->GetIndexInParent(), Column_RawValue, container);
+            emit dataChanged( containerIndex, containerIndex );
+        }
     }
 }
 
 QModelIndex PdfObjectModel::index(int row, int column, const QModelIndex& parent) const
 {
+    QMutexLocker lock(m_pDocumentLock);
     if (!parent.isValid())
     {
         // We've been asked for an item in the top-level table. We currently only
         // support one-item trees (single rooted) so just return the root node.
         if (row >= 0 && row < static_cast<PdfObjectModelTree*>(m_pTree)->GetRoots().size())
+        {
+            if (m_pLoader && column == 0)
+                HintRoots(row);
             return createIndex(row, column, static_cast<PdfObjectModelTree*>(m_pTree)->GetRoot(row));
+        }
         else
             return QModelIndex();
     }
@@ -618,13 +1148,23 @@ QModelIndex PdfObjectModel::index(int row, int column, const QModelIndex& parent
         PdfObjectModelNode * childNode = parentNode->GetChild(row);
         if (!childNode)
             return QModelIndex();
-        else
-            return createIndex(row, column, childNode);
+
+        // A visible reference is likely to be expanded, so get its target
+        // loaded.
+        const PdfObject * const childObj = childNode->GetObject();
+        if (m_pLoader && column == 0
+            && static_cast<PdfObjectModelTree*>(m_pTree)->FollowReferences()
+            && childObj->IsReference())
+            m_pLoader->Prioritise(childObj->GetReference());
+
+        return createIndex(row, column, childNode);
     }
 }
 
 QVariant PdfObjectModel::data(const QModelIndex& index, int role) const
 {
+    PerfTrace::Scope scope("model-data");
+    QMutexLocker lock(m_pDocumentLock);
     if (!index.isValid())
         return QVariant();
 
@@ -632,70 +1172,47 @@ QVariant PdfObjectModel::data(const QModelIndex& index, int role) const
 
     QVariant ret;
 
-    const PdfObject* item;
-    const char * iconFileName = 0;
     switch (index.column())
     {
         case Column_ParentIdentifier:
             switch (role)
             {
                 case Qt::DisplayRole:
-                    if (!node->GetParent())
+                    ret = node->GetLabel();
+                    break;
+                case Qt::DecorationRole:
+                    ret = node->GetIcon();
+                    break;
+                case Qt::FontRole:
+                    if (node->IsIndirectObject() && m_pChanges->Contains(node->GetObject()->Reference()))
                     {
-                        const PdfReference & ref ( node->GetObject()->Reference() );
-                        ret = QString::fromUtf8("%1 %2 obj")
-				.arg(ref.ObjectNumber())
-				.arg(ref.GenerationNumber());
+                        QFont font;
+                        font.setBold(true);
+                        ret = font;
                     }
-                    else
+                    break;
+                case Qt::ToolTipRole:
+                    if (node->IsIndirectObject())
                     {
-                        item = node->GetParent()->GetObject();
-
-                        if (item->IsDictionary())
-                        {
-                            // Item is a directly contained object in a dictionary, so show dictionary key
-			    // We'll interpret the key as utf-8, which it usually should be if it's got any
-			    // high-bit stuff in it.
-                            ret = QString::fromUtf8( node->GetParentKey().GetName().c_str() );
-                        }
-                        else if (item->IsArray())
+                        QString tip;
+                        if (m_pReferenceIndex)
                         {
-                            // directly contained array element
-                            ret = QString::fromUtf8("<element %1>")
-				    .arg(node->GetIndexInParent());
+                            const int referrers = m_pReferenceIndex->CountReferrers(node->GetObject()->Reference());
+                            if (m_pReferenceIndex->IsComplete())
+                                tip = tr("Referred to by %n object(s)", "", referrers);
+                            else
+                                tip = tr("Referred to by at least %n object(s) (still loading)", "", referrers);
                         }
-                        else if (item->IsReference())
+                        if (m_pChanges->Contains(node->GetObject()->Reference()))
                         {
-                            // item is an indirect object from a followed reference
-                            const PdfReference& ref ( item->GetReference() );
-                            ret = QString::fromUtf8("%1 %2 obj").
-				    arg(ref.ObjectNumber()).
-				    arg(ref.GenerationNumber());
+                            if (!tip.isEmpty())
+                                tip += QLatin1Char('\n');
+                            tip += tr("Changed since the document was last saved");
                         }
-                        else
-                            ret = QString::fromUtf8("<UNKNOWN>");
+                        if (!tip.isEmpty())
+                            ret = tip;
                     }
                     break;
-                case Qt::DecorationRole:
-                    item = node->GetObject();
-            switch (item->GetDataType())
-            {
-                case ePdfDataType_Bool: iconFileName = ":/icons/bool.png"; break;
-                case ePdfDataType_Number: iconFileName = ":/icons/number.png"; break;
-                case ePdfDataType_Real: iconFileName = ":/icons/real.png"; break;
-                case ePdfDataType_String: iconFileName = ":/icons/litstring.png"; break;
-                case ePdfDataType_HexString: iconFileName = ":/icons/hexstring.png"; break;
-                case ePdfDataType_Name: iconFileName = ":/icons/name.png"; break;
-                case ePdfDataType_Array: iconFileName = ":/icons/array.png"; break;
-                case ePdfDataType_Dictionary: iconFileName = ":/icons/dictionary.png"; break;
-                case ePdfDataType_Null: iconFileName = ":/icons/empty.png"; break;
-                case ePdfDataType_Reference:
-                                 iconFileName = node->IsValidReference() ? ":/icons/reference.png" : ":/icons/dangling_reference.png";
-                                 break;
-                case ePdfDataType_RawData: iconFileName = ""; break;
-            }
-                    ret = QPixmap(QString::fromUtf8(iconFileName));
-                    break;
                 default:
                     break;
             }
@@ -705,46 +1222,7 @@ QVariant PdfObjectModel::data(const QModelIndex& index, int role) const
             switch (role)
             {
                 case Qt::DisplayRole:
-                    item = node->GetObject();
-
-                    if (item->IsDictionary())
-                    {
-                        QString value = QString::fromUtf8("<< ");
-                        if (item->GetDictionary().HasKey( PdfName::KeyType ) )
-                        {
-                            std::string s;
-                            item->GetDictionary().GetKey( PdfName::KeyType )->ToString(s);
-                            value += QString::fromUtf8("/Type %1 ")
-				    .arg(QString::fromUtf8(s.c_str()));
-                        }
-                        if (item->GetDictionary().HasKey( PdfName("SubType") ) )
-                        {
-                            std::string s;
-                            item->GetDictionary().GetKey( PdfName("SubType") )->ToString(s);
-                            value += QString::fromUtf8("/SubType %1 ")
-				    .arg(QString::fromUtf8(s.c_str()));
-                        }
-                        if (item->GetDictionary().HasKey( PdfName("Name") ) )
-                        {
-                            std::string s;
-                            item->GetDictionary().GetKey( PdfName("Name") )->ToString(s);
-                            value += QString::fromUtf8("/Name %1 ")
-				    .arg(QString::fromUtf8(s.c_str()));
-                        }
-                        ret = value += QString::fromUtf8("... >>");
-                    }
-                    else if (item->IsArray())
-                    {
-                        std::ostringstream s;
-                        s << '[' << item->GetArray().size() << ']';
-                        ret = QString::fromUtf8( s.str().c_str() );
-                    }
-                    else
-                    {
-                        std::string s;
-                        item->ToString(s);
-                        ret = QString::fromUtf8( s.c_str() );
-                    }
+                    ret = node->GetValueSummary();
                     break;
                 default:
                     break;
@@ -769,6 +1247,7 @@ QVariant PdfObjectModel::data(const QModelIndex& index, int role) const
 
 Qt::ItemFlags PdfObjectModel::flags(const QModelIndex &index) const
 {
+    QMutexLocker lock(m_pDocumentLock);
     static const Qt::ItemFlags noEditFlags = Qt::ItemIsEnabled | Qt::ItemIsSelectable;
     static const Qt::ItemFlags editFlags = noEditFlags | Qt::ItemIsEditable;
 
@@ -778,7 +1257,7 @@ Qt::ItemFlags PdfObjectModel::flags(const QModelIndex &index) const
     const PdfObjectModelNode * const node = static_cast<PdfObjectModelNode*>(index.internalPointer());
     const PdfObject * const obj = node->GetObject();
 
-    if ( index.column() == Column_RawValue && !(obj->IsArray() || obj->IsDictionary()) )
+    if ( !m_bReadOnly && index.column() == Column_RawValue && !(obj->IsArray() || obj->IsDictionary()) )
         return editFlags;
     else
         return noEditFlags;
@@ -835,6 +1314,7 @@ QModelIndex PdfObjectModel::parent(const QModelIndex &index) const
 
 int PdfObjectModel::rowCount(const QModelIndex &parent) const
 {
+    QMutexLocker lock(m_pDocumentLock);
     if (!parent.isValid())
     {
         return static_cast<PdfObjectModelTree*>(m_pTree)->GetRoots().size();
@@ -863,18 +1343,14 @@ const PdfObject* PdfObjectModel::GetObjectForIndex(const QModelIndex & index) co
 
 int PdfObjectModel::FindObject( const PoDoFo::PdfReference & ref )
 {
-    PdfObjectModelTree* pTree = static_cast<PdfObjectModelTree*>(m_pTree);
-
     // Only toplevel objects are searched.
-    const std::vector<PdfObjectModelNode*> & roots = pTree->GetRoots();
-    std::vector<PdfObjectModelNode*>::const_iterator it = std::find_if( roots.begin(), roots.end(), 
-                                                                        PdfObjectsComperator( ref ) );
-    return it != roots.end() ? it - roots.begin() : -1;
+    return static_cast<PdfObjectModelTree*>(m_pTree)->FindRoot( ref );
 }
 
 bool PdfObjectModel::setData ( const QModelIndex & index, const QVariant & value, int role )
 {
-    if (!index.isValid() || index.column() != Column_RawValue)
+    QMutexLocker lock(m_pDocumentLock);
+    if (m_bReadOnly || !index.isValid() || index.column() != Column_RawValue)
         return false;
     if (value.isNull() || !value.isValid() || !value.canConvert<QByteArray>())
         return false;
@@ -903,12 +1379,14 @@ bool PdfObjectModel::setData ( const QModelIndex & index, const QVariant & value
          podofoError(eCode);
     }
     SubtreeChanged(index);
-    m_bDocChanged = m_bDocChanged|changed;
     return changed;
 }
 
 bool PdfObjectModel::insertElement( int row, const QModelIndex & parent )
 {
+    QMutexLocker lock(m_pDocumentLock);
+    if (m_bReadOnly)
+        return false;
     PdfObjectModelNode * node;
     if (!parent.isValid())
     {
@@ -928,6 +1406,9 @@ bool PdfObjectModel::insertElement( int row, const QModelIndex & parent )
 
 bool PdfObjectModel::insertKey(const PdfName& keyName, const QModelIndex & parent )
 {
+    QMutexLocker lock(m_pDocumentLock);
+    if (m_bReadOnly)
+        return false;
     PdfObjectModelNode * node;
     if (!parent.isValid())
     {
@@ -947,6 +1428,9 @@ bool PdfObjectModel::insertKey(const PdfName& keyName, const QModelIndex & paren
 
 bool PdfObjectModel::deleteIndex(const QModelIndex & index)
 {
+    QMutexLocker lock(m_pDocumentLock);
+    if (m_bReadOnly)
+        return false;
     if (!index.isValid())
     {
         qDebug("Tried to delete invalid index!");
@@ -972,6 +1456,9 @@ bool PdfObjectModel::deleteIndex(const QModelIndex & index)
 
 bool PdfObjectModel::createNewObject(const QModelIndex & index)
 {
+    QMutexLocker lock(m_pDocumentLock);
+    if (m_bReadOnly)
+        return false;
     if (!index.isValid())
     {
         qDebug("Tried to create object on invalid index!");
@@ -983,21 +1470,36 @@ bool PdfObjectModel::createNewObject(const QModelIndex & index)
     // exists.
 
 
+    PdfObjectModelTree * const tree = static_cast<PdfObjectModelTree*>(m_pTree);
+
     // Create the new indirect object
-    PdfObject* obj = static_cast<PdfObjectModelTree*>(m_pTree)->GetDocument()->GetObjects().CreateObject( PdfVariant() );
+    PdfObject* obj = tree->GetDocument()->GetObjects().CreateObject( PdfVariant() );
+    RecordChange(obj);
+    if (m_pReferenceIndex)
+        m_pReferenceIndex->Update(obj);
+
+    // When every indirect object has its own row, so does the new one. In
+    // catalog view it only shows up under the reference made below.
+    if (!tree->FollowReferences())
+    {
+        const int row = tree->GetRoots().size();
+        beginInsertRows( QModelIndex(), row, row );
+        tree->AppendRoot(obj);
+        endInsertRows();
+    }
 
     // and set the selected field to a reference
     PrepareForSubtreeChange(index);
     PdfObjectModelNode* node = static_cast<PdfObjectModelNode*>(index.internalPointer());
     node->SetData(obj->Reference());
     SubtreeChanged(index);
-    m_bDocChanged = true;
 
     return true;
 }
 
 void PdfObjectModel::InvalidateChildren(const QModelIndex & index)
 {
+    QMutexLocker lock(m_pDocumentLock);
     if (index.isValid())
     {
         PdfObjectModelNode * const node = static_cast<PdfObjectModelNode*>(index.internalPointer());
@@ -1009,8 +1511,203 @@ void PdfObjectModel::InvalidateChildren(const QModelIndex & index)
     }
 }
 
+void PdfObjectModel::DropChildren(const QModelIndex & index)
+{
+    QMutexLocker lock(m_pDocumentLock);
+    if (!index.isValid())
+        return;
+    PdfObjectModelNode * const node = static_cast<PdfObjectModelNode*>(index.internalPointer());
+    assert(node);
+    if (!node->HasChildNodes())
+        return;
+
+    // The rows go, and then come back without nodes behind them, which are
+    // only made again if the row is expanded. The nodes' slots go back to
+    // the pool for reuse, so however much of the tree is browsed, it never
+    // takes more memory than the parts expanded at one time.
+    const QModelIndex parent = createIndex( node->GetIndexInParent(), 0, node );
+    const int count = node->CountChildren();
+    beginRemoveRows( parent, 0, count - 1 );
+    node->InvalidateChildren();
+    node->SetPretendEmpty(true);
+    endRemoveRows();
+    node->SetPretendEmpty(false);
+    beginInsertRows( parent, 0, count - 1 );
+    endInsertRows();
+}
+
+qint64 PdfObjectModel::EstimateMemoryUse() const
+{
+    QMutexLocker lock(m_pDocumentLock);
+    return static_cast<qint64>(static_cast<PdfObjectModelTree*>(m_pTree)->GetNodeCount())
+        * (sizeof(PdfObjectModelNode) + nodeDisplayCacheSize);
+}
+
+void PdfObjectModel::SetBackgroundLoader(BackgroundLoader* loader)
+{
+    m_pLoader = loader;
+    m_hintedRootsBegin = m_hintedRootsEnd = 0;
+}
+
+std::vector<PdfReference> PdfObjectModel::GetChangedObjects() const
+{
+    const std::set<PdfReference> & changed = m_pChanges->GetObjects();
+    return std::vector<PdfReference>(changed.begin(), changed.end());
+}
+
+bool PdfObjectModel::ChangedObjectsComplete() const
+{
+    return m_pChanges->IsComplete();
+}
+
+void PdfObjectModel::SetDocumentChanges(DocumentChanges* changes)
+{
+    m_pChanges = changes ? changes : &m_ownChanges;
+}
+
+void PdfObjectModel::MarkObjectChanged(const PdfReference & ref)
+{
+    QMutexLocker lock(m_pDocumentLock);
+    m_staleObjects.insert(ref);
+    const PdfObject * const obj = static_cast<PdfObjectModelTree*>(m_pTree)->GetDocument()->GetObjects().GetObject(ref);
+    if (obj)
+        RecordChange(obj);
+    else
+        m_pChanges->AddUntracked();
+}
+
+void PdfObjectModel::ClearChangedObjects()
+{
+    QMutexLocker lock(m_pDocumentLock);
+    const std::set<PdfReference> saved(m_pChanges->GetObjects());
+    m_pChanges->Clear();
+    PdfObjectModelTree * const tree = static_cast<PdfObjectModelTree*>(m_pTree);
+    const PdfVecObjects & objs = tree->GetDocument()->GetObjects();
+    for (std::set<PdfReference>::const_iterator it = saved.begin(); it != saved.end(); ++it)
+    {
+        const PdfObject * const obj = objs.GetObject(*it);
+        if (obj)
+            EmitObjectRowsChanged(obj);
+
+        // Objects with no rows have nothing left to refresh: rows made for
+        // them from now on are read afresh. Those with rows still show the
+        // old contents until RefreshStaleObjects().
+        if (!obj || !tree->GetFirstAlias(obj))
+            m_staleObjects.erase(*it);
+    }
+}
+
+void PdfObjectModel::RecordChange(const PdfObject* obj)
+{
+    // An object without an object number can't be saved on its own
+    if (!obj->Reference().IsIndirect())
+        m_pChanges->AddUntracked();
+    else if (m_pChanges->Add(obj->Reference()))
+        EmitObjectRowsChanged(obj);
+    RefreshDanglingReferences(obj->Reference());
+    emit objectChanged(obj->Reference());
+}
+
+void PdfObjectModel::RefreshDanglingReferences(const PdfReference & target)
+{
+    PdfObjectModelTree * const tree = static_cast<PdfObjectModelTree*>(m_pTree);
+    const std::vector<PdfObjectModelNode*> nodes = tree->TakeDangling(target);
+    for (std::vector<PdfObjectModelNode*>::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+    {
+        PdfObjectModelNode * const node = *it;
+        node->InvalidateDisplay();
+        node->InvalidateChildren();
+        const QModelIndex index = createIndex(node->GetIndexInParent(), 0, node);
+        // In the catalog view the target now appears under the reference
+        if (node->CountChildren())
+        {
+            beginInsertRows(index, 0, node->CountChildren() - 1);
+            endInsertRows();
+        }
+        emit dataChanged(index, createIndex(index.row(), Column_Type, node));
+    }
+}
+
+void PdfObjectModel::EmitObjectRowsChanged(const PdfObject* obj)
+{
+    PdfObjectModelTree * const tree = static_cast<PdfObjectModelTree*>(m_pTree);
+    for (PdfObjectModelNode* alias = tree->GetFirstAlias(obj); alias; alias = alias->GetNextAlias())
+    {
+        const QModelIndex index = createIndex(alias->GetIndexInParent(), Column_ParentIdentifier, alias);
+        emit dataChanged(index, index);
+    }
+}
+
+int PdfObjectModel::RefreshStaleObjects()
+{
+    QMutexLocker lock(m_pDocumentLock);
+    PdfObjectModelTree * const tree = static_cast<PdfObjectModelTree*>(m_pTree);
+    std::set<PdfReference> stale;
+    stale.swap(m_staleObjects);
+
+    int refreshed = 0;
+    for (std::set<PdfReference>::const_iterator it = stale.begin(); it != stale.end(); ++it)
+    {
+        RefreshDanglingReferences(*it);
+        const PdfObject * const obj = tree->GetDocument()->GetObjects().GetObject(*it);
+        // Objects nobody has looked at yet have no rows to refresh
+        PdfObjectModelNode * const node = obj ? tree->GetFirstAlias(obj) : 0;
+        if (!node)
+            continue;
+
+        // This takes care of every alias of the node. The change itself was
+        // recorded by MarkObjectChanged(), and may have been saved since,
+        // so it mustn't be recorded again.
+        const QModelIndex index = createIndex(node->GetIndexInParent(), 0, node);
+        PrepareForSubtreeChange(index);
+        if (m_pReferenceIndex)
+            m_pReferenceIndex->Update(obj);
+        RefreshSubtreeRows(index);
+        ++refreshed;
+    }
+    return refreshed;
+}
+
+bool PdfObjectModel::IsCatalogRooted() const
+{
+    return static_cast<PdfObjectModelTree*>(m_pTree)->FollowReferences();
+}
+
+void PdfObjectModel::SetReferenceIndex(ReferenceIndex* index)
+{
+    m_pReferenceIndex = index;
+}
+
+void PdfObjectModel::SetReadOnly(bool readOnly)
+{
+    m_bReadOnly = readOnly;
+}
+
+void PdfObjectModel::HintRoots(int row) const
+{
+    // The view asks for the same rows over and over as it paints, so only
+    // send new hints once it gets near the edge of what we last hinted.
+    if (row >= m_hintedRootsBegin && row + rootHintLookahead / 2 < m_hintedRootsEnd)
+        return;
+
+    const std::vector<PdfObjectModelNode*> & roots = static_cast<PdfObjectModelTree*>(m_pTree)->GetRoots();
+    const int end = std::min<int>(row + rootHintLookahead, roots.size());
+
+    // The loader serves the most recent hint first, so hint the furthest row
+    // first and the requested row last.
+    std::vector<PdfReference> refs;
+    refs.reserve(end - row);
+    for (int i = end - 1; i >= row; --i)
+        refs.push_back(roots[i]->GetObject()->Reference());
+    m_pLoader->Prioritise(refs);
+
+    m_hintedRootsBegin = row;
+    m_hintedRootsEnd = end;
+}
+
 int PdfObjectModel::IndexChildCount(const QModelIndex & index) const
 {
+    QMutexLocker lock(m_pDocumentLock);
     return static_cast<PdfObjectModelNode*>(index.internalPointer())->CountChildren();
 }
 
@@ -1,19 +1,28 @@
 #ifndef PDFOBJECTMODEL_H
 #define PDFOBJECTMODEL_H
 
+#include <set>
 #include <utility>
+#include <vector>
 
 #include <QAbstractTableModel>
 #include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
 
 #include <podofo/podofo.h>
 
+#include "documentchanges.h"
+
 namespace PoDoFo {
     class PdfMemDocument;
     class PdfObject;
     class PdfName;
 };
 
+class BackgroundLoader;
+class ReferenceIndex;
+
 /*
  * A Qt model to represent the PDF's top-level indirect object
  * tree and all child dictionaries of it.
@@ -34,6 +43,10 @@ namespace PoDoFo {
  * 3: Any other useful identifying information about the object
  *
  * All are Qt::DisplayRole roles with string values.
+ *
+ * If the document is shared with worker threads (see BackgroundLoader), pass
+ * its document lock to the constructor. The model then holds it whenever it
+ * touches the document on behalf of its users.
  */
 class PdfObjectModel : public QAbstractTableModel
 {
@@ -51,7 +64,8 @@ public:
         Column_Type = 2
     };
 
-    PdfObjectModel(PoDoFo::PdfMemDocument* doc, QObject* parent = 0, bool catalogRooted = true);
+    PdfObjectModel(PoDoFo::PdfMemDocument* doc, QObject* parent = 0, bool catalogRooted = true,
+                   QMutex* documentLock = 0);
     virtual ~PdfObjectModel();
 
     virtual QVariant data(const QModelIndex& index, int role) const;
@@ -81,6 +95,13 @@ public:
     // they're needed. You MUST call this before modifying the children of an object.
     void InvalidateChildren(const QModelIndex & index);
 
+    // Free the rows under `index', which should be collapsed in every view,
+    // until they're next wanted. Their contents aren't changed.
+    void DropChildren(const QModelIndex & index);
+
+    // About how much memory, in bytes, the rows made so far take
+    qint64 EstimateMemoryUse() const;
+
     // These perhaps shouldn't really be public as they're only necessary
     // where the tree is modified, and only the model should be doing that.
     void PrepareForSubtreeChange(const QModelIndex& index);
@@ -107,12 +128,95 @@ public:
     // indirect reference to it.
     bool createNewObject(const QModelIndex & index);
 
-    /** \return true iff the document has changed */
-    bool DocChanged() const throw() { return m_bDocChanged; }
+    /** \return true iff the document has changed since it was last saved */
+    bool DocChanged() const throw() { return m_pChanges->IsChanged(); }
+
+    // The indirect objects changed through the model, or passed to
+    // MarkObjectChanged(), since the list was last cleared. Objects created
+    // by createNewObject() count as changed.
+    std::vector<PoDoFo::PdfReference> GetChangedObjects() const;
+    // Whether GetChangedObjects() lists every change, so that saving them
+    // is enough to save the document
+    bool ChangedObjectsComplete() const;
+    // Record a change made to object `ref' behind the model's back, such as
+    // new stream data. Its rows aren't updated until RefreshStaleObjects().
+    void MarkObjectChanged(const PoDoFo::PdfReference & ref);
+    // Forget the changes so far, once they've been saved, so that
+    // DocChanged() is false until the next one
+    void ClearChangedObjects();
+
+    // Re-read the rows of the objects passed to MarkObjectChanged() since
+    // the last call, which is much cheaper than building a new model.
+    // Returns how many objects were refreshed.
+    int RefreshStaleObjects();
+
+    // Whether the tree starts at the catalog and follows references, rather
+    // than listing every indirect object at the top level
+    bool IsCatalogRooted() const;
+
+    // Tell `loader' (which may be null) about objects the view is likely to
+    // need soon, such as the rows just past the ones on screen and the targets
+    // of visible references, so it can load those ahead of the rest.
+    void SetBackgroundLoader(BackgroundLoader* loader);
+
+    // Keep `index' (which may be null) up to date as objects are edited, and
+    // use it to show how many objects refer to each indirect object. The
+    // index is guarded by the document lock.
+    void SetReferenceIndex(ReferenceIndex* index);
+
+    // While read-only, nothing can be edited through the model, as while the
+    // document is being saved
+    void SetReadOnly(bool readOnly);
+    bool IsReadOnly() const { return m_bReadOnly; }
+
+    // Record changes in `changes' (which may be null), which outlives the
+    // model, rather than in the model's own list. Set it before editing
+    // anything.
+    void SetDocumentChanges(DocumentChanges* changes);
+
+signals:
+    // The indirect object `ref' was changed through the model or passed to
+    // MarkObjectChanged(). Emitted for every change, not just the first.
+    void objectChanged(const PoDoFo::PdfReference & ref);
 
 private:
-    // have any changes been made to the document tree through the model?
-    bool m_bDocChanged;
+    // See SetReadOnly()
+    bool m_bReadOnly;
+
+    // See GetChangedObjects() and SetDocumentChanges(). The rows of the
+    // changed objects are highlighted.
+    DocumentChanges m_ownChanges;
+    DocumentChanges* m_pChanges;
+    // Changed behind our back, so their rows may be out of date
+    std::set<PoDoFo::PdfReference> m_staleObjects;
+
+    // Add the indirect object `obj' to the changed objects
+    void RecordChange(const PoDoFo::PdfObject* obj);
+    // The part of SubtreeChanged() that tells the views: re-read the rows
+    // under every alias of `index', without recording a change
+    void RefreshSubtreeRows(const QModelIndex& index);
+    // Tell the view that the rows showing the indirect object `obj' look
+    // different
+    void EmitObjectRowsChanged(const PoDoFo::PdfObject* obj);
+    // Redraw the references drawn as dangling to object `target', in case
+    // it's been created since
+    void RefreshDanglingReferences(const PoDoFo::PdfReference & target);
+
+    // Lock to hold while touching the document, or null if not shared
+    QMutex* m_pDocumentLock;
+
+    // Receives load hints; may be null
+    BackgroundLoader* m_pLoader;
+
+    // Kept up to date with edits; may be null
+    ReferenceIndex* m_pReferenceIndex;
+
+    // Range of top-level rows most recently hinted to m_pLoader
+    mutable int m_hintedRootsBegin;
+    mutable int m_hintedRootsEnd;
+
+    // Hint the loader about the top-level rows at and after `row'
+    void HintRoots(int row) const;
 
     void setupModelData_CatalogRooted(PoDoFo::PdfMemDocument* doc);
     void setupModelData_IndirectRooted(PoDoFo::PdfMemDocument* doc);
@@ -126,16 +230,19 @@ private:
 
 bool PdfObjectModel::IndexIsDictionary(const QModelIndex & index) const
 {
+    QMutexLocker lock(m_pDocumentLock);
     return GetObjectForIndex(index)->IsDictionary();
 }
 
 bool PdfObjectModel::IndexIsArray(const QModelIndex & index) const
 {
+    QMutexLocker lock(m_pDocumentLock);
     return GetObjectForIndex(index)->IsArray();
 }
 
 bool PdfObjectModel::IndexIsReference(const QModelIndex & index) const
 {
+    QMutexLocker lock(m_pDocumentLock);
     return GetObjectForIndex(index)->IsReference();
 }
 
@@ -0,0 +1,197 @@
+#include "perfdock.h"
+#include "perftrace.h"
+
+#include <QCheckBox>
+#include <QFileDialog>
+#include <QFont>
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QStringList>
+#include <QTimer>
+#include <QTreeWidget>
+#include <QVBoxLayout>
+
+namespace {
+
+// How often the figures are brought up to date while recording, in
+// milliseconds
+static const int refreshInterval = 1000;
+
+// The operation whose histogram is shown until the user picks another
+static const char* const defaultHistogram = "delayed-load";
+
+// Width of the longest bar in the histogram, in characters
+static const int histogramWidth = 40;
+
+enum Column
+{
+    Column_Name,
+    Column_Count,
+    Column_Total,
+    Column_Mean,
+    Column_Max
+};
+
+QString milliseconds( qint64 microseconds )
+{
+    return QString::number( microseconds / 1000.0, 'f', 1 );
+}
+
+// The lower bound of histogram bucket `bucket', for its label
+QString bucketLabel( int bucket )
+{
+    const qint64 microseconds = static_cast<qint64>(1) << bucket;
+    if (microseconds < 1000)
+        return QString::fromUtf8("%1 us").arg( microseconds );
+    if (microseconds < 1000000)
+        return QString::fromUtf8("%1 ms").arg( microseconds / 1000.0, 0, 'g', 3 );
+    return QString::fromUtf8("%1 s").arg( microseconds / 1000000.0, 0, 'g', 3 );
+}
+
+};
+
+PerfDock::PerfDock(QWidget* parent)
+    : QDockWidget(tr("Performance"), parent),
+      m_pRecord(0),
+      m_pReset(0),
+      m_pSave(0),
+      m_pStatistics(0),
+      m_pHistogram(0),
+      m_pRefreshTimer(0)
+{
+    setObjectName(QString::fromUtf8("PerfDock"));
+
+    QWidget* contents = new QWidget(this);
+    QVBoxLayout* layout = new QVBoxLayout(contents);
+    layout->setMargin(2);
+
+    QHBoxLayout* buttonLayout = new QHBoxLayout();
+    m_pRecord = new QCheckBox(tr("Record"), contents);
+    m_pRecord->setToolTip( tr("Time opening, loading, decoding, layout, saving and browsing") );
+    m_pRecord->setChecked( PerfTrace::IsEnabled() );
+    buttonLayout->addWidget(m_pRecord, 1);
+    m_pReset = new QPushButton(tr("Reset"), contents);
+    buttonLayout->addWidget(m_pReset);
+    m_pSave = new QPushButton(tr("Save Trace..."), contents);
+    m_pSave->setToolTip( tr("Save the slower operations as a Chrome trace file") );
+    buttonLayout->addWidget(m_pSave);
+    layout->addLayout(buttonLayout);
+
+    m_pStatistics = new QTreeWidget(contents);
+    m_pStatistics->setRootIsDecorated(false);
+    m_pStatistics->setHeaderLabels( QStringList() << tr("Operation") << tr("Count")
+                                    << tr("Total ms") << tr("Mean ms") << tr("Max ms") );
+    layout->addWidget(m_pStatistics, 1);
+
+    m_pHistogram = new QLabel(contents);
+    m_pHistogram->setFont( QFont(QString::fromLocal8Bit("Monospace"), 8) );
+    m_pHistogram->setTextInteractionFlags(Qt::TextSelectableByMouse);
+    layout->addWidget(m_pHistogram);
+
+    setWidget(contents);
+
+    m_pRefreshTimer = new QTimer(this);
+    m_pRefreshTimer->setInterval(refreshInterval);
+
+    connect( m_pRecord, SIGNAL(toggled(bool)), this, SLOT(recordToggled(bool)) );
+    connect( m_pReset, SIGNAL(clicked()), this, SLOT(resetClicked()) );
+    connect( m_pSave, SIGNAL(clicked()), this, SLOT(saveClicked()) );
+    connect( m_pStatistics, SIGNAL(itemSelectionChanged()), this, SLOT(refresh()) );
+    connect( m_pRefreshTimer, SIGNAL(timeout()), this, SLOT(refresh()) );
+
+    if (PerfTrace::IsEnabled())
+        m_pRefreshTimer->start();
+    refresh();
+}
+
+void PerfDock::recordToggled(bool record)
+{
+    PerfTrace::SetEnabled(record);
+    if (record)
+        m_pRefreshTimer->start();
+    else
+        m_pRefreshTimer->stop();
+    refresh();
+}
+
+void PerfDock::resetClicked()
+{
+    PerfTrace::Reset();
+    refresh();
+}
+
+void PerfDock::saveClicked()
+{
+    const QString filename = QFileDialog::getSaveFileName(
+            this, tr("Save Trace..."), QString(), tr("Trace File (*.json)"));
+    if (filename.isEmpty())
+        return;
+    if (!PerfTrace::WriteChromeTrace(filename))
+        QMessageBox::critical(this, tr("Saving failed"), tr("Unable to save %1").arg(filename));
+}
+
+void PerfDock::refresh()
+{
+    // Keep the selection across the rebuild
+    QString selected = QString::fromLatin1(defaultHistogram);
+    const QList<QTreeWidgetItem*> selection = m_pStatistics->selectedItems();
+    if (!selection.isEmpty())
+        selected = selection.first()->text(Column_Name);
+
+    const QList<PerfTrace::Statistic> stats = PerfTrace::GetStatistics();
+
+    m_pStatistics->blockSignals(true);
+    m_pStatistics->clear();
+    const PerfTrace::Statistic* shown = 0;
+    for (QList<PerfTrace::Statistic>::const_iterator it = stats.begin(); it != stats.end(); ++it)
+    {
+        QTreeWidgetItem* item = new QTreeWidgetItem(m_pStatistics);
+        item->setText(Column_Name, it->name);
+        item->setText(Column_Count, QString::number(it->count));
+        item->setText(Column_Total, milliseconds(it->totalTime));
+        item->setText(Column_Mean, milliseconds(it->count ? it->totalTime / static_cast<qint64>(it->count) : 0));
+        item->setText(Column_Max, milliseconds(it->maxTime));
+        for (int column = Column_Count; column <= Column_Max; ++column)
+            item->setTextAlignment(column, Qt::AlignRight);
+        if (it->name == selected)
+        {
+            m_pStatistics->setItemSelected(item, true);
+            shown = &*it;
+        }
+    }
+    m_pStatistics->blockSignals(false);
+
+    if (!shown)
+    {
+        m_pHistogram->setText( stats.isEmpty() && !PerfTrace::IsEnabled()
+                               ? tr("Check Record to time what the browser does")
+                               : QString() );
+        return;
+    }
+
+    // One bar per bucket from the quickest to the slowest one used
+    int first = PerfTrace::HistogramBuckets;
+    int last = -1;
+    quint64 most = 0;
+    for (int i = 0; i < PerfTrace::HistogramBuckets; ++i)
+    {
+        if (!shown->histogram[i])
+            continue;
+        first = qMin(first, i);
+        last = i;
+        most = qMax(most, shown->histogram[i]);
+    }
+    QStringList lines;
+    lines << tr("%1 times:").arg(shown->name);
+    for (int i = first; i <= last; ++i)
+    {
+        const int bar = static_cast<int>((shown->histogram[i] * histogramWidth + most - 1) / most);
+        lines << QString::fromUtf8("%1 %2 %3")
+            .arg(bucketLabel(i), 8)
+            .arg(QString(bar, QLatin1Char('#')), -histogramWidth)
+            .arg(shown->histogram[i]);
+    }
+    m_pHistogram->setText(lines.join(QString::fromUtf8("\n")));
+}
@@ -0,0 +1,43 @@
+#ifndef PODOFOBROWSER_PERFDOCK_H
+#define PODOFOBROWSER_PERFDOCK_H
+
+#include <QDockWidget>
+
+class QCheckBox;
+class QLabel;
+class QPushButton;
+class QTimer;
+class QTreeWidget;
+
+/**
+ * A dock showing what PerfTrace has collected: how often each timed
+ * operation ran and how long it took, and a histogram of the times of
+ * whichever one is selected, which is the per-object delayed load to begin
+ * with. It can turn tracing on and off and save a trace file.
+ */
+class PerfDock : public QDockWidget
+{
+    Q_OBJECT
+
+public:
+    PerfDock(QWidget* parent = 0);
+
+private slots:
+    void recordToggled(bool record);
+    void resetClicked();
+    void saveClicked();
+    void refresh();
+
+private:
+    // Show the histogram of the selected operation
+    void ShowHistogram();
+
+    QCheckBox* m_pRecord;
+    QPushButton* m_pReset;
+    QPushButton* m_pSave;
+    QTreeWidget* m_pStatistics;
+    QLabel* m_pHistogram;
+    QTimer* m_pRefreshTimer;
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "perftrace.h"
+#include "podofoutil.h"
+
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThread>
+
+#include <cstring>
+#include <vector>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+namespace {
+
+// Scopes quicker than this, in microseconds, only go into the statistics.
+// There are far too many of them for a trace, and they'd just be noise.
+static const qint64 minEventTime = 100;
+
+// The most events kept for a trace, the oldest going first
+static const size_t maxEvents = 100000;
+
+struct Accumulator
+{
+    quint64 count;
+    qint64 totalTime;
+    qint64 maxTime;
+    quint64 histogram[PerfTrace::HistogramBuckets];
+};
+
+struct Event
+{
+    const char* name;
+    Qt::HANDLE thread;
+    qint64 start;
+    qint64 duration;
+};
+
+int bucketFor( qint64 duration )
+{
+    int bucket = 0;
+    while (duration > 1 && bucket < PerfTrace::HistogramBuckets - 1)
+    {
+        duration >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+// Everything collected, under `mutex'
+QMutex mutex;
+QHash<const char*, Accumulator> accumulators;
+std::vector<Event> events;
+// Where the next event goes, once `events' is full
+size_t nextEvent = 0;
+// When the trace began, which is time 0 in a trace file
+qint64 epoch = -1;
+Qt::HANDLE guiThread = 0;
+
+bool writeBytes( QIODevice & device, const QByteArray & bytes )
+{
+    return device.write( bytes ) == bytes.size();
+}
+
+};
+
+volatile bool PerfTrace::s_bEnabled = false;
+
+void PerfTrace::SetEnabled( bool enabled )
+{
+    QMutexLocker lock( &mutex );
+    if (epoch < 0)
+        epoch = Now();
+    // It's the GUI that turns tracing on
+    if (!guiThread)
+        guiThread = QThread::currentThreadId();
+    s_bEnabled = enabled;
+}
+
+void PerfTrace::Reset()
+{
+    QMutexLocker lock( &mutex );
+    accumulators.clear();
+    events.clear();
+    nextEvent = 0;
+    epoch = Now();
+}
+
+qint64 PerfTrace::Now()
+{
+#ifdef Q_OS_WIN
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency( &frequency );
+    QueryPerformanceCounter( &counter );
+    return static_cast<qint64>(counter.QuadPart / (frequency.QuadPart / 1000000.0));
+#else
+    timeval tv;
+    gettimeofday( &tv, 0 );
+    return static_cast<qint64>(tv.tv_sec) * 1000000 + tv.tv_usec;
+#endif
+}
+
+void PerfTrace::Record( const char* name, qint64 start, qint64 duration )
+{
+    QMutexLocker lock( &mutex );
+
+    QHash<const char*, Accumulator>::iterator it = accumulators.find( name );
+    if (it == accumulators.end())
+    {
+        Accumulator empty;
+        memset( &empty, 0, sizeof(empty) );
+        it = accumulators.insert( name, empty );
+    }
+    Accumulator & acc = it.value();
+    ++acc.count;
+    acc.totalTime += duration;
+    acc.maxTime = qMax( acc.maxTime, duration );
+    ++acc.histogram[bucketFor( duration )];
+
+    if (duration < minEventTime)
+        return;
+    Event event;
+    event.name = name;
+    event.thread = QThread::currentThreadId();
+    event.start = start;
+    event.duration = duration;
+    if (events.size() < maxEvents)
+        events.push_back( event );
+    else
+    {
+        events[nextEvent] = event;
+        nextEvent = (nextEvent + 1) % maxEvents;
+    }
+}
+
+QList<PerfTrace::Statistic> PerfTrace::GetStatistics()
+{
+    QMutexLocker lock( &mutex );
+
+    // The same name may turn up under different pointers, from different
+    // translation units
+    QMap<QString, Statistic> byName;
+    for (QHash<const char*, Accumulator>::const_iterator it = accumulators.begin(); it != accumulators.end(); ++it)
+    {
+        const QString name = QString::fromLatin1( it.key() );
+        const Accumulator & acc = it.value();
+        QMap<QString, Statistic>::iterator stat = byName.find( name );
+        if (stat == byName.end())
+        {
+            Statistic empty;
+            empty.name = name;
+            empty.count = 0;
+            empty.totalTime = 0;
+            empty.maxTime = 0;
+            memset( empty.histogram, 0, sizeof(empty.histogram) );
+            stat = byName.insert( name, empty );
+        }
+        stat.value().count += acc.count;
+        stat.value().totalTime += acc.totalTime;
+        stat.value().maxTime = qMax( stat.value().maxTime, acc.maxTime );
+        for (int i = 0; i < HistogramBuckets; ++i)
+            stat.value().histogram[i] += acc.histogram[i];
+    }
+    return byName.values();
+}
+
+bool PerfTrace::WriteChromeTrace( QIODevice & device )
+{
+    QMutexLocker lock( &mutex );
+
+    // Viewers want small thread numbers, and names for them
+    QHash<Qt::HANDLE, int> threads;
+    if (guiThread)
+        threads.insert( guiThread, 1 );
+
+    if (!writeBytes( device, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n" ))
+        return false;
+
+    bool first = true;
+    for (size_t i = 0; i < events.size(); ++i)
+    {
+        // Oldest first
+        const Event & event = events[(nextEvent + i) % events.size()];
+        QHash<Qt::HANDLE, int>::const_iterator thread = threads.find( event.thread );
+        if (thread == threads.end())
+            thread = threads.insert( event.thread, threads.size() + 1 );
+
+        const QString line = QString::fromUtf8("%1{\"name\": %2, \"cat\": \"podofobrowser\", \"ph\": \"X\", "
+                                               "\"ts\": %3, \"dur\": %4, \"pid\": 1, \"tid\": %5}")
+            .arg( first ? QString() : QString::fromUtf8(",\n") )
+            .arg( jsonString( QString::fromLatin1( event.name ) ) )
+            .arg( event.start - epoch )
+            .arg( event.duration )
+            .arg( thread.value() );
+        if (!writeBytes( device, line.toUtf8() ))
+            return false;
+        first = false;
+    }
+
+    for (QHash<Qt::HANDLE, int>::const_iterator it = threads.begin(); it != threads.end(); ++it)
+    {
+        const QString threadName = it.key() == guiThread
+            ? QString::fromUtf8("GUI")
+            : QString::fromUtf8("Worker %1").arg( it.value() - 1 );
+        const QString line = QString::fromUtf8("%1{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+                                               "\"tid\": %2, \"args\": {\"name\": %3}}")
+            .arg( first ? QString() : QString::fromUtf8(",\n") )
+            .arg( it.value() )
+            .arg( jsonString( threadName ) );
+        if (!writeBytes( device, line.toUtf8() ))
+            return false;
+        first = false;
+    }
+
+    return writeBytes( device, "\n]}\n" );
+}
+
+bool PerfTrace::WriteChromeTrace( const QString & filename )
+{
+    QFile file( filename );
+    return file.open( QIODevice::WriteOnly | QIODevice::Truncate )
+        && WriteChromeTrace( file )
+        && file.flush();
+}
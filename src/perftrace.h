@@ -0,0 +1,100 @@
+#ifndef PODOFOBROWSER_PERFTRACE_H
+#define PODOFOBROWSER_PERFTRACE_H
+
+#include <QList>
+#include <QString>
+
+class QIODevice;
+
+/**
+ * Timing of the browser's hot paths, for finding out where the time went
+ * when a big document makes it feel hung: opening, delayed loading, stream
+ * decoding, text layout, saving, and the model and hex view calls made while
+ * scrolling.
+ *
+ * Code to be timed puts a PerfTrace::Scope on the stack, named with a string
+ * literal. While tracing is off that costs a test of a flag; while it's on,
+ * each scope adds to per-name statistics (see GetStatistics()), and the
+ * slower ones are also kept, up to a limit, as events for a trace file (see
+ * WriteChromeTrace()).
+ *
+ * Everything here may be used from any thread.
+ */
+class PerfTrace
+{
+public:
+    // Bucket i of a histogram counts the times of at least 2^i and less
+    // than 2^(i+1) microseconds, except that the first also has the
+    // quicker ones and the last the slower ones.
+    enum { HistogramBuckets = 24 };
+
+    struct Statistic
+    {
+        QString name;
+        quint64 count;
+        // In microseconds
+        qint64 totalTime;
+        qint64 maxTime;
+        quint64 histogram[HistogramBuckets];
+    };
+
+    /**
+     * Times its own lifetime under `name', which must be a string literal
+     * or otherwise outlive the trace
+     */
+    class Scope
+    {
+    public:
+        explicit Scope(const char* name)
+            : m_name(name), m_start(IsEnabled() ? Now() : -1)
+        {
+        }
+
+        ~Scope()
+        {
+            if (m_start >= 0)
+                Record(m_name, m_start, Now() - m_start);
+        }
+
+    private:
+        Scope(const Scope &);
+        Scope & operator=(const Scope &);
+
+        const char* const m_name;
+        const qint64 m_start;
+    };
+
+    // Start or stop collecting. Turning tracing on doesn't forget what was
+    // collected before; see Reset().
+    static void SetEnabled(bool enabled);
+    static bool IsEnabled() { return s_bEnabled; }
+
+    // Forget everything collected so far
+    static void Reset();
+
+    // A clock in microseconds, for Record()
+    static qint64 Now();
+
+    // Add a time of `duration' microseconds, from `start' on, to `name'
+    static void Record(const char* name, qint64 start, qint64 duration);
+
+    // What has been collected, one entry per name, sorted by name
+    static QList<Statistic> GetStatistics();
+
+    // Write the events collected to `device' in the Trace Event Format read
+    // by Chrome's about:tracing and similar viewers. Returns false on I/O
+    // errors.
+    static bool WriteChromeTrace(QIODevice & device);
+
+    // WriteChromeTrace() to the file `filename'
+    static bool WriteChromeTrace(const QString & filename);
+
+private:
+    PerfTrace();
+
+    // Only ever changed by SetEnabled(). A scope that sees a stale value
+    // just records one event too many or too few.
+    static volatile bool s_bEnabled;
+};
+
+#endif
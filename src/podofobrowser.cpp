@@ -22,7 +22,31 @@
 #include "podofoinfodlg.h"
 #include "podofoutil.h"
 #include "backgroundloader.h"
+#include "documentchanges.h"
+#include "documentopener.h"
+#include "documentsaver.h"
+#include "documentsearch.h"
+#include "filteredstreamdevice.h"
+#include "incrementalwriter.h"
+#include "memorybudget.h"
+#include "perfdock.h"
+#include "perftrace.h"
+#include "rawstreamdevice.h"
+#include "referenceindex.h"
+#include "searchdock.h"
+#include "searchindex.h"
+#include "sessioncache.h"
+#include "streamclassifier.h"
+#include "streamcompressor.h"
+#include "streamexporter.h"
+#include "streamreplacer.h"
+#include "structuredock.h"
+#include "structureindex.h"
+#include "textstreamview.h"
+#include "thumbnaildock.h"
+#include "thumbnailloader.h"
 #include "ui_podofoaboutdlg.h"
+#include "ui_podofoexportdlg.h"
 #include "ui_podofofinddlg.h"
 #include "ui_podofogotodlg.h"
 #include "ui_podofogotopagedlg.h"
@@ -34,20 +58,23 @@
 #include <QDockWidget>
 #include <QCursor>
 #include <QDir>
+#include <QEventLoop>
 #include <QFileDialog>
 #include <QFileInfo>
 #include <QInputDialog>
 #include <QLabel>
 #include <QMessageBox>
+#include <QMutexLocker>
 #include <QProgressBar>
 #include <QProgressDialog>
 #include <QPushButton>
+#include <QSet>
 #include <QSettings>
 #include <QSplitter>
 #include <QStatusBar>
 #include <QTextCodec>
 #include <QTextEdit>
-#include <QBuffer>
+#include <QTime>
 
 #include <cassert>
 #include <iostream>
@@ -71,15 +98,47 @@ private:
     unsigned long m_lGeneration;
 };
 
+// Memory the object tree may use unless configured otherwise, in megabytes,
+// and the share of the budget each stream view may cache
+static const int defaultMemoryBudget = 256;
+static const int streamViewCacheShare = 64;
+
+// The smallest and largest budgets that may be set, in megabytes
+static const int minMemoryBudget = 16;
+static const int maxMemoryBudget = 1024 * 1024;
+
 PoDoFoBrowser::PoDoFoBrowser( const QString & filename )
     : QMainWindow(),
       PoDoFoBrowserBase(),
+      m_pMemoryBudget( NULL ),
+      m_memoryBudget( defaultMemoryBudget ),
       m_pDocument( NULL ),
+      m_documentLock( QMutex::Recursive ),
       m_pBackgroundLoader( NULL ),
+      m_pReferenceIndex( NULL ),
+      m_pDocumentChanges( NULL ),
       m_pDelayedLoadProgress( NULL ),
+      m_pOpener( NULL ),
+      m_changesBeforeOpen( 0 ),
+      m_pSaver( NULL ),
+      m_saveFileName(),
+      m_bSaveSucceeded( false ),
+      m_pCancelButton( NULL ),
+      m_pExporter( NULL ),
+      m_pExportProgress( NULL ),
+      m_pSearchIndex( NULL ),
+      m_pSearchDock( NULL ),
+      m_pStructureIndex( NULL ),
+      m_pStructureDock( NULL ),
+      m_pThumbnailLoader( NULL ),
+      m_pThumbnailDock( NULL ),
+      m_pPerfDock( NULL ),
+      m_pSessionCache( NULL ),
+      m_pDocumentSearch( NULL ),
+      m_searchResultCount( 0 ),
       m_bHasFindText( false ),
-      m_pByteArray( NULL ),
-      m_pByteArrayIO (NULL)
+      m_pStreamIO (NULL),
+      m_pTextView( NULL )
 {
     setupUi(this);
     setObjectName(QString::fromUtf8("PoDoFoBrowser"));
@@ -88,22 +147,67 @@ PoDoFoBrowser::PoDoFoBrowser( const QString & filename )
     // tree view
     dockObjects = new QDockWidget(tr("Objects"),this);
     listObjects = new QTreeView(0);
+    // The selected object's stream is the one shown; selecting more is for
+    // replacing text in several streams at once
+    listObjects->setSelectionMode(QAbstractItemView::ExtendedSelection);
     dockObjects->setWidget(listObjects);
     addDockWidget(Qt::TopDockWidgetArea, dockObjects);
+    m_pMemoryBudget = new MemoryBudget(listObjects, this);
+
+    // whole-document search results
+    m_pSearchDock = new SearchDock(this);
+    addDockWidget(Qt::BottomDockWidgetArea, m_pSearchDock);
+    m_pSearchDock->hide();
+    connect( m_pSearchDock, SIGNAL(searchRequested(const QString &)), this, SLOT(searchDocument(const QString &)) );
+    connect( m_pSearchDock, SIGNAL(resultActivated(const PoDoFo::PdfReference &)),
+             this, SLOT(searchResultActivated(const PoDoFo::PdfReference &)) );
+    connect( m_pSearchDock, SIGNAL(cancelRequested()), this, SLOT(searchCancel()) );
+
+    // pages, fonts and images
+    m_pStructureDock = new StructureDock(this);
+    addDockWidget(Qt::LeftDockWidgetArea, m_pStructureDock);
+    m_pStructureDock->hide();
+    menuView->addSeparator();
+    menuView->addAction( m_pStructureDock->toggleViewAction() );
+    connect( m_pStructureDock, SIGNAL(resultActivated(const PoDoFo::PdfReference &)),
+             this, SLOT(searchResultActivated(const PoDoFo::PdfReference &)) );
+
+    // image thumbnails
+    m_pThumbnailDock = new ThumbnailDock(this);
+    addDockWidget(Qt::LeftDockWidgetArea, m_pThumbnailDock);
+    m_pThumbnailDock->hide();
+    menuView->addAction( m_pThumbnailDock->toggleViewAction() );
+    connect( m_pThumbnailDock, SIGNAL(resultActivated(const PoDoFo::PdfReference &)),
+             this, SLOT(searchResultActivated(const PoDoFo::PdfReference &)) );
+
+    // timings, for finding out what's slow
+    m_pPerfDock = new PerfDock(this);
+    addDockWidget(Qt::BottomDockWidgetArea, m_pPerfDock);
+    m_pPerfDock->hide();
+    menuView->addAction( m_pPerfDock->toggleViewAction() );
 
     // stream edition
     slotSetStreamEditable(false);
 
+    m_pTextView = new TextStreamView( stackedWidget );
+    stackedWidget->addWidget( m_pTextView );
+
     m_pDelayedLoadProgress = new QProgressBar( statusBar() );
     m_pDelayedLoadProgress->setFormat( tr("%p% of objects loaded") );
     statusBar()->addPermanentWidget(m_pDelayedLoadProgress);
 
+    m_pCancelButton = new QPushButton( tr("Cancel"), statusBar() );
+    m_pCancelButton->hide();
+    statusBar()->addPermanentWidget(m_pCancelButton);
+    connect( m_pCancelButton, SIGNAL( clicked() ), this, SLOT( cancelTask() ) );
+
     clear();
 
     connect( buttonImport, SIGNAL( clicked() ), this, SLOT( slotImportStream() ) );
     connect( buttonExport, SIGNAL( clicked() ), this, SLOT( slotExportStream() ) );
     connect( fileReloadAction, SIGNAL( activated() ), this, SLOT( fileReload() ) );
     connect( actionInformations, SIGNAL( activated() ), this, SLOT( fileInfo() ) );
+    connect( actionExportStreams, SIGNAL( activated() ), this, SLOT( fileExportStreams() ) );
     connect( actionInsert_Before, SIGNAL( activated() ), this, SLOT( editInsertBefore() ) );
     connect( actionInsert_After,  SIGNAL( activated() ), this, SLOT( editInsertAfter() ) );
     connect( actionInsert_Key,    SIGNAL( activated() ), this, SLOT( editInsertKey() ) );
@@ -111,6 +215,8 @@ PoDoFoBrowser::PoDoFoBrowser( const QString & filename )
     connect( actionRemove_Item,   SIGNAL( activated() ), this, SLOT( editRemoveItem()) );
     connect( actionRefreshView,   SIGNAL( activated() ), this, SLOT( viewRefreshView()) );
     connect( actionCatalogView,   SIGNAL( activated() ), this, SLOT( viewRefreshView()) );
+    connect( actionRawStreamData, SIGNAL( toggled(bool) ), this, SLOT( viewRawStreamData()) );
+    connect( actionMemoryBudget,  SIGNAL( activated() ), this, SLOT( viewMemoryBudget()) );
     connect( actionCreateNewObject, SIGNAL( activated() ), this, SLOT( editCreateNewObject()) );
     connect( actionToolsDisplayCodeForSelection, SIGNAL( activated() ), this, SLOT( toolsDisplayCodeForSelection()) );
     connect( actionFind,          SIGNAL( activated() ), this, SLOT( editFind() ) );
@@ -119,6 +225,8 @@ PoDoFoBrowser::PoDoFoBrowser( const QString & filename )
     connect( actionReplace,       SIGNAL( activated() ), this, SLOT( editReplace() ) );
     connect( actionGotoObject,    SIGNAL( activated() ), this, SLOT( editGotoObject() ) );
     connect( actionGotoPage,      SIGNAL( activated() ), this, SLOT( editGotoPage() ) );
+    connect( actionSearchDocument, SIGNAL( activated() ), this, SLOT( editSearchDocument() ) );
+    connect( actionFindReferrers, SIGNAL( activated() ), this, SLOT( editFindReferrers() ) );
 
     connect( checkEditable, SIGNAL(toggled(bool)), this, SLOT(slotSetStreamEditable(bool)) );
     connect( commitButton, SIGNAL(clicked()), this, SLOT(slotCommitStream()) );
@@ -140,9 +248,15 @@ void PoDoFoBrowser::ModelChange(PdfObjectModel* newModel)
         disconnect( listObjects->selectionModel(), SIGNAL( currentChanged (QModelIndex, QModelIndex) ),
                     this, SLOT( treeSelectionChanged(QModelIndex, QModelIndex) ) );
     }
+    m_pMemoryBudget->Reset();
     listObjects->setModel(newModel);
     if (newModel)
     {
+        newModel->SetBackgroundLoader(m_pBackgroundLoader);
+        newModel->SetReferenceIndex(m_pReferenceIndex);
+        newModel->SetDocumentChanges(m_pDocumentChanges);
+        connect( newModel, SIGNAL(objectChanged(const PoDoFo::PdfReference &)),
+                 this, SLOT(objectChanged(const PoDoFo::PdfReference &)) );
         connect( listObjects->selectionModel(), SIGNAL( currentChanged (QModelIndex, QModelIndex) ),
                  this, SLOT( treeSelectionChanged(QModelIndex, QModelIndex) ) );
     }
@@ -152,32 +266,84 @@ void PoDoFoBrowser::ModelChange(PdfObjectModel* newModel)
 
 void PoDoFoBrowser::DocChange(PdfMemDocument* newDoc)
 {
+    PdfObjectModel* model = static_cast<PdfObjectModel*>(listObjects->model());
+    if (model)
+    {
+        model->SetBackgroundLoader(NULL);
+        model->SetReferenceIndex(NULL);
+        model->SetDocumentChanges(NULL);
+    }
+
+    exportStreamsCancel();
+    delete m_pDocumentSearch;
+    m_pDocumentSearch = NULL;
+    m_pSearchDock->SetBusy( false );
+    delete m_pSearchIndex;
+    m_pSearchIndex = NULL;
+    m_pStructureDock->SetIndex( NULL );
+    m_pThumbnailDock->SetIndex( NULL, NULL );
+    delete m_pThumbnailLoader;
+    m_pThumbnailLoader = NULL;
+    delete m_pStructureIndex;
+    m_pStructureIndex = NULL;
     delete m_pBackgroundLoader;
     m_pBackgroundLoader = NULL;
+    delete m_pReferenceIndex;
+    m_pReferenceIndex = NULL;
+    delete m_pDocumentChanges;
+    m_pDocumentChanges = NULL;
+    m_pendingDeflate.clear();
     m_pDelayedLoadProgress->reset();
+    m_pDelayedLoadProgress->setFormat( tr("%p% of objects loaded") );
     if (newDoc)
     {
-        // create a background loader and hook it up to the progress bar
-        m_pBackgroundLoader = new BackgroundLoader(newDoc);
+        // create a background loader, which also fills in the reference
+        // index, and hook it up to the progress bar. A file we've seen
+        // before has its index saved, which the loader just checks.
+        const bool cached = m_pSessionCache && m_pSessionCache->IsRead();
+        m_pReferenceIndex = cached ? new ReferenceIndex( m_pSessionCache->GetReferenceIndex() ) : new ReferenceIndex();
+        m_pBackgroundLoader = new BackgroundLoader(newDoc, &m_documentLock, this, m_pReferenceIndex);
+        m_pDocumentChanges = new DocumentChanges();
         m_pDelayedLoadProgress->setMaximum( m_pDocument->GetObjects().GetSize() );
         connect( m_pBackgroundLoader, SIGNAL(progress(int)), m_pDelayedLoadProgress, SLOT(setValue(int)) );
         connect( m_pBackgroundLoader, SIGNAL(done()), m_pDelayedLoadProgress, SLOT(reset()) );
+        // indexing waits for loading, rather than fight it for the lock
+        connect( m_pBackgroundLoader, SIGNAL(done()), this, SLOT(startSearchIndex()) );
+        connect( m_pBackgroundLoader, SIGNAL(done()), this, SLOT(startStructureIndex()) );
+
+        // let the view steer it
+        if (model)
+        {
+            model->SetBackgroundLoader(m_pBackgroundLoader);
+            model->SetReferenceIndex(m_pReferenceIndex);
+            model->SetDocumentChanges(m_pDocumentChanges);
+        }
+
+        // then start loading, staying out of the way of the GUI
+        m_pBackgroundLoader->start(QThread::LowPriority);
 
-        // then start loading
-        m_pBackgroundLoader->start();
+        // and the structure index needn't wait for it
+        if (cached)
+        {
+            m_pStructureIndex = new StructureIndex(newDoc, &m_documentLock, this);
+            m_pStructureIndex->Restore( m_pSessionCache->GetEntries(), m_pSessionCache->GetPages() );
+            structureIndexDone();
+        }
     }
 }
 
 PoDoFoBrowser::~PoDoFoBrowser()
 {
+    fileOpenCancel();
+    fileSaveCancel();
     ModelChange(NULL);
     DocChange(NULL);
 
     saveConfig();
 
     delete m_pDocument;
-    delete m_pByteArrayIO;
-    delete m_pByteArray;
+    delete m_pStreamIO;
+    delete m_pSessionCache;
 }
 
 void PoDoFoBrowser::loadConfig()
@@ -205,6 +371,10 @@ void PoDoFoBrowser::loadConfig()
     this->resize( w, h );
 
     actionCatalogView->setChecked( settings.value(QString::fromUtf8("/view/catalog"), actionCatalogView->isChecked() ).toBool() );
+    actionRawStreamData->setChecked( settings.value(QString::fromUtf8("/view/rawstream"), actionRawStreamData->isChecked() ).toBool() );
+    actionSmallStreams->setChecked( settings.value(QString::fromUtf8("/save/smallstreams"), actionSmallStreams->isChecked() ).toBool() );
+    actionSessionCache->setChecked( settings.value(QString::fromUtf8("/cache/sessions"), actionSessionCache->isChecked() ).toBool() );
+    SetMemoryBudget( settings.value(QString::fromUtf8("/memory/budget"), m_memoryBudget ).toInt() );
 }
 
 void PoDoFoBrowser::saveConfig()
@@ -219,12 +389,108 @@ void PoDoFoBrowser::saveConfig()
     settings.setValue(QString::fromUtf8("/geometry/width"), width() );
     settings.setValue(QString::fromUtf8("/geometry/height"), height() );
     settings.setValue(QString::fromUtf8("/view/catalog"), actionCatalogView->isChecked() );
+    settings.setValue(QString::fromUtf8("/view/rawstream"), actionRawStreamData->isChecked() );
+    settings.setValue(QString::fromUtf8("/save/smallstreams"), actionSmallStreams->isChecked() );
+    settings.setValue(QString::fromUtf8("/cache/sessions"), actionSessionCache->isChecked() );
+    settings.setValue(QString::fromUtf8("/memory/budget"), m_memoryBudget );
 
     settings.setValue(QString::fromUtf8("/Stream/Codec"), m_codecForStream->name());
 }
 
+void PoDoFoBrowser::SetMemoryBudget(int megabytes)
+{
+    m_memoryBudget = qBound( minMemoryBudget, megabytes, maxMemoryBudget );
+    const qint64 bytes = static_cast<qint64>(m_memoryBudget) * 1024 * 1024;
+    m_pMemoryBudget->SetBudget( bytes );
+
+    // The stream views only keep a window on what they show, but a big one
+    // makes scrolling back and forth through a large stream smoother
+    const unsigned int viewCache = static_cast<unsigned int>(
+        qBound<qint64>( 1024 * 1024, bytes / streamViewCacheShare, 64 * 1024 * 1024 ) );
+    hexView->setCacheSize( viewCache );
+    m_pTextView->setCacheSize( viewCache );
+}
+
+void PoDoFoBrowser::ClearStreamViews()
+{
+    hexView->clear();
+    m_pTextView->clear();
+    delete m_pStreamIO;
+    m_pStreamIO = NULL;
+}
+
+QIODevice* PoDoFoBrowser::OpenStreamDevice( const PdfObject* object, bool encoded )
+{
+    if (encoded)
+        return new RawStreamDevice( object, &m_documentLock );
+    else
+        return new FilteredStreamDevice( object, &m_documentLock );
+}
+
+QByteArray PoDoFoBrowser::ReadStreamData( const PdfObject* object )
+{
+    bool isFiltered = true;
+    try {
+        isFiltered = !PdfFilterFactory::CreateFilterList( object ).empty();
+    } catch( PdfError & ) {
+        // Leave it to the decoder to complain about
+    }
+
+    PerfTrace::Scope scope( "read-stream" );
+    QIODevice * const device = OpenStreamDevice( object, !isFiltered );
+    const QByteArray data = device->readAll();
+    FilteredStreamDevice * const decoder = dynamic_cast<FilteredStreamDevice*>( device );
+    if (decoder && decoder->HasError())
+    {
+        const PdfError error = decoder->GetError();
+        delete device;
+        throw error;
+    }
+    delete device;
+    return data;
+}
+
+void PoDoFoBrowser::LoadStreamIntoEditor()
+{
+    if (stackedWidget->currentWidget() != m_pTextView)
+        return;
+
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    if (!model)
+        return;
+
+    QMutexLocker lock( &m_documentLock );
+    const PdfObject* object = model->GetObjectForIndex( GetSelectedItem() );
+    if (!object)
+        return;
+
+    // The text view has read its device as far as it got, and a decoder
+    // can't be rewound, so read the stream afresh.
+    QApplication::setOverrideCursor( Qt::WaitCursor );
+    QByteArray data;
+    try {
+        data = ReadStreamData( object );
+    } catch( PdfError & e ) {
+        QApplication::restoreOverrideCursor();
+        podofoError( e );
+        return;
+    }
+
+    ClearStreamViews();
+    textStream->setEnabled(true);
+    {
+        PerfTrace::Scope scope( "text-layout" );
+        textStream->setText( m_codecForStream->toUnicode(data) );
+    }
+    stackedWidget->setCurrentWidget( pageStream );
+    QApplication::restoreOverrideCursor();
+}
+
 void PoDoFoBrowser::clear()
 {
+    // The saver is still reading the document
+    fileSaveCancel();
+
     m_filename = QString::null;
     setWindowTitle( tr("PoDoFoBrowser") );
 
@@ -239,12 +505,10 @@ void PoDoFoBrowser::clear()
 
     delete m_pDocument;
     m_pDocument       = NULL;
+    delete m_pSessionCache;
+    m_pSessionCache   = NULL;
 
-    hexView->clear();
-    delete m_pByteArrayIO;
-    m_pByteArrayIO = NULL;
-    delete m_pByteArray;
-    m_pByteArray = NULL;
+    ClearStreamViews();
 }
 
 void PoDoFoBrowser::fileNew()
@@ -254,68 +518,317 @@ void PoDoFoBrowser::fileNew()
     if( !trySave() ) 
         return;
 
+    fileOpenCancel();
     this->clear();
 
     PdfMemDocument* oldDoc = m_pDocument;
     m_pDocument = new PdfMemDocument();
 
-    ModelChange( new PdfObjectModel(m_pDocument, listObjects, actionCatalogView->isChecked()) );
+    ModelChange( new PdfObjectModel(m_pDocument, listObjects, actionCatalogView->isChecked(), &m_documentLock) );
     DocChange(m_pDocument);
 
     delete oldDoc;
 
-    hexView->clear();
-    delete m_pByteArrayIO;
-    m_pByteArrayIO = NULL;
-    delete m_pByteArray;
-    m_pByteArray = NULL;
+    ClearStreamViews();
 }
 
 void PoDoFoBrowser::fileOpen( const QString & filename )
 {
-    QStringList      lst;
+    // Only one document can be on its way in at a time, and not while the
+    // current one is on its way out
+    if (!CheckNotSaving())
+        return;
+    fileOpenCancel();
 
-    clear();
+    {
+        QMutexLocker lock( &m_documentLock );
+        m_changesBeforeOpen = m_pDocumentChanges ? m_pDocumentChanges->GetChangeCount() : 0;
+    }
 
-    QApplication::setOverrideCursor( Qt::WaitCursor );
+    // The document is parsed on a worker thread. Until it's ready the current
+    // document stays on screen and usable; see fileOpenDone().
+    m_pOpener = new DocumentOpener( filename, this );
+    connect( m_pOpener, SIGNAL( opened() ), this, SLOT( fileOpenDone() ) );
+    connect( m_pOpener, SIGNAL( failed() ), this, SLOT( fileOpenFailed() ) );
+    if (actionSessionCache->isChecked())
+        m_pOpener->ReadSessionCache();
+
+    // The progress bar belongs to the opener until it's done. PoDoFo can't
+    // tell us how far through the file it is, so all we can show is that
+    // we're busy.
+    if (m_pBackgroundLoader)
+        disconnect( m_pBackgroundLoader, 0, m_pDelayedLoadProgress, 0 );
+    if (m_pSearchIndex)
+        disconnect( m_pSearchIndex, 0, m_pDelayedLoadProgress, 0 );
+    m_pDelayedLoadProgress->setRange( 0, 0 );
+    m_pCancelButton->show();
+    statusBar()->showMessage( tr("Opening file %1 ...").arg( filename ) );
+
+    m_pOpener->start();
+}
 
-    PdfMemDocument* oldDoc = m_pDocument;
-    try {
-        m_pDocument = new PdfMemDocument( filename.toLocal8Bit().data() );
-        delete oldDoc;
-    } catch( PdfError & e ) {
-        QApplication::restoreOverrideCursor();
-        podofoError( e );
+void PoDoFoBrowser::fileOpenDone()
+{
+    DocumentOpener* opener = m_pOpener;
+    m_pOpener = NULL;
+    m_pCancelButton->hide();
+
+    const QString filename = opener->GetFileName();
+    PdfMemDocument* newDoc = opener->TakeDocument();
+    SessionCache* newCache = opener->TakeSessionCache();
+    opener->deleteLater();
+
+    // The current document stayed usable while the new one was parsed, so
+    // it may have been edited since, which the user hasn't been asked
+    // about, or be being saved. Keep it if they'd rather not let it go.
+    const bool saved = WaitForSave();
+    int changes;
+    {
+        QMutexLocker lock( &m_documentLock );
+        changes = m_pDocumentChanges ? m_pDocumentChanges->GetChangeCount() : 0;
+    }
+    if ((!saved || changes != m_changesBeforeOpen) && !trySave())
+    {
+        delete newCache;
+        delete newDoc;
+        EndTaskProgress();
+        statusBar()->showMessage( tr("Opening cancelled"), 2000 );
         return;
     }
 
-    ModelChange( new PdfObjectModel(m_pDocument, listObjects, actionCatalogView->isChecked()) );
-    DocChange(m_pDocument);
-
+    // Only now that the new document is complete do we let go of the old one
+    clear();
+    m_pDocument = newDoc;
+    m_pSessionCache = newCache;
     SetFileName( filename );
 
-    QApplication::restoreOverrideCursor();
+    ModelChange( new PdfObjectModel(m_pDocument, listObjects, actionCatalogView->isChecked(), &m_documentLock) );
+    DocChange(m_pDocument);
+
     statusBar()->showMessage( tr("Opened file %1 successfully").arg( filename ), 2000 );
 }
 
+void PoDoFoBrowser::fileOpenFailed()
+{
+    DocumentOpener* opener = m_pOpener;
+    m_pOpener = NULL;
+    EndTaskProgress();
+
+    statusBar()->clearMessage();
+    podofoError( opener->GetError() );
+    opener->deleteLater();
+}
+
+void PoDoFoBrowser::fileOpenCancel()
+{
+    if (!m_pOpener)
+        return;
+
+    // The opener deletes itself once its worker is done. Don't keep it as
+    // a child, or closing the window would have to wait for the parser.
+    disconnect( m_pOpener, 0, this, 0 );
+    m_pOpener->setParent( NULL );
+    m_pOpener->Cancel();
+    m_pOpener = NULL;
+
+    EndTaskProgress();
+    statusBar()->showMessage( tr("Opening cancelled"), 2000 );
+}
+
+void PoDoFoBrowser::cancelTask()
+{
+    if (m_pOpener)
+        fileOpenCancel();
+    else
+        fileSaveCancel();
+}
+
+void PoDoFoBrowser::EndTaskProgress()
+{
+    m_pCancelButton->hide();
+
+    // Hand the progress bar back to the current document's loader or
+    // search index, if any
+    m_pDelayedLoadProgress->reset();
+    m_pDelayedLoadProgress->setRange( 0, m_pDocument ? m_pDocument->GetObjects().GetSize() : 0 );
+    m_pDelayedLoadProgress->setFormat( tr("%p% of objects loaded") );
+    if (m_pBackgroundLoader)
+    {
+        connect( m_pBackgroundLoader, SIGNAL(progress(int)), m_pDelayedLoadProgress, SLOT(setValue(int)) );
+        connect( m_pBackgroundLoader, SIGNAL(done()), m_pDelayedLoadProgress, SLOT(reset()) );
+    }
+    if (m_pSearchIndex && !m_pSearchIndex->IsReady())
+    {
+        m_pDelayedLoadProgress->setFormat( tr("%p% of objects indexed") );
+        connect( m_pSearchIndex, SIGNAL(progress(int)), m_pDelayedLoadProgress, SLOT(setValue(int)) );
+    }
+}
+
 bool PoDoFoBrowser::fileSave( const QString & filename )
 {
-    QApplication::setOverrideCursor( Qt::WaitCursor );
+    if (m_pSaver || !m_pDocument)
+        return false;
 
-    try {
-        m_pDocument->Write( filename.toLocal8Bit().data() );
-    } catch( PdfError & e ) {
+    // We can't just overwrite the existing file, since we might have file
+    // streams reading from it as we write. Instead we write to a temp file
+    // beside it, and then move that over the original in one step, so we
+    // never leave it half written or missing.
+    const QString tmpFileName = TempFileNameFor( filename );
+    QFile::remove( tmpFileName );
+
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    QMutexLocker lock( &m_documentLock );
+    if (!DocumentSaver::CanSave( m_pDocument ))
+    {
+        // The saver can't encrypt, so let PoDoFo write the lot while we wait
+        QApplication::setOverrideCursor( Qt::WaitCursor );
+        lock.unlock();
+        CompressPendingStreams();
+        lock.relock();
+        try {
+            PerfTrace::Scope scope( "save-podofo" );
+            m_pDocument->Write( tmpFileName.toLocal8Bit().data() );
+        } catch( PdfError & e ) {
+            QApplication::restoreOverrideCursor();
+            QFile::remove( tmpFileName );
+            podofoError( e );
+            return false;
+        }
         QApplication::restoreOverrideCursor();
-        podofoError( e );
+        lock.unlock();
+        return FinishSave( tmpFileName, filename );
+    }
+
+    // Otherwise write it on a worker thread, keeping everyone's hands off the
+    // document until it's done; see fileSaveDone().
+    m_pSaver = new DocumentSaver( m_pDocument, &m_documentLock, tmpFileName, this );
+    m_pSaver->CompressStreamsFirst( std::vector<PdfReference>( m_pendingDeflate.begin(), m_pendingDeflate.end() ),
+            actionSmallStreams->isChecked() ? StreamCompressor::Level_Small : StreamCompressor::Level_Fast );
+    m_saveFileName = filename;
+    connect( m_pSaver, SIGNAL( saved() ), this, SLOT( fileSaveDone() ) );
+    connect( m_pSaver, SIGNAL( failed() ), this, SLOT( fileSaveFailed() ) );
+    if (model)
+        model->SetReadOnly( true );
+    lock.unlock();
+
+    // The progress bar belongs to the saver until it's done
+    if (m_pBackgroundLoader)
+        disconnect( m_pBackgroundLoader, 0, m_pDelayedLoadProgress, 0 );
+    if (m_pSearchIndex)
+        disconnect( m_pSearchIndex, 0, m_pDelayedLoadProgress, 0 );
+    m_pDelayedLoadProgress->reset();
+    m_pDelayedLoadProgress->setRange( 0, m_pSaver->GetObjectCount() );
+    m_pDelayedLoadProgress->setFormat( tr("%p% of objects saved") );
+    connect( m_pSaver, SIGNAL(progress(int)), m_pDelayedLoadProgress, SLOT(setValue(int)) );
+    m_pCancelButton->show();
+    statusBar()->showMessage( tr("Saving file %1 ...").arg( filename ) );
+    UpdateMenus();
+
+    m_pSaver->start();
+    return true;
+}
+
+void PoDoFoBrowser::fileSaveDone()
+{
+    DocumentSaver* saver = m_pSaver;
+    m_pSaver = NULL;
+    EndTaskProgress();
+    saver->deleteLater();
+    // Whatever the saver did with them, they're not worth another try
+    m_pendingDeflate.clear();
+
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    if (model)
+        model->SetReadOnly( false );
+    m_bSaveSucceeded = FinishSave( saver->GetFileName(), m_saveFileName );
+    UpdateMenus();
+}
+
+void PoDoFoBrowser::fileSaveFailed()
+{
+    DocumentSaver* saver = m_pSaver;
+    m_pSaver = NULL;
+    EndTaskProgress();
+    saver->deleteLater();
+    m_pendingDeflate.clear();
+
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    if (model)
+        model->SetReadOnly( false );
+    m_bSaveSucceeded = false;
+    UpdateMenus();
+
+    statusBar()->clearMessage();
+    QMessageBox::critical(this, tr("Saving failed"),
+            tr("Unable to save %1:\n%2").arg(m_saveFileName).arg(saver->GetErrorString()));
+}
+
+void PoDoFoBrowser::fileSaveCancel()
+{
+    if (!m_pSaver)
+        return;
+
+    // Unlike the opener, the saver stops within a batch, so just wait
+    const QString tmpFileName = m_pSaver->GetFileName();
+    delete m_pSaver;
+    m_pSaver = NULL;
+    // It may have finished writing before noticing it was cancelled
+    QFile::remove( tmpFileName );
+    m_bSaveSucceeded = false;
+
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    if (model)
+        model->SetReadOnly( false );
+    EndTaskProgress();
+    UpdateMenus();
+    statusBar()->showMessage( tr("Saving cancelled"), 2000 );
+}
+
+QString PoDoFoBrowser::TempFileNameFor( const QString & filename ) const
+{
+    const QFileInfo info( filename );
+    return info.dir().absoluteFilePath(
+            QString::fromUtf8(".") + QString::number(QCoreApplication::applicationPid())
+            + QString::fromUtf8("-") + info.fileName() );
+}
+
+bool PoDoFoBrowser::FinishSave( const QString & tmpFileName, const QString & filename )
+{
+    if (!replaceFile( tmpFileName, filename ))
+    {
+        QMessageBox::critical(this, tr("Saving failed"),
+                tr("Unable to save %1:\n%2").arg(filename)
+                .arg(tr("Unable to replace the original file, which is unchanged. The new version is in \"%1\".").arg(tmpFileName)));
         return false;
     }
 
-    QApplication::restoreOverrideCursor();
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    if (model)
+        model->ClearChangedObjects();
+    SetFileName( filename );
     statusBar()->showMessage( tr("Wrote file %1 successfully").arg( filename ), 2000 );
+    return true;
+}
 
-    SetFileName( filename );
+bool PoDoFoBrowser::WaitForSave()
+{
+    if (!m_pSaver)
+        return true;
+
+    m_bSaveSucceeded = false;
+    // The save ends in a queued signal from the worker, or the Cancel button
+    while (m_pSaver)
+        QCoreApplication::processEvents( QEventLoop::WaitForMoreEvents );
+    return m_bSaveSucceeded;
+}
 
-    return true;
+bool PoDoFoBrowser::CheckNotSaving()
+{
+    if (!m_pSaver)
+        return true;
+
+    statusBar()->showMessage( tr("The document can't be changed while it's being saved"), 2000 );
+    return false;
 }
 
 void PoDoFoBrowser::UpdateMenus()
@@ -323,24 +836,29 @@ void PoDoFoBrowser::UpdateMenus()
     PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
     QModelIndex sel = GetSelectedItem();
 
-    fileSaveAction->setEnabled(model != 0);
-    fileSaveAsAction->setEnabled(model != 0);
-    fileReloadAction->setEnabled(model != 0 && !m_filename.isEmpty() && model->DocChanged() );
+    QMutexLocker lock( &m_documentLock );
+
+    // Nothing may change the document while it's being saved
+    const bool saving = m_pSaver != 0;
+    fileSaveAction->setEnabled(model != 0 && !saving);
+    fileSaveAsAction->setEnabled(model != 0 && !saving);
+    fileReloadAction->setEnabled(model != 0 && !saving && !m_filename.isEmpty() && model->DocChanged() );
+    actionExportStreams->setEnabled(model != 0 && !m_pExporter);
     actionRefreshView->setEnabled(model != 0);
     actionCatalogView->setEnabled(model != 0);
     actionGotoObject->setEnabled(model != 0 && !actionCatalogView->isChecked() );
 
     // Can add a child to any array or dictionary
-    actionInsert_Child->setEnabled( sel.isValid() && (model->IndexIsDictionary(sel) || model->IndexIsArray(sel)) );
+    actionInsert_Child->setEnabled( sel.isValid() && !saving && (model->IndexIsDictionary(sel) || model->IndexIsArray(sel)) );
     // Can create a new indirect object in place of any value
-    actionCreateNewObject->setEnabled( sel.isValid() );
+    actionCreateNewObject->setEnabled( sel.isValid() && !saving );
 
     QModelIndex parent = sel.parent();
-    bool enableInsertBeforeAfter = parent.isValid() && model->IndexIsArray(parent);
+    bool enableInsertBeforeAfter = parent.isValid() && !saving && model->IndexIsArray(parent);
     actionInsert_Before->setEnabled(enableInsertBeforeAfter);
     actionInsert_After->setEnabled(enableInsertBeforeAfter);
-    actionInsert_Key->setEnabled(parent.isValid() && model->IndexIsDictionary(parent));
-    actionRemove_Item->setEnabled(sel.isValid() && !model->GetObjectForIndex(sel)->Reference().IsIndirect());
+    actionInsert_Key->setEnabled(parent.isValid() && !saving && model->IndexIsDictionary(parent));
+    actionRemove_Item->setEnabled(sel.isValid() && !saving && !model->GetObjectForIndex(sel)->Reference().IsIndirect());
 
     // DS: parent.isValid() is never true, if not in catalog view mode
     //     and should not be needed anyways
@@ -351,9 +869,13 @@ void PoDoFoBrowser::UpdateMenus()
     actionFind->setEnabled( enableFind );
     actionFindNext->setEnabled( enableFind && m_bHasFindText );
     actionFindPrevious->setEnabled( enableFind && m_bHasFindText );
-    actionReplace->setEnabled( enableFind );
+    actionReplace->setEnabled( enableFind && !saving );
 
     actionToolsDisplayCodeForSelection->setEnabled( sel.isValid() );
+
+    // Can list the referrers of an indirect object or of a reference's target
+    actionFindReferrers->setEnabled( sel.isValid() && m_pReferenceIndex
+            && (model->IndexIsReference(sel) || model->GetObjectForIndex(sel)->Reference().IsIndirect()) );
 }
 
  void PoDoFoBrowser::SetFileName(const QString& name)
@@ -372,11 +894,7 @@ void PoDoFoBrowser::treeSelectionChanged( const QModelIndex & current, const QMo
     buttonExport->setEnabled( false );
     textStream->setEnabled(false);
         
-    hexView->clear();
-    delete m_pByteArrayIO;
-    m_pByteArrayIO = NULL;
-    delete m_pByteArray;
-    m_pByteArray = NULL;
+    ClearStreamViews();
 
     // make keyboard navigation easier, especially in Catalog View mode
     // hopefully this does not slow down to much.
@@ -393,6 +911,8 @@ void PoDoFoBrowser::treeSelectionChanged( const QModelIndex & current, const QMo
         return;
     }
 
+    QMutexLocker lock( &m_documentLock );
+
     const PdfObject* object = model->GetObjectForIndex(current);
     if (!object)
     {
@@ -425,58 +945,119 @@ void PoDoFoBrowser::treeSelectionChanged( const QModelIndex & current, const QMo
     buttonImport->setEnabled( true );
 
     // XXX this should be in the model
-    const PdfStream * const stream = object->GetStream();
-    char * pBuf = NULL;
-    pdf_long lLen = -1;
+    // Streams without filters, or all streams if the user asked for the
+    // encoded data, are shown straight from the document's copy of the stored
+    // bytes. Anything else is decoded progressively as the viewer asks for
+    // it. Either way we can show the start of even a huge stream at once.
+    const bool showEncoded = actionRawStreamData->isChecked();
+    bool isFiltered = true;
+    try {
+        isFiltered = !PdfFilterFactory::CreateFilterList( object ).empty();
+    } catch( PdfError & ) {
+        // Leave it to the decoder to complain about
+    }
+
+    QIODevice * device = NULL;
     try {
-        stream->GetFilteredCopy( &pBuf, &lLen );
+        device = OpenStreamDevice( object, showEncoded || !isFiltered );
     } catch( PdfError & e ) {
-        labelStream->setText( tr("Unable to filter object stream") );
+        labelStream->setText( tr("Unable to read object stream") );
         podofoError( e );
         return;
     }
 
-    assert(pBuf);
-    assert(lLen >= 0);
+    // Pick a viewer. The dictionary settles most streams, such as images and
+    // fonts, without reading any data; otherwise we sniff the start of it.
+    FilteredStreamDevice * const decoder = dynamic_cast<FilteredStreamDevice*>( device );
+    StreamContent content = classifyStreamDictionary( object, showEncoded );
+    if (content == StreamContent_Unknown)
+    {
+        const QByteArray probe = device->peek( streamSniffSize );
+        if (decoder && decoder->HasError())
+        {
+            labelStream->setText( tr("Unable to filter object stream") );
+            podofoError( decoder->GetError() );
+            delete device;
+            return;
+        }
+        content = classifyStreamData( probe.constData(), probe.size() );
+    }
 
-    // Quick and dirty binary-ness test
-    // TODO: sane encoding-safe approach to binary data
-    // TODO: hex editor
     QString displayInfo;
-    const bool isBinary = std::find(pBuf, pBuf+lLen, 0) != pBuf+lLen;
-    if (!isBinary)
+    qint64 lLen = decoder ? -1 : device->size();
+    const bool isBinary = content == StreamContent_Binary;
+    // Text up to this size goes to the text editor, which lays out all of
+    // it at once. Anything bigger is paged in by m_pTextView as it's shown.
+    static const qint64 editorTextLimit = 1024 * 1024;
+    if (!isBinary && device->peek( editorTextLimit + 1 ).size() > editorTextLimit)
     {
+        if (decoder && decoder->HasError())
+        {
+            labelStream->setText( tr("Unable to filter object stream") );
+            podofoError( decoder->GetError() );
+            delete device;
+            return;
+        }
+        m_pStreamIO = device;
+        m_pTextView->setData( m_pStreamIO, m_codecForStream );
+        displayInfo = tr("displayed as it is read");
+        stackedWidget->setCurrentWidget( m_pTextView );
+    }
+    else if (!isBinary)
+    {
+        // The text editor needs all of it anyway
+        QByteArray pArray = device->readAll();
+        lLen = pArray.size();
+        if (decoder && decoder->HasError())
+        {
+            labelStream->setText( tr("Unable to filter object stream") );
+            podofoError( decoder->GetError() );
+            delete device;
+            return;
+        }
+        delete device;
+
         // TODO FIXME XXX AUUGH! Encoding assumption like nothing ever
         // seen before!
-//        QString data = QString::fromAscii(pBuf, lLen);
-	QByteArray pArray(pBuf, lLen);
-	QString data = m_codecForStream->toUnicode(pArray);
+        QString data = m_codecForStream->toUnicode(pArray);
         textStream->setEnabled(true);
-        textStream->setText( data );
+        {
+            PerfTrace::Scope scope( "text-layout" );
+            textStream->setText( data );
+        }
         displayInfo = tr("displayed in full");
         stackedWidget->setCurrentWidget( pageStream );
     }
     else
     {
-	// Read the whole stream into memory and point the hex editor at it.
-	// Later we'll support progressive I/O.
-        m_pByteArray = new QByteArray( pBuf, lLen );
-	m_pByteArrayIO = new QBuffer( m_pByteArray );
-	// Open for random R/W I/O
-	m_pByteArrayIO->open(QIODevice::ReadWrite);
-	// and tell the hex editor to display the new data
-        hexView->setData( m_pByteArrayIO, m_pByteArrayIO->size() );
-        displayInfo = tr("contains binary data");
+        // Point the hex editor straight at the device. It'll only read what
+        // the user scrolls to.
+        m_pStreamIO = device;
+        hexView->setData( m_pStreamIO, decoder ? QHexView::unknownSize : static_cast<size_t>(lLen) );
+        displayInfo = showEncoded ? tr("shown as stored in the file") : tr("contains binary data");
         stackedWidget->setCurrentWidget( pageHexView );
     }
-    free( pBuf );
 
-    labelStream->setText( tr("Stream from object %1 %2 obj of unfiltered length %3 bytes %4")
-            .arg(ref.ObjectNumber())
-            .arg(ref.GenerationNumber())
-            .arg(lLen)
-            .arg(displayInfo)
-            );
+    if (lLen < 0)
+        labelStream->setText( tr("Stream from object %1 %2 obj %3")
+                .arg(ref.ObjectNumber())
+                .arg(ref.GenerationNumber())
+                .arg(displayInfo)
+                );
+    else if (showEncoded)
+        labelStream->setText( tr("Stream from object %1 %2 obj of encoded length %3 bytes %4")
+                .arg(ref.ObjectNumber())
+                .arg(ref.GenerationNumber())
+                .arg(lLen)
+                .arg(displayInfo)
+                );
+    else
+        labelStream->setText( tr("Stream from object %1 %2 obj of unfiltered length %3 bytes %4")
+                .arg(ref.ObjectNumber())
+                .arg(ref.GenerationNumber())
+                .arg(lLen)
+                .arg(displayInfo)
+                );
     buttonImport->setEnabled( true );
     buttonExport->setEnabled( true );
 
@@ -495,49 +1076,50 @@ void PoDoFoBrowser::fileOpen()
 
 bool PoDoFoBrowser::fileSave()
 {
+    if( m_pSaver )
+        return false;
     if( m_filename.isEmpty() )
         return fileSaveAs();
-    else
+
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    const QString origFileName = m_filename;
+
+    // Where we can, just append the changed objects to the file
     {
-        // can't just overwrite existing file, since we might have file streams
-        // reading from it as we write. Instead we write to a temp file and then
-	// swap it with the original.
-	    // lets try something else. pm
-        const QString origFileName = m_filename;
-	const QFileInfo origFileInfo(origFileName);
-	QDir tmpDir = QDir::temp();
-	const QString tmpFileName = QString::number(QCoreApplication::applicationPid())
-				    + QString::fromAscii("-")
-				    + origFileInfo.fileName();
-	tmpDir.remove(tmpFileName);
-        bool success = false;
-        QString message;
-
-	if (!fileSave( tmpDir.absoluteFilePath(tmpFileName) ))
-	{
-		message = tr("Unable to write file \"%1\"").arg(tmpDir.absoluteFilePath(tmpFileName));
-		tmpDir.remove(tmpFileName);
-	}
-	else
-	{
-		if(!QFile::remove(origFileName))
-		{
-			message = tr("Unable to remove original file.");
-		}
-		else if(!QFile::copy(tmpDir.absoluteFilePath(tmpFileName), origFileName))
-		{
-			message = tr("Unable to replace original file by the new file \"%1\".\nNote that the original file has been already removed.").arg(tmpDir.absoluteFilePath(tmpFileName));
-		}
-		else
-			success = true;
-	}
-	SetFileName( origFileName );
+        QMutexLocker lock( &m_documentLock );
+        IncrementalWriter writer( m_pDocument, origFileName );
+        // which is only safe if we know what they all are
+        if (model && model->ChangedObjectsComplete() && writer.CanUpdate())
+        {
+            const std::vector<PdfReference> changed = model->GetChangedObjects();
+            QApplication::setOverrideCursor( Qt::WaitCursor );
+            lock.unlock();
+            CompressPendingStreams();
+            lock.relock();
+            bool success = false;
+            try {
+                success = writer.Write( changed );
+            } catch( PdfError & e ) {
+                QApplication::restoreOverrideCursor();
+                podofoError( e );
+                return false;
+            }
+            QApplication::restoreOverrideCursor();
 
-        if (!success)
-            QMessageBox::critical(this, tr("Saving failed"),
-		    tr("Unable to save %1:\n%2").arg(origFileName).arg(message));
-        return success;
+            if (!success)
+            {
+                QMessageBox::critical(this, tr("Saving failed"),
+                        tr("Unable to save %1:\n%2").arg(origFileName).arg(writer.ErrorString()));
+                return false;
+            }
+            model->ClearChangedObjects();
+            statusBar()->showMessage( tr("Appended %1 changed objects to %2").arg( changed.size() ).arg( origFileName ), 2000 );
+            return true;
+        }
     }
+
+    // Otherwise write the whole document out afresh
+    return fileSave( origFileName );
 }
 
 bool PoDoFoBrowser::fileSaveAs()
@@ -567,11 +1149,84 @@ void PoDoFoBrowser::fileInfo()
 {
 	if(m_pDocument)
 	{
+		QMutexLocker lock( &m_documentLock );
 		PodofoInfoDialog infoDlg( m_filename , m_pDocument , this);
+		lock.unlock();
 		infoDlg.exec();
 	}
 }
 
+void PoDoFoBrowser::fileExportStreams()
+{
+    if (!m_pDocument || m_pExporter)
+        return;
+
+    QDialog dlg( this );
+    Ui::PoDoFoExportDlg dlgUi;
+    dlgUi.setupUi( &dlg );
+    dlgUi.lineValue->selectAll();
+    if (dlg.exec() != QDialog::Accepted)
+        return;
+
+    // In the order of the combo box, whose labels may be translated
+    static const char* const keys[] = { "Type", "Subtype", "Filter" };
+    const int keyIdx = qBound( 0, dlgUi.comboKey->currentIndex(), static_cast<int>(sizeof(keys) / sizeof(keys[0])) - 1 );
+    QString value = dlgUi.lineValue->text().trimmed();
+    if (value.startsWith( QLatin1Char('/') ))
+        value.remove( 0, 1 );
+    if (value.isEmpty())
+        return;
+
+    const QString dir = QFileDialog::getExistingDirectory( this, tr("Export streams to") );
+    if (dir.isEmpty())
+        return;
+
+    m_pExporter = new StreamExporter( m_pDocument, &m_documentLock, PdfName( keys[keyIdx] ),
+                                      PdfName( value.toUtf8().data() ), dir, this );
+    connect( m_pExporter, SIGNAL( finished() ), this, SLOT( exportStreamsDone() ) );
+
+    m_pExportProgress = new QProgressDialog( tr("Exporting streams to %1 ...").arg( dir ), tr("Cancel"),
+                                             0, m_pExporter->GetObjectCount(), this );
+    m_pExportProgress->setAutoClose( false );
+    m_pExportProgress->setAutoReset( false );
+    connect( m_pExporter, SIGNAL( progress(int) ), m_pExportProgress, SLOT( setValue(int) ) );
+    connect( m_pExportProgress, SIGNAL( canceled() ), this, SLOT( exportStreamsCancel() ) );
+    m_pExportProgress->show();
+    UpdateMenus();
+}
+
+void PoDoFoBrowser::exportStreamsDone()
+{
+    const int exported = m_pExporter->GetExportedCount();
+    const int failed = m_pExporter->GetFailedCount();
+    m_pExporter->deleteLater();
+    m_pExporter = NULL;
+    m_pExportProgress->deleteLater();
+    m_pExportProgress = NULL;
+    UpdateMenus();
+
+    if (failed)
+        QMessageBox::warning( this, tr("Export Streams"),
+                tr("Exported %1 streams. %2 more couldn't be decoded or written.").arg( exported ).arg( failed ) );
+    else
+        statusBar()->showMessage( tr("Exported %1 streams").arg( exported ), 2000 );
+}
+
+void PoDoFoBrowser::exportStreamsCancel()
+{
+    if (!m_pExporter)
+        return;
+
+    const int exported = m_pExporter->GetExportedCount();
+    delete m_pExporter;
+    m_pExporter = NULL;
+    // This may be its own canceled() signal
+    m_pExportProgress->deleteLater();
+    m_pExportProgress = NULL;
+    UpdateMenus();
+    statusBar()->showMessage( tr("Export cancelled after %1 streams").arg( exported ), 2000 );
+}
+
 void PoDoFoBrowser::fileExit()
 {
    if( !trySave() ) 
@@ -710,6 +1365,8 @@ void PoDoFoBrowser::editFind()
 
 void PoDoFoBrowser::editFindNext()
 {
+    LoadStreamIntoEditor();
+
     if( !textStream->find( m_sFindText, m_findFlags ) )
         QMessageBox::warning( this, tr("Find Next"), tr("The Text \"%1\" could not be found!").arg( m_sFindText ) );
 
@@ -718,6 +1375,8 @@ void PoDoFoBrowser::editFindNext()
 
 void PoDoFoBrowser::editFindPrevious()
 {
+    LoadStreamIntoEditor();
+
     int  cursorPos = textStream->textCursor().position();
     bool bFound = textStream->find( m_sFindText, m_findFlags | QTextDocument::FindBackward );
     
@@ -740,14 +1399,30 @@ void PoDoFoBrowser::editFindPrevious()
 
 void PoDoFoBrowser::editReplace()
 {
+    if (!CheckNotSaving())
+        return;
+
     Ui::PoDoFoReplaceDlg dlgui;
     QDialog dlg;
     dlgui.setupUi( &dlg );
+    dlgui.checkBoxSelectedStreams->setEnabled( listObjects->selectionModel()->selectedRows().size() > 1 );
 
     if( dlg.exec() == QDialog::Accepted ) 
     {
         QString sFind     = dlgui.comboBoxText->currentText();
         QString sReplace  = dlgui.comboBoxReplace->currentText();
+        const StreamReplacer replacer( m_codecForStream->fromUnicode( sFind ),
+                                       m_codecForStream->fromUnicode( sReplace ),
+                                       dlgui.checkBoxCaseSensitive->isChecked(),
+                                       dlgui.checkBoxWholeWords->isChecked() );
+
+        if( dlgui.checkBoxSelectedStreams->isEnabled() && dlgui.checkBoxSelectedStreams->isChecked() )
+        {
+            ReplaceInSelectedStreams( replacer, sFind );
+            return;
+        }
+
+        LoadStreamIntoEditor();
 
         QTextDocument::FindFlags findFlags = 0;
 
@@ -766,6 +1441,15 @@ void PoDoFoBrowser::editReplace()
 
         while( true ) 
         {
+            // Without prompting, replace the lot in one go
+            if( !bPrompt )
+            {
+                nCount += ReplaceRestInEditor( replacer, bBackwards );
+                if( !nCount )
+                    QMessageBox::warning( this, tr("Replace"), tr("The Text \"%1\" could not be found!").arg( sFind ) );
+                break;
+            }
+
             // Find the text
             // TODO: Reg exp
             bool bFound;
@@ -818,8 +1502,9 @@ void PoDoFoBrowser::editReplace()
                 } 
                 else if (msgBox.clickedButton() == buttonReplaceAll) 
                 {
+                    // this match and all that follow
                     bPrompt = false;
-                    bPerformReplace = true;
+                    continue;
                 }
                 else if (msgBox.clickedButton() == buttonFindNext) 
                 {
@@ -845,6 +1530,85 @@ void PoDoFoBrowser::editReplace()
     }
 }
 
+int PoDoFoBrowser::ReplaceRestInEditor( const StreamReplacer & replacer, bool backwards )
+{
+    // From the cursor, or its selection, to the end of the text, or to the
+    // start when going backwards
+    QTextCursor cursor = textStream->textCursor();
+    const QString text = textStream->toPlainText();
+    const int begin = backwards ? 0 : cursor.selectionStart();
+    const int end = backwards ? cursor.selectionEnd() : text.length();
+
+    QByteArray replaced;
+    const int count = replacer.Replace( m_codecForStream->fromUnicode( text.mid( begin, end - begin ) ), replaced );
+    if (!count)
+        return 0;
+
+    // A single edit, so the document is laid out again just once and the
+    // lot can be undone in one step
+    QApplication::setOverrideCursor( Qt::WaitCursor );
+    cursor.setPosition( begin );
+    cursor.setPosition( end, QTextCursor::KeepAnchor );
+    cursor.insertText( m_codecForStream->toUnicode( replaced ) );
+    textStream->setTextCursor( cursor );
+    QApplication::restoreOverrideCursor();
+    return count;
+}
+
+void PoDoFoBrowser::ReplaceInSelectedStreams( const StreamReplacer & replacer, const QString & sFind )
+{
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    if (!model)
+        return;
+
+    QApplication::setOverrideCursor( Qt::WaitCursor );
+    int nCount = 0;
+    int nStreams = 0;
+    int nFailed = 0;
+    {
+        QMutexLocker lock( &m_documentLock );
+        const PdfObject * const current = model->GetObjectForIndex( GetSelectedItem() );
+        const QModelIndexList rows = listObjects->selectionModel()->selectedRows();
+        // The same object can be selected more than once in catalog view
+        QSet<const PdfObject*> done;
+        for (QModelIndexList::const_iterator it = rows.begin(); it != rows.end(); ++it)
+        {
+            const PdfObject * const obj = model->GetObjectForIndex( *it );
+            if (!obj || !obj->HasStream() || done.contains( obj ))
+                continue;
+            done.insert( obj );
+
+            try {
+                // Keep any edits not yet committed from the editor
+                const QByteArray data = (obj == current && stackedWidget->currentWidget() == pageStream)
+                    ? m_codecForStream->fromUnicode( textStream->toPlainText() )
+                    : ReadStreamData( obj );
+
+                QByteArray replaced;
+                const int count = replacer.Replace( data, replaced );
+                if (count)
+                {
+                    SetStreamData( obj, replaced );
+                    nCount += count;
+                    ++nStreams;
+                }
+            } catch( PdfError & ) {
+                // Don't write back what we couldn't read properly
+                ++nFailed;
+            }
+        }
+    }
+
+    // Show the current stream as it is now
+    treeSelectionChanged( GetSelectedItem(), QModelIndex() );
+    QApplication::restoreOverrideCursor();
+
+    QString message = tr("Replaced %1 occurences of \"%2\" in %3 streams.").arg( nCount ).arg( sFind ).arg( nStreams );
+    if (nFailed)
+        message += QString::fromUtf8(" ") + tr("%1 streams could not be decoded and were left alone.").arg( nFailed );
+    QMessageBox::information( this, tr("Replace"), message );
+}
+
 void PoDoFoBrowser::editGotoObject()
 {
     QDialog dlg( this );
@@ -872,21 +1636,58 @@ void PoDoFoBrowser::editGotoPage()
 
     dlgUi.spinPage->setValue( 0 );
     dlgUi.spinPage->setMinimum( 1 );
-    dlgUi.spinPage->setMaximum( m_pDocument->GetPageCount() );
+    {
+        QMutexLocker lock( &m_documentLock );
+        dlgUi.spinPage->setMaximum( m_pDocument->GetPageCount() );
+    }
     dlgUi.spinPage->selectAll();
 
     if( dlg.exec() == QDialog::Accepted ) 
     {
-        PdfPage* pPage = m_pDocument->GetPage( dlgUi.spinPage->value() - 1 );
+        const int page = dlgUi.spinPage->value() - 1;
+        // The index has the pages in order, so there's no need to walk the
+        // page tree for them
+        if (m_pStructureIndex && m_pStructureIndex->IsReady()
+            && page < static_cast<int>(m_pStructureIndex->GetPages().size()))
+        {
+            m_gotoReference = m_pStructureIndex->GetPages()[page];
+            this->GotoObject();
+            return;
+        }
+
+        QMutexLocker lock( &m_documentLock );
+        PdfPage* pPage = m_pDocument->GetPage( page );
         if( pPage ) 
         {
             m_gotoReference = pPage->GetObject()->Reference();
+            lock.unlock();
 
             this->GotoObject();
         }
     }
 }
 
+void PoDoFoBrowser::viewRawStreamData()
+{
+    // Show the current stream again the other way
+    treeSelectionChanged( GetSelectedItem(), GetSelectedItem() );
+}
+
+void PoDoFoBrowser::viewMemoryBudget()
+{
+    bool ok = false;
+    const int megabytes = QInputDialog::getInteger( this, tr("Memory Budget"),
+            tr("Memory the object tree may use, in MB.\n"
+               "Collapsed parts of the tree are freed to stay within it."),
+            m_memoryBudget, minMemoryBudget, maxMemoryBudget, 16, &ok );
+    if (!ok)
+        return;
+
+    SetMemoryBudget( megabytes );
+    statusBar()->showMessage( tr("The object tree now takes about %1 MB")
+            .arg( m_pMemoryBudget->GetUsage() / (1024.0 * 1024.0), 0, 'f', 1 ), 2000 );
+}
+
 // For debugging: refresh the view
 void PoDoFoBrowser::viewRefreshView()
 {
@@ -894,16 +1695,31 @@ void PoDoFoBrowser::viewRefreshView()
     if (!model)
         qDebug("can't refresh with no model");
 
-    ModelChange(new PdfObjectModel(m_pDocument, listObjects, actionCatalogView->isChecked()));
+    // Only a switch between catalog and object views needs a new model.
+    // Otherwise just the objects changed behind the model's back, such as
+    // by stream commits, can be out of date.
+    if (model && model->IsCatalogRooted() == actionCatalogView->isChecked())
+    {
+        const int refreshed = model->RefreshStaleObjects();
+        statusBar()->showMessage( tr("Refreshed %1 changed objects").arg( refreshed ), 2000 );
+        return;
+    }
+
+    ModelChange(new PdfObjectModel(m_pDocument, listObjects, actionCatalogView->isChecked(), &m_documentLock));
 }
 
 void PoDoFoBrowser::slotImportStream()
 {
+    if (!CheckNotSaving())
+        return;
+
     QModelIndex idx = GetSelectedItem();
     if (!idx.isValid()) return; // shouldn't happen
 
     PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
 
+    QMutexLocker lock( &m_documentLock );
+
     // TODO: if the stream is a file stream, convert it to a mem
     // stream while retaining all dictionary attributes.
     const PdfObject * obj = model->GetObjectForIndex(idx);
@@ -912,11 +1728,13 @@ void PoDoFoBrowser::slotImportStream()
     // dodgy!
     PdfStream * stream = const_cast<PdfObject*>(obj)->GetStream();
 
+    lock.unlock();
     QString fn = QFileDialog::getOpenFileName(this,
             tr("Import stream")
             );
     if (fn.isEmpty())
         return;
+    lock.relock();
 
     QFile f(fn);
     if (!f.open(QIODevice::ReadOnly))
@@ -932,8 +1750,14 @@ void PoDoFoBrowser::slotImportStream()
     qint64 bytesRead = 0;
     try {
 	// Clear the stream and begin appending, with all data being encoded according
-	// to the current stream dictionary's filters.
-        stream->BeginAppend( PdfFilterFactory::CreateFilterList(obj), true );
+	// to the current stream dictionary's filters. Plain Flate we can leave
+	// to CompressPendingStreams() instead.
+        TVecFilters filters = PdfFilterFactory::CreateFilterList(obj);
+        const bool deferDeflate = filters.size() == 1 && filters.front() == ePdfFilter_FlateDecode
+                                  && !obj->GetDictionary().HasKey( PdfName("DecodeParms") );
+        if (deferDeflate)
+            filters.clear();
+        stream->BeginAppend( filters, true );
         do
         {
             bytesRead = f.read(pBuf, streamChunkSize);
@@ -943,6 +1767,9 @@ void PoDoFoBrowser::slotImportStream()
         }
         while (bytesRead > 0);
 	stream->EndAppend();
+        if (deferDeflate)
+            m_pendingDeflate.insert( obj->Reference() );
+        model->MarkObjectChanged(obj->Reference());
     } catch (PdfError& e) {
         free(pBuf);
         podofoError( e );
@@ -952,7 +1779,9 @@ void PoDoFoBrowser::slotImportStream()
 
     statusBar()->showMessage( tr("Stream imported from %1").arg( fn ), 2000 );
 
-    // TODO: refresh stream
+    // The viewer may be reading the old stream contents, so start it afresh
+    lock.unlock();
+    treeSelectionChanged( idx, idx );
 }
 
 void PoDoFoBrowser::slotExportStream()
@@ -962,44 +1791,34 @@ void PoDoFoBrowser::slotExportStream()
 
     PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
 
+    QMutexLocker lock( &m_documentLock );
+
     // TODO: if the stream is a file stream, convert it to a mem
     // stream while retaining all dictionary attributes.
     const PdfObject * obj = model->GetObjectForIndex(idx);
     if (!obj->HasStream())
         return;
 
+    lock.unlock();
     QString fn = QFileDialog::getSaveFileName(this,
             tr("Import stream")
             );
     if (fn.isEmpty())
         return;
+    lock.relock();
 
-    // TODO: progressive reading of stream
-    char* pBuf = 0;
-    pdf_long lLen = 0;
+    QString error;
     try {
-        obj->GetStream()->GetFilteredCopy( &pBuf, &lLen );
+        if (!exportStream( obj, fn, error ))
+        {
+            QMessageBox::critical( this, tr("Saving failed"), tr("Cannot write the stream to %1:\n%2").arg( fn ).arg( error ) );
+            return;
+        }
     } catch( PdfError & e ) {
         podofoError( e );
         return;
     }
 
-    QFile f(fn);
-    if (!f.open(QIODevice::WriteOnly))
-    {
-        QMessageBox::critical( this, tr("Saving failed"), QString( tr("Cannot open file %1 for writing.") ).arg( fn ) );
-        return;
-    }
-
-    qint64 bytesWritten = f.write(pBuf, lLen);
-    free(pBuf);
-    f.close();
-    if (bytesWritten != lLen)
-    {
-        QMessageBox::critical( this, tr("Saving failed"), QString( tr("Wrote only partial stream contents") ).arg( fn ) );
-        return;
-    }
-
     statusBar()->showMessage( tr("Stream exported to %1").arg( fn ), 2000 );
 }
 
@@ -1063,7 +1882,10 @@ void PoDoFoBrowser::toolsDisplayCodeForSelection()
     PdfObjectModel* model = static_cast<PdfObjectModel*>(listObjects->model());
     const PdfObject* obj = model->GetObjectForIndex(idx);
     std::string s;
-    obj->ToString(s);
+    {
+        QMutexLocker lock( &m_documentLock );
+        obj->ToString(s);
+    }
     QMessageBox::information(this,
 		    tr("PDF code for selection"),
 		    QString::fromAscii( s.c_str() ) );
@@ -1079,6 +1901,9 @@ void PoDoFoBrowser::helpAbout()
 
 bool PoDoFoBrowser::trySave() 
 {
+   // A save in progress may leave nothing to ask about
+   WaitForSave();
+
    PdfObjectModel* model = static_cast<PdfObjectModel*>(listObjects->model());
    if( model && model->DocChanged() ) 
    {
@@ -1088,12 +1913,7 @@ bool PoDoFoBrowser::trySave()
        if( m == QMessageBox::Cancel )
            return false;
        else if( m == QMessageBox::Yes ) 
-       {
-           if( m_filename.isEmpty() )
-               return fileSaveAs();
-           else
-               fileSave( m_filename );
-       }
+           return fileSave() && WaitForSave();
        else 
            return true;
    }
@@ -1101,10 +1921,236 @@ bool PoDoFoBrowser::trySave()
    return true;
 }
 
+void PoDoFoBrowser::editSearchDocument()
+{
+    m_pSearchDock->FocusQuery();
+}
+
+void PoDoFoBrowser::editFindReferrers()
+{
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    QModelIndex sel = GetSelectedItem();
+    if (!model || !sel.isValid() || !m_pReferenceIndex)
+        return;
+
+    // Not worth hiding these under the results of a search nobody's watching
+    delete m_pDocumentSearch;
+    m_pDocumentSearch = NULL;
+    m_pSearchDock->SetBusy( false );
+    m_pSearchDock->ClearResults();
+    m_searchResultCount = 0;
+
+    QMutexLocker lock( &m_documentLock );
+    const PdfObject* obj = model->GetObjectForIndex( sel );
+    const PdfReference target = obj->IsReference() ? obj->GetReference() : obj->Reference();
+    if (!target.IsIndirect())
+        return;
+
+    ShowSearchResults( m_pReferenceIndex->GetReferrers( target ) );
+    if (m_pReferenceIndex->IsComplete())
+        m_pSearchDock->SetStatus( tr("%1 objects refer to %2 %3 obj")
+                .arg( m_searchResultCount ).arg( target.ObjectNumber() ).arg( target.GenerationNumber() ) );
+    else
+        m_pSearchDock->SetStatus( tr("%1 objects found so far refer to %2 %3 obj; the rest of the document is still loading")
+                .arg( m_searchResultCount ).arg( target.ObjectNumber() ).arg( target.GenerationNumber() ) );
+    m_pSearchDock->show();
+    m_pSearchDock->raise();
+}
+
+void PoDoFoBrowser::startSearchIndex()
+{
+    if (!m_pDocument || m_pSearchIndex)
+        return;
+
+    m_pSearchIndex = new SearchIndex(m_pDocument, &m_documentLock, this);
+    connect( m_pSearchIndex, SIGNAL(done()), this, SLOT(searchIndexDone()) );
+    // The progress bar may be busy with a file being opened; see
+    // EndTaskProgress().
+    if (!m_pOpener && !m_pSaver)
+    {
+        m_pDelayedLoadProgress->setFormat( tr("%p% of objects indexed") );
+        m_pDelayedLoadProgress->setMaximum( m_pDocument->GetObjects().GetSize() );
+        connect( m_pSearchIndex, SIGNAL(progress(int)), m_pDelayedLoadProgress, SLOT(setValue(int)) );
+    }
+    m_pSearchIndex->start(QThread::LowPriority);
+}
+
+void PoDoFoBrowser::searchIndexDone()
+{
+    if (!m_pOpener && !m_pSaver)
+    {
+        m_pDelayedLoadProgress->reset();
+        m_pDelayedLoadProgress->setFormat( tr("%p% of objects loaded") );
+    }
+    statusBar()->showMessage( tr("Document indexed for searching"), 2000 );
+}
+
+void PoDoFoBrowser::startStructureIndex()
+{
+    if (!m_pDocument || m_pStructureIndex)
+        return;
+
+    m_pStructureIndex = new StructureIndex(m_pDocument, &m_documentLock, this);
+    connect( m_pStructureIndex, SIGNAL(done()), this, SLOT(structureIndexDone()) );
+    m_pStructureIndex->start(QThread::LowPriority);
+}
+
+void PoDoFoBrowser::structureIndexDone()
+{
+    // The document may have changed since this was queued
+    if (!m_pStructureIndex || !m_pStructureIndex->IsReady())
+        return;
+    m_pStructureDock->SetIndex( m_pStructureIndex );
+
+    // Thumbnails are kept for the file the document was read from; a new
+    // document has no file to keep them for
+    delete m_pThumbnailLoader;
+    m_pThumbnailLoader = new ThumbnailLoader( m_pDocument, &m_documentLock,
+                                              ThumbnailLoader::CacheDirectoryFor( m_filename ),
+                                              ThumbnailDock::ThumbnailSize(), this );
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    if (model)
+    {
+        // Images edited already aren't as they are in the file
+        const std::vector<PdfReference> changed = model->GetChangedObjects();
+        for (std::vector<PdfReference>::const_iterator it = changed.begin(); it != changed.end(); ++it)
+            m_pThumbnailLoader->ObjectChanged( *it );
+    }
+    m_pThumbnailDock->SetIndex( m_pStructureIndex, m_pThumbnailLoader );
+
+    // Save the indexes for next time, if they're of the file as it is
+    if (m_pSessionCache && !m_pSessionCache->IsRead() && m_pReferenceIndex && m_pReferenceIndex->IsComplete()
+        && model && !model->DocChanged())
+    {
+        PerfTrace::Scope scope( "write-session-cache" );
+        QMutexLocker lock( &m_documentLock );
+        m_pSessionCache->Write( m_pDocument->GetObjects().GetSize(), *m_pReferenceIndex, *m_pStructureIndex );
+    }
+    // Either way, there's nothing more for it to do
+    delete m_pSessionCache;
+    m_pSessionCache = NULL;
+}
+
+void PoDoFoBrowser::objectChanged( const PdfReference & ref )
+{
+    // The loader first, so the dock's request for a new thumbnail doesn't
+    // get the old one from the disk cache
+    if (m_pThumbnailLoader)
+        m_pThumbnailLoader->ObjectChanged( ref );
+    m_pThumbnailDock->ObjectChanged( ref );
+}
+
+void PoDoFoBrowser::searchDocument( const QString & query )
+{
+    delete m_pDocumentSearch;
+    m_pDocumentSearch = NULL;
+    m_pSearchDock->SetBusy( false );
+    m_pSearchDock->ClearResults();
+    m_searchResultCount = 0;
+    if (!m_pDocument)
+        return;
+
+    m_searchTime.start();
+    if (!m_pSearchIndex || !m_pSearchIndex->IsReady())
+    {
+        // No index yet, so search the document itself. Results trickle in
+        // through searchResultsReady().
+        m_pDocumentSearch = new DocumentSearch( m_pDocument, &m_documentLock, query, this );
+        connect( m_pDocumentSearch, SIGNAL(resultsReady()), this, SLOT(searchResultsReady()) );
+        connect( m_pDocumentSearch, SIGNAL(finished()), this, SLOT(searchFinished()) );
+        m_pSearchDock->SetBusy( true );
+        m_pSearchDock->SetStatus( tr("Searching...") );
+        return;
+    }
+
+    ShowSearchResults( m_pSearchIndex->Query( query ) );
+    m_pSearchDock->SetStatus( tr("%1 objects found in %2 ms")
+            .arg( m_searchResultCount ).arg( m_searchTime.elapsed() ) );
+}
+
+void PoDoFoBrowser::searchResultsReady()
+{
+    std::vector<PdfReference> results;
+    m_pDocumentSearch->TakeResults( results );
+    ShowSearchResults( results );
+    m_pSearchDock->SetStatus( tr("Searching... %1 objects found so far").arg( m_searchResultCount ) );
+}
+
+void PoDoFoBrowser::searchFinished()
+{
+    m_pSearchDock->SetBusy( false );
+    m_pSearchDock->SetStatus( tr("%1 objects found in %2 ms")
+            .arg( m_searchResultCount ).arg( m_searchTime.elapsed() ) );
+
+    // We're in one of its signals, so it can't go just yet
+    m_pDocumentSearch->deleteLater();
+    m_pDocumentSearch = NULL;
+}
+
+void PoDoFoBrowser::searchCancel()
+{
+    if (!m_pDocumentSearch)
+        return;
+
+    m_pDocumentSearch->Cancel();
+    std::vector<PdfReference> results;
+    m_pDocumentSearch->TakeResults( results );
+    ShowSearchResults( results );
+    delete m_pDocumentSearch;
+    m_pDocumentSearch = NULL;
+
+    m_pSearchDock->SetBusy( false );
+    m_pSearchDock->SetStatus( tr("Search stopped after finding %1 objects").arg( m_searchResultCount ) );
+}
+
+void PoDoFoBrowser::ShowSearchResults( const std::vector<PdfReference> & results )
+{
+    // Listing a huge number of results helps nobody
+    static const size_t maxShownResults = 1000;
+
+    QMutexLocker lock( &m_documentLock );
+    const PdfVecObjects & objs = m_pDocument->GetObjects();
+    std::vector<PdfReference>::const_iterator it = results.begin();
+    for (; it != results.end() && m_searchResultCount < maxShownResults; ++it, ++m_searchResultCount)
+    {
+        const PdfReference & ref = *it;
+        QString label = tr("%1 %2 obj").arg( ref.ObjectNumber() ).arg( ref.GenerationNumber() );
+
+        // Say what sort of object it is, if it says
+        const PdfObject* obj = objs.GetObject( ref );
+        if (obj && obj->IsDictionary())
+        {
+            const PdfObject* type = obj->GetDictionary().GetKey( PdfName("Type") );
+            const PdfObject* subtype = obj->GetDictionary().GetKey( PdfName("Subtype") );
+            if (type && type->IsName())
+                label += QString::fromUtf8(" /") + QString::fromUtf8( type->GetName().GetName().c_str() );
+            if (subtype && subtype->IsName())
+                label += QString::fromUtf8(" /") + QString::fromUtf8( subtype->GetName().GetName().c_str() );
+        }
+        m_pSearchDock->AddResult( ref, label );
+    }
+    // Count the rest without listing them
+    m_searchResultCount += results.end() - it;
+}
+
+void PoDoFoBrowser::searchResultActivated( const PdfReference & ref )
+{
+    if (!listObjects->model())
+        return;
+
+    m_gotoReference = ref;
+    GotoObject();
+}
+
 void PoDoFoBrowser::GotoObject()
 {
     PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
 
+    // Get the target loaded ahead of the rest while we look for it. Its
+    // neighbours get hinted by the model once the view scrolls there.
+    if (m_pBackgroundLoader)
+        m_pBackgroundLoader->Prioritise( m_gotoReference );
+
     int index = model->FindObject( m_gotoReference );
     if( index == -1 )
         QMessageBox::warning( this, tr("Object not found"), 
@@ -1120,6 +2166,7 @@ void PoDoFoBrowser::slotSetStreamEditable(bool e)
 {
 	if(e)
 	{
+		LoadStreamIntoEditor();
 		textStream->setReadOnly(false);
 		textStream->setTextInteractionFlags(Qt::TextEditorInteraction);
 		commitButton->setEnabled(true);
@@ -1134,26 +2181,67 @@ void PoDoFoBrowser::slotSetStreamEditable(bool e)
 
 void PoDoFoBrowser::slotCommitStream()
 {
+	if (!CheckNotSaving())
+	{
+	    return;
+	}
+
 	QModelIndex idx = GetSelectedItem();
 	if (!idx.isValid())
 	{
 	    return; // shouldn't happen
 	}
 
+	if (stackedWidget->currentWidget() != pageStream)
+	{
+	    return; // the editor doesn't hold this stream
+	}
+
 
 	PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
 
+	QMutexLocker lock( &m_documentLock );
+
 	const PdfObject * obj = model->GetObjectForIndex(idx);
 	if (!obj->HasStream())
 	{
 		return;
 	}
 
-	QByteArray cs(m_codecForStream->fromUnicode(textStream->toPlainText()));
-	PdfStream * stream = const_cast<PdfObject*>(obj)->GetStream();
-	stream->Set(cs.data(), cs.size());
+	try {
+		SetStreamData(obj, m_codecForStream->fromUnicode(textStream->toPlainText()));
+	} catch( PdfError & e ) {
+		podofoError( e );
+		return;
+	}
 	statusBar()->showMessage( tr("Stream Committed"), 2000 );
 
 }
 
+void PoDoFoBrowser::SetStreamData( const PdfObject* object, const QByteArray & data )
+{
+    QMutexLocker lock( &m_documentLock );
+    PdfStream * stream = const_cast<PdfObject*>(object)->GetStream();
+    // No filters; the data is compressed when saving
+    stream->Set(data.data(), data.size(), TVecFilters());
+    const_cast<PdfObject*>(object)->GetDictionary().RemoveKey( PdfName("DecodeParms") );
+    m_pendingDeflate.insert( object->Reference() );
+
+    PdfObjectModel * const model = static_cast<PdfObjectModel*>(listObjects->model());
+    if (model)
+        model->MarkObjectChanged(object->Reference());
+}
+
+void PoDoFoBrowser::CompressPendingStreams()
+{
+    if (m_pendingDeflate.empty())
+        return;
+
+    const std::vector<PdfReference> streams( m_pendingDeflate.begin(), m_pendingDeflate.end() );
+    m_pendingDeflate.clear();
+    StreamCompressor compressor( m_pDocument, &m_documentLock,
+            actionSmallStreams->isChecked() ? StreamCompressor::Level_Small : StreamCompressor::Level_Fast );
+    compressor.Compress( streams );
+}
+
 
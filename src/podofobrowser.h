@@ -23,11 +23,17 @@
 
 #include <QMainWindow>
 #include <QModelIndex>
+#include <QMutex>
 #include <QString>
+#include <QTime>
 #include <QTextDocument>
 #include <QTreeView>
 
+#include <set>
+
 class QProgressBar;
+class QProgressDialog;
+class QPushButton;
 
 #include "ui_podofobrowserbase.h"
 #include <podofo/podofo.h>
@@ -35,6 +41,23 @@ class QProgressBar;
 
 class PdfObjectModel;
 class BackgroundLoader;
+class DocumentChanges;
+class ReferenceIndex;
+class DocumentOpener;
+class DocumentSaver;
+class DocumentSearch;
+class MemoryBudget;
+class SearchDock;
+class PerfDock;
+class SearchIndex;
+class SessionCache;
+class StreamExporter;
+class StructureDock;
+class StructureIndex;
+class StreamReplacer;
+class TextStreamView;
+class ThumbnailDock;
+class ThumbnailLoader;
 class QModelIndex;
 class QDockWidget;
 
@@ -51,15 +74,27 @@ class PoDoFoBrowser: public QMainWindow, private Ui::PoDoFoBrowserBase
 
     void fileOpen();
     void fileOpen( const QString & filename );
+    void fileOpenDone();
+    void fileOpenFailed();
+    void fileOpenCancel();
 
     bool fileSave();
     bool fileSave( const QString & filename );
     bool fileSaveAs();
+    void fileSaveDone();
+    void fileSaveFailed();
+    void fileSaveCancel();
     void fileReload();
     void fileInfo();
+    void fileExportStreams();
+    void exportStreamsDone();
+    void exportStreamsCancel();
 
     void fileExit();
 
+    // Cancel whatever the status bar's Cancel button is showing for
+    void cancelTask();
+
     void toolsToHex();
     void toolsFromHex();
     void toolsDisplayCodeForSelection();
@@ -83,8 +118,28 @@ class PoDoFoBrowser: public QMainWindow, private Ui::PoDoFoBrowserBase
     void editReplace();
     void editGotoObject();
     void editGotoPage();
+    void editSearchDocument();
+    void editFindReferrers();
+
+    // Whole-document search, through m_pSearchIndex
+    void searchDocument( const QString & query );
+    void searchResultActivated( const PoDoFo::PdfReference & ref );
+    // ... or through m_pDocumentSearch, until the index is ready
+    void searchResultsReady();
+    void searchFinished();
+    void searchCancel();
+    void startSearchIndex();
+    void searchIndexDone();
+
+    // The pages, fonts and images in m_pStructureDock
+    void startStructureIndex();
+    void structureIndexDone();
+    // Thumbnails of edited images are out of date
+    void objectChanged( const PoDoFo::PdfReference & ref );
 
     void viewRefreshView();
+    void viewRawStreamData();
+    void viewMemoryBudget();
 
     void slotSetStreamEditable(bool e);
     void slotCommitStream();
@@ -94,6 +149,25 @@ class PoDoFoBrowser: public QMainWindow, private Ui::PoDoFoBrowserBase
     void DocChange(PoDoFo::PdfMemDocument* doc);
     void UpdateMenus();
 
+    // Give the status bar progress back to the background loader after
+    // an asynchronous open or save finished without replacing the document.
+    void EndTaskProgress();
+
+    // Name of the file to write beside `filename' before moving it over it
+    QString TempFileNameFor(const QString & filename) const;
+
+    // Move the freshly written `tmpFileName' over `filename' and make it the
+    // document's file. Reports failures. Returns true on success.
+    bool FinishSave(const QString & tmpFileName, const QString & filename);
+
+    // Wait until the save in progress, if any, is over, keeping the GUI
+    // responsive meanwhile. Returns false if it failed or was cancelled.
+    bool WaitForSave();
+
+    // The document can't be changed while it's being saved. Warns and
+    // returns false if it is.
+    bool CheckNotSaving();
+
     void SetFileName(const QString& name);
 
     // Find the object m_gotoReference
@@ -105,8 +179,49 @@ class PoDoFoBrowser: public QMainWindow, private Ui::PoDoFoBrowserBase
     void loadConfig();
     void saveConfig();
 
+    // Keep the object tree within `megabytes', and size the stream views'
+    // caches to match
+    void SetMemoryBudget(int megabytes);
+
     void clear();
 
+    // Empty the hex and text stream views and free whatever they were
+    // showing
+    void ClearStreamViews();
+
+    // Open a device on the stream of `object', which must have one: its data
+    // as stored in the file if `encoded', else decoded on the fly where
+    // necessary. Throws PdfError.
+    QIODevice* OpenStreamDevice(const PoDoFo::PdfObject* object, bool encoded);
+
+    // Read the whole of the stream of `object', decoded unless it has no
+    // filters. Throws PdfError.
+    QByteArray ReadStreamData(const PoDoFo::PdfObject* object);
+
+    // Replace the data of the stream of `object' with `data'. It's left
+    // uncompressed until the document is saved; see m_pendingDeflate.
+    // Throws PdfError.
+    void SetStreamData(const PoDoFo::PdfObject* object, const QByteArray & data);
+
+    // Flate-compress the streams in m_pendingDeflate in parallel, and wait
+    // for them. Don't hold the document lock.
+    void CompressPendingStreams();
+
+    // Replace every match in the editor after the cursor (before it if
+    // `backwards') in a single edit, and return how many there were
+    int ReplaceRestInEditor(const StreamReplacer & replacer, bool backwards);
+
+    // Replace every match in all the selected streams, rewriting each
+    // changed stream once, and report how it went
+    void ReplaceInSelectedStreams(const StreamReplacer & replacer, const QString & sFind);
+
+    // If the current stream is in m_pTextView, move it to textStream so it
+    // can be edited and searched. Reads the whole stream.
+    void LoadStreamIntoEditor();
+
+    // List search results in m_pSearchDock, up to a limit
+    void ShowSearchResults( const std::vector<PoDoFo::PdfReference> & results );
+
     bool saveObject();
 
     bool trySave();
@@ -120,10 +235,59 @@ class PoDoFoBrowser: public QMainWindow, private Ui::PoDoFoBrowserBase
     QTreeView * listObjects;
 
     QString               m_filename;
+    // Keeps listObjects' rows within the budget, in megabytes
+    MemoryBudget*         m_pMemoryBudget;
+    int                   m_memoryBudget;
 
     PoDoFo::PdfMemDocument*  m_pDocument;
+    // Must be held while touching m_pDocument, which is shared with worker
+    // threads such as the background loader. Recursive.
+    QMutex                m_documentLock;
     BackgroundLoader*     m_pBackgroundLoader;
+    // Who refers to what; filled in by the background loader
+    ReferenceIndex*       m_pReferenceIndex;
+    // What needs saving. Kept here, not in the model, which is rebuilt
+    // whenever the view is switched.
+    DocumentChanges*      m_pDocumentChanges;
     QProgressBar*         m_pDelayedLoadProgress;
+    // Non-null while a document is being parsed on a worker thread
+    DocumentOpener*       m_pOpener;
+    // The change count of the current document when the opener started;
+    // the user has already been asked about the changes up to there
+    int                   m_changesBeforeOpen;
+    // Non-null while the whole document is being written on a worker thread
+    DocumentSaver*        m_pSaver;
+    // The file m_pSaver's temp file goes over once it's done
+    QString               m_saveFileName;
+    // How the last save that went through m_pSaver ended
+    bool                  m_bSaveSucceeded;
+    QPushButton*          m_pCancelButton;
+    // Non-null while streams are being exported
+    StreamExporter*       m_pExporter;
+    QProgressDialog*      m_pExportProgress;
+    // Streams edited since the last save, which were left uncompressed so
+    // they can all be compressed in parallel when saving
+    std::set<PoDoFo::PdfReference> m_pendingDeflate;
+    // Built once the background loader is done with the document
+    SearchIndex*          m_pSearchIndex;
+    SearchDock*           m_pSearchDock;
+    // Also built once the background loader is done; until it's ready,
+    // pages are looked up by walking the page tree
+    StructureIndex*       m_pStructureIndex;
+    StructureDock*        m_pStructureDock;
+    // Thumbnails of the images the structure index found
+    ThumbnailLoader*      m_pThumbnailLoader;
+    ThumbnailDock*        m_pThumbnailDock;
+    // What PerfTrace has timed
+    PerfDock*             m_pPerfDock;
+    // The indexes saved for the file the document was read from, or where
+    // to save them once they're built; null if caching is off
+    SessionCache*         m_pSessionCache;
+    // Non-null while searching the document without the index
+    DocumentSearch*       m_pDocumentSearch;
+    // Results found by the last search so far, shown or not
+    size_t                m_searchResultCount;
+    QTime                 m_searchTime;
 
     // Members for find, findNext and findPrevious
     bool                  m_bHasFindText;
@@ -132,8 +296,10 @@ class PoDoFoBrowser: public QMainWindow, private Ui::PoDoFoBrowserBase
     PoDoFo::PdfReference  m_gotoReference;
 
     QTextDocument::FindFlags m_findFlags;
-    QByteArray*           m_pByteArray;
-    QIODevice*            m_pByteArrayIO;
+    // The device the hex or text stream view is reading the stream from
+    QIODevice*            m_pStreamIO;
+    // Used instead of textStream for text too large to lay out all at once
+    TextStreamView*       m_pTextView;
 
     QTextCodec*	m_codecForStream;
 };
@@ -19,9 +19,11 @@
  ***************************************************************************/
 
 #include "podofoinfodlg.h"
+#include "documentinfo.h"
 
 #include <QFileInfo>
 #include <QLocale>
+#include <QStringList>
 
 PodofoInfoDialog::PodofoInfoDialog (const QString& filename, PoDoFo::PdfDocument * document, QWidget * parent)
 		:QDialog ( parent )
@@ -63,83 +65,17 @@ PodofoInfoDialog::PodofoInfoDialog (const QString& filename, PoDoFo::PdfDocument
 		QString filesize ( itemTemplate.arg ( tr ( "size" ) )
 				.arg (unit.arg(QLocale::system().toString(size,'f',2))) );
 		
-		PoDoFo::PdfInfo * info ( document->GetInfo() );
-		
-
-		QString author ( itemTemplate.arg ( tr ( "author" ) )
-		                 .arg ( QString::fromUtf8 ( info->GetAuthor().GetStringUtf8().c_str() ) ) );
-		QString creator ( itemTemplate.arg ( tr ( "creator" ) )
-		                  .arg ( QString::fromUtf8 ( info->GetCreator().GetStringUtf8().c_str() ) ) );
-		QString keywords ( itemTemplate.arg ( tr ( "keywords" ) )
-		                   .arg ( QString::fromUtf8 ( info->GetKeywords().GetStringUtf8().c_str() ) ) );
-		QString subject ( itemTemplate.arg ( tr ( "subject" ) )
-		                  .arg ( QString::fromUtf8 ( info->GetSubject().GetStringUtf8().c_str() ) ) );
-		QString title ( itemTemplate.arg ( tr ( "title" ) )
-		                .arg ( QString::fromUtf8 ( info->GetTitle().GetStringUtf8().c_str() ) ) );
-		QString producer ( itemTemplate.arg ( tr ( "producer" ) )
-		                   .arg ( QString::fromUtf8 ( info->GetProducer().GetStringUtf8().c_str() ) ) );
-		QString trapped ( itemTemplate.arg ( tr ( "trapped" ) )
-		                  .arg ( QString::fromUtf8 ( info->GetTrapped().GetEscapedName().c_str() ) ) );
+		// Our own names for the standard entries, in the order they come
+		const QString standardLabels[standardInfoEntryCount] = {
+			tr ( "title" ), tr ( "author" ), tr ( "subject" ), tr ( "keywords" ),
+			tr ( "creator" ), tr ( "producer" ), tr ( "trapped" ) };
 
-		PoDoFo::PdfObject * infoObject(info->GetObject());
-		
-		// Even that is pointless since the constructor of PdfInfo has already overwrite the Producer key
-// 		PoDoFo::PdfName nameProducer("Producer");
-// 		PoDoFo::PdfObject* objectProducer = infoObject->GetDictionary().GetKey( nameProducer );
-// 		if(objectProducer && objectProducer->IsString())
-// 		{
-// 			producer = itemTemplate.arg ( tr ( "producer" ) )
-// 					.arg ( QString::fromUtf8 ( objectProducer->GetString().GetStringUtf8().c_str() ) ) ;
-// 		}
-		
-		QStringList extraKeys;
-		if(infoObject && infoObject->IsDictionary())
+		QStringList items;
+		const DocumentInfoEntries entries ( documentInfoEntries ( document ) );
+		for ( int i = 0; i < entries.size(); ++i )
 		{
-			QList<PoDoFo::PdfName> knownNames;
-			knownNames << PoDoFo::PdfName("Author")
-					<< PoDoFo::PdfName("Creator")
-					<< PoDoFo::PdfName("Keywords")
-					<< PoDoFo::PdfName("Subject")
-					<< PoDoFo::PdfName("Title")
-					<< PoDoFo::PdfName("Producer")
-					<< PoDoFo::PdfName("Trapped");
-			PoDoFo::TKeyMap::const_iterator it = infoObject->GetDictionary().GetKeys().begin();
-			PoDoFo::TKeyMap::const_iterator end= infoObject->GetDictionary().GetKeys().end();
-			while ( it !=  end )
-			{
-				PoDoFo::PdfName name(( *it ).first);
-				if ( ! knownNames.contains(name) )
-				{
-					PoDoFo::PdfObject * object(( *it ).second);
-					if(object)
-					{
-						if(object->IsString())
-						{
-							extraKeys << (itemTemplate.arg(QString::fromUtf8 ( name.GetEscapedName().c_str()))
-									.arg(QString::fromUtf8 ( object->GetString().GetStringUtf8().c_str())));
-						}
-						else if(object->IsName())
-						{
-							extraKeys << (itemTemplate.arg(QString::fromUtf8 ( name.GetEscapedName().c_str()))
-									.arg(QString::fromUtf8 ( object->GetName().GetEscapedName().c_str())));
-						}
-						else if(object->IsNumber())
-						{
-							extraKeys << (itemTemplate.arg(QString::fromUtf8 ( name.GetEscapedName().c_str()))
-									.arg(object->GetNumber()));
-							
-						}
-						else if(object->IsReal())
-						{
-							extraKeys << (itemTemplate.arg(QString::fromUtf8 ( name.GetEscapedName().c_str()))
-									.arg(object->GetReal()));
-						}
-						
-					}
-				}
-				++it;
-			}
-
+			const QString & label = i < standardInfoEntryCount ? standardLabels[i] : entries[i].first;
+			items << itemTemplate.arg ( label ).arg ( entries[i].second );
 		}
 
 		
@@ -154,18 +90,7 @@ PodofoInfoDialog::PodofoInfoDialog (const QString& filename, PoDoFo::PdfDocument
 		               <body>") );
 		html += filepath;
 		html += filesize;
-		html += title;
-		html += author;
-		html += subject;
-		html += keywords;
-		html += creator;
-		html += producer;
-		html += trapped;
-
-		if(extraKeys.count() > 0)
-		{
-			html += extraKeys.join(QString());
-		}
+		html += items.join(QString());
 		
 		html +=  QString::fromUtf8("</body</html>");
 
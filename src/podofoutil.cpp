@@ -1,9 +1,15 @@
 #include "podofoutil.h"
 #include <string>
 #include <iostream>
+#include <memory>
 #include <podofo/podofo.h>
 #include <QtCore>
 #include <QtGui>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#else
+#include <cstdio>
+#endif
 using namespace PoDoFo;
 
 void podofoError( const PdfError & eCode ) 
@@ -49,3 +55,199 @@ void printObject( const PdfObject* obj )
     obj->ToString(s);
     std::cerr << s << std::endl;
 }
+
+void getEncodedStreamData( const PdfStream* stream, const char* & data, pdf_long & len )
+{
+    // Every stream of a PdfMemDocument is a PdfMemStream
+    const PdfMemStream * const memStream = dynamic_cast<const PdfMemStream*>(stream);
+    if (!memStream)
+        PODOFO_RAISE_ERROR_INFO( ePdfError_InternalLogic, "Stream data is not held in memory" );
+    data = memStream->Get();
+    len = memStream->GetLength();
+}
+
+namespace {
+
+bool writeBytes( QIODevice & device, const QByteArray & bytes )
+{
+    return device.write( bytes ) == bytes.size();
+}
+
+// Passes whatever's written to it on to a file
+class FileOutputStream : public PdfOutputStream
+{
+public:
+    FileOutputStream( QFile & file ) : m_file( file ), m_bFailed( false ) { }
+
+    virtual pdf_long Write( const char* pBuffer, pdf_long lLen )
+    {
+        if (!m_bFailed && m_file.write( pBuffer, lLen ) != lLen)
+            m_bFailed = true;
+        return lLen;
+    }
+
+    virtual void Close() { }
+
+    bool HasFailed() const { return m_bFailed; }
+
+private:
+    QFile & m_file;
+    bool m_bFailed;
+};
+
+// A cross-reference table entry. These are exactly 20 bytes long, end of
+// line included.
+QByteArray xrefEntry( qint64 offset, int generation, char type )
+{
+    return QByteArray::number( offset ).rightJustified( 10, '0' ) + ' '
+        + QByteArray::number( generation ).rightJustified( 5, '0' ) + ' ' + type + " \n";
+}
+
+};
+
+bool writePdfObject( QIODevice & device, const PdfObject & object, EPdfWriteMode mode )
+{
+    PdfRefCountedBuffer buffer;
+    PdfOutputDevice out( &buffer );
+    object.WriteObject( &out, mode, NULL );
+    const qint64 len = static_cast<qint64>(out.GetLength());
+    return device.write( buffer.GetBuffer(), len ) == len;
+}
+
+bool writeXRefAndTrailer( QIODevice & device, const XRefEntries & entries, const PdfObject & trailer,
+                          EPdfWriteMode mode, bool complete )
+{
+    const qint64 xrefOffset = device.pos();
+    QByteArray xref( "xref\n" );
+    if (complete)
+    {
+        // One subsection from object 0 on, with the unused numbers below
+        // the last object chained into the free list, object 0 at its head
+        const unsigned long size = entries.empty() ? 1 : entries.back().first.ObjectNumber() + 1;
+        std::vector<qint64> nextFree( size, 0 );
+        std::vector<bool> used( size, false );
+        for (XRefEntries::const_iterator it = entries.begin(); it != entries.end(); ++it)
+            used[it->first.ObjectNumber()] = true;
+        unsigned long lastFree = 0;
+        for (unsigned long i = 1; i < size; ++i)
+        {
+            if (used[i])
+                continue;
+            nextFree[lastFree] = i;
+            lastFree = i;
+        }
+
+        xref += "0 " + QByteArray::number( static_cast<qint64>(size) ) + '\n';
+        XRefEntries::const_iterator entry = entries.begin();
+        for (unsigned long i = 0; i < size; ++i)
+        {
+            if (used[i])
+            {
+                xref += xrefEntry( entry->second, entry->first.GenerationNumber(), 'n' );
+                ++entry;
+            }
+            else
+                xref += xrefEntry( nextFree[i], i == 0 ? 65535 : 0, 'f' );
+        }
+    }
+    else
+    {
+        for (size_t first = 0; first < entries.size(); )
+        {
+            size_t last = first;
+            while (last + 1 < entries.size()
+                   && entries[last + 1].first.ObjectNumber() == entries[last].first.ObjectNumber() + 1)
+                ++last;
+            xref += QByteArray::number( static_cast<qint64>(entries[first].first.ObjectNumber()) ) + ' '
+                + QByteArray::number( static_cast<qint64>(last - first + 1) ) + '\n';
+            for (size_t i = first; i <= last; ++i)
+                xref += xrefEntry( entries[i].second, entries[i].first.GenerationNumber(), 'n' );
+            first = last + 1;
+        }
+    }
+
+    return writeBytes( device, xref )
+        && writeBytes( device, "trailer\n" )
+        && writePdfObject( device, trailer, mode )
+        && writeBytes( device, "startxref\n" + QByteArray::number( xrefOffset ) + "\n%%EOF\n" );
+}
+
+bool exportStream( const PdfObject* object, const QString & filename, QString & error )
+{
+    QFile f( filename );
+    if (!f.open( QIODevice::WriteOnly ))
+    {
+        error = f.errorString();
+        return false;
+    }
+
+    // Decode straight into the file, rather than into a copy of the whole
+    // decoded stream first. Don't leave half of it lying around if that
+    // fails.
+    FileOutputStream out( f );
+    try {
+        const char* data = 0;
+        pdf_long len = 0;
+        getEncodedStreamData( object->GetStream(), data, len );
+        const TVecFilters filters = PdfFilterFactory::CreateFilterList( object );
+        if (filters.empty())
+            out.Write( data, len );
+        else
+        {
+            std::auto_ptr<PdfOutputStream> decoder(
+                    PdfFilterFactory::CreateDecodeStream( filters, &out, &object->GetDictionary() ) );
+            decoder->Write( data, len );
+            decoder->Close();
+        }
+    } catch( PdfError & ) {
+        f.close();
+        QFile::remove( filename );
+        throw;
+    }
+
+    if (out.HasFailed())
+    {
+        error = f.errorString();
+        f.close();
+        QFile::remove( filename );
+        return false;
+    }
+    return true;
+}
+
+bool replaceFile( const QString & source, const QString & dest )
+{
+#ifdef Q_OS_WIN
+    // rename() won't replace an existing file here
+    return MoveFileExW( reinterpret_cast<const wchar_t*>(source.utf16()),
+                        reinterpret_cast<const wchar_t*>(dest.utf16()),
+                        MOVEFILE_REPLACE_EXISTING ) != 0;
+#else
+    return ::rename( QFile::encodeName(source).constData(), QFile::encodeName(dest).constData() ) == 0;
+#endif
+}
+
+QString jsonString( const QString & str )
+{
+    QString out( QLatin1Char('"') );
+    out.reserve( str.size() + 2 );
+    for (int i = 0; i < str.size(); ++i)
+    {
+        const QChar c = str[i];
+        switch (c.unicode())
+        {
+        case '"':  out += QString::fromUtf8("\\\""); break;
+        case '\\': out += QString::fromUtf8("\\\\"); break;
+        case '\n': out += QString::fromUtf8("\\n"); break;
+        case '\r': out += QString::fromUtf8("\\r"); break;
+        case '\t': out += QString::fromUtf8("\\t"); break;
+        default:
+            if (c.unicode() < 0x20)
+                out += QString::fromUtf8("\\u%1").arg( c.unicode(), 4, 16, QLatin1Char('0') );
+            else
+                out += c;
+        }
+    }
+    out += QLatin1Char('"');
+    return out;
+}
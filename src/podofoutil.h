@@ -1,12 +1,69 @@
 #ifndef PODOFOBROWSER_UTIL_H
 #define PODOFOBROWSER_UTIL_H
 
-namespace PoDoFo {
-    class PdfError;
-    class PdfObject;
-};
+#include <QtGlobal>
+
+#include <utility>
+#include <vector>
+
+class QIODevice;
+class QString;
+
+#include <podofo/podofo.h>
 
 void podofoError( const PoDoFo::PdfError & eCode );
 void printObject( const PoDoFo::PdfObject* obj );
 
+// Pack an object reference into a single integer, for use as a hash key.
+inline quint64 referenceKey( const PoDoFo::PdfReference & ref )
+{
+    return (static_cast<quint64>(ref.ObjectNumber()) << 16) | ref.GenerationNumber();
+}
+
+// The objects of `doc', for the workers that walk them by index.
+// FIXME: We should not have to cast away constness in pdfvecobjects
+// just to index its members.
+inline PoDoFo::PdfVecObjects & indexableObjects( const PoDoFo::PdfMemDocument* doc )
+{
+    return const_cast<PoDoFo::PdfVecObjects&>(doc->GetObjects());
+}
+
+// Point `data' and `len' at the encoded (still filtered) bytes of `stream',
+// without copying them. The pointer is only good until the stream is next
+// modified. Throws a PdfError if the stream doesn't keep its data in memory.
+void getEncodedStreamData( const PoDoFo::PdfStream* stream, const char* & data, PoDoFo::pdf_long & len );
+
+// Write `object' to `device' as it appears in a PDF file: "N G obj ...
+// endobj" for an indirect object, or just its value otherwise. Returns false
+// on I/O errors. Throws PdfError if the object can't be serialised.
+bool writePdfObject( QIODevice & device, const PoDoFo::PdfObject & object, PoDoFo::EPdfWriteMode mode );
+
+// Where each object was written, sorted by object number
+typedef std::vector< std::pair<PoDoFo::PdfReference, qint64> > XRefEntries;
+
+// Write a cross-reference table for `entries', one subsection per run of
+// consecutive object numbers, then the trailer dictionary `trailer' and the
+// startxref pointing back at the table. A table that starts a file rather
+// than updating one must instead be a single subsection from object 0, with
+// the unused object numbers on the free list; pass `complete' for that.
+// Returns false on I/O errors.
+bool writeXRefAndTrailer( QIODevice & device, const XRefEntries & entries, const PoDoFo::PdfObject & trailer,
+                          PoDoFo::EPdfWriteMode mode, bool complete );
+
+// Write the decoded data of the stream of `object', which must have one, to
+// the file `filename'. Returns false on I/O errors, with `error' set. Throws
+// PdfError if the stream can't be decoded. Either way, the partial file is
+// removed. The caller must hold the document lock, if any.
+bool exportStream( const PoDoFo::PdfObject* object, const QString & filename, QString & error );
+
+// Move the file `source' over `dest', replacing it in a single step so that
+// there's never a moment without a file called `dest'. Readers that already
+// have the old `dest' open keep reading the old contents, where the system
+// allows it to be replaced while open at all. Both must be on the same
+// filesystem. Returns false on failure, leaving both files alone.
+bool replaceFile( const QString & source, const QString & dest );
+
+// `str' as a JSON string, quotes included
+QString jsonString( const QString & str );
+
 #endif
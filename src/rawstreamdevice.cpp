@@ -0,0 +1,64 @@
+#include "rawstreamdevice.h"
+#include "podofoutil.h"
+
+#include <QMutexLocker>
+
+#include <cstring>
+
+using namespace PoDoFo;
+
+RawStreamDevice::RawStreamDevice(const PdfObject* object, QMutex* documentLock, QObject* parent)
+    : QIODevice(parent),
+      m_pObject(object),
+      m_pDocumentLock(documentLock)
+{
+    // Make sure the stream is loaded, and will let us at its data
+    QMutexLocker lock(m_pDocumentLock);
+    const char * data = 0;
+    pdf_long len = 0;
+    getEncodedStreamData(m_pObject->GetStream(), data, len);
+
+    // Unbuffered, since QIODevice's read buffer would just be another copy
+    // of data we already have in memory. It also keeps pos() exact in
+    // readData().
+    open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+}
+
+qint64 RawStreamDevice::size() const
+{
+    QMutexLocker lock(m_pDocumentLock);
+    const char * data = 0;
+    pdf_long len = 0;
+    try {
+        getEncodedStreamData(m_pObject->GetStream(), data, len);
+    } catch (PdfError &) {
+        return 0;
+    }
+    return len;
+}
+
+qint64 RawStreamDevice::readData(char* buf, qint64 maxSize)
+{
+    QMutexLocker lock(m_pDocumentLock);
+    const char * data = 0;
+    pdf_long len = 0;
+    try {
+        // Look the buffer up afresh each time, in case the stream was
+        // reallocated under us.
+        getEncodedStreamData(m_pObject->GetStream(), data, len);
+    } catch (PdfError &) {
+        return -1;
+    }
+
+    const qint64 offset = pos();
+    if (offset >= len)
+        return 0;
+    const qint64 n = qMin<qint64>(maxSize, len - offset);
+    memcpy(buf, data + offset, n);
+    return n;
+}
+
+qint64 RawStreamDevice::writeData(const char*, qint64)
+{
+    return -1;
+}
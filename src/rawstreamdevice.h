@@ -0,0 +1,39 @@
+#ifndef PODOFOBROWSER_RAWSTREAMDEVICE_H
+#define PODOFOBROWSER_RAWSTREAMDEVICE_H
+
+#include <QIODevice>
+
+#include <podofo/podofo.h>
+
+class QMutex;
+
+/**
+ * A read-only, random access QIODevice over the encoded bytes of a PDF
+ * object's stream, exactly as they're stored in the file. Reads come straight
+ * out of the document's own copy of the stream data, so a viewer only ever
+ * copies the part it's showing, however big the stream is.
+ *
+ * The device is opened by the constructor, which throws a PdfError if the
+ * stream data isn't available. Every read takes `documentLock', which may be
+ * null if the document isn't shared with other threads. The object must
+ * outlive the device; if its stream is replaced, throw the device away and
+ * make a new one.
+ */
+class RawStreamDevice : public QIODevice
+{
+public:
+    RawStreamDevice(const PoDoFo::PdfObject* object, QMutex* documentLock, QObject* parent = 0);
+
+    virtual bool isSequential() const { return false; }
+    virtual qint64 size() const;
+
+protected:
+    virtual qint64 readData(char* data, qint64 maxSize);
+    virtual qint64 writeData(const char* data, qint64 maxSize);
+
+private:
+    const PoDoFo::PdfObject* m_pObject;
+    QMutex* m_pDocumentLock;
+};
+
+#endif
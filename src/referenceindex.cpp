@@ -0,0 +1,178 @@
+#include "referenceindex.h"
+#include "podofoutil.h"
+
+#include <QDataStream>
+#include <QIODevice>
+
+#include <algorithm>
+
+using namespace PoDoFo;
+
+namespace {
+
+inline PdfReference referenceFromKey( quint64 key )
+{
+    return PdfReference( static_cast<pdf_objnum>(key >> 16), static_cast<pdf_gennum>(key & 0xffff) );
+}
+
+// Append the targets of all references in `value' to `targets'
+void collectReferences( const PdfVariant & value, std::vector<quint64> & targets )
+{
+    switch (value.GetDataType())
+    {
+        case ePdfDataType_Reference:
+            targets.push_back( referenceKey( value.GetReference() ) );
+            break;
+        case ePdfDataType_Array:
+        {
+            const PdfArray & array = value.GetArray();
+            for (PdfArray::const_iterator it = array.begin(); it != array.end(); ++it)
+                collectReferences( *it, targets );
+            break;
+        }
+        case ePdfDataType_Dictionary:
+        {
+            const TKeyMap & keys = value.GetDictionary().GetKeys();
+            for (TCIKeyMap it = keys.begin(); it != keys.end(); ++it)
+                collectReferences( *it->second, targets );
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Add `key' to, and remove it from, the sorted `links'. Objects are mostly
+// indexed in order, so adding usually goes on the end.
+void insertLink( std::vector<quint64> & links, quint64 key )
+{
+    if (links.empty() || links.back() < key)
+        links.push_back( key );
+    else
+        links.insert( std::lower_bound( links.begin(), links.end(), key ), key );
+}
+
+void eraseLink( std::vector<quint64> & links, quint64 key )
+{
+    const std::vector<quint64>::iterator it = std::lower_bound( links.begin(), links.end(), key );
+    if (it != links.end() && *it == key)
+        links.erase( it );
+}
+
+};
+
+ReferenceIndex::ReferenceIndex()
+    : m_outgoing(),
+      m_incoming(),
+      m_bComplete(false)
+{
+}
+
+void ReferenceIndex::Update( const PdfObject* obj )
+{
+    const quint64 key = referenceKey( obj->Reference() );
+
+    Links targets;
+    collectReferences( *obj, targets );
+    std::sort( targets.begin(), targets.end() );
+    targets.erase( std::unique( targets.begin(), targets.end() ), targets.end() );
+
+    Links & outgoing = m_outgoing[key];
+    if (outgoing == targets)
+        return;
+
+    Unlink( key, outgoing );
+    outgoing.swap( targets );
+    for (Links::const_iterator it = outgoing.begin(); it != outgoing.end(); ++it)
+        insertLink( m_incoming[*it], key );
+}
+
+void ReferenceIndex::Unlink( quint64 from, const Links & targets )
+{
+    for (Links::const_iterator it = targets.begin(); it != targets.end(); ++it)
+    {
+        QHash<quint64, Links>::iterator incoming = m_incoming.find( *it );
+        if (incoming == m_incoming.end())
+            continue;
+        Links & referrers = incoming.value();
+        eraseLink( referrers, from );
+        if (referrers.empty())
+            m_incoming.erase( incoming );
+    }
+}
+
+bool ReferenceIndex::IsIndexed( const PdfReference & ref ) const
+{
+    return m_outgoing.contains( referenceKey( ref ) );
+}
+
+std::vector<PdfReference> ReferenceIndex::GetReferrers( const PdfReference & ref ) const
+{
+    std::vector<PdfReference> referrers;
+    QHash<quint64, Links>::const_iterator it = m_incoming.find( referenceKey( ref ) );
+    if (it == m_incoming.end())
+        return referrers;
+
+    referrers.reserve( it.value().size() );
+    for (Links::const_iterator link = it.value().begin(); link != it.value().end(); ++link)
+        referrers.push_back( referenceFromKey( *link ) );
+    return referrers;
+}
+
+int ReferenceIndex::CountReferrers( const PdfReference & ref ) const
+{
+    QHash<quint64, Links>::const_iterator it = m_incoming.find( referenceKey( ref ) );
+    return it == m_incoming.end() ? 0 : static_cast<int>(it.value().size());
+}
+
+void ReferenceIndex::Write( QDataStream & out ) const
+{
+    // What refers to what can be worked out again from what each object
+    // refers to, so that's all we keep
+    out << static_cast<qint8>(m_bComplete) << static_cast<quint32>(m_outgoing.size());
+    for (QHash<quint64, Links>::const_iterator it = m_outgoing.begin(); it != m_outgoing.end(); ++it)
+    {
+        out << it.key() << static_cast<quint32>(it.value().size());
+        for (Links::const_iterator link = it.value().begin(); link != it.value().end(); ++link)
+            out << *link;
+    }
+}
+
+bool ReferenceIndex::Read( QDataStream & in )
+{
+    m_outgoing.clear();
+    m_incoming.clear();
+    m_bComplete = false;
+
+    qint8 complete = 0;
+    quint32 count = 0;
+    in >> complete >> count;
+    // Each link takes 8 bytes, so a damaged count can't make us allocate
+    // much more than the file holds
+    const qint64 linkBytes = static_cast<qint64>(sizeof(quint64));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i)
+    {
+        quint64 key = 0;
+        quint32 size = 0;
+        in >> key >> size;
+        if (size > in.device()->bytesAvailable() / linkBytes)
+            break;
+        Links & targets = m_outgoing[key];
+        targets.resize( size );
+        for (quint32 n = 0; n < size; ++n)
+            in >> targets[n];
+    }
+    if (in.status() != QDataStream::Ok || m_outgoing.size() != static_cast<int>(count))
+    {
+        m_outgoing.clear();
+        return false;
+    }
+
+    for (QHash<quint64, Links>::const_iterator it = m_outgoing.begin(); it != m_outgoing.end(); ++it)
+        for (Links::const_iterator link = it.value().begin(); link != it.value().end(); ++link)
+            m_incoming[*link].push_back( it.key() );
+    for (QHash<quint64, Links>::iterator it = m_incoming.begin(); it != m_incoming.end(); ++it)
+        std::sort( it.value().begin(), it.value().end() );
+    m_bComplete = complete != 0;
+    return true;
+}
@@ -0,0 +1,72 @@
+#ifndef PODOFOBROWSER_REFERENCEINDEX_H
+#define PODOFOBROWSER_REFERENCEINDEX_H
+
+#include <QHash>
+#include <QtGlobal>
+
+class QDataStream;
+
+#include <vector>
+
+#include <podofo/podofo.h>
+
+/**
+ * Records which indirect objects refer to which, so that the objects
+ * referring to a given one can be listed, and counted, without walking the
+ * whole document.
+ *
+ * An object "refers to" another if a reference to it appears anywhere in its
+ * value, however deeply nested in arrays and dictionaries. Each referring
+ * object is counted once however many such references it holds. Only
+ * direct links are recorded, so reference cycles are no trouble.
+ *
+ * The index is filled by the background loader's pass over the document and
+ * kept up to date by the model as it edits objects. Until the loader is done
+ * it's incomplete: every object listed as a referrer really is one, but
+ * there may be more.
+ *
+ * Locking: the index is guarded by the document lock. Hold it for every
+ * call.
+ */
+class ReferenceIndex
+{
+public:
+    ReferenceIndex();
+
+    // (Re)record the references held by the indirect object `obj'. Costs
+    // time in proportion to the number of them, times the log of the number
+    // of other referrers to each object `obj' used to or now refers to.
+    void Update(const PoDoFo::PdfObject* obj);
+
+    // True if Update() has been called for object `ref'
+    bool IsIndexed(const PoDoFo::PdfReference & ref) const;
+
+    // The objects referring to object `ref', in no particular order
+    std::vector<PoDoFo::PdfReference> GetReferrers(const PoDoFo::PdfReference & ref) const;
+    int CountReferrers(const PoDoFo::PdfReference & ref) const;
+
+    // Whether every object in the document has been indexed
+    void SetComplete() { m_bComplete = true; }
+    bool IsComplete() const { return m_bComplete; }
+
+    // Save the index to `out', for a SessionCache
+    void Write(QDataStream & out) const;
+    // Replace the index with one saved by Write(). Returns false if what
+    // was saved is damaged, leaving the index empty.
+    bool Read(QDataStream & in);
+
+private:
+    // Objects, as referenceKey()s, sorted
+    typedef std::vector<quint64> Links;
+
+    // Drop `from' from the referrers of everything it refers to
+    void Unlink(quint64 from, const Links & targets);
+
+    // What each indexed object refers to
+    QHash<quint64, Links> m_outgoing;
+    // What refers to each object
+    QHash<quint64, Links> m_incoming;
+    bool m_bComplete;
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include "searchdock.h"
+
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QLineEdit>
+#include <QListWidget>
+#include <QPushButton>
+#include <QVBoxLayout>
+
+using namespace PoDoFo;
+
+namespace {
+
+// Item data roles the reference of a result is kept under
+static const int objectNumberRole = Qt::UserRole;
+static const int generationNumberRole = Qt::UserRole + 1;
+
+};
+
+SearchDock::SearchDock(QWidget* parent)
+    : QDockWidget(tr("Search"), parent),
+      m_pQuery(0),
+      m_pResults(0),
+      m_pStatus(0),
+      m_pCancel(0)
+{
+    setObjectName(QString::fromUtf8("SearchDock"));
+
+    QWidget* contents = new QWidget(this);
+    QVBoxLayout* layout = new QVBoxLayout(contents);
+    layout->setMargin(2);
+
+    m_pQuery = new QLineEdit(contents);
+    m_pQuery->setToolTip( tr("Words to look for in names, strings and stream text") );
+    layout->addWidget(m_pQuery);
+
+    m_pResults = new QListWidget(contents);
+    layout->addWidget(m_pResults);
+
+    QHBoxLayout* statusLayout = new QHBoxLayout();
+    m_pStatus = new QLabel(contents);
+    statusLayout->addWidget(m_pStatus, 1);
+    m_pCancel = new QPushButton(tr("Stop"), contents);
+    m_pCancel->hide();
+    statusLayout->addWidget(m_pCancel);
+    layout->addLayout(statusLayout);
+
+    setWidget(contents);
+
+    connect( m_pQuery, SIGNAL(returnPressed()), this, SLOT(queryEntered()) );
+    connect( m_pResults, SIGNAL(itemActivated(QListWidgetItem*)), this, SLOT(itemActivated(QListWidgetItem*)) );
+    connect( m_pCancel, SIGNAL(clicked()), this, SIGNAL(cancelRequested()) );
+}
+
+void SearchDock::FocusQuery()
+{
+    show();
+    raise();
+    m_pQuery->setFocus();
+    m_pQuery->selectAll();
+}
+
+void SearchDock::ClearResults()
+{
+    m_pResults->clear();
+    m_pStatus->clear();
+}
+
+void SearchDock::AddResult(const PdfReference & ref, const QString & label)
+{
+    QListWidgetItem* item = new QListWidgetItem(label, m_pResults);
+    item->setData(objectNumberRole, static_cast<int>(ref.ObjectNumber()));
+    item->setData(generationNumberRole, static_cast<int>(ref.GenerationNumber()));
+}
+
+void SearchDock::SetStatus(const QString & status)
+{
+    m_pStatus->setText(status);
+}
+
+void SearchDock::SetBusy(bool busy)
+{
+    m_pCancel->setVisible(busy);
+}
+
+void SearchDock::queryEntered()
+{
+    const QString query = m_pQuery->text().trimmed();
+    if (!query.isEmpty())
+        emit searchRequested(query);
+}
+
+void SearchDock::itemActivated(QListWidgetItem* item)
+{
+    const PdfReference ref( item->data(objectNumberRole).toInt(),
+                            item->data(generationNumberRole).toInt() );
+    emit resultActivated(ref);
+}
@@ -0,0 +1,56 @@
+#ifndef PODOFOBROWSER_SEARCHDOCK_H
+#define PODOFOBROWSER_SEARCHDOCK_H
+
+#include <QDockWidget>
+
+#include <podofo/podofo.h>
+
+class QLabel;
+class QLineEdit;
+class QListWidget;
+class QListWidgetItem;
+class QPushButton;
+
+/**
+ * A dock holding a query field and a list of the objects found by the last
+ * whole-document search. It knows nothing about how searches are done:
+ * searchRequested() asks for one, and whoever did it fills in the results.
+ */
+class SearchDock : public QDockWidget
+{
+    Q_OBJECT
+
+public:
+    SearchDock(QWidget* parent = 0);
+
+    // Show the dock and put the cursor in the query field
+    void FocusQuery();
+
+    void ClearResults();
+    void AddResult(const PoDoFo::PdfReference & ref, const QString & label);
+
+    // Say something about the results, such as how many there are
+    void SetStatus(const QString & status);
+
+    // Offer to stop a search that's still going
+    void SetBusy(bool busy);
+
+signals:
+    void searchRequested(const QString & query);
+    // The user picked a result
+    void resultActivated(const PoDoFo::PdfReference & ref);
+    // The user wants the search still going to stop
+    void cancelRequested();
+
+private slots:
+    void queryEntered();
+    void itemActivated(QListWidgetItem* item);
+
+private:
+    QLineEdit* m_pQuery;
+    QListWidget* m_pResults;
+    QLabel* m_pStatus;
+    QPushButton* m_pCancel;
+};
+
+#endif
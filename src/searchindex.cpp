@@ -0,0 +1,265 @@
+#include "searchindex.h"
+#include "podofoutil.h"
+#include "streamsnapshot.h"
+#include "wordsplitter.h"
+
+#include <QHash>
+#include <QMutexLocker>
+#include <QSet>
+#include <QTime>
+
+#include <algorithm>
+#include <iterator>
+
+using namespace PoDoFo;
+
+namespace {
+
+// How long we may hold the document lock per batch of objects, in
+// milliseconds. See BackgroundLoader.
+static const int maxBatchTime = 20;
+
+// Number of progress() emissions we spread a whole build over
+static const int progressSteps = 200;
+
+typedef SearchIndex::Postings Postings;
+typedef SearchIndex::WordMap WordMap;
+
+/**
+ * Records the words of one object in a WordMap
+ */
+class WordCollector : public WordSplitter
+{
+public:
+    WordCollector( WordMap & words, quint32 objIdx )
+        : m_words(words), m_objIdx(objIdx)
+    {
+    }
+
+protected:
+    virtual void Word( const QByteArray & word )
+    {
+        // Objects are indexed in order, so this keeps postings sorted and
+        // free of duplicates.
+        Postings & postings = m_words[word];
+        if (postings.empty() || postings.back() != m_objIdx)
+            postings.push_back( m_objIdx );
+    }
+
+private:
+    WordMap & m_words;
+    const quint32 m_objIdx;
+};
+
+/**
+ * Passes decoded stream data on to a WordCollector, until the index is told
+ * to stop.
+ */
+class WordSink : public StreamDataSink
+{
+public:
+    WordSink( WordCollector & collector, const SearchIndex & index )
+        : m_collector(collector), m_index(index)
+    {
+    }
+
+    virtual pdf_long Write( const char* pBuffer, pdf_long lLen )
+    {
+        m_collector.Feed( pBuffer, lLen );
+        return lLen;
+    }
+
+    virtual void Close() { m_collector.EndWord(); }
+
+    virtual bool WantsMore() const { return !m_index.IsStopping(); }
+
+private:
+    WordCollector & m_collector;
+    const SearchIndex & m_index;
+};
+
+};
+
+SearchIndex::SearchIndex(PdfMemDocument* doc, QMutex* documentLock, QObject* parent)
+    : QThread(parent),
+      m_pDoc(doc),
+      m_pDocumentLock(documentLock),
+      m_stopMutex(),
+      m_bStop(false),
+      m_readyMutex(),
+      m_bReady(false),
+      m_refs(),
+      m_words()
+{
+}
+
+SearchIndex::~SearchIndex()
+{
+    Stop();
+    wait();
+}
+
+void SearchIndex::Stop()
+{
+    QMutexLocker lock(&m_stopMutex);
+    m_bStop = true;
+}
+
+bool SearchIndex::IsStopping() const
+{
+    QMutexLocker lock(&m_stopMutex);
+    return m_bStop;
+}
+
+bool SearchIndex::IsReady() const
+{
+    QMutexLocker lock(&m_readyMutex);
+    return m_bReady;
+}
+
+void SearchIndex::run()
+{
+    PdfVecObjects & objs = indexableObjects(m_pDoc);
+
+    // As in BackgroundLoader, an index into the vector is good enough; the
+    // vector is only changed with the lock held, and we re-check the size
+    // every batch.
+    WordMap words;
+    int nextObjectIdx = 0;
+    int objCount = 0;
+    int lastProgress = 0;
+    QTime batchTimer;
+
+    while (!IsStopping())
+    {
+        StreamSnapshot snapshot;
+        bool haveSnapshot = false;
+        quint32 snapshotIdx = 0;
+        {
+            QMutexLocker lock(m_pDocumentLock);
+            objCount = objs.GetSize();
+            if (nextObjectIdx >= objCount)
+                break;
+
+            // Index objects until we run out of time or come to a stream,
+            // which we decode once we've let go of the lock.
+            batchTimer.start();
+            while (nextObjectIdx < objCount && batchTimer.elapsed() < maxBatchTime && !haveSnapshot)
+            {
+                const PdfObject* obj = objs[nextObjectIdx++];
+                const quint32 objIdx = m_refs.size();
+                m_refs.push_back( obj->Reference() );
+                try {
+                    WordCollector collector( words, objIdx );
+                    collector.FeedValue( *obj );
+                    if (obj->HasStream())
+                    {
+                        haveSnapshot = snapshot.Take( obj, true );
+                        snapshotIdx = objIdx;
+                    }
+                } catch( PdfError & e ) {
+                    // Index what we can of the rest
+                    qDebug("Error indexing object %i: %s", obj->Reference().ObjectNumber(),
+                           PdfError::ErrorName(e.GetError()));
+                }
+            }
+        }
+
+        if (haveSnapshot)
+        {
+            WordCollector collector( words, snapshotIdx );
+            WordSink sink( collector, *this );
+            try {
+                snapshot.Decode( sink );
+            } catch( PdfError & ) {
+                // Keep whatever we decoded before the filters gave up
+            }
+        }
+
+        if (nextObjectIdx - lastProgress >= qMax(1, objCount / progressSteps))
+        {
+            lastProgress = nextObjectIdx;
+            emit progress(nextObjectIdx);
+        }
+
+        // Give a waiting GUI thread a chance at the lock
+        yieldCurrentThread();
+    }
+
+    if (IsStopping())
+        return;
+
+    Freeze( words );
+    {
+        QMutexLocker lock(&m_readyMutex);
+        m_bReady = true;
+    }
+    emit progress(objCount);
+    emit done();
+}
+
+void SearchIndex::Freeze(WordMap & words)
+{
+    m_words.reserve( words.size() );
+    for (WordMap::iterator it = words.begin(); it != words.end(); ++it)
+    {
+        m_words.push_back( std::make_pair( it.key(), Postings() ) );
+        m_words.back().second.swap( it.value() );
+    }
+    words.clear();
+    std::sort( m_words.begin(), m_words.end() );
+}
+
+std::vector<PdfReference> SearchIndex::Query(const QString & query) const
+{
+    std::vector<PdfReference> results;
+
+    // Split the query up just like the text we indexed
+    const std::vector<QByteArray> queryWords = WordSplitter::Split( query );
+    if (queryWords.empty())
+        return results;
+
+    Postings matches;
+    bool first = true;
+    for (std::vector<QByteArray>::const_iterator q = queryWords.begin(); q != queryWords.end(); ++q)
+    {
+        // Gather the objects holding any word that starts with this one
+        const QByteArray & prefix = *q;
+        Postings hits;
+        std::vector< std::pair<QByteArray, Postings> >::const_iterator it =
+            std::lower_bound( m_words.begin(), m_words.end(), std::make_pair( prefix, Postings() ) );
+        for (; it != m_words.end() && it->first.startsWith( prefix ); ++it)
+            hits.insert( hits.end(), it->second.begin(), it->second.end() );
+        std::sort( hits.begin(), hits.end() );
+        hits.erase( std::unique( hits.begin(), hits.end() ), hits.end() );
+
+        if (first)
+            matches.swap( hits );
+        else
+        {
+            Postings both;
+            std::set_intersection( matches.begin(), matches.end(), hits.begin(), hits.end(),
+                                   std::back_inserter( both ) );
+            matches.swap( both );
+        }
+        first = false;
+        if (matches.empty())
+            break;
+    }
+
+    // An object may have been indexed twice if the object vector was
+    // re-sorted under us
+    QSet<quint64> seen;
+    results.reserve( matches.size() );
+    for (Postings::const_iterator it = matches.begin(); it != matches.end(); ++it)
+    {
+        const PdfReference & ref = m_refs[*it];
+        const quint64 key = referenceKey( ref );
+        if (!seen.contains( key ))
+        {
+            seen.insert( key );
+            results.push_back( ref );
+        }
+    }
+    return results;
+}
@@ -0,0 +1,94 @@
+#ifndef PODOFOBROWSER_SEARCHINDEX_H
+#define PODOFOBROWSER_SEARCHINDEX_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+
+#include <utility>
+#include <vector>
+
+#include <podofo/podofo.h>
+
+/**
+ * An inverted index of the words in a document, so that whole-document
+ * searches come back at once however big the document is.
+ *
+ * Words are taken from the names and strings of every indirect object (keys
+ * included, references not followed) and from the decoded text of every
+ * stream that isn't plainly binary, such as page content streams. See
+ * WordSplitter for what makes a word. Each query word matches any word it is
+ * a prefix of.
+ *
+ * The index is built on a worker thread. Locking is as for BackgroundLoader:
+ * the worker holds `documentLock' for a short batch of objects at a time.
+ * Streams are copied out under the lock and decoded without it, so even a
+ * huge content stream doesn't keep the GUI waiting.
+ *
+ * The index describes the document as it was when it was built. Edits made
+ * since aren't reflected, so results may name objects that no longer match
+ * or no longer exist.
+ *
+ * Ownership: the index never owns the document. Deleting the index stops the
+ * worker and waits for it, after which the document may be deleted. Don't
+ * delete the index while holding the document lock.
+ */
+class SearchIndex : public QThread
+{
+    Q_OBJECT
+
+public:
+    // Indices into m_refs of the objects holding a word, in ascending order
+    typedef std::vector<quint32> Postings;
+    typedef QHash<QByteArray, Postings> WordMap;
+
+    SearchIndex(PoDoFo::PdfMemDocument* doc, QMutex* documentLock, QObject* parent = 0);
+
+    virtual ~SearchIndex();
+
+    // Ask the worker to stop after its current object. Returns immediately.
+    void Stop();
+    bool IsStopping() const;
+
+    // True once the index is complete and may be queried
+    bool IsReady() const;
+
+    // The objects containing every word of `query', in document order. Must
+    // only be called once IsReady().
+    std::vector<PoDoFo::PdfReference> Query(const QString & query) const;
+
+signals:
+    // Progress indexing from 0 to number of objects. Emitted in coarse steps.
+    void progress(int);
+    // Emitted once the index is ready (but not if stopped early).
+    void done();
+
+protected:
+    virtual void run();
+
+private:
+    // Turn the words gathered by the worker into m_words
+    void Freeze(WordMap & words);
+
+    // Document
+    PoDoFo::PdfMemDocument* m_pDoc;
+    QMutex* m_pDocumentLock;
+
+    mutable QMutex m_stopMutex;
+    bool m_bStop;
+
+    mutable QMutex m_readyMutex;
+    bool m_bReady;
+
+    // Every indexed object. Postings hold indices into this.
+    std::vector<PoDoFo::PdfReference> m_refs;
+
+    // Each word and the objects containing it, sorted by word so prefixes can
+    // be looked up. Only touched by the worker until m_bReady is set, and
+    // read only afterwards.
+    std::vector< std::pair<QByteArray, Postings> > m_words;
+};
+
+#endif
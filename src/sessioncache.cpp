@@ -0,0 +1,193 @@
+#include "sessioncache.h"
+#include "podofoutil.h"
+
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QSettings>
+#include <QStringList>
+
+using namespace PoDoFo;
+
+namespace {
+
+// "PBSC", and the version of what follows it
+static const quint32 cacheMagic = 0x50425343;
+static const quint32 cacheVersion = 1;
+
+// Cache files beyond this many are deleted, oldest first
+static const int maxCacheFiles = 32;
+
+// The least a saved structure entry can take, in bytes: a reference, kind
+// and page, and two empty strings
+static const qint64 minEntrySize = 4 + 2 + 1 + 4 + 4 + 4;
+
+void writeReference( QDataStream & out, const PdfReference & ref )
+{
+    out << static_cast<quint32>(ref.ObjectNumber()) << static_cast<quint16>(ref.GenerationNumber());
+}
+
+PdfReference readReference( QDataStream & in )
+{
+    quint32 objectNumber = 0;
+    quint16 generationNumber = 0;
+    in >> objectNumber >> generationNumber;
+    return PdfReference( objectNumber, generationNumber );
+}
+
+};
+
+SessionCache::SessionCache( const QString & filename )
+    : m_filename( QFileInfo( filename ).absoluteFilePath() ),
+      m_size( -1 ),
+      m_modified(),
+      m_bRead( false ),
+      m_references(),
+      m_entries(),
+      m_pages()
+{
+    const QFileInfo info( m_filename );
+    if (info.exists())
+    {
+        m_size = info.size();
+        m_modified = info.lastModified();
+    }
+}
+
+QString SessionCache::CacheDirectory()
+{
+    const QSettings settings( QSettings::IniFormat, QSettings::UserScope, QString::fromUtf8("podofobrowser") );
+    return QFileInfo( settings.fileName() ).absolutePath() + QString::fromUtf8("/podofobrowser-sessions");
+}
+
+QString SessionCache::CacheFileName() const
+{
+    // The path is saved in the file too, so a clash just costs a rescan
+    return CacheDirectory() + QLatin1Char('/') + QString::number( qHash( m_filename ), 16 ) + QString::fromUtf8(".cache");
+}
+
+bool SessionCache::FileUnchanged() const
+{
+    const QFileInfo info( m_filename );
+    return m_size >= 0 && info.exists() && info.size() == m_size && info.lastModified() == m_modified;
+}
+
+bool SessionCache::Read( int objectCount )
+{
+    m_bRead = false;
+    if (m_size < 0)
+        return false;
+
+    QFile file( CacheFileName() );
+    if (!file.open( QIODevice::ReadOnly ))
+        return false;
+    QDataStream in( &file );
+    in.setVersion( QDataStream::Qt_4_2 );
+
+    quint32 magic = 0;
+    quint32 version = 0;
+    QString filename;
+    qint64 size = -1;
+    quint32 modified = 0;
+    qint32 count = -1;
+    in >> magic >> version;
+    if (magic != cacheMagic || version != cacheVersion)
+        return false;
+    in >> filename >> size >> modified >> count;
+    if (in.status() != QDataStream::Ok || filename != m_filename || size != m_size
+        || modified != m_modified.toTime_t() || count != objectCount)
+        return false;
+
+    quint32 entryCount = 0;
+    in >> entryCount;
+    if (entryCount > file.bytesAvailable() / minEntrySize)
+        return false;
+    std::vector<StructureIndex::Entry> entries( entryCount );
+    for (quint32 i = 0; i < entryCount && in.status() == QDataStream::Ok; ++i)
+    {
+        StructureIndex::Entry & entry = entries[i];
+        qint8 kind = 0;
+        qint32 page = 0;
+        entry.ref = readReference( in );
+        in >> kind >> entry.name >> page >> entry.details;
+        if (kind < StructureIndex::Kind_Page || kind > StructureIndex::Kind_Image)
+            return false;
+        entry.kind = static_cast<StructureIndex::Kind>(kind);
+        entry.page = page;
+    }
+
+    quint32 pageCount = 0;
+    in >> pageCount;
+    if (in.status() != QDataStream::Ok || pageCount > file.bytesAvailable() / 6)
+        return false;
+    std::vector<PdfReference> pages;
+    pages.reserve( pageCount );
+    for (quint32 i = 0; i < pageCount; ++i)
+        pages.push_back( readReference( in ) );
+
+    if (in.status() != QDataStream::Ok || !m_references.Read( in ))
+        return false;
+
+    m_entries.swap( entries );
+    m_pages.swap( pages );
+    m_bRead = true;
+    return true;
+}
+
+bool SessionCache::Write( int objectCount, const ReferenceIndex & references, const StructureIndex & structure ) const
+{
+    if (!FileUnchanged() || !structure.IsReady())
+        return false;
+
+    const QString cacheFileName = CacheFileName();
+    if (!QDir().mkpath( QFileInfo( cacheFileName ).absolutePath() ))
+        return false;
+
+    // Write it beside the old one, then swap it in
+    const QString tmpFileName = cacheFileName + QString::fromUtf8(".tmp");
+    QFile file( tmpFileName );
+    if (!file.open( QIODevice::WriteOnly | QIODevice::Truncate ))
+        return false;
+    QDataStream out( &file );
+    out.setVersion( QDataStream::Qt_4_2 );
+
+    out << cacheMagic << cacheVersion
+        << m_filename << m_size << static_cast<quint32>(m_modified.toTime_t()) << static_cast<qint32>(objectCount);
+
+    const std::vector<StructureIndex::Entry> & entries = structure.GetEntries();
+    out << static_cast<quint32>(entries.size());
+    for (std::vector<StructureIndex::Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+    {
+        writeReference( out, it->ref );
+        out << static_cast<qint8>(it->kind) << it->name << static_cast<qint32>(it->page) << it->details;
+    }
+
+    const std::vector<PdfReference> & pages = structure.GetPages();
+    out << static_cast<quint32>(pages.size());
+    for (std::vector<PdfReference>::const_iterator it = pages.begin(); it != pages.end(); ++it)
+        writeReference( out, *it );
+
+    references.Write( out );
+
+    const bool ok = out.status() == QDataStream::Ok && file.flush();
+    file.close();
+    if (!ok || !replaceFile( tmpFileName, cacheFileName ))
+    {
+        QFile::remove( tmpFileName );
+        return false;
+    }
+
+    Prune();
+    return true;
+}
+
+void SessionCache::Prune()
+{
+    QDir dir( CacheDirectory() );
+    const QFileInfoList files = dir.entryInfoList( QStringList() << QString::fromUtf8("*.cache"),
+                                                   QDir::Files, QDir::Time );
+    for (int i = maxCacheFiles; i < files.size(); ++i)
+        QFile::remove( files[i].absoluteFilePath() );
+}
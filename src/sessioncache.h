@@ -0,0 +1,75 @@
+#ifndef PODOFOBROWSER_SESSIONCACHE_H
+#define PODOFOBROWSER_SESSIONCACHE_H
+
+#include <QDateTime>
+#include <QString>
+
+#include <vector>
+
+#include <podofo/podofo.h>
+
+#include "referenceindex.h"
+#include "structureindex.h"
+
+/**
+ * Keeps what took the browser a full pass over a file to work out, the
+ * reference index and the structure index, on disk beside the settings, so
+ * that they're there at once the next time the same file is opened instead
+ * of after the background loader and structure index are done.
+ *
+ * A file is taken to be unchanged if its path, size and modification time
+ * are, and it parses to the same number of objects. Each cache file is
+ * replaced in one step, so a crash never leaves half of one behind, and
+ * only the most recently written few are kept.
+ *
+ * The cache is plain data and does no locking of its own. Make it for a
+ * file before parsing the file, so a change made during parsing isn't
+ * missed.
+ */
+class SessionCache
+{
+public:
+    // The cache for the file `filename', as it is now
+    explicit SessionCache(const QString & filename);
+
+    // Look for what was saved for the file as it is now, which parsed to
+    // `objectCount' objects. Returns false if there's nothing usable.
+    bool Read(int objectCount);
+
+    // True if Read() found something; the indexes below are only filled in
+    // then
+    bool IsRead() const { return m_bRead; }
+
+    const ReferenceIndex & GetReferenceIndex() const { return m_references; }
+    const std::vector<StructureIndex::Entry> & GetEntries() const { return m_entries; }
+    const std::vector<PoDoFo::PdfReference> & GetPages() const { return m_pages; }
+
+    // Save the indexes of a document of `objectCount' objects read from the
+    // file, unless the file has changed since the cache was made. The
+    // caller must hold the document lock. Returns false on failure.
+    bool Write(int objectCount, const ReferenceIndex & references, const StructureIndex & structure) const;
+
+    // Where the cache files go
+    static QString CacheDirectory();
+
+private:
+    // The cache file for m_filename
+    QString CacheFileName() const;
+
+    // Is the file still as it was when we were made?
+    bool FileUnchanged() const;
+
+    // Delete all but the most recently used cache files
+    static void Prune();
+
+    const QString m_filename;
+    qint64 m_size;
+    QDateTime m_modified;
+
+    bool m_bRead;
+    ReferenceIndex m_references;
+    std::vector<StructureIndex::Entry> m_entries;
+    std::vector<PoDoFo::PdfReference> m_pages;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include "streamclassifier.h"
+
+#include <string>
+
+using namespace PoDoFo;
+
+namespace {
+
+// Streams where more than one byte in this many is a control character are
+// binary. Compressed or random data runs at about one in nine; text,
+// including content streams with the odd small inline image, far below.
+static const long binaryByteRatio = 20;
+
+// The name `key' maps to in `dict', or an empty string if it isn't a name
+std::string nameForKey( const PdfDictionary & dict, const char* key )
+{
+    const PdfObject* value = dict.GetKey( PdfName(key) );
+    return value && value->IsName() ? value->GetName().GetName() : std::string();
+}
+
+// The number `key' maps to in `dict', or -1 if it isn't a number
+long numberForKey( const PdfDictionary & dict, const char* key )
+{
+    const PdfObject* value = dict.GetKey( PdfName(key) );
+    return value && value->IsNumber() ? static_cast<long>(value->GetNumber()) : -1;
+}
+
+// True for filters whose output is image data rather than anything readable
+bool isImageFilter( EPdfFilter filter )
+{
+    return filter == ePdfFilter_DCTDecode
+        || filter == ePdfFilter_JPXDecode
+        || filter == ePdfFilter_JBIG2Decode
+        || filter == ePdfFilter_CCITTFaxDecode;
+}
+
+// Classify by what the decoded data is for
+StreamContent classifyDecoded( const PdfDictionary & dict )
+{
+    const std::string type = nameForKey( dict, "Type" );
+    if (type == "XRef")
+        return StreamContent_Binary;
+    if (type == "ObjStm" || type == "Metadata" || type == "CMap")
+        return StreamContent_Text;
+
+    const std::string subtype = nameForKey( dict, "Subtype" );
+    if (subtype == "Image" || subtype == "Type1C" || subtype == "CIDFontType0C"
+        || subtype == "OpenType")
+        return StreamContent_Binary;
+    if (subtype == "Form" || subtype == "PS" || subtype == "XML")
+        return StreamContent_Text;
+
+    // Embedded Type 1 and TrueType fonts
+    if (dict.HasKey( PdfName("Length1") ))
+        return StreamContent_Binary;
+
+    // Sampled functions hold a table of samples; PostScript calculator
+    // functions are source code.
+    const long functionType = numberForKey( dict, "FunctionType" );
+    if (functionType == 0)
+        return StreamContent_Binary;
+    if (functionType == 4)
+        return StreamContent_Text;
+
+    // Mesh shadings are packed vertex data
+    if (numberForKey( dict, "ShadingType" ) >= 4)
+        return StreamContent_Binary;
+
+    // Tiling patterns are content streams
+    if (numberForKey( dict, "PatternType" ) == 1)
+        return StreamContent_Text;
+
+    // ICC profiles have nothing but /N and perhaps /Alternate and /Range
+    if (type.empty() && dict.HasKey( PdfName("N") ))
+        return StreamContent_Binary;
+
+    return StreamContent_Unknown;
+}
+
+};
+
+StreamContent classifyStreamDictionary( const PdfObject* object, bool encoded )
+{
+    if (!object->IsDictionary())
+        return StreamContent_Unknown;
+
+    TVecFilters filters;
+    try {
+        filters = PdfFilterFactory::CreateFilterList( object );
+    } catch( PdfError & ) {
+        // Unknown filters; leave it to the data
+        return StreamContent_Unknown;
+    }
+
+    if (encoded && !filters.empty())
+    {
+        // What's stored is the output of the outermost filter
+        const EPdfFilter outer = filters.front();
+        if (outer == ePdfFilter_ASCIIHexDecode || outer == ePdfFilter_ASCII85Decode)
+            return StreamContent_Text;
+        return StreamContent_Binary;
+    }
+
+    for (TVecFilters::const_iterator it = filters.begin(); it != filters.end(); ++it)
+        if (isImageFilter( *it ))
+            return StreamContent_Binary;
+
+    return classifyDecoded( object->GetDictionary() );
+}
+
+StreamContent classifyStreamData( const char* data, long len )
+{
+    // Control characters other than the usual white space, counted without
+    // branches so the compiler can vectorise the loop.
+    long binaryBytes = 0;
+    for (long i = 0; i < len; ++i)
+    {
+        const unsigned char c = static_cast<unsigned char>(data[i]);
+        binaryBytes += (c < 0x20) & (c != '\t') & (c != '\n') & (c != '\f') & (c != '\r');
+        binaryBytes += (c == 0x7f);
+    }
+    return binaryBytes * binaryByteRatio > len ? StreamContent_Binary : StreamContent_Text;
+}
@@ -0,0 +1,38 @@
+#ifndef PODOFOBROWSER_STREAMCLASSIFIER_H
+#define PODOFOBROWSER_STREAMCLASSIFIER_H
+
+#include <podofo/podofo.h>
+
+/**
+ * Guesses whether a stream is best shown as text or as binary data, so the
+ * browser can pick a viewer before (or without) reading the stream.
+ *
+ * The stream dictionary is consulted first: /Filter, /Type, /Subtype and
+ * friends settle most streams, such as images, fonts and cross-reference
+ * streams, without looking at the data at all. Page content streams have
+ * nothing in their dictionaries to go on, so for those we sniff the first
+ * few KB of the data.
+ */
+
+enum StreamContent
+{
+    StreamContent_Unknown,
+    StreamContent_Text,
+    StreamContent_Binary
+};
+
+// How many bytes of a stream are worth passing to classifyStreamData()
+static const int streamSniffSize = 64 * 1024;
+
+// Classify the stream of `object' by its dictionary alone. `encoded' says
+// whether the data will be viewed as stored in the file rather than decoded.
+// Returns StreamContent_Unknown if the dictionary doesn't tell. The caller
+// must hold the document lock.
+StreamContent classifyStreamDictionary( const PoDoFo::PdfObject* object, bool encoded );
+
+// Classify stream data given the first `len' bytes of it. Never returns
+// StreamContent_Unknown. A few stray control characters, such as a short
+// inline image in a content stream, don't make text binary.
+StreamContent classifyStreamData( const char* data, long len );
+
+#endif
@@ -0,0 +1,146 @@
+#include "streamcompressor.h"
+#include "podofoutil.h"
+#include "workerpool.h"
+
+#include <QByteArray>
+#include <QMutexLocker>
+
+#include <cstring>
+
+#include <zlib.h>
+
+using namespace PoDoFo;
+
+namespace {
+
+// Starting a thread for fewer streams than this isn't worth it, so a short
+// list is compressed on fewer threads
+static const size_t streamsPerWorker = 4;
+
+};
+
+StreamCompressor::StreamCompressor(PdfMemDocument* doc, QMutex* documentLock, Level level)
+    : m_pDoc(doc),
+      m_pDocumentLock(documentLock),
+      m_level(level),
+      m_cancelMutex(),
+      m_bCancelled(false),
+      m_claimMutex(),
+      m_pStreams(0),
+      m_nextStreamIdx(0),
+      m_compressedCount(0)
+{
+}
+
+void StreamCompressor::Cancel()
+{
+    QMutexLocker lock(&m_cancelMutex);
+    m_bCancelled = true;
+}
+
+bool StreamCompressor::IsCancelled() const
+{
+    QMutexLocker lock(&m_cancelMutex);
+    return m_bCancelled;
+}
+
+int StreamCompressor::Compress(const std::vector<PdfReference> & streams)
+{
+    if (streams.empty())
+        return 0;
+
+    {
+        QMutexLocker lock(&m_claimMutex);
+        m_pStreams = &streams;
+        m_nextStreamIdx = 0;
+        m_compressedCount = 0;
+    }
+
+    const int threadCount = qMin(WorkerPool::IdealThreadCount(),
+                                 static_cast<int>((streams.size() + streamsPerWorker - 1) / streamsPerWorker));
+
+    // The calling thread is one of the workers
+    WorkerPool workers;
+    workers.Start(this, &StreamCompressor::Work, threadCount - 1);
+    Work();
+    workers.Wait();
+
+    QMutexLocker lock(&m_claimMutex);
+    m_pStreams = 0;
+    return m_compressedCount;
+}
+
+bool StreamCompressor::Claim(PdfReference & ref)
+{
+    QMutexLocker lock(&m_claimMutex);
+    if (m_nextStreamIdx >= m_pStreams->size())
+        return false;
+    ref = (*m_pStreams)[m_nextStreamIdx++];
+    return true;
+}
+
+void StreamCompressor::Work()
+{
+    const int zlibLevel = m_level == Level_Small ? Z_BEST_COMPRESSION : Z_BEST_SPEED;
+    QByteArray raw;
+    QByteArray deflated;
+    PdfReference ref;
+    while (!IsCancelled() && Claim(ref))
+    {
+        {
+            QMutexLocker lock(m_pDocumentLock);
+            const PdfObject * const obj = m_pDoc->GetObjects().GetObject(ref);
+            if (!obj || !obj->HasStream() || obj->GetDictionary().HasKey(PdfName::KeyFilter))
+                continue;
+            const char * data = 0;
+            pdf_long len = 0;
+            try {
+                getEncodedStreamData(obj->GetStream(), data, len);
+            } catch (PdfError &) {
+                continue;
+            }
+            raw = QByteArray(data, static_cast<int>(len));
+        }
+
+        uLongf deflatedLen = compressBound(raw.size());
+        deflated.resize(static_cast<int>(deflatedLen));
+        if (compress2(reinterpret_cast<Bytef*>(deflated.data()), &deflatedLen,
+                      reinterpret_cast<const Bytef*>(raw.constData()), raw.size(), zlibLevel) != Z_OK)
+            continue;
+        if (static_cast<int>(deflatedLen) >= raw.size())
+            continue;
+        deflated.resize(static_cast<int>(deflatedLen));
+
+        if (Replace(ref, raw, deflated))
+        {
+            QMutexLocker lock(&m_claimMutex);
+            ++m_compressedCount;
+        }
+    }
+}
+
+bool StreamCompressor::Replace(const PdfReference & ref, const QByteArray & raw, const QByteArray & deflated)
+{
+    QMutexLocker lock(m_pDocumentLock);
+    PdfObject * const obj = m_pDoc->GetObjects().GetObject(ref);
+    if (!obj || !obj->HasStream() || obj->GetDictionary().HasKey(PdfName::KeyFilter))
+        return false;
+
+    try {
+        // Don't clobber an edit made while we were compressing
+        const char * data = 0;
+        pdf_long len = 0;
+        getEncodedStreamData(obj->GetStream(), data, len);
+        if (len != raw.size() || memcmp(data, raw.constData(), raw.size()) != 0)
+            return false;
+
+        PdfInputDevice device(deflated.constData(), deflated.size());
+        obj->GetStream()->SetRawData(&device, deflated.size());
+        obj->GetDictionary().AddKey(PdfName::KeyFilter, PdfName("FlateDecode"));
+        // Parameters left over from an old filter would apply to ours
+        obj->GetDictionary().RemoveKey(PdfName("DecodeParms"));
+    } catch (PdfError &) {
+        return false;
+    }
+    return true;
+}
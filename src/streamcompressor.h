@@ -0,0 +1,74 @@
+#ifndef PODOFOBROWSER_STREAMCOMPRESSOR_H
+#define PODOFOBROWSER_STREAMCOMPRESSOR_H
+
+#include <QMutex>
+
+#include <vector>
+
+#include <podofo/podofo.h>
+
+/**
+ * Flate-compresses a list of unfiltered streams, several at a time on
+ * worker threads. Edited streams are kept uncompressed until the document
+ * is saved (see PoDoFoBrowser::SetStreamData()), and compressed here just
+ * before they're written, so a save after changing hundreds of streams uses
+ * every core rather than deflating them one after another.
+ *
+ * As in DocumentSearch, a worker copies a stream's data out with the
+ * document lock held, compresses it without the lock, and takes the lock
+ * again to put the result in place and set /Filter. Streams that have a
+ * filter by then, or that compression wouldn't make smaller, are left
+ * alone.
+ *
+ * Compress() blocks until the workers are done; call it from any thread,
+ * but not with the document lock held.
+ */
+class StreamCompressor
+{
+public:
+    enum Level
+    {
+        Level_Fast,     // zlib's fastest
+        Level_Small     // zlib's best compression
+    };
+
+    StreamCompressor(PoDoFo::PdfMemDocument* doc, QMutex* documentLock, Level level = Level_Fast);
+
+    void SetLevel(Level level) { m_level = level; }
+
+    // Compress the streams of `streams' and return how many were. Objects
+    // that no longer exist, or have no stream, are skipped.
+    int Compress(const std::vector<PoDoFo::PdfReference> & streams);
+
+    // Make a Compress() in progress return once the streams the workers
+    // are on are done. May be called from any thread.
+    void Cancel();
+    bool IsCancelled() const;
+
+private:
+    // Run by each worker thread
+    void Work();
+
+    // Claim the next stream for a worker. Returns false once there are none
+    // left.
+    bool Claim(PoDoFo::PdfReference & ref);
+
+    // Put `deflated' in place of the unfiltered data `raw' of the object
+    // `ref', unless it's changed meanwhile. Takes the document lock.
+    bool Replace(const PoDoFo::PdfReference & ref, const QByteArray & raw, const QByteArray & deflated);
+
+    PoDoFo::PdfMemDocument* m_pDoc;
+    QMutex* m_pDocumentLock;
+    Level m_level;
+
+    mutable QMutex m_cancelMutex;
+    bool m_bCancelled;
+
+    // What's still to be claimed, and how many were compressed
+    QMutex m_claimMutex;
+    const std::vector<PoDoFo::PdfReference> * m_pStreams;
+    size_t m_nextStreamIdx;
+    int m_compressedCount;
+};
+
+#endif
@@ -0,0 +1,224 @@
+#include "streamexporter.h"
+#include "podofoutil.h"
+#include "streamsnapshot.h"
+
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+
+using namespace PoDoFo;
+
+namespace {
+
+// Objects handed to a worker at a time; see DocumentSearch
+static const int rangeSize = 64;
+
+// How often progress is passed on, in milliseconds
+static const int pollInterval = 100;
+
+/**
+ * Writes decoded stream data straight to a file, until the export is
+ * cancelled
+ */
+class FileSink : public StreamDataSink
+{
+public:
+    FileSink( QFile & file, const StreamExporter & exporter )
+        : m_file(file), m_exporter(exporter), m_bFailed(false)
+    {
+    }
+
+    virtual pdf_long Write( const char* pBuffer, pdf_long lLen )
+    {
+        if (!m_bFailed && m_file.write( pBuffer, lLen ) != lLen)
+            m_bFailed = true;
+        return lLen;
+    }
+
+    virtual bool WantsMore() const { return !m_bFailed && !m_exporter.IsCancelled(); }
+
+    bool HasFailed() const { return m_bFailed; }
+
+private:
+    QFile & m_file;
+    const StreamExporter & m_exporter;
+    bool m_bFailed;
+};
+
+};
+
+StreamExporter::StreamExporter(PdfMemDocument* doc, QMutex* documentLock,
+                               const PdfName & key, const PdfName & value,
+                               const QString & directory, QObject* parent)
+    : QObject(parent),
+      m_pDoc(doc),
+      m_pDocumentLock(documentLock),
+      m_key(key),
+      m_value(value),
+      m_directory(directory),
+      m_objectCount(0),
+      m_cancelMutex(),
+      m_bCancelled(false),
+      m_claimMutex(),
+      m_nextObjectIdx(0),
+      m_doneCount(0),
+      m_exportedCount(0),
+      m_failedCount(0),
+      m_workers(),
+      m_pollTimer()
+{
+    {
+        QMutexLocker lock(m_pDocumentLock);
+        m_objectCount = m_pDoc->GetObjects().GetSize();
+    }
+
+    connect(&m_pollTimer, SIGNAL(timeout()), this, SLOT(poll()));
+    m_pollTimer.start(pollInterval);
+
+    m_workers.Start(this, &StreamExporter::Work, WorkerPool::IdealThreadCount(), QThread::LowPriority);
+}
+
+StreamExporter::~StreamExporter()
+{
+    Cancel();
+    m_workers.Wait();
+}
+
+void StreamExporter::Cancel()
+{
+    QMutexLocker lock(&m_cancelMutex);
+    m_bCancelled = true;
+}
+
+bool StreamExporter::IsCancelled() const
+{
+    QMutexLocker lock(&m_cancelMutex);
+    return m_bCancelled;
+}
+
+int StreamExporter::GetExportedCount() const
+{
+    QMutexLocker lock(&m_claimMutex);
+    return m_exportedCount;
+}
+
+int StreamExporter::GetFailedCount() const
+{
+    QMutexLocker lock(&m_claimMutex);
+    return m_failedCount;
+}
+
+void StreamExporter::poll()
+{
+    const bool allDone = m_workers.IsFinished();
+    if (allDone)
+        m_pollTimer.stop();
+
+    if (IsCancelled())
+        return;
+
+    int done;
+    {
+        QMutexLocker lock(&m_claimMutex);
+        done = m_doneCount;
+    }
+    emit progress(done);
+    if (allDone)
+        emit finished();
+}
+
+bool StreamExporter::ClaimRange(int & begin, int & end)
+{
+    QMutexLocker lock(&m_claimMutex);
+    if (m_nextObjectIdx >= m_objectCount)
+        return false;
+    begin = m_nextObjectIdx;
+    end = qMin(begin + rangeSize, m_objectCount);
+    m_nextObjectIdx = end;
+    return true;
+}
+
+bool StreamExporter::Matches(const PdfObject* obj) const
+{
+    if (!obj->HasStream())
+        return false;
+    const PdfObject * const value = obj->GetDictionary().GetKey(m_key);
+    if (!value)
+        return false;
+    if (value->IsName())
+        return value->GetName() == m_value;
+    if (value->IsArray())
+    {
+        const PdfArray & array = value->GetArray();
+        for (PdfArray::const_iterator it = array.begin(); it != array.end(); ++it)
+            if (it->IsName() && it->GetName() == m_value)
+                return true;
+    }
+    return false;
+}
+
+void StreamExporter::Work()
+{
+    PdfVecObjects & objs = indexableObjects(m_pDoc);
+    const QDir dir(m_directory);
+
+    StreamSnapshot snapshot;
+    int begin = 0;
+    int end = 0;
+    while (!IsCancelled() && ClaimRange(begin, end))
+    {
+        for (int idx = begin; idx < end && !IsCancelled(); ++idx)
+        {
+            PdfReference ref;
+            bool haveSnapshot = false;
+            bool failed = false;
+            {
+                // As in DocumentSearch, re-check the index against the size,
+                // which may have shrunk since the range was claimed
+                QMutexLocker lock(m_pDocumentLock);
+                if (idx >= static_cast<int>(objs.GetSize()))
+                    break;
+                const PdfObject* obj = objs[idx];
+                ref = obj->Reference();
+                try {
+                    haveSnapshot = Matches(obj) && snapshot.Take(obj, false);
+                } catch (PdfError &) {
+                    failed = true;
+                }
+            }
+
+            if (haveSnapshot)
+            {
+                QString suffix = snapshot.KeepImageEncoding();
+                if (suffix.isEmpty())
+                    suffix = QString::fromUtf8("bin");
+                QFile file(dir.filePath(QString::fromUtf8("%1-%2.%3")
+                        .arg(ref.ObjectNumber()).arg(ref.GenerationNumber()).arg(suffix)));
+                if (file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+                {
+                    FileSink sink(file, *this);
+                    try {
+                        snapshot.Decode(sink);
+                    } catch (PdfError &) {
+                        failed = true;
+                    }
+                    failed = failed || sink.HasFailed();
+                    file.close();
+                    // Don't leave a file cut short, or cancelled halfway
+                    if (failed || IsCancelled())
+                        file.remove();
+                }
+                else
+                    failed = true;
+                snapshot.Clear();
+            }
+
+            QMutexLocker lock(&m_claimMutex);
+            ++m_doneCount;
+            if (failed)
+                ++m_failedCount;
+            else if (haveSnapshot)
+                ++m_exportedCount;
+        }
+    }
+}
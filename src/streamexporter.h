@@ -0,0 +1,104 @@
+#ifndef PODOFOBROWSER_STREAMEXPORTER_H
+#define PODOFOBROWSER_STREAMEXPORTER_H
+
+#include <QMutex>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+
+#include <vector>
+
+#include <podofo/podofo.h>
+
+#include "workerpool.h"
+
+/**
+ * Writes every stream of a document whose dictionary matches a key and name,
+ * such as every /Subtype /Image, decoded to its own file in a directory. The
+ * export starts as soon as the exporter is created.
+ *
+ * As in DocumentSearch, the object vector is shared out between worker
+ * threads a range at a time. A worker takes a StreamSnapshot of a matching
+ * stream with the document lock held, then decodes it without the lock,
+ * straight into its file a chunk at a time. So only the encoded data of one
+ * stream per worker is held in memory, however big the decoded streams are.
+ *
+ * JPEG and JPEG 2000 images are written as .jpg and .jp2 files, rather than
+ * decoded to raw samples; everything else goes in a .bin file. The files
+ * are named after the object and generation numbers.
+ *
+ * progress() and finished() are emitted in the thread the exporter lives in
+ * (normally the GUI thread).
+ *
+ * Ownership: the exporter never owns the document. Deleting the exporter
+ * cancels it and waits for the workers, after which the document may be
+ * deleted. Don't delete the exporter while holding the document lock.
+ */
+class StreamExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Export the streams whose dictionary has `key' with the value `value',
+    // or an array containing it (as /Filter may be), into `directory'
+    StreamExporter(PoDoFo::PdfMemDocument* doc, QMutex* documentLock,
+                   const PoDoFo::PdfName & key, const PoDoFo::PdfName & value,
+                   const QString & directory, QObject* parent = 0);
+
+    virtual ~StreamExporter();
+
+    // Ask the workers to stop after the stream they're on. No more signals
+    // are emitted afterwards. Returns immediately.
+    void Cancel();
+    bool IsCancelled() const;
+
+    // Number of objects there are to look at, for progress()
+    int GetObjectCount() const { return m_objectCount; }
+
+    // How it went so far
+    int GetExportedCount() const;
+    int GetFailedCount() const;
+
+signals:
+    // Number of objects looked at so far
+    void progress(int);
+    // Every object has been looked at (but not emitted if cancelled)
+    void finished();
+
+private slots:
+    // Pass on what the workers have been up to
+    void poll();
+
+private:
+    // Run by each worker thread
+    void Work();
+
+    // Claim the next range of objects for a worker. Returns false once
+    // there are none left.
+    bool ClaimRange(int & begin, int & end);
+
+    // Whether the stream dictionary of `obj' is one we want
+    bool Matches(const PoDoFo::PdfObject* obj) const;
+
+    PoDoFo::PdfMemDocument* m_pDoc;
+    QMutex* m_pDocumentLock;
+    const PoDoFo::PdfName m_key;
+    const PoDoFo::PdfName m_value;
+    const QString m_directory;
+    int m_objectCount;
+
+    mutable QMutex m_cancelMutex;
+    bool m_bCancelled;
+
+    // Next object to hand out to a worker, and the tallies
+    mutable QMutex m_claimMutex;
+    int m_nextObjectIdx;
+    int m_doneCount;
+    int m_exportedCount;
+    int m_failedCount;
+
+    WorkerPool m_workers;
+    QTimer m_pollTimer;
+};
+
+#endif
@@ -0,0 +1,99 @@
+#include "streamreplacer.h"
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+inline unsigned char asciiLower( unsigned char c )
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+inline bool isWordByte( unsigned char c )
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')
+        || c == '_' || c >= 0x80;
+}
+
+};
+
+StreamReplacer::StreamReplacer( const QByteArray & find, const QByteArray & replacement,
+                                bool caseSensitive, bool wholeWords )
+    : m_find( find ),
+      m_replacement( replacement ),
+      m_bCaseSensitive( caseSensitive ),
+      m_bWholeWords( wholeWords )
+{
+    const int len = m_find.size();
+    for (int i = 0; i < len; ++i)
+        m_find[i] = Fold( m_find[i] );
+
+    for (int c = 0; c < 256; ++c)
+        m_shift[c] = len;
+    for (int i = 0; i < len - 1; ++i)
+        m_shift[static_cast<unsigned char>(m_find[i])] = len - 1 - i;
+}
+
+unsigned char StreamReplacer::Fold( unsigned char c ) const
+{
+    return m_bCaseSensitive ? c : asciiLower(c);
+}
+
+bool StreamReplacer::IsWholeWord( const QByteArray & in, int pos ) const
+{
+    const int end = pos + m_find.size();
+    return (pos == 0 || !isWordByte( in[pos - 1] ))
+        && (end == in.size() || !isWordByte( in[end] ));
+}
+
+int StreamReplacer::Replace( const QByteArray & in, QByteArray & out ) const
+{
+    const int findLen = m_find.size();
+    const int inLen = in.size();
+    if (!findLen || findLen > inLen)
+        return 0;
+
+    const unsigned char * const data = reinterpret_cast<const unsigned char*>(in.constData());
+    const unsigned char * const find = reinterpret_cast<const unsigned char*>(m_find.constData());
+
+    // Find all the matches first, so the result can be sized up front
+    std::vector<int> matches;
+    int pos = 0;
+    while (pos <= inLen - findLen)
+    {
+        const unsigned char last = Fold( data[pos + findLen - 1] );
+        if (last == find[findLen - 1])
+        {
+            int i = findLen - 2;
+            while (i >= 0 && Fold( data[pos + i] ) == find[i])
+                --i;
+            if (i < 0 && (!m_bWholeWords || IsWholeWord( in, pos )))
+            {
+                matches.push_back( pos );
+                pos += findLen;
+                continue;
+            }
+        }
+        pos += m_shift[last];
+    }
+
+    if (matches.empty())
+        return 0;
+
+    const int replacementLen = m_replacement.size();
+    out.resize( inLen + static_cast<int>(matches.size()) * (replacementLen - findLen) );
+    char * dest = out.data();
+    int copied = 0;
+    for (std::vector<int>::const_iterator it = matches.begin(); it != matches.end(); ++it)
+    {
+        memcpy( dest, in.constData() + copied, *it - copied );
+        dest += *it - copied;
+        memcpy( dest, m_replacement.constData(), replacementLen );
+        dest += replacementLen;
+        copied = *it + findLen;
+    }
+    memcpy( dest, in.constData() + copied, inLen - copied );
+
+    return static_cast<int>(matches.size());
+}
@@ -0,0 +1,43 @@
+#ifndef PODOFOBROWSER_STREAMREPLACER_H
+#define PODOFOBROWSER_STREAMREPLACER_H
+
+#include <QByteArray>
+
+/**
+ * Replaces every occurrence of one byte string with another in a buffer, in
+ * a single pass: matches are found with a Boyer-Moore-Horspool search and the
+ * result is built in one allocation, however many there are. Used for
+ * "Replace All", which would otherwise edit the text editor's document once
+ * per match.
+ *
+ * Matches don't overlap, and are found from the start of the buffer. Without
+ * `caseSensitive', ASCII letters match either case; other bytes only match
+ * themselves. With `wholeWords', a match must not have a letter, digit,
+ * underscore or non-ASCII byte on either side.
+ */
+class StreamReplacer
+{
+public:
+    StreamReplacer(const QByteArray & find, const QByteArray & replacement,
+                   bool caseSensitive, bool wholeWords);
+
+    // Copy `in' into `out' with every match replaced, and return the number
+    // of matches. `out' is left alone if there are none.
+    int Replace(const QByteArray & in, QByteArray & out) const;
+
+private:
+    inline unsigned char Fold(unsigned char c) const;
+    bool IsWholeWord(const QByteArray & in, int pos) const;
+
+    // Folded to lower case unless searching case sensitively
+    QByteArray m_find;
+    QByteArray m_replacement;
+    bool m_bCaseSensitive;
+    bool m_bWholeWords;
+
+    // How far to move the search on, by the folded byte under the end of
+    // the find string
+    int m_shift[256];
+};
+
+#endif
@@ -0,0 +1,148 @@
+#include "streamsnapshot.h"
+#include "podofoutil.h"
+
+#include <memory>
+
+using namespace PoDoFo;
+
+namespace {
+
+// Amount of encoded data fed to the filters at a time, so that decoding can
+// be cut short.
+static const pdf_long encodedChunkSize = 64 * 1024;
+
+/**
+ * Holds back the start of the decoded data until it can tell whether it's
+ * text, then passes it all on to another sink, or nothing if it isn't.
+ */
+class SniffingSink : public StreamDataSink
+{
+public:
+    SniffingSink( StreamDataSink & sink )
+        : m_sink(sink), m_bSniffing(true), m_bRejected(false), m_head()
+    {
+    }
+
+    virtual pdf_long Write( const char* pBuffer, pdf_long lLen )
+    {
+        if (m_bRejected)
+            return lLen;
+        if (!m_bSniffing)
+            return m_sink.Write( pBuffer, lLen );
+
+        m_head.append( pBuffer, lLen );
+        if (m_head.size() >= streamSniffSize)
+            Sniff();
+        return lLen;
+    }
+
+    virtual void Close()
+    {
+        if (m_bSniffing)
+            Sniff();
+        if (!m_bRejected)
+            m_sink.Close();
+    }
+
+    virtual bool WantsMore() const { return !m_bRejected && m_sink.WantsMore(); }
+
+    bool IsRejected() const { return m_bRejected; }
+
+private:
+    void Sniff()
+    {
+        m_bSniffing = false;
+        m_bRejected = classifyStreamData( m_head.constData(), m_head.size() ) == StreamContent_Binary;
+        if (!m_bRejected)
+            m_sink.Write( m_head.constData(), m_head.size() );
+        m_head = QByteArray();
+    }
+
+    StreamDataSink & m_sink;
+    bool m_bSniffing;
+    bool m_bRejected;
+    QByteArray m_head;
+};
+
+};
+
+StreamSnapshot::StreamSnapshot()
+    : m_filters(),
+      m_dict(),
+      m_data(),
+      m_content(StreamContent_Unknown),
+      m_bTextOnly(true)
+{
+}
+
+bool StreamSnapshot::Take( const PdfObject* object, bool textOnly )
+{
+    Clear();
+    m_content = classifyStreamDictionary( object, false );
+    m_bTextOnly = textOnly;
+    if (textOnly && m_content == StreamContent_Binary)
+        return false;
+
+    const char* data = 0;
+    pdf_long len = 0;
+    getEncodedStreamData( object->GetStream(), data, len );
+    m_filters = PdfFilterFactory::CreateFilterList( object );
+    m_dict = object->GetDictionary();
+    m_data = QByteArray( data, len );
+    return true;
+}
+
+void StreamSnapshot::Clear()
+{
+    m_filters.clear();
+    m_dict.Clear();
+    m_data = QByteArray();
+    m_content = StreamContent_Unknown;
+    m_bTextOnly = true;
+}
+
+QString StreamSnapshot::KeepImageEncoding()
+{
+    if (m_filters.empty())
+        return QString();
+
+    QString suffix;
+    if (m_filters.back() == ePdfFilter_DCTDecode)
+        suffix = QString::fromUtf8("jpg");
+    else if (m_filters.back() == ePdfFilter_JPXDecode)
+        suffix = QString::fromUtf8("jp2");
+    else
+        return QString();
+
+    m_filters.pop_back();
+    return suffix;
+}
+
+bool StreamSnapshot::Decode( StreamDataSink & sink ) const
+{
+    SniffingSink sniffer( sink );
+    StreamDataSink & target = m_bTextOnly && m_content == StreamContent_Unknown
+        ? static_cast<StreamDataSink&>(sniffer) : sink;
+
+    std::auto_ptr<PdfOutputStream> decoder;
+    PdfOutputStream* out = &target;
+    if (!m_filters.empty())
+    {
+        decoder.reset( PdfFilterFactory::CreateDecodeStream( m_filters, &target, &m_dict ) );
+        out = decoder.get();
+    }
+
+    const char* data = m_data.constData();
+    const pdf_long len = m_data.size();
+    try {
+        for (pdf_long pos = 0; pos < len && target.WantsMore(); pos += encodedChunkSize)
+            out->Write( data + pos, qMin(encodedChunkSize, len - pos) );
+        out->Close();
+    } catch( PdfError & ) {
+        // Pass on what was decoded, including anything still being sniffed
+        target.Close();
+        throw;
+    }
+
+    return !sniffer.IsRejected();
+}
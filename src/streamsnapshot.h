@@ -0,0 +1,70 @@
+#ifndef PODOFOBROWSER_STREAMSNAPSHOT_H
+#define PODOFOBROWSER_STREAMSNAPSHOT_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <podofo/podofo.h>
+
+#include "streamclassifier.h"
+
+/**
+ * Where StreamSnapshot::Decode() sends the decoded data. WantsMore() is
+ * checked between chunks, so a sink that has seen enough, or whose reader
+ * has given up, can cut decoding short. Close() may be called more than
+ * once.
+ */
+class StreamDataSink : public PoDoFo::PdfOutputStream
+{
+public:
+    virtual bool WantsMore() const { return true; }
+    virtual void Close() { }
+};
+
+/**
+ * A private copy of everything it takes to decode an object's stream: the
+ * encoded data, the filter chain and the dictionary with the filter
+ * parameters. Taking a snapshot needs the document lock, but decoding it
+ * doesn't, so worker threads can decode big streams without keeping
+ * everybody else waiting for the document.
+ */
+class StreamSnapshot
+{
+public:
+    StreamSnapshot();
+
+    // Copy the stream of `object', which must have one. With `textOnly',
+    // don't bother if the stream dictionary says the data is binary, and
+    // return false. The caller must hold the document lock. Throws
+    // PdfError.
+    bool Take(const PoDoFo::PdfObject* object, bool textOnly);
+
+    // Forget the data taken
+    void Clear();
+
+    // What the stream dictionary says the decoded data is
+    StreamContent GetContent() const { return m_content; }
+
+    // If the last filter is one whose encoding is an image file format,
+    // DCTDecode (JPEG) or JPXDecode (JPEG 2000), drop it, so that Decode()
+    // gives an image file. Returns the usual suffix for the file, or an
+    // empty string if there's no such filter.
+    QString KeepImageEncoding();
+
+    // Decode the data, writing it to `sink' and closing it. If the
+    // snapshot was taken `textOnly' and the dictionary didn't say whether
+    // the data is text, the start of it is sniffed first, and nothing is
+    // written if it turns out to be binary; then false is returned. Needs
+    // no lock. Throws PdfError if the filters fail, having written whatever
+    // was decoded until then.
+    bool Decode(StreamDataSink & sink) const;
+
+private:
+    PoDoFo::TVecFilters m_filters;
+    PoDoFo::PdfDictionary m_dict;
+    QByteArray m_data;
+    StreamContent m_content;
+    bool m_bTextOnly;
+};
+
+#endif
@@ -0,0 +1,228 @@
+#include "structuredock.h"
+#include "structureindex.h"
+
+#include <QAbstractTableModel>
+#include <QComboBox>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLabel>
+#include <QLineEdit>
+#include <QSortFilterProxyModel>
+#include <QTreeView>
+#include <QVBoxLayout>
+
+#include <vector>
+
+using namespace PoDoFo;
+
+namespace {
+
+typedef StructureIndex::Entry Entry;
+
+enum Column
+{
+    Column_Kind,
+    Column_Name,
+    Column_Page,
+    Column_Details,
+    Column_Object,
+    Column_Count
+};
+
+// Role the kind of an entry is kept under, for filtering on
+static const int kindRole = Qt::UserRole;
+
+// The kind filter's entries, after "All"
+static const StructureIndex::Kind kindChoices[] = {
+    StructureIndex::Kind_Page,
+    StructureIndex::Kind_Font,
+    StructureIndex::Kind_Image
+};
+
+QString kindName( StructureIndex::Kind kind )
+{
+    switch (kind)
+    {
+        case StructureIndex::Kind_Page:
+            return StructureDock::tr("Page");
+        case StructureIndex::Kind_Font:
+            return StructureDock::tr("Font");
+        case StructureIndex::Kind_Image:
+            return StructureDock::tr("Image");
+    }
+    return QString();
+}
+
+/**
+ * The entries of a StructureIndex as a table, one row each
+ */
+class StructureModel : public QAbstractTableModel
+{
+public:
+    StructureModel( const std::vector<Entry> & entries, QObject* parent )
+        : QAbstractTableModel(parent), m_entries(entries)
+    {
+    }
+
+    virtual int rowCount( const QModelIndex & parent = QModelIndex() ) const
+    {
+        return parent.isValid() ? 0 : static_cast<int>(m_entries.size());
+    }
+
+    virtual int columnCount( const QModelIndex & parent = QModelIndex() ) const
+    {
+        return parent.isValid() ? 0 : Column_Count;
+    }
+
+    virtual QVariant data( const QModelIndex & index, int role = Qt::DisplayRole ) const
+    {
+        if (!index.isValid() || index.row() >= rowCount())
+            return QVariant();
+        const Entry & entry = m_entries[index.row()];
+        if (role == kindRole)
+            return QString::number( entry.kind );
+        if (role != Qt::DisplayRole)
+            return QVariant();
+
+        switch (index.column())
+        {
+            case Column_Kind:
+                return kindName( entry.kind );
+            case Column_Name:
+                return entry.name;
+            case Column_Page:
+                // As a number, so it sorts as one
+                return entry.page ? QVariant( entry.page ) : QVariant();
+            case Column_Details:
+                return entry.details;
+            case Column_Object:
+                return StructureDock::tr("%1 %2 R").arg( entry.ref.ObjectNumber() )
+                                                   .arg( entry.ref.GenerationNumber() );
+        }
+        return QVariant();
+    }
+
+    virtual QVariant headerData( int section, Qt::Orientation orientation, int role = Qt::DisplayRole ) const
+    {
+        if (orientation != Qt::Horizontal || role != Qt::DisplayRole)
+            return QVariant();
+        switch (section)
+        {
+            case Column_Kind:
+                return StructureDock::tr("Kind");
+            case Column_Name:
+                return StructureDock::tr("Name");
+            case Column_Page:
+                return StructureDock::tr("Page");
+            case Column_Details:
+                return StructureDock::tr("Details");
+            case Column_Object:
+                return StructureDock::tr("Object");
+        }
+        return QVariant();
+    }
+
+    const Entry & GetEntry( int row ) const { return m_entries[row]; }
+
+private:
+    const std::vector<Entry> m_entries;
+};
+
+};
+
+StructureDock::StructureDock(QWidget* parent)
+    : QDockWidget(tr("Structure"), parent),
+      m_pName(0),
+      m_pKind(0),
+      m_pView(0),
+      m_pStatus(0),
+      m_pModel(0),
+      m_pKindFilter(0),
+      m_pNameFilter(0)
+{
+    setObjectName(QString::fromUtf8("StructureDock"));
+
+    QWidget* contents = new QWidget(this);
+    QVBoxLayout* layout = new QVBoxLayout(contents);
+    layout->setMargin(2);
+
+    QHBoxLayout* filterLayout = new QHBoxLayout();
+    m_pKind = new QComboBox(contents);
+    m_pKind->addItem(tr("All"));
+    m_pKind->addItem(tr("Pages"));
+    m_pKind->addItem(tr("Fonts"));
+    m_pKind->addItem(tr("Images"));
+    filterLayout->addWidget(m_pKind);
+    m_pName = new QLineEdit(contents);
+    m_pName->setToolTip( tr("Show only entries whose name contains this") );
+    filterLayout->addWidget(m_pName, 1);
+    layout->addLayout(filterLayout);
+
+    // Filtering by kind works on the kind number rather than its name, so
+    // that it can't be confused by translations
+    m_pKindFilter = new QSortFilterProxyModel(this);
+    m_pKindFilter->setFilterRole(kindRole);
+    m_pKindFilter->setFilterKeyColumn(Column_Kind);
+    m_pNameFilter = new QSortFilterProxyModel(this);
+    m_pNameFilter->setSourceModel(m_pKindFilter);
+    m_pNameFilter->setFilterKeyColumn(Column_Name);
+    m_pNameFilter->setFilterCaseSensitivity(Qt::CaseInsensitive);
+
+    m_pView = new QTreeView(contents);
+    m_pView->setRootIsDecorated(false);
+    m_pView->setUniformRowHeights(true);
+    m_pView->setAllColumnsShowFocus(true);
+    m_pView->setSortingEnabled(true);
+    m_pView->setModel(m_pNameFilter);
+    m_pView->sortByColumn(Column_Page, Qt::AscendingOrder);
+    layout->addWidget(m_pView);
+
+    m_pStatus = new QLabel(contents);
+    layout->addWidget(m_pStatus);
+
+    setWidget(contents);
+
+    connect( m_pKind, SIGNAL(activated(int)), this, SLOT(kindChanged(int)) );
+    connect( m_pName, SIGNAL(textChanged(const QString &)), this, SLOT(nameChanged(const QString &)) );
+    connect( m_pView, SIGNAL(activated(const QModelIndex &)), this, SLOT(itemActivated(const QModelIndex &)) );
+}
+
+void StructureDock::SetIndex(const StructureIndex* index)
+{
+    QAbstractItemModel* old = m_pModel;
+    m_pModel = index ? new StructureModel(index->GetEntries(), this) : 0;
+    m_pKindFilter->setSourceModel(m_pModel);
+    delete old;
+    UpdateStatus();
+}
+
+void StructureDock::kindChanged(int kind)
+{
+    if (kind <= 0)
+        m_pKindFilter->setFilterRegExp(QString());
+    else
+        m_pKindFilter->setFilterFixedString(QString::number( kindChoices[kind - 1] ));
+    UpdateStatus();
+}
+
+void StructureDock::nameChanged(const QString & text)
+{
+    m_pNameFilter->setFilterFixedString(text);
+    UpdateStatus();
+}
+
+void StructureDock::itemActivated(const QModelIndex & index)
+{
+    if (!m_pModel || !index.isValid())
+        return;
+    const QModelIndex source = m_pKindFilter->mapToSource( m_pNameFilter->mapToSource( index ) );
+    emit resultActivated( static_cast<const StructureModel*>(m_pModel)->GetEntry( source.row() ).ref );
+}
+
+void StructureDock::UpdateStatus()
+{
+    if (!m_pModel)
+        m_pStatus->clear();
+    else
+        m_pStatus->setText( tr("%1 of %2 shown").arg( m_pNameFilter->rowCount() ).arg( m_pModel->rowCount() ) );
+}
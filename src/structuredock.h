@@ -0,0 +1,58 @@
+#ifndef PODOFOBROWSER_STRUCTUREDOCK_H
+#define PODOFOBROWSER_STRUCTUREDOCK_H
+
+#include <QDockWidget>
+
+#include <podofo/podofo.h>
+
+class QAbstractItemModel;
+class QComboBox;
+class QLabel;
+class QLineEdit;
+class QModelIndex;
+class QSortFilterProxyModel;
+class QTreeView;
+class StructureIndex;
+
+/**
+ * A dock listing the pages, fonts and images of a StructureIndex, which can
+ * be narrowed down by kind and by name as you type, and sorted by any column.
+ * Filtering only looks at the list the index already made, so it's instant
+ * however large the document is.
+ */
+class StructureDock : public QDockWidget
+{
+    Q_OBJECT
+
+public:
+    StructureDock(QWidget* parent = 0);
+
+    // Show what `index' found, which must be ready, or nothing if it's null.
+    // The dock copies what it needs, so the index may be deleted afterwards.
+    void SetIndex(const StructureIndex* index);
+
+signals:
+    // The user picked an entry
+    void resultActivated(const PoDoFo::PdfReference & ref);
+
+private slots:
+    void kindChanged(int kind);
+    void nameChanged(const QString & text);
+    void itemActivated(const QModelIndex & index);
+
+private:
+    void UpdateStatus();
+
+    QLineEdit* m_pName;
+    QComboBox* m_pKind;
+    QTreeView* m_pView;
+    QLabel* m_pStatus;
+
+    // What the index found, or null
+    QAbstractItemModel* m_pModel;
+    // Filters by kind, and then by name
+    QSortFilterProxyModel* m_pKindFilter;
+    QSortFilterProxyModel* m_pNameFilter;
+};
+
+#endif
@@ -0,0 +1,324 @@
+#include "structureindex.h"
+#include "podofoutil.h"
+
+#include <QMutexLocker>
+#include <QTime>
+
+#include <algorithm>
+
+using namespace PoDoFo;
+
+namespace {
+
+// How long we may hold the document lock per batch of objects, in
+// milliseconds. See BackgroundLoader.
+static const int maxBatchTime = 20;
+
+QString nameString( const PdfName & name )
+{
+    return QString::fromUtf8( name.GetName().c_str() );
+}
+
+// The value of `key' in `obj' if it's a name, or an empty string
+QString dictName( const PdfObject* obj, const char* key )
+{
+    const PdfObject* value = obj->GetDictionary().GetKey( PdfName(key) );
+    return value && value->IsName() ? nameString( value->GetName() ) : QString();
+}
+
+bool isFont( const PdfObject* obj )
+{
+    return dictName( obj, "Type" ) == QLatin1String("Font");
+}
+
+bool isImage( const PdfObject* obj )
+{
+    return dictName( obj, "Subtype" ) == QLatin1String("Image");
+}
+
+// "W × H" from the numbers under `widthKey' and `heightKey', if there are any
+QString sizeString( const PdfObject* obj, const char* widthKey, const char* heightKey )
+{
+    const PdfObject* w = obj->GetDictionary().GetKey( PdfName(widthKey) );
+    const PdfObject* h = obj->GetDictionary().GetKey( PdfName(heightKey) );
+    if (!w || !h || !w->IsNumber() || !h->IsNumber())
+        return QString();
+    return QString::fromUtf8("%1 \xc3\x97 %2").arg( w->GetNumber() ).arg( h->GetNumber() );
+}
+
+// The size of a page's media box
+QString mediaBoxString( const PdfObject* mediaBox )
+{
+    if (!mediaBox || !mediaBox->IsArray() || mediaBox->GetArray().size() != 4)
+        return QString();
+    const PdfArray & box = mediaBox->GetArray();
+    for (int i = 0; i < 4; ++i)
+        if (!box[i].IsReal() && !box[i].IsNumber())
+            return QString();
+    const double width = box[2].GetReal() - box[0].GetReal();
+    const double height = box[3].GetReal() - box[1].GetReal();
+    return QString::fromUtf8("%1 \xc3\x97 %2").arg( qAbs(width) ).arg( qAbs(height) );
+}
+
+};
+
+StructureIndex::StructureIndex(PdfMemDocument* doc, QMutex* documentLock, QObject* parent)
+    : QThread(parent),
+      m_pDoc(doc),
+      m_pDocumentLock(documentLock),
+      m_stopMutex(),
+      m_bStop(false),
+      m_readyMutex(),
+      m_bReady(false),
+      m_entries(),
+      m_pages(),
+      m_pendingNodes(),
+      m_seen(),
+      m_nextObjectIdx(0)
+{
+}
+
+StructureIndex::~StructureIndex()
+{
+    Stop();
+    wait();
+}
+
+void StructureIndex::Stop()
+{
+    QMutexLocker lock(&m_stopMutex);
+    m_bStop = true;
+}
+
+bool StructureIndex::IsStopping() const
+{
+    QMutexLocker lock(&m_stopMutex);
+    return m_bStop;
+}
+
+bool StructureIndex::IsReady() const
+{
+    QMutexLocker lock(&m_readyMutex);
+    return m_bReady;
+}
+
+void StructureIndex::Restore(const std::vector<Entry> & entries, const std::vector<PdfReference> & pages)
+{
+    QMutexLocker lock(&m_readyMutex);
+    m_entries = entries;
+    m_pages = pages;
+    m_bReady = true;
+}
+
+void StructureIndex::run()
+{
+    {
+        QMutexLocker lock(m_pDocumentLock);
+        const PdfObject* root = Resolve( m_pDoc->GetTrailer()->GetDictionary().GetKey( PdfName("Root") ) );
+        const PdfObject* pages = root && root->IsDictionary()
+            ? Resolve( root->GetDictionary().GetKey( PdfName("Pages") ) ) : 0;
+        if (pages && pages->IsDictionary())
+        {
+            PendingNode top;
+            top.node = pages->Reference();
+            m_pendingNodes.push_back( top );
+        }
+    }
+
+    bool walking = true;
+    while (!IsStopping())
+    {
+        bool more = false;
+        {
+            QMutexLocker lock(m_pDocumentLock);
+            try {
+                if (walking)
+                {
+                    walking = WalkPages();
+                    more = true;
+                }
+                else
+                    more = SweepObjects();
+            } catch( PdfError & ) {
+                // A broken page tree or object just leaves some things out
+                if (walking)
+                {
+                    walking = !m_pendingNodes.empty();
+                    more = true;
+                }
+                else
+                    more = m_nextObjectIdx < static_cast<int>(m_pDoc->GetObjects().GetSize());
+            }
+        }
+        if (!more)
+            break;
+
+        // Give a waiting GUI thread a chance at the lock
+        yieldCurrentThread();
+    }
+
+    if (IsStopping())
+        return;
+
+    m_pendingNodes.clear();
+    m_seen.clear();
+    {
+        QMutexLocker lock(&m_readyMutex);
+        m_bReady = true;
+    }
+    emit done();
+}
+
+const PdfObject* StructureIndex::Resolve(const PdfObject* obj) const
+{
+    if (obj && obj->IsReference())
+        return m_pDoc->GetObjects().GetObject( obj->GetReference() );
+    return obj;
+}
+
+bool StructureIndex::WalkPages()
+{
+    QTime batchTimer;
+    batchTimer.start();
+    while (!m_pendingNodes.empty() && batchTimer.elapsed() < maxBatchTime)
+    {
+        const PendingNode pending = m_pendingNodes.back();
+        m_pendingNodes.pop_back();
+
+        // A page tree with a loop in it would keep us here forever
+        const quint64 key = referenceKey( pending.node );
+        if (m_seen.contains( key ))
+            continue;
+        m_seen.insert( key );
+
+        const PdfObject* node = m_pDoc->GetObjects().GetObject( pending.node );
+        if (!node || !node->IsDictionary())
+            continue;
+
+        // Resources and the media box are inherited from the nearest
+        // ancestor that has them
+        const PdfDictionary & dict = node->GetDictionary();
+        const PdfReference resourcesOwner = dict.HasKey( PdfName("Resources") )
+            ? pending.node : pending.resourcesOwner;
+        const PdfReference mediaBoxOwner = dict.HasKey( PdfName("MediaBox") )
+            ? pending.node : pending.mediaBoxOwner;
+
+        const PdfObject* kids = Resolve( dict.GetKey( PdfName("Kids") ) );
+        if (kids && kids->IsArray())
+        {
+            // Pushed last to first, so the first kid comes off the stack next
+            // and pages are found in order
+            const PdfArray & array = kids->GetArray();
+            for (int i = static_cast<int>(array.size()) - 1; i >= 0; --i)
+            {
+                if (!array[i].IsReference())
+                    continue;
+                PendingNode kid;
+                kid.node = array[i].GetReference();
+                kid.resourcesOwner = resourcesOwner;
+                kid.mediaBoxOwner = mediaBoxOwner;
+                m_pendingNodes.push_back( kid );
+            }
+            continue;
+        }
+
+        m_pages.push_back( pending.node );
+        const int pageNumber = static_cast<int>(m_pages.size());
+
+        Entry entry;
+        entry.ref = pending.node;
+        entry.kind = Kind_Page;
+        entry.name = tr("Page %1").arg( pageNumber );
+        entry.page = pageNumber;
+        const PdfObject* mediaBoxNode = m_pDoc->GetObjects().GetObject( mediaBoxOwner );
+        if (mediaBoxNode && mediaBoxNode->IsDictionary())
+            entry.details = mediaBoxString( Resolve( mediaBoxNode->GetDictionary().GetKey( PdfName("MediaBox") ) ) );
+        m_entries.push_back( entry );
+
+        const PdfObject* owner = m_pDoc->GetObjects().GetObject( resourcesOwner );
+        if (owner && owner->IsDictionary())
+            AddResources( Resolve( owner->GetDictionary().GetKey( PdfName("Resources") ) ), pageNumber );
+    }
+    return !m_pendingNodes.empty();
+}
+
+void StructureIndex::AddResources(const PdfObject* resources, int page)
+{
+    if (!resources || !resources->IsDictionary())
+        return;
+
+    const PdfObject* fonts = Resolve( resources->GetDictionary().GetKey( PdfName("Font") ) );
+    if (fonts && fonts->IsDictionary())
+    {
+        const TKeyMap & keys = fonts->GetDictionary().GetKeys();
+        for (TCIKeyMap it = keys.begin(); it != keys.end(); ++it)
+            AddIfNew( Resolve( (*it).second ), Kind_Font, nameString( (*it).first ), page );
+    }
+
+    const PdfObject* xobjects = Resolve( resources->GetDictionary().GetKey( PdfName("XObject") ) );
+    if (xobjects && xobjects->IsDictionary())
+    {
+        const TKeyMap & keys = xobjects->GetDictionary().GetKeys();
+        for (TCIKeyMap it = keys.begin(); it != keys.end(); ++it)
+        {
+            const PdfObject* xobject = Resolve( (*it).second );
+            if (xobject && xobject->IsDictionary() && isImage( xobject ))
+                AddIfNew( xobject, Kind_Image, nameString( (*it).first ), page );
+        }
+    }
+}
+
+void StructureIndex::AddIfNew(const PdfObject* obj, Kind kind, const QString & name, int page)
+{
+    // Only indirect objects can be gone to
+    if (!obj || !obj->IsDictionary() || !obj->Reference().IsIndirect())
+        return;
+    const quint64 key = referenceKey( obj->Reference() );
+    if (m_seen.contains( key ))
+        return;
+    m_seen.insert( key );
+
+    Entry entry;
+    entry.ref = obj->Reference();
+    entry.kind = kind;
+    entry.page = page;
+    if (kind == Kind_Font)
+    {
+        const QString baseFont = dictName( obj, "BaseFont" );
+        if (name.isEmpty())
+            entry.name = baseFont;
+        else if (baseFont.isEmpty())
+            entry.name = name;
+        else
+            entry.name = QString::fromUtf8("%1 (%2)").arg( name ).arg( baseFont );
+        entry.details = dictName( obj, "Subtype" );
+    }
+    else
+    {
+        entry.name = name;
+        entry.details = sizeString( obj, "Width", "Height" );
+    }
+    m_entries.push_back( entry );
+}
+
+bool StructureIndex::SweepObjects()
+{
+    // As in BackgroundLoader, an index into the vector is good enough; the
+    // vector is only changed with the lock held, and we re-check the size
+    // every batch.
+    const PdfVecObjects & objs = m_pDoc->GetObjects();
+    const int objCount = static_cast<int>(objs.GetSize());
+    QTime batchTimer;
+    batchTimer.start();
+    while (m_nextObjectIdx < objCount && batchTimer.elapsed() < maxBatchTime)
+    {
+        const PdfObject* obj = objs[m_nextObjectIdx++];
+        if (!obj->IsDictionary())
+            continue;
+        if (isFont( obj ))
+            AddIfNew( obj, Kind_Font, QString(), 0 );
+        else if (isImage( obj ))
+            AddIfNew( obj, Kind_Image, QString(), 0 );
+    }
+    return m_nextObjectIdx < objCount;
+}
@@ -0,0 +1,130 @@
+#ifndef PODOFOBROWSER_STRUCTUREINDEX_H
+#define PODOFOBROWSER_STRUCTUREINDEX_H
+
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QThread>
+
+#include <vector>
+
+#include <podofo/podofo.h>
+
+/**
+ * A list of the pages, fonts and images of a document, built in one pass so
+ * that they can be listed, filtered and jumped to without walking the page
+ * tree or expanding the object tree by hand.
+ *
+ * The page tree is walked first, in page order, noting each page and the
+ * fonts and images its resources name, with the page they're first used on.
+ * Then every other object is looked at for fonts and images no page names
+ * directly, such as those used by form XObjects and annotations.
+ *
+ * The index is built on a worker thread. Locking is as for SearchIndex: the
+ * worker holds `documentLock' for a short batch of objects at a time. The
+ * index describes the document as it was when it was built.
+ *
+ * Ownership: the index never owns the document. Deleting the index stops the
+ * worker and waits for it, after which the document may be deleted. Don't
+ * delete the index while holding the document lock.
+ */
+class StructureIndex : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum Kind
+    {
+        Kind_Page,
+        Kind_Font,
+        Kind_Image
+    };
+
+    struct Entry
+    {
+        PoDoFo::PdfReference ref;
+        Kind kind;
+        // "F12 (Helvetica)" for a font, the resource name of an image
+        QString name;
+        // The page it's on or first used on, from 1, or 0 if none
+        int page;
+        // Page and image dimensions, the font type
+        QString details;
+    };
+
+    StructureIndex(PoDoFo::PdfMemDocument* doc, QMutex* documentLock, QObject* parent = 0);
+
+    virtual ~StructureIndex();
+
+    // Ask the worker to stop after its current batch. Returns immediately.
+    void Stop();
+    bool IsStopping() const;
+
+    // True once the index is complete and may be read
+    bool IsReady() const;
+
+    // Make the index ready at once with `entries' and `pages', as saved by
+    // a SessionCache for the file the document was read from, rather than
+    // building it. Call instead of start(); done() isn't emitted.
+    void Restore(const std::vector<Entry> & entries, const std::vector<PoDoFo::PdfReference> & pages);
+
+    // Everything found, the pages first in page order. Must only be called
+    // once IsReady().
+    const std::vector<Entry> & GetEntries() const { return m_entries; }
+
+    // The page objects in order, so page `n' (from 0) is GetPages()[n].
+    // Must only be called once IsReady().
+    const std::vector<PoDoFo::PdfReference> & GetPages() const { return m_pages; }
+
+signals:
+    // Emitted once the index is ready (but not if stopped early).
+    void done();
+
+protected:
+    virtual void run();
+
+private:
+    // Walk the page tree for up to one batch; false once it's all walked
+    bool WalkPages();
+    // Look for fonts and images among the rest of the objects, for up to
+    // one batch; false once they've all been seen
+    bool SweepObjects();
+
+    // Note the fonts and images named in the resource dictionary `resources'
+    // of page number `page'
+    void AddResources(const PoDoFo::PdfObject* resources, int page);
+    // Add `obj' if it's a font or image we haven't seen yet
+    void AddIfNew(const PoDoFo::PdfObject* obj, Kind kind, const QString & name, int page);
+
+    // `obj', or what it refers to if it's a reference; may be null
+    const PoDoFo::PdfObject* Resolve(const PoDoFo::PdfObject* obj) const;
+
+    PoDoFo::PdfMemDocument* m_pDoc;
+    QMutex* m_pDocumentLock;
+
+    mutable QMutex m_stopMutex;
+    bool m_bStop;
+
+    mutable QMutex m_readyMutex;
+    bool m_bReady;
+
+    // Only touched by the worker until m_bReady is set, and read only
+    // afterwards.
+    std::vector<Entry> m_entries;
+    std::vector<PoDoFo::PdfReference> m_pages;
+
+    // The worker's state between batches: page tree nodes still to visit,
+    // each with the nodes its resources and media box would be inherited
+    // from, and the objects already added or visited
+    struct PendingNode
+    {
+        PoDoFo::PdfReference node;
+        PoDoFo::PdfReference resourcesOwner;
+        PoDoFo::PdfReference mediaBoxOwner;
+    };
+    std::vector<PendingNode> m_pendingNodes;
+    QSet<quint64> m_seen;
+    int m_nextObjectIdx;
+};
+
+#endif
@@ -0,0 +1,227 @@
+#include "textstreamview.h"
+
+#include <QFont>
+#include <QFontMetrics>
+#include <QIODevice>
+#include <QKeyEvent>
+#include <QPainter>
+#include <QScrollBar>
+#include <QTextCodec>
+#include <QTime>
+
+namespace {
+
+// Bytes scanned per read while indexing
+static const unsigned int indexChunk = 64 * 1024;
+
+// How long one slice of indexing may keep the event loop waiting, in
+// milliseconds.
+static const int maxIndexTime = 10;
+
+// Lines longer than this many bytes are broken up into several, so that no
+// single line costs much to draw however the text is laid out. PDF generators
+// are fond of putting a whole content stream on one line. With multi-byte
+// encodings this may split a character; we put up with that.
+static const int maxLineBytes = 1024;
+
+// Columns a tab advances by
+static const int tabWidth = 8;
+
+};
+
+TextStreamView::TextStreamView(QWidget* parent)
+    : QAbstractScrollArea(parent),
+      m_codec(0),
+      m_cache(),
+      m_lineStarts(),
+      m_indexed(0),
+      m_bIndexComplete(true),
+      m_bPendingCR(false),
+      m_longestLine(0),
+      m_indexTimer()
+{
+    setFont(QFont(QString::fromLocal8Bit("Monospace"), 8));
+    viewport()->setBackgroundRole(QPalette::Base);
+    verticalScrollBar()->setSingleStep(1);
+
+    // Index whenever the event loop has nothing better to do
+    m_indexTimer.setInterval(0);
+    connect(&m_indexTimer, SIGNAL(timeout()), this, SLOT(indexMore()));
+}
+
+TextStreamView::~TextStreamView()
+{
+}
+
+void TextStreamView::setData(QIODevice* device, QTextCodec* codec)
+{
+    m_indexTimer.stop();
+    m_cache.setDevice(codec ? device : 0);
+    m_codec = device ? codec : 0;
+
+    m_lineStarts.clear();
+    m_indexed = 0;
+    m_bPendingCR = false;
+    m_longestLine = 0;
+    m_bIndexComplete = !m_cache.device();
+    if (!m_bIndexComplete)
+    {
+        m_lineStarts.push_back(0);
+        // Index enough to fill the screen straight away, so there's no flash
+        // of an empty view.
+        IndexTo(indexChunk);
+        if (!m_bIndexComplete)
+            m_indexTimer.start();
+    }
+
+    verticalScrollBar()->setValue(0);
+    horizontalScrollBar()->setValue(0);
+    UpdateScrollBars();
+    viewport()->update();
+}
+
+void TextStreamView::indexMore()
+{
+    const int linesBefore = lineCount();
+
+    QTime sliceTimer;
+    sliceTimer.start();
+    while (sliceTimer.elapsed() < maxIndexTime && IndexTo(m_indexed + indexChunk))
+        ;
+
+    UpdateScrollBars();
+    // Only the last line on screen can have been extended, unless we had
+    // fewer lines than fit on screen so far.
+    if (linesBefore <= verticalScrollBar()->value() + VisibleLines())
+        viewport()->update();
+
+    if (m_bIndexComplete)
+    {
+        m_indexTimer.stop();
+        emit indexComplete();
+    }
+}
+
+bool TextStreamView::IndexTo(quint64 end)
+{
+    while (!m_bIndexComplete && m_indexed < end)
+    {
+        const unsigned int want = static_cast<unsigned int>(qMin<quint64>(end - m_indexed, indexChunk));
+        m_cache.fetch(m_indexed, want);
+        if (!m_cache.windowContains(m_indexed, 1))
+        {
+            m_bIndexComplete = true;
+            break;
+        }
+
+        const QByteArray & window = m_cache.window();
+        const quint64 windowEnd = m_cache.windowOffset() + window.size();
+        const char* const data = window.constData() + (m_indexed - m_cache.windowOffset());
+        const unsigned int n = static_cast<unsigned int>(qMin<quint64>(windowEnd - m_indexed, want));
+
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            const quint64 here = m_indexed + i;
+            const char c = data[i];
+            if (c == '\n' && m_bPendingCR)
+                // The "\r\n" we started a line after was really one break
+                m_lineStarts.back() = here + 1;
+            else if (c == '\n' || c == '\r')
+            {
+                m_longestLine = qMax(m_longestLine, static_cast<int>(here - m_lineStarts.back()));
+                m_lineStarts.push_back(here + 1);
+            }
+            else if (here - m_lineStarts.back() >= static_cast<quint64>(maxLineBytes))
+            {
+                m_longestLine = maxLineBytes;
+                m_lineStarts.push_back(here);
+            }
+            m_bPendingCR = (c == '\r');
+        }
+        m_indexed += n;
+        m_longestLine = qMax(m_longestLine, static_cast<int>(m_indexed - m_lineStarts.back()));
+    }
+    return !m_bIndexComplete;
+}
+
+int TextStreamView::VisibleLines() const
+{
+    return qMax(1, viewport()->height() / QFontMetrics(font()).height());
+}
+
+void TextStreamView::UpdateScrollBars()
+{
+    const QFontMetrics fm(font());
+    const int visible = VisibleLines();
+
+    verticalScrollBar()->setPageStep(visible);
+    verticalScrollBar()->setRange(0, qMax(0, lineCount() - visible));
+
+    const int charWidth = fm.width(QLatin1Char('M'));
+    horizontalScrollBar()->setSingleStep(charWidth);
+    horizontalScrollBar()->setPageStep(viewport()->width());
+    horizontalScrollBar()->setRange(0, qMax(0, m_longestLine * charWidth - viewport()->width()));
+}
+
+QByteArray TextStreamView::LineBytes(int line)
+{
+    const quint64 start = m_lineStarts[line];
+    const quint64 end = line + 1 < lineCount() ? m_lineStarts[line + 1] : m_indexed;
+    // Never more than maxLineBytes plus a "\r\n", by construction
+    const unsigned int length = static_cast<unsigned int>(end - start);
+    if (!length)
+        return QByteArray();
+
+    m_cache.fetch(start, length);
+    if (!m_cache.windowContains(start, length))
+        return QByteArray();
+
+    QByteArray bytes = m_cache.window().mid(
+            static_cast<int>(start - m_cache.windowOffset()), length);
+    if (bytes.endsWith('\n'))
+        bytes.chop(1);
+    if (bytes.endsWith('\r'))
+        bytes.chop(1);
+    return bytes;
+}
+
+void TextStreamView::paintEvent(QPaintEvent*)
+{
+    if (!m_codec)
+        return;
+
+    QPainter painter(viewport());
+    painter.setFont(font());
+    const QFontMetrics fm(font());
+    const int lineHeight = fm.height();
+    const int x = -horizontalScrollBar()->value();
+    const QString tab(tabWidth, QLatin1Char(' '));
+
+    const int first = verticalScrollBar()->value();
+    const int last = qMin(lineCount(), first + VisibleLines() + 1);
+    int y = fm.ascent();
+    for (int line = first; line < last; ++line, y += lineHeight)
+    {
+        QString text = m_codec->toUnicode(LineBytes(line));
+        text.replace(QLatin1Char('\t'), tab);
+        painter.drawText(x, y, text);
+    }
+}
+
+void TextStreamView::resizeEvent(QResizeEvent* event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    UpdateScrollBars();
+}
+
+void TextStreamView::keyPressEvent(QKeyEvent* event)
+{
+    // The scroll area already handles the arrow keys and page up/down
+    if (event->key() == Qt::Key_Home && (event->modifiers() & Qt::ControlModifier))
+        verticalScrollBar()->setValue(0);
+    else if (event->key() == Qt::Key_End && (event->modifiers() & Qt::ControlModifier))
+        // Only as far as we've indexed; the rest may take a while to read.
+        verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+    else
+        QAbstractScrollArea::keyPressEvent(event);
+}
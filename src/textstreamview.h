@@ -0,0 +1,97 @@
+#ifndef PODOFOBROWSER_TEXTSTREAMVIEW_H
+#define PODOFOBROWSER_TEXTSTREAMVIEW_H
+
+#include <QAbstractScrollArea>
+#include <QTimer>
+
+#include <vector>
+
+#include "hexwidget/DeviceCache.h"
+
+class QIODevice;
+class QTextCodec;
+
+/**
+ * A read-only view of text read from a QIODevice, for streams too big to
+ * hand to a QTextEdit.
+ *
+ * Only the lines on screen are ever read, decoded and laid out. Everything
+ * else stays in the device, or in a DeviceCache for devices that can't seek,
+ * so memory use doesn't grow with the size of the text.
+ *
+ * To know where lines start, the view builds an index of line offsets, 8
+ * bytes per line. It does so a slice at a time from a timer, so the first
+ * screen is shown at once and the scroll bar grows as the rest is indexed.
+ * Lines end at "\n", "\r\n" or a lone "\r", as they may in PDF content.
+ *
+ * The view never owns the device, which must already be open and must stay
+ * valid until setData() is called with another one or the view is destroyed.
+ */
+class TextStreamView : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    TextStreamView(QWidget* parent = 0);
+
+    virtual ~TextStreamView();
+
+    // Show the text read from `device' as decoded by `codec'. Either may be
+    // null to show nothing.
+    void setData(QIODevice* device, QTextCodec* codec);
+    void clear() { setData(0, 0); }
+
+    // Memory, in bytes, that may be used to cache the text read; see
+    // DeviceCache
+    void setCacheSize(unsigned int bytes) { m_cache.setCacheSize(bytes); }
+
+    // Number of lines found so far, and whether that's all of them
+    int lineCount() const { return static_cast<int>(m_lineStarts.size()); }
+    bool isIndexComplete() const { return m_bIndexComplete; }
+
+signals:
+    // Emitted once the whole text has been indexed
+    void indexComplete();
+
+protected:
+    virtual void paintEvent(QPaintEvent* event);
+    virtual void resizeEvent(QResizeEvent* event);
+    virtual void keyPressEvent(QKeyEvent* event);
+
+private slots:
+    // Index another slice of the text
+    void indexMore();
+
+private:
+    // Index the text from m_indexed up to at least `end', or to its end.
+    // Returns false once there's nothing left to index.
+    bool IndexTo(quint64 end);
+
+    void UpdateScrollBars();
+
+    // Number of whole lines that fit in the viewport
+    int VisibleLines() const;
+
+    // The bytes of line `line', without its line break, cut short if the
+    // line is very long.
+    QByteArray LineBytes(int line);
+
+    QTextCodec* m_codec;
+    DeviceCache m_cache;
+
+    // Offset of the start of each line found so far. The last line runs to
+    // m_indexed.
+    std::vector<quint64> m_lineStarts;
+    quint64 m_indexed;
+    bool m_bIndexComplete;
+    // Set if the byte just before m_indexed was a '\r', whose line break we
+    // can't finish until we see whether a '\n' follows.
+    bool m_bPendingCR;
+    // Length of the longest line found, in bytes, for the horizontal scroll
+    // range. Capped like the lines themselves.
+    int m_longestLine;
+
+    QTimer m_indexTimer;
+};
+
+#endif
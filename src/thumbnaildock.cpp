@@ -0,0 +1,208 @@
+#include "thumbnaildock.h"
+#include "podofoutil.h"
+#include "structureindex.h"
+#include "thumbnailloader.h"
+
+#include <QAbstractListModel>
+#include <QCache>
+#include <QHash>
+#include <QImage>
+#include <QLabel>
+#include <QListView>
+#include <QPixmap>
+#include <QSet>
+#include <QVBoxLayout>
+
+#include <vector>
+
+using namespace PoDoFo;
+
+namespace {
+
+typedef StructureIndex::Entry Entry;
+
+static const int thumbnailSize = 96;
+
+// Room around each thumbnail for its label
+static const int cellWidth = thumbnailSize + 24;
+static const int cellHeight = thumbnailSize + 32;
+
+// Memory the thumbnails kept for painting may take, in bytes
+static const int pixmapCacheSize = 64 * 1024 * 1024;
+
+/**
+ * The images of a StructureIndex, with their thumbnails as decorations.
+ * Asking for the decoration of an image whose thumbnail isn't to hand asks
+ * the loader for it.
+ */
+class ThumbnailModel : public QAbstractListModel
+{
+public:
+    ThumbnailModel( const std::vector<Entry> & entries, ThumbnailLoader* loader, QObject* parent )
+        : QAbstractListModel(parent), m_images(), m_rows(), m_pLoader(loader),
+          m_pixmaps(pixmapCacheSize), m_failed()
+    {
+        for (std::vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+        {
+            if ((*it).kind != StructureIndex::Kind_Image)
+                continue;
+            m_rows.insert( referenceKey( (*it).ref ), static_cast<int>(m_images.size()) );
+            m_images.push_back( *it );
+        }
+    }
+
+    virtual int rowCount( const QModelIndex & parent = QModelIndex() ) const
+    {
+        return parent.isValid() ? 0 : static_cast<int>(m_images.size());
+    }
+
+    virtual QVariant data( const QModelIndex & index, int role = Qt::DisplayRole ) const
+    {
+        if (!index.isValid() || index.row() >= rowCount())
+            return QVariant();
+        const Entry & entry = m_images[index.row()];
+        const quint64 key = referenceKey( entry.ref );
+
+        switch (role)
+        {
+            case Qt::DisplayRole:
+                return ThumbnailDock::tr("%1 %2 R").arg( entry.ref.ObjectNumber() )
+                                                   .arg( entry.ref.GenerationNumber() );
+            case Qt::ToolTipRole:
+            {
+                QString tip = entry.name.isEmpty() ? data( index, Qt::DisplayRole ).toString() : entry.name;
+                if (!entry.details.isEmpty())
+                    tip += QString::fromUtf8(", ") + entry.details;
+                if (entry.page)
+                    tip += ThumbnailDock::tr(", first used on page %1").arg( entry.page );
+                return tip;
+            }
+            case Qt::DecorationRole:
+            {
+                if (const QPixmap* pixmap = m_pixmaps.object( key ))
+                    return *pixmap;
+                if (m_pLoader && !m_failed.contains( key ))
+                    m_pLoader->Request( entry.ref );
+                return QVariant();
+            }
+        }
+        return QVariant();
+    }
+
+    void SetThumbnail( const PdfReference & ref, const QImage & image )
+    {
+        const quint64 key = referenceKey( ref );
+        const QHash<quint64, int>::const_iterator row = m_rows.find( key );
+        if (row == m_rows.end())
+            return;
+        if (image.isNull())
+            m_failed.insert( key );
+        else
+            m_pixmaps.insert( key, new QPixmap( QPixmap::fromImage( image ) ),
+                              image.width() * image.height() * 4 );
+        const QModelIndex changed = index( row.value() );
+        emit dataChanged( changed, changed );
+    }
+
+    void ForgetThumbnail( const PdfReference & ref )
+    {
+        const quint64 key = referenceKey( ref );
+        const QHash<quint64, int>::const_iterator row = m_rows.find( key );
+        if (row == m_rows.end())
+            return;
+        m_pixmaps.remove( key );
+        m_failed.remove( key );
+        const QModelIndex changed = index( row.value() );
+        emit dataChanged( changed, changed );
+    }
+
+    const Entry & GetEntry( int row ) const { return m_images[row]; }
+
+private:
+    std::vector<Entry> m_images;
+    // Rows by referenceKey()
+    QHash<quint64, int> m_rows;
+    ThumbnailLoader* m_pLoader;
+    // The thumbnails shown lately, by referenceKey(), and the images that
+    // have none
+    QCache<quint64, QPixmap> m_pixmaps;
+    QSet<quint64> m_failed;
+};
+
+};
+
+ThumbnailDock::ThumbnailDock(QWidget* parent)
+    : QDockWidget(tr("Images"), parent),
+      m_pView(0),
+      m_pStatus(0),
+      m_pLoader(0),
+      m_pModel(0)
+{
+    setObjectName(QString::fromUtf8("ThumbnailDock"));
+
+    QWidget* contents = new QWidget(this);
+    QVBoxLayout* layout = new QVBoxLayout(contents);
+    layout->setMargin(2);
+
+    // Cells are all the same size, and laid out a batch at a time, so that
+    // neither takes long however many images there are
+    m_pView = new QListView(contents);
+    m_pView->setViewMode(QListView::IconMode);
+    m_pView->setMovement(QListView::Static);
+    m_pView->setResizeMode(QListView::Adjust);
+    m_pView->setUniformItemSizes(true);
+    m_pView->setLayoutMode(QListView::Batched);
+    m_pView->setIconSize(QSize(thumbnailSize, thumbnailSize));
+    m_pView->setGridSize(QSize(cellWidth, cellHeight));
+    layout->addWidget(m_pView);
+
+    m_pStatus = new QLabel(contents);
+    layout->addWidget(m_pStatus);
+
+    setWidget(contents);
+
+    connect( m_pView, SIGNAL(activated(const QModelIndex &)), this, SLOT(itemActivated(const QModelIndex &)) );
+}
+
+int ThumbnailDock::ThumbnailSize()
+{
+    return thumbnailSize;
+}
+
+void ThumbnailDock::SetIndex(const StructureIndex* index, ThumbnailLoader* loader)
+{
+    if (m_pLoader)
+        disconnect( m_pLoader, 0, this, 0 );
+    m_pLoader = index ? loader : 0;
+    if (m_pLoader)
+        connect( m_pLoader, SIGNAL(ready(const PoDoFo::PdfReference &, const QImage &)),
+                 this, SLOT(thumbnailReady(const PoDoFo::PdfReference &, const QImage &)) );
+
+    QAbstractItemModel* old = m_pModel;
+    m_pModel = index ? new ThumbnailModel(index->GetEntries(), m_pLoader, this) : 0;
+    m_pView->setModel(m_pModel);
+    delete old;
+
+    if (m_pModel)
+        m_pStatus->setText( tr("%1 images").arg( m_pModel->rowCount() ) );
+    else
+        m_pStatus->clear();
+}
+
+void ThumbnailDock::thumbnailReady(const PdfReference & ref, const QImage & image)
+{
+    if (m_pModel)
+        static_cast<ThumbnailModel*>(m_pModel)->SetThumbnail( ref, image );
+}
+
+void ThumbnailDock::ObjectChanged(const PdfReference & ref)
+{
+    if (m_pModel)
+        static_cast<ThumbnailModel*>(m_pModel)->ForgetThumbnail( ref );
+}
+
+void ThumbnailDock::itemActivated(const QModelIndex & index)
+{
+    if (m_pModel && index.isValid())
+        emit resultActivated( static_cast<const ThumbnailModel*>(m_pModel)->GetEntry( index.row() ).ref );
+}
@@ -0,0 +1,59 @@
+#ifndef PODOFOBROWSER_THUMBNAILDOCK_H
+#define PODOFOBROWSER_THUMBNAILDOCK_H
+
+#include <QDockWidget>
+
+#include <podofo/podofo.h>
+
+class QImage;
+class QAbstractItemModel;
+class QLabel;
+class QListView;
+class QModelIndex;
+class StructureIndex;
+class ThumbnailLoader;
+
+/**
+ * A dock showing a grid of thumbnails of the images a StructureIndex found.
+ * Thumbnails are only asked of the ThumbnailLoader as their cells are
+ * painted, so however many images there are, only those on show are
+ * decoded. The most recently shown are kept in memory; the loader's disk
+ * cache has the rest.
+ */
+class ThumbnailDock : public QDockWidget
+{
+    Q_OBJECT
+
+public:
+    ThumbnailDock(QWidget* parent = 0);
+
+    // Show the images `index' found, which must be ready, with thumbnails
+    // from `loader'; or nothing if they're null. The dock copies what it
+    // needs of the index, and doesn't own the loader, which must outlive
+    // the dock or be replaced first.
+    void SetIndex(const StructureIndex* index, ThumbnailLoader* loader);
+
+    // Size thumbnails are made to fit, in pixels square
+    static int ThumbnailSize();
+
+    // Forget the thumbnail of `ref', which has been edited, and ask for a
+    // new one when it's next shown. Tell the loader first.
+    void ObjectChanged(const PoDoFo::PdfReference & ref);
+
+signals:
+    // The user picked an image
+    void resultActivated(const PoDoFo::PdfReference & ref);
+
+private slots:
+    void thumbnailReady(const PoDoFo::PdfReference & ref, const QImage & image);
+    void itemActivated(const QModelIndex & index);
+
+private:
+    QListView* m_pView;
+    QLabel* m_pStatus;
+    ThumbnailLoader* m_pLoader;
+    // The images shown, or null
+    QAbstractItemModel* m_pModel;
+};
+
+#endif
@@ -0,0 +1,584 @@
+#include "thumbnailloader.h"
+#include "podofoutil.h"
+#include "streamsnapshot.h"
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMap>
+#include <QMutexLocker>
+#include <QStringList>
+
+#include <cstring>
+
+#if QT_VERSION >= 0x040300
+#include <QCryptographicHash>
+#endif
+#if QT_VERSION >= 0x040400
+#include <QDesktopServices>
+#endif
+
+using namespace PoDoFo;
+
+namespace {
+
+// How often thumbnails are passed on, in milliseconds
+static const int pollInterval = 100;
+
+// Most requests kept waiting; older ones are dropped
+static const size_t maxPending = 256;
+
+// How much of each end of a file goes into its cache directory's name
+static const qint64 fingerprintSampleSize = 64 * 1024;
+
+// Cache directories beyond this many are deleted, least recently used first
+static const int maxCacheDirectories = 32;
+
+// Rewritten whenever a cache directory is used, so its time says when that
+// was. A directory's own time only changes when thumbnails are added.
+static const char* const cacheStampName = "last-used";
+
+// Largest image dimension we'll try to sample, to keep row sizes sane
+static const int maxImageDimension = 1 << 16;
+
+/**
+ * How the samples of an image are laid out, and what colours they are
+ */
+struct ImageFormat
+{
+    int width;
+    int height;
+    int bitsPerComponent;
+    // Per sample: 1 for gray, indexed and masks, 3 for RGB, 4 for CMYK
+    int components;
+    // The colours of an indexed image, by sample value
+    std::vector<QRgb> palette;
+};
+
+const PdfObject* resolve( const PdfVecObjects & objs, const PdfObject* obj )
+{
+    if (obj && obj->IsReference())
+        return objs.GetObject( obj->GetReference() );
+    return obj;
+}
+
+const PdfObject* dictKey( const PdfVecObjects & objs, const PdfObject* dict, const char* key )
+{
+    return resolve( objs, dict->GetDictionary().GetKey( PdfName(key) ) );
+}
+
+// Number of components of a device, calibrated or ICC based colour space,
+// or 0 if it's some other kind
+int componentsOf( const PdfVecObjects & objs, const PdfObject* space )
+{
+    space = resolve( objs, space );
+    if (!space)
+        return 0;
+
+    if (space->IsArray() && space->GetArray().size() == 2 && space->GetArray()[0].IsName())
+    {
+        const std::string family = space->GetArray()[0].GetName().GetName();
+        if (family == "CalGray")
+            return 1;
+        if (family == "CalRGB")
+            return 3;
+        if (family == "ICCBased")
+        {
+            const PdfObject* profile = resolve( objs, &space->GetArray()[1] );
+            const PdfObject* n = profile && profile->IsDictionary()
+                ? dictKey( objs, profile, "N" ) : 0;
+            if (n && n->IsNumber() && (n->GetNumber() == 1 || n->GetNumber() == 3 || n->GetNumber() == 4))
+                return static_cast<int>(n->GetNumber());
+        }
+        return 0;
+    }
+
+    if (!space->IsName())
+        return 0;
+    const std::string name = space->GetName().GetName();
+    if (name == "DeviceGray" || name == "G" || name == "CalGray")
+        return 1;
+    if (name == "DeviceRGB" || name == "RGB" || name == "CalRGB")
+        return 3;
+    if (name == "DeviceCMYK" || name == "CMYK")
+        return 4;
+    return 0;
+}
+
+inline QRgb colourOf( const unsigned char* c, int components )
+{
+    switch (components)
+    {
+        case 1:
+            return qRgb( c[0], c[0], c[0] );
+        case 3:
+            return qRgb( c[0], c[1], c[2] );
+        default:
+            // Good enough for a thumbnail
+            return qRgb( 255 - qMin( 255, c[0] + c[3] ),
+                         255 - qMin( 255, c[1] + c[3] ),
+                         255 - qMin( 255, c[2] + c[3] ) );
+    }
+}
+
+// Work out the format of the image `obj'. False if we don't understand it.
+bool readFormat( const PdfVecObjects & objs, const PdfObject* obj, ImageFormat & format )
+{
+    const PdfObject* width = dictKey( objs, obj, "Width" );
+    const PdfObject* height = dictKey( objs, obj, "Height" );
+    if (!width || !height || !width->IsNumber() || !height->IsNumber())
+        return false;
+    format.width = static_cast<int>(width->GetNumber());
+    format.height = static_cast<int>(height->GetNumber());
+    if (format.width <= 0 || format.height <= 0
+        || format.width > maxImageDimension || format.height > maxImageDimension)
+        return false;
+
+    const PdfObject* mask = dictKey( objs, obj, "ImageMask" );
+    if (mask && mask->IsBool() && mask->GetBool())
+    {
+        format.bitsPerComponent = 1;
+        format.components = 1;
+        return true;
+    }
+
+    const PdfObject* bits = dictKey( objs, obj, "BitsPerComponent" );
+    if (!bits || !bits->IsNumber())
+        return false;
+    format.bitsPerComponent = static_cast<int>(bits->GetNumber());
+    if (format.bitsPerComponent != 1 && format.bitsPerComponent != 2 && format.bitsPerComponent != 4
+        && format.bitsPerComponent != 8 && format.bitsPerComponent != 16)
+        return false;
+
+    const PdfObject* space = dictKey( objs, obj, "ColorSpace" );
+    if (space && space->IsArray() && space->GetArray().size() == 4 && space->GetArray()[0].IsName()
+        && (space->GetArray()[0].GetName() == PdfName("Indexed") || space->GetArray()[0].GetName() == PdfName("I")))
+    {
+        // [/Indexed base hival lookup], with the lookup table in a string
+        const PdfArray & array = space->GetArray();
+        const int baseComponents = componentsOf( objs, &array[1] );
+        const PdfObject* hival = resolve( objs, &array[2] );
+        const PdfObject* lookup = resolve( objs, &array[3] );
+        if (!baseComponents || !hival || !hival->IsNumber() || !lookup || !lookup->IsString())
+            return false;
+        const int colours = static_cast<int>(qBound<pdf_int64>( 0, hival->GetNumber(), 255 )) + 1;
+        const unsigned char* table = reinterpret_cast<const unsigned char*>(lookup->GetString().GetString());
+        const int tableColours = static_cast<int>(lookup->GetString().GetLength()) / baseComponents;
+        format.palette.resize( colours, qRgb( 0, 0, 0 ) );
+        for (int i = 0; i < qMin( colours, tableColours ); ++i)
+            format.palette[i] = colourOf( table + i * baseComponents, baseComponents );
+        format.components = 1;
+        return true;
+    }
+
+    format.components = componentsOf( objs, space );
+    return format.components != 0;
+}
+
+// The largest size no bigger than `size' square with the shape of `full'
+QSize thumbnailSize( const QSize & full, int size )
+{
+    if (full.width() <= size && full.height() <= size)
+        return full;
+    QSize scaled( full );
+    scaled.scale( size, size, Qt::KeepAspectRatio );
+    return scaled.expandedTo( QSize( 1, 1 ) );
+}
+
+/**
+ * Collects encoded image file data, such as a JPEG, until the loader stops
+ */
+class ByteSink : public StreamDataSink
+{
+public:
+    ByteSink( QByteArray & data, const ThumbnailLoader & loader )
+        : m_data(data), m_loader(loader)
+    {
+    }
+
+    virtual pdf_long Write( const char* pBuffer, pdf_long lLen )
+    {
+        m_data.append( QByteArray( pBuffer, lLen ) );
+        return lLen;
+    }
+
+    virtual bool WantsMore() const { return !m_loader.IsStopping(); }
+
+private:
+    QByteArray & m_data;
+    const ThumbnailLoader & m_loader;
+};
+
+/**
+ * Samples raw image data into a thumbnail a row at a time as it's decoded,
+ * keeping only the row it's on. Once the last row the thumbnail needs has
+ * been seen, it wants no more.
+ */
+class DownsamplingSink : public StreamDataSink
+{
+public:
+    DownsamplingSink( const ImageFormat & format, const QSize & size, const ThumbnailLoader & loader )
+        : m_format(format),
+          m_image(size, QImage::Format_RGB32),
+          m_row((format.width * format.components * format.bitsPerComponent + 7) / 8, '\0'),
+          m_filled(0),
+          m_sourceRow(0),
+          m_imageRow(0),
+          m_loader(loader)
+    {
+        m_image.fill( qRgb( 255, 255, 255 ) );
+    }
+
+    virtual pdf_long Write( const char* pBuffer, pdf_long lLen )
+    {
+        const int rowSize = m_row.size();
+        pdf_long left = lLen;
+        while (left > 0 && m_imageRow < m_image.height())
+        {
+            const int take = static_cast<int>(qMin<pdf_long>( left, rowSize - m_filled ));
+            memcpy( m_row.data() + m_filled, pBuffer, take );
+            m_filled += take;
+            pBuffer += take;
+            left -= take;
+            if (m_filled == rowSize)
+            {
+                Row();
+                m_filled = 0;
+                ++m_sourceRow;
+            }
+        }
+        return lLen;
+    }
+
+    virtual bool WantsMore() const
+    {
+        return m_imageRow < m_image.height() && !m_loader.IsStopping();
+    }
+
+    // The thumbnail, or a null image if not a single row of it was seen
+    QImage GetImage() const { return m_imageRow ? m_image : QImage(); }
+
+private:
+    // Sample `index' of the current row, scaled to 0-255
+    inline unsigned char Sample( int index ) const
+    {
+        const unsigned char* row = reinterpret_cast<const unsigned char*>(m_row.constData());
+        switch (m_format.bitsPerComponent)
+        {
+            case 8:
+                return row[index];
+            case 16:
+                return row[index * 2];
+            default:
+            {
+                const int bits = m_format.bitsPerComponent;
+                const int bit = index * bits;
+                const int max = (1 << bits) - 1;
+                const int value = (row[bit / 8] >> (8 - bits - bit % 8)) & max;
+                return static_cast<unsigned char>(value * 255 / max);
+            }
+        }
+    }
+
+    inline QRgb Pixel( int x ) const
+    {
+        const int components = m_format.components;
+        if (!m_format.palette.empty())
+        {
+            // Indexed samples are palette entries, not intensities
+            const unsigned char* row = reinterpret_cast<const unsigned char*>(m_row.constData());
+            const int bits = m_format.bitsPerComponent;
+            const int value = bits >= 8 ? row[x * (bits / 8)]
+                : (row[x * bits / 8] >> (8 - bits - x * bits % 8)) & ((1 << bits) - 1);
+            return value < static_cast<int>(m_format.palette.size()) ? m_format.palette[value] : qRgb( 0, 0, 0 );
+        }
+        unsigned char c[4];
+        for (int i = 0; i < components; ++i)
+            c[i] = Sample( x * components + i );
+        return colourOf( c, components );
+    }
+
+    // Fill in every thumbnail row sampled from the current source row
+    void Row()
+    {
+        const int width = m_image.width();
+        const int height = m_image.height();
+        while (m_imageRow < height
+               && static_cast<qint64>(m_imageRow) * m_format.height / height == m_sourceRow)
+        {
+            QRgb* out = reinterpret_cast<QRgb*>(m_image.scanLine( m_imageRow ));
+            for (int x = 0; x < width; ++x)
+                out[x] = Pixel( static_cast<int>(static_cast<qint64>(x) * m_format.width / width) );
+            ++m_imageRow;
+        }
+    }
+
+    const ImageFormat & m_format;
+    QImage m_image;
+    QByteArray m_row;
+    int m_filled;
+    int m_sourceRow;
+    int m_imageRow;
+    const ThumbnailLoader & m_loader;
+};
+
+};
+
+ThumbnailLoader::ThumbnailLoader(PdfMemDocument* doc, QMutex* documentLock,
+                                 const QString & cacheDirectory, int size, QObject* parent)
+    : QObject(parent),
+      m_pDoc(doc),
+      m_pDocumentLock(documentLock),
+      m_cacheDirectory(cacheDirectory),
+      m_size(size),
+      m_queueMutex(),
+      m_queueCondition(),
+      m_pending(),
+      m_requested(),
+      m_results(),
+      m_changes(),
+      m_bStop(false),
+      m_workers(),
+      m_pollTimer()
+{
+    if (!m_cacheDirectory.isEmpty() && QDir().mkpath( m_cacheDirectory ))
+    {
+        QFile stamp( m_cacheDirectory + QLatin1Char('/') + QString::fromLatin1( cacheStampName ) );
+        stamp.open( QIODevice::WriteOnly | QIODevice::Truncate );
+        stamp.close();
+        PruneCacheDirectories( QFileInfo( m_cacheDirectory ).absolutePath() );
+    }
+
+    connect(&m_pollTimer, SIGNAL(timeout()), this, SLOT(poll()));
+
+    m_workers.Start(this, &ThumbnailLoader::Work, WorkerPool::IdealThreadCount(), QThread::LowPriority);
+}
+
+ThumbnailLoader::~ThumbnailLoader()
+{
+    {
+        QMutexLocker lock(&m_queueMutex);
+        m_bStop = true;
+        m_queueCondition.wakeAll();
+    }
+    m_workers.Wait();
+}
+
+QString ThumbnailLoader::CacheDirectoryFor(const QString & filename)
+{
+    QFile file( filename );
+    if (filename.isEmpty() || !file.open( QIODevice::ReadOnly ))
+        return QString();
+
+    // Hashing all of a big file would take longer than decoding the
+    // thumbnails; its size and ends tell files apart well enough
+    const qint64 size = file.size();
+    QByteArray sample = QByteArray::number( size );
+    sample += file.read( fingerprintSampleSize );
+    if (size > fingerprintSampleSize && file.seek( qMax( fingerprintSampleSize, size - fingerprintSampleSize ) ))
+        sample += file.read( fingerprintSampleSize );
+
+#if QT_VERSION >= 0x040300
+    const QString fingerprint = QString::fromLatin1( QCryptographicHash::hash( sample, QCryptographicHash::Md5 ).toHex() );
+#else
+    const QString fingerprint = QString::number( qChecksum( sample.constData(), sample.size() ), 16 )
+        + QLatin1Char('-') + QString::number( size, 16 );
+#endif
+
+#if QT_VERSION >= 0x040400
+    const QString cacheRoot = QDesktopServices::storageLocation( QDesktopServices::CacheLocation );
+#else
+    const QString cacheRoot = QDir::homePath() + QString::fromUtf8("/.podofobrowser");
+#endif
+    return cacheRoot + QString::fromUtf8("/thumbnails/") + fingerprint;
+}
+
+void ThumbnailLoader::PruneCacheDirectories(const QString & cacheRoot)
+{
+    // Directories without a stamp weren't made by us, or are older still
+    const QString stampName = QString::fromLatin1( cacheStampName );
+    QMap<QDateTime, QString> byAge;
+    const QFileInfoList dirs = QDir( cacheRoot ).entryInfoList( QDir::Dirs | QDir::NoDotAndDotDot );
+    for (QFileInfoList::const_iterator it = dirs.begin(); it != dirs.end(); ++it)
+    {
+        const QFileInfo stamp( it->absoluteFilePath() + QLatin1Char('/') + stampName );
+        byAge.insertMulti( stamp.exists() ? stamp.lastModified() : QDateTime(), it->absoluteFilePath() );
+    }
+
+    // Oldest first
+    int excess = byAge.size() - maxCacheDirectories;
+    for (QMap<QDateTime, QString>::const_iterator it = byAge.begin(); it != byAge.end() && excess > 0; ++it, --excess)
+    {
+        QDir dir( it.value() );
+        const QStringList files = dir.entryList( QDir::Files | QDir::Hidden );
+        for (QStringList::const_iterator file = files.begin(); file != files.end(); ++file)
+            dir.remove( *file );
+        QDir( cacheRoot ).rmdir( dir.dirName() );
+    }
+}
+
+void ThumbnailLoader::Request(const PdfReference & ref)
+{
+    QMutexLocker lock(&m_queueMutex);
+    const quint64 key = referenceKey( ref );
+    if (m_requested.contains( key ))
+        return;
+    m_requested.insert( key );
+    m_pending.push_back( ref );
+    if (m_pending.size() > maxPending)
+    {
+        // Long out of view by now
+        m_requested.remove( referenceKey( m_pending.front() ) );
+        m_pending.erase( m_pending.begin() );
+    }
+    m_queueCondition.wakeOne();
+
+    if (!m_pollTimer.isActive())
+        m_pollTimer.start(pollInterval);
+}
+
+void ThumbnailLoader::ObjectChanged(const PdfReference & ref)
+{
+    QMutexLocker lock(&m_queueMutex);
+    ++m_changes[referenceKey( ref )];
+}
+
+bool ThumbnailLoader::IsStopping() const
+{
+    QMutexLocker lock(&m_queueMutex);
+    return m_bStop;
+}
+
+void ThumbnailLoader::poll()
+{
+    Results results;
+    {
+        QMutexLocker lock(&m_queueMutex);
+        results.swap( m_results );
+        if (m_requested.isEmpty())
+            m_pollTimer.stop();
+    }
+    for (Results::const_iterator it = results.begin(); it != results.end(); ++it)
+        emit ready( (*it).first, (*it).second );
+}
+
+bool ThumbnailLoader::Claim(PdfReference & ref)
+{
+    QMutexLocker lock(&m_queueMutex);
+    while (!m_bStop && m_pending.empty())
+        m_queueCondition.wait( &m_queueMutex );
+    if (m_bStop)
+        return false;
+
+    // Newest first: it's the most likely to still be on show
+    ref = m_pending.back();
+    m_pending.pop_back();
+    return true;
+}
+
+void ThumbnailLoader::Work()
+{
+    PdfReference ref;
+    while (Claim( ref ))
+    {
+        const quint64 key = referenceKey( ref );
+        int changes = 0;
+        {
+            QMutexLocker lock(&m_queueMutex);
+            changes = m_changes.value( key );
+        }
+
+        // An edited image isn't what's in the file the cache is kept for
+        const QImage image = Load( ref, changes == 0 );
+        if (IsStopping())
+            break;
+
+        QMutexLocker lock(&m_queueMutex);
+        if (m_changes.value( key ) != changes)
+        {
+            // Changed while we were at it, so this may be the old image
+            m_pending.push_back( ref );
+            continue;
+        }
+        m_requested.remove( key );
+        m_results.push_back( std::make_pair( ref, image ) );
+    }
+}
+
+QString ThumbnailLoader::CacheFileName(const PdfReference & ref) const
+{
+    return m_cacheDirectory + QString::fromUtf8("/%1-%2.png")
+        .arg( ref.ObjectNumber() ).arg( ref.GenerationNumber() );
+}
+
+QImage ThumbnailLoader::Load(const PdfReference & ref, bool useDiskCache) const
+{
+    if (m_cacheDirectory.isEmpty() || !useDiskCache)
+        return Decode( ref );
+
+    const QString cacheFile = CacheFileName( ref );
+    QImage image;
+    if (QFile::exists( cacheFile ) && image.load( cacheFile, "PNG" ))
+        return image;
+
+    image = Decode( ref );
+    if (!image.isNull() && !IsStopping())
+        image.save( cacheFile, "PNG" );
+    return image;
+}
+
+QImage ThumbnailLoader::Decode(const PdfReference & ref) const
+{
+    StreamSnapshot snapshot;
+    ImageFormat format;
+    QString encoding;
+    try {
+        QMutexLocker lock(m_pDocumentLock);
+        const PdfVecObjects & objs = m_pDoc->GetObjects();
+        const PdfObject* obj = objs.GetObject( ref );
+        if (!obj || !obj->HasStream() || !obj->IsDictionary())
+            return QImage();
+        snapshot.Take( obj, false );
+        encoding = snapshot.KeepImageEncoding();
+        if (encoding.isEmpty() && !readFormat( objs, obj, format ))
+            return QImage();
+    } catch( PdfError & ) {
+        // It just has no thumbnail
+        return QImage();
+    }
+
+    if (!encoding.isEmpty())
+    {
+        // An image file; have QImageReader scale it as it decodes
+        QByteArray data;
+        ByteSink sink( data, *this );
+        try {
+            snapshot.Decode( sink );
+        } catch( PdfError & ) {
+            return QImage();
+        }
+        snapshot.Clear();
+
+        QBuffer buffer( &data );
+        buffer.open( QIODevice::ReadOnly );
+        QImageReader reader( &buffer );
+        const QSize full = reader.size();
+        if (full.isValid())
+            reader.setScaledSize( thumbnailSize( full, m_size ) );
+        QImage image = reader.read();
+        if (!image.isNull() && (image.width() > m_size || image.height() > m_size))
+            image = image.scaled( m_size, m_size, Qt::KeepAspectRatio, Qt::SmoothTransformation );
+        return image;
+    }
+
+    DownsamplingSink sink( format, thumbnailSize( QSize( format.width, format.height ), m_size ), *this );
+    try {
+        snapshot.Decode( sink );
+    } catch( PdfError & ) {
+        // Show whatever was decoded before the filters gave up
+    }
+    return sink.GetImage();
+}
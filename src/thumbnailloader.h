@@ -0,0 +1,128 @@
+#ifndef PODOFOBROWSER_THUMBNAILLOADER_H
+#define PODOFOBROWSER_THUMBNAILLOADER_H
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QSet>
+#include <QString>
+#include <QTimer>
+#include <QWaitCondition>
+
+#include <utility>
+#include <vector>
+
+#include <podofo/podofo.h>
+
+#include "workerpool.h"
+
+/**
+ * Makes small thumbnails of image XObjects on worker threads, as they're
+ * asked for. It's meant to be asked for just the images that are on show, so
+ * requests are served newest first, and the oldest are dropped when too many
+ * pile up: whoever asked for them will ask again if they come back into view.
+ *
+ * Images are scaled down while they're decoded. JPEGs are handed to
+ * QImageReader at the size wanted, which decodes them at a fraction of full
+ * size; raw samples, whatever filters they came through, are sampled a row
+ * at a time as they're decoded, so a full size image is never held in
+ * memory. Gray, RGB, CMYK, ICC based and indexed colour spaces and image
+ * masks are understood; anything else has no thumbnail.
+ *
+ * Thumbnails are kept on disk, in a directory named for the document's
+ * file (see CacheDirectoryFor()), so they're there at once when the file is
+ * opened again. Only the directories of the most recently opened few files
+ * are kept. They show the images as they are in that file, so images
+ * edited since are told to the loader with ObjectChanged(): theirs are
+ * always decoded afresh, and never kept on disk.
+ *
+ * Locking is as for StreamExporter: a worker takes a StreamSnapshot of the
+ * image with the document lock held, and decodes it without the lock.
+ *
+ * ready() is emitted in the thread the loader lives in (normally the GUI
+ * thread).
+ *
+ * Ownership: the loader never owns the document. Deleting the loader stops
+ * the workers and waits for them, after which the document may be deleted.
+ * Don't delete the loader while holding the document lock.
+ */
+class ThumbnailLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+    // Make thumbnails that fit in `size' pixels square, keeping them in
+    // `cacheDirectory', or nowhere if it's empty
+    ThumbnailLoader(PoDoFo::PdfMemDocument* doc, QMutex* documentLock,
+                    const QString & cacheDirectory, int size, QObject* parent = 0);
+
+    virtual ~ThumbnailLoader();
+
+    // Where to keep the thumbnails of the document in `filename', named for
+    // a hash of its size and of the start and end of it, or an empty string
+    // if it can't be read
+    static QString CacheDirectoryFor(const QString & filename);
+
+    // Ask for the thumbnail of `ref', if it hasn't been already. ready() is
+    // emitted once it's made.
+    void Request(const PoDoFo::PdfReference & ref);
+
+    // The image `ref' no longer matches the file the document was read
+    // from. Its thumbnail is made afresh from now on, bypassing the disk
+    // cache; one being made as this is called is made again. Whoever showed
+    // the old thumbnail must Request() a new one.
+    void ObjectChanged(const PoDoFo::PdfReference & ref);
+
+    // Whether the workers have been told to stop
+    bool IsStopping() const;
+
+signals:
+    // The thumbnail of `ref', or a null image if it couldn't be made
+    void ready(const PoDoFo::PdfReference & ref, const QImage & image);
+
+private slots:
+    // Pass on the thumbnails the workers have made
+    void poll();
+
+private:
+    // Run by each worker thread
+    void Work();
+
+    // Wait for a request for a worker. Returns false once stopping.
+    bool Claim(PoDoFo::PdfReference & ref);
+
+    // The thumbnail of `ref', from the disk cache if `useDiskCache', or
+    // decoded
+    QImage Load(const PoDoFo::PdfReference & ref, bool useDiskCache) const;
+    QImage Decode(const PoDoFo::PdfReference & ref) const;
+
+    QString CacheFileName(const PoDoFo::PdfReference & ref) const;
+
+    // Delete all but the most recently used cache directories under
+    // `cacheRoot'
+    static void PruneCacheDirectories(const QString & cacheRoot);
+
+    typedef std::vector< std::pair<PoDoFo::PdfReference, QImage> > Results;
+
+    PoDoFo::PdfMemDocument* m_pDoc;
+    QMutex* m_pDocumentLock;
+    const QString m_cacheDirectory;
+    const int m_size;
+
+    // Requests not yet taken by a worker, oldest first, everything asked
+    // for and not yet passed on, and the thumbnails waiting to be
+    mutable QMutex m_queueMutex;
+    QWaitCondition m_queueCondition;
+    std::vector<PoDoFo::PdfReference> m_pending;
+    QSet<quint64> m_requested;
+    Results m_results;
+    // How many times each image has been changed, by referenceKey()
+    QHash<quint64, int> m_changes;
+    bool m_bStop;
+
+    WorkerPool m_workers;
+    QTimer m_pollTimer;
+};
+
+#endif
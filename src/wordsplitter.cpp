@@ -0,0 +1,112 @@
+#include "wordsplitter.h"
+
+#include <algorithm>
+
+using namespace PoDoFo;
+
+namespace {
+
+inline bool isWordChar( unsigned char c )
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+inline char foldCase( char c )
+{
+    return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+}
+
+// Gathers the distinct words of a text, for WordSplitter::Split()
+class WordList : public WordSplitter
+{
+public:
+    std::vector<QByteArray> words;
+
+protected:
+    virtual void Word( const QByteArray & word )
+    {
+        if (std::find( words.begin(), words.end(), word ) == words.end())
+            words.push_back( word );
+    }
+};
+
+};
+
+WordSplitter::WordSplitter()
+    : m_word(),
+      m_bTooLong(false)
+{
+}
+
+WordSplitter::~WordSplitter()
+{
+}
+
+void WordSplitter::Feed( const char* data, long len )
+{
+    for (long i = 0; i < len; ++i)
+    {
+        const unsigned char c = static_cast<unsigned char>(data[i]);
+        if (!isWordChar( c ))
+            EndWord();
+        else if (m_word.size() < maxWordLength)
+            m_word.append( foldCase(c) );
+        else
+            m_bTooLong = true;
+    }
+}
+
+void WordSplitter::Feed( const std::string & text )
+{
+    Feed( text.data(), text.size() );
+    EndWord();
+}
+
+void WordSplitter::EndWord()
+{
+    if (!m_word.isEmpty() && !m_bTooLong)
+        Word( m_word );
+    m_word.clear();
+    m_bTooLong = false;
+}
+
+void WordSplitter::FeedValue( const PdfVariant & value )
+{
+    switch (value.GetDataType())
+    {
+        case ePdfDataType_Name:
+            Feed( value.GetName().GetName() );
+            break;
+        case ePdfDataType_String:
+        case ePdfDataType_HexString:
+            Feed( value.GetString().GetStringUtf8() );
+            break;
+        case ePdfDataType_Array:
+        {
+            const PdfArray & array = value.GetArray();
+            for (PdfArray::const_iterator it = array.begin(); it != array.end(); ++it)
+                FeedValue( *it );
+            break;
+        }
+        case ePdfDataType_Dictionary:
+        {
+            const TKeyMap & keys = value.GetDictionary().GetKeys();
+            for (TCIKeyMap it = keys.begin(); it != keys.end(); ++it)
+            {
+                Feed( it->first.GetName() );
+                FeedValue( *it->second );
+            }
+            break;
+        }
+        default:
+            // Numbers, booleans, references and so on have no words in them
+            break;
+    }
+}
+
+std::vector<QByteArray> WordSplitter::Split( const QString & text )
+{
+    WordList list;
+    list.Feed( std::string( text.toUtf8().constData() ) );
+    return list.words;
+}
@@ -0,0 +1,53 @@
+#ifndef PODOFOBROWSER_WORDSPLITTER_H
+#define PODOFOBROWSER_WORDSPLITTER_H
+
+#include <QByteArray>
+#include <QString>
+
+#include <string>
+#include <vector>
+
+#include <podofo/podofo.h>
+
+/**
+ * Splits text into the words that document searches match against, and
+ * hands each to Word().
+ *
+ * A word is a run of letters, digits and non-ASCII bytes; everything else
+ * separates words, so "/Helvetica-Bold" is "helvetica" and "bold". Words are
+ * folded to lower case (ASCII only). Runs longer than maxWordLength, which
+ * are hex strings, base 85 data and the like, are dropped.
+ *
+ * Text may be fed in pieces, such as chunks of a decoded stream; words
+ * spanning pieces are put back together. Call EndWord() after the last one.
+ */
+class WordSplitter
+{
+public:
+    enum { maxWordLength = 64 };
+
+    WordSplitter();
+    virtual ~WordSplitter();
+
+    void Feed(const char* data, long len);
+    // Feed a whole piece of text, which is taken to end a word
+    void Feed(const std::string & text);
+    void EndWord();
+
+    // Feed the names and strings in `value' and everything directly inside
+    // it, dictionary keys included. References aren't followed. The caller
+    // must hold the document lock.
+    void FeedValue(const PoDoFo::PdfVariant & value);
+
+    // The distinct words of `text', in order of first appearance
+    static std::vector<QByteArray> Split(const QString & text);
+
+protected:
+    virtual void Word(const QByteArray & word) = 0;
+
+private:
+    QByteArray m_word;
+    bool m_bTooLong;
+};
+
+#endif
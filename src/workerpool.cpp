@@ -0,0 +1,64 @@
+#include "workerpool.h"
+
+class WorkerPool::Worker : public QThread
+{
+public:
+    Worker(Job* job) : QThread(), m_pJob(job) { }
+
+protected:
+    virtual void run() { m_pJob->Run(); }
+
+private:
+    Job* m_pJob;
+};
+
+WorkerPool::WorkerPool()
+    : m_pJob(0),
+      m_workers()
+{
+}
+
+WorkerPool::~WorkerPool()
+{
+    Wait();
+}
+
+int WorkerPool::IdealThreadCount()
+{
+#if QT_VERSION >= 0x040300
+    return qMax(1, QThread::idealThreadCount());
+#else
+    return 2;
+#endif
+}
+
+void WorkerPool::StartJob(Job* job, int count, QThread::Priority priority)
+{
+    Q_ASSERT(!m_pJob);
+    m_pJob = job;
+    for (int i = 0; i < count; ++i)
+    {
+        m_workers.push_back(new Worker(m_pJob));
+        m_workers.back()->start(priority);
+    }
+}
+
+void WorkerPool::Wait()
+{
+    for (std::vector<QThread*>::iterator it = m_workers.begin(); it != m_workers.end(); ++it)
+    {
+        (*it)->wait();
+        delete *it;
+    }
+    m_workers.clear();
+    delete m_pJob;
+    m_pJob = 0;
+}
+
+bool WorkerPool::IsFinished() const
+{
+    for (std::vector<QThread*>::const_iterator it = m_workers.begin(); it != m_workers.end(); ++it)
+        if (!(*it)->isFinished())
+            return false;
+    return true;
+}
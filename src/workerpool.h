@@ -0,0 +1,73 @@
+#ifndef PODOFOBROWSER_WORKERPOOL_H
+#define PODOFOBROWSER_WORKERPOOL_H
+
+#include <QThread>
+
+#include <vector>
+
+/**
+ * A few threads all running the same member function of one object, for
+ * the classes that share a job out between workers that claim their part
+ * of it under a mutex. Telling the workers to stop is up to the owner; the
+ * pool just starts them and waits for them.
+ *
+ * The pool waits for its threads when it's destroyed, but the owner should
+ * Wait() first thing in its own destructor, while everything the workers
+ * use is still there.
+ */
+class WorkerPool
+{
+public:
+    WorkerPool();
+    ~WorkerPool();
+
+    // How many workers to start for work that keeps every core busy
+    static int IdealThreadCount();
+
+    // Start `count' threads each running owner->work(). The pool must
+    // not be running already.
+    template<typename T>
+    void Start(T* owner, void (T::*work)(), int count,
+               QThread::Priority priority = QThread::InheritPriority)
+    {
+        StartJob(new MemberJob<T>(owner, work), count, priority);
+    }
+
+    // Wait for every worker to return, and forget them
+    void Wait();
+
+    // True once every worker has returned, or if none were started
+    bool IsFinished() const;
+
+private:
+    WorkerPool(const WorkerPool &);
+    WorkerPool & operator=(const WorkerPool &);
+
+    class Job
+    {
+    public:
+        virtual ~Job() { }
+        virtual void Run() = 0;
+    };
+
+    template<typename T>
+    class MemberJob : public Job
+    {
+    public:
+        MemberJob(T* owner, void (T::*work)()) : m_pOwner(owner), m_work(work) { }
+        virtual void Run() { (m_pOwner->*m_work)(); }
+
+    private:
+        T* m_pOwner;
+        void (T::*m_work)();
+    };
+
+    class Worker;
+
+    void StartJob(Job* job, int count, QThread::Priority priority);
+
+    Job* m_pJob;
+    std::vector<QThread*> m_workers;
+};
+
+#endif